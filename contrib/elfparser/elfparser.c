@@ -751,6 +751,44 @@ elf_parser_lookup_symbol (ElfParser *parser,
     return result;
 }
 
+guint
+elf_parser_get_n_symbols (ElfParser *parser)
+{
+    g_return_val_if_fail (parser != NULL, 0);
+
+    if (!parser->symbols)
+        read_symbols (parser);
+
+    if (!parser->text_section)
+        return 0;
+
+    return parser->n_symbols;
+}
+
+/* Symbols are sorted by address, matching the order used by
+ * elf_parser_lookup_symbol().
+ */
+const ElfSym *
+elf_parser_get_nth_symbol (ElfParser *parser,
+                           guint      nth)
+{
+    g_return_val_if_fail (parser != NULL, NULL);
+    g_return_val_if_fail (nth < elf_parser_get_n_symbols (parser), NULL);
+
+    return &parser->symbols[nth];
+}
+
+gulong
+elf_parser_get_text_size (ElfParser *parser)
+{
+    g_return_val_if_fail (parser != NULL, 0);
+
+    if (!parser->text_section)
+        return 0;
+
+    return parser->text_section->size;
+}
+
 gulong
 elf_parser_get_text_offset (ElfParser *parser)
 {
@@ -53,6 +53,10 @@ gulong        elf_parser_get_text_offset (ElfParser     *parser);
  */
 const ElfSym *elf_parser_lookup_symbol         (ElfParser    *parser,
                                                 gulong        address);
+guint         elf_parser_get_n_symbols         (ElfParser    *parser);
+const ElfSym *elf_parser_get_nth_symbol        (ElfParser    *parser,
+                                                guint         nth);
+gulong        elf_parser_get_text_size         (ElfParser    *parser);
 guint32       elf_parser_get_crc32             (ElfParser    *parser);
 const char   *elf_parser_get_sym_name          (ElfParser    *parser,
                                                 const ElfSym *sym);
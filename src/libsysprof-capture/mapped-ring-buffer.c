@@ -63,8 +63,15 @@
 #include <string.h>
 #include <sys/mman.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
+#ifdef __linux__
+# include <limits.h>
+# include <linux/futex.h>
+# include <sys/syscall.h>
+#endif
+
 #include "sysprof-capture-util-private.h"
 #include "sysprof-macros-internal.h"
 #include "sysprof-platform.h"
@@ -74,6 +81,9 @@
 #define DEFAULT_N_PAGES 63
 #define BUFFER_MAX_SIZE ((UINT32_MAX/2)-_sysprof_getpagesize())
 #define SHM_COLOUR 0x00400000
+#define WAIT_NSEC (1000L * 1000L)              /* 1 msec */
+#define MAX_WAIT_NSEC (1000L * 1000L * 1000L)  /* 1 sec */
+#define MAX_SAMPLE_INTERVAL 64
 
 enum {
   MODE_READER    = 1,
@@ -81,10 +91,24 @@ enum {
   MODE_READWRITE = 3,
 };
 
+enum {
+  /* Set by readers which understand MappedRingRecord framing */
+  FEATURE_MULTI_PRODUCER = 1 << 0,
+};
+
 /*
  * MappedRingHeader is the header of the first page of the
  * buffer. We use the whole buffer so that we can double map
  * the body of the buffer.
+ *
+ * @features is filled by the reader so that newer writers do not
+ * use a framing which an older reader cannot understand. The writer
+ * sets @multi_producer before writing anything if it wants it.
+ *
+ * Writers waiting for space increment @n_waiters and wait on @head
+ * which the reader wakes after moving it. Older readers never wake
+ * anyone, so waits are bounded and degrade into polling. Records the
+ * writer had to give up on are counted in @dropped.
  */
 typedef struct _MappedRingHeader
 {
@@ -92,9 +116,29 @@ typedef struct _MappedRingHeader
   uint32_t tail;
   uint32_t offset;
   uint32_t size;
+  uint32_t features;
+  uint32_t multi_producer;
+  uint32_t n_waiters;
+  uint32_t dropped;
 } MappedRingHeader;
 
-SYSPROF_STATIC_ASSERT (sizeof (MappedRingHeader) == 16, "MappedRingHeader changed size");
+SYSPROF_STATIC_ASSERT (sizeof (MappedRingHeader) == 32, "MappedRingHeader changed size");
+
+/*
+ * In multi-producer mode, every allocation is prefixed with a
+ * MappedRingRecord. Producers reserve @size bytes by moving the tail
+ * with compare-and-swap and publish the record by storing a non-zero
+ * @length last. The reader stops at the first record which has not
+ * been published yet, and zeroes what it consumed so that stale data
+ * is never mistaken for a published record.
+ */
+typedef struct _MappedRingRecord
+{
+  uint32_t size;
+  uint32_t length;
+} MappedRingRecord;
+
+SYSPROF_STATIC_ASSERT (sizeof (MappedRingRecord) == 8, "MappedRingRecord changed size");
 
 /*
  * MappedRingBuffer is used to wrap both the reader and writer
@@ -108,7 +152,10 @@ struct _MappedRingBuffer
   void         *map;
   size_t        body_size;
   size_t        page_size;
-  unsigned      has_failed : 1;
+  MappedRingBufferPolicy policy;
+  unsigned      sample_seq;
+  int           has_failed;
+  unsigned      multi_producer : 1;
 };
 
 static inline MappedRingHeader *
@@ -248,6 +295,8 @@ mapped_ring_buffer_new_reader (size_t buffer_size)
   header->tail = 0;
   header->offset = page_size;
   header->size = buffer_size - page_size;
+  header->features = FEATURE_MULTI_PRODUCER;
+  header->multi_producer = false;
 
   self = sysprof_malloc0 (sizeof (MappedRingBuffer));
   if (self == NULL)
@@ -441,6 +490,192 @@ mapped_ring_buffer_close_fd (MappedRingBuffer *self)
     }
 }
 
+/**
+ * mapped_ring_buffer_enable_multi_producer:
+ * @self: a #MappedRingBuffer
+ *
+ * Allows multiple threads to allocate from @self concurrently without
+ * any external locking. Allocations must then be completed with
+ * mapped_ring_buffer_commit() rather than mapped_ring_buffer_advance().
+ *
+ * This must be called by the writer before anything has been written
+ * to the buffer, and fails if the reader is too old to support it.
+ *
+ * Returns: %TRUE if multi-producer mode was enabled
+ */
+bool
+mapped_ring_buffer_enable_multi_producer (MappedRingBuffer *self)
+{
+  MappedRingHeader *header;
+  uint32_t enabled = true;
+
+  assert (self != NULL);
+  assert (self->mode & MODE_WRITER);
+
+  if (self->multi_producer)
+    return true;
+
+  header = get_header (self);
+
+  if ((header->features & FEATURE_MULTI_PRODUCER) == 0 ||
+      !mapped_ring_buffer_is_empty (self))
+    return false;
+
+  __atomic_store (&header->multi_producer, &enabled, __ATOMIC_SEQ_CST);
+  self->multi_producer = true;
+
+  return true;
+}
+
+static inline int64_t
+get_monotonic_time (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return (int64_t)ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+/*
+ * Waits for the reader to move the head away from @headpos. Returns
+ * %false if the caller should give up on the allocation instead.
+ */
+static bool
+mapped_ring_buffer_wait (MappedRingBuffer *self,
+                         uint32_t          headpos,
+                         int64_t          *deadline)
+{
+  MappedRingHeader *header = get_header (self);
+  int64_t now;
+
+  /* Once the reader failed to keep up, do not stall every allocation
+   * until it has caught up again.
+   */
+  if (self->policy != MAPPED_RING_BUFFER_BLOCK ||
+      __atomic_load_n (&self->has_failed, __ATOMIC_RELAXED))
+    return false;
+
+  now = get_monotonic_time ();
+
+  if (*deadline == 0)
+    *deadline = now + MAX_WAIT_NSEC;
+  else if (now >= *deadline)
+    return false;
+
+  __atomic_fetch_add (&header->n_waiters, 1, __ATOMIC_SEQ_CST);
+
+#ifdef __linux__
+  {
+    struct timespec timeout = { 0, WAIT_NSEC };
+
+    /* Returns immediately if the head already moved */
+    syscall (__NR_futex, &header->head, FUTEX_WAIT, headpos, &timeout, NULL, 0);
+  }
+#else
+  usleep (WAIT_NSEC / 1000);
+#endif
+
+  __atomic_fetch_sub (&header->n_waiters, 1, __ATOMIC_SEQ_CST);
+
+  return true;
+}
+
+static void
+mapped_ring_buffer_wake_writers (MappedRingBuffer *self)
+{
+  MappedRingHeader *header = get_header (self);
+
+  if (__atomic_load_n (&header->n_waiters, __ATOMIC_SEQ_CST) == 0)
+    return;
+
+#ifdef __linux__
+  syscall (__NR_futex, &header->head, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#endif
+}
+
+/*
+ * Decides whether to keep an allocation when sampling down. One in
+ * every 2^n allocations is kept once less than 1/2^n of the buffer
+ * is free, so the loss is spread over the burst rather than
+ * hitting whatever comes once the buffer is full.
+ */
+static bool
+mapped_ring_buffer_sample (MappedRingBuffer *self)
+{
+  MappedRingHeader *header = get_header (self);
+  uint32_t headpos;
+  uint32_t tailpos;
+  uint32_t available;
+  unsigned interval = 1;
+
+  __atomic_load (&header->tail, &tailpos, __ATOMIC_ACQUIRE);
+  __atomic_load (&header->head, &headpos, __ATOMIC_ACQUIRE);
+
+  if (headpos <= tailpos)
+    headpos += self->body_size;
+  available = headpos - tailpos;
+
+  while (interval < MAX_SAMPLE_INTERVAL &&
+         available < self->body_size / (interval * 2))
+    interval *= 2;
+
+  if (interval == 1)
+    return true;
+
+  return __atomic_fetch_add (&self->sample_seq, 1, __ATOMIC_RELAXED) % interval == 0;
+}
+
+static void *
+mapped_ring_buffer_reserve (MappedRingBuffer *self,
+                            size_t            length,
+                            size_t            reserve,
+                            int64_t          *deadline)
+{
+  MappedRingHeader *header = get_header (self);
+  MappedRingRecord *record;
+  uint32_t size = sizeof *record + length;
+
+  assert (size + reserve < self->body_size);
+
+  for (;;)
+    {
+      uint32_t headpos;
+      uint32_t tailpos;
+      uint32_t new_tailpos;
+
+      /* Load the tail first so that it can never be a lap ahead of
+       * the head we compare it against.
+       */
+      __atomic_load (&header->tail, &tailpos, __ATOMIC_ACQUIRE);
+      __atomic_load (&header->head, &headpos, __ATOMIC_ACQUIRE);
+
+      new_tailpos = tailpos + size;
+      if (new_tailpos >= self->body_size)
+        new_tailpos -= self->body_size;
+
+      /* Same rules as the single producer case, but the space is
+       * claimed by whichever producer moves the tail first.
+       */
+      if (tailpos + size + reserve < (headpos <= tailpos ? headpos + self->body_size : headpos))
+        {
+          if (__atomic_compare_exchange_n (&header->tail, &tailpos, new_tailpos, false,
+                                           __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            {
+              record = get_body_at_pos (self, tailpos);
+              record->size = size;
+              return &record[1];
+            }
+
+          /* Lost the race, try again without sleeping */
+          continue;
+        }
+
+      if (!mapped_ring_buffer_wait (self, headpos, deadline))
+        return NULL;
+    }
+}
+
 /**
  * mapped_ring_buffer_allocate:
  * @self: a #MappedRingBuffer
@@ -449,8 +684,9 @@ mapped_ring_buffer_close_fd (MappedRingBuffer *self)
  * the ring buffer and returns a pointer to the beginning of that zone.
  *
  * If the reader has not read enough bytes to allow @length to be added
- * then a mark will be added or incremented notifying the peer of how
- * many records they have lost and %NULL is returned.
+ * then, depending on the #MappedRingBufferPolicy, this waits for the
+ * reader or gives up. If it gives up, the count of dropped records
+ * visible to the peer is incremented and %NULL is returned.
  *
  * You must always check for %NULL before dereferencing the result of
  * this function as space may not be immediately available.
@@ -472,6 +708,8 @@ mapped_ring_buffer_allocate_with_reserve (MappedRingBuffer *self,
   MappedRingHeader *header;
   uint32_t headpos;
   uint32_t tailpos;
+  int64_t deadline = 0;
+  void *ret = NULL;
 
   assert (self != NULL);
   assert (self->mode & MODE_WRITER);
@@ -482,9 +720,19 @@ mapped_ring_buffer_allocate_with_reserve (MappedRingBuffer *self,
   assert (reserve < self->body_size);
   assert (length + reserve < self->body_size);
 
-  for (unsigned i = 0; i < 1000; i++)
+  header = get_header (self);
+
+  if (self->policy == MAPPED_RING_BUFFER_SAMPLE && !mapped_ring_buffer_sample (self))
+    goto dropped;
+
+  if (self->multi_producer)
+    {
+      ret = mapped_ring_buffer_reserve (self, length, reserve, &deadline);
+      goto finish;
+    }
+
+  for (;;)
     {
-      header = get_header (self);
       __atomic_load (&header->head, &headpos, __ATOMIC_SEQ_CST);
       __atomic_load (&header->tail, &tailpos, __ATOMIC_SEQ_CST);
 
@@ -497,23 +745,31 @@ mapped_ring_buffer_allocate_with_reserve (MappedRingBuffer *self,
        * forward with an atomic write.
        */
 
-      if (tailpos == headpos &&
-          length + reserve < self->body_size)
-        return get_body_at_pos (self, tailpos);
-
-      if (headpos < tailpos)
-        headpos += self->body_size;
+      if ((tailpos == headpos && length + reserve < self->body_size) ||
+          (tailpos + length + reserve < (headpos < tailpos ? headpos + self->body_size : headpos)))
+        {
+          ret = get_body_at_pos (self, tailpos);
+          break;
+        }
 
-      if (tailpos + length + reserve < headpos)
-        return get_body_at_pos (self, tailpos);
-
-      if (self->has_failed)
+      if (!mapped_ring_buffer_wait (self, headpos, &deadline))
         break;
+    }
+
+finish:
+  if (ret != NULL)
+    {
+      if (__atomic_load_n (&self->has_failed, __ATOMIC_RELAXED))
+        __atomic_store_n (&self->has_failed, false, __ATOMIC_RELAXED);
 
-      usleep (1000); /* 1 msec */
+      return ret;
     }
 
-  self->has_failed = true;
+  if (self->policy == MAPPED_RING_BUFFER_BLOCK)
+    __atomic_store_n (&self->has_failed, true, __ATOMIC_RELAXED);
+
+dropped:
+  __atomic_fetch_add (&header->dropped, 1, __ATOMIC_RELAXED);
 
   return NULL;
 }
@@ -552,6 +808,7 @@ mapped_ring_buffer_advance (MappedRingBuffer *self,
 
   assert (self != NULL);
   assert (self->mode & MODE_WRITER);
+  assert (!self->multi_producer);
   assert (length > 0);
   assert (length < self->body_size);
   assert ((length & 0x7) == 0);
@@ -573,33 +830,134 @@ mapped_ring_buffer_advance (MappedRingBuffer *self,
 }
 
 /**
- * mapped_ring_buffer_drain:
+ * mapped_ring_buffer_commit:
  * @self: a #MappedRingBuffer
- * @callback: (scope call): a callback to execute for each frame
- * @user_data: closure data for @callback
- *
- * Drains the buffer by calling @callback for each frame.
+ * @data: the result of mapped_ring_buffer_allocate()
+ * @length: a 8-byte aligned length
  *
- * This should only be called by a reader created with
- * mapped_ring_buffer_new_reader().
+ * Publishes the first @length bytes of @data to the reader.
  *
- * Returns: %TRUE if the buffer was drained, %FALSE if @callback prematurely
- *   returned while draining.
+ * This is equivalent to mapped_ring_buffer_advance() unless
+ * mapped_ring_buffer_enable_multi_producer() was called, in which
+ * case records may be committed in any order from any thread.
  */
-bool
-mapped_ring_buffer_drain (MappedRingBuffer         *self,
-                          MappedRingBufferCallback  callback,
-                          void                     *user_data)
+void
+mapped_ring_buffer_commit (MappedRingBuffer *self,
+                           void             *data,
+                           size_t            length)
 {
   MappedRingHeader *header;
-  uint32_t headpos;
-  uint32_t tailpos;
+  MappedRingRecord *record;
+  uint32_t size;
 
   assert (self != NULL);
-  assert (self->mode & MODE_READER);
-  assert (callback != NULL);
+  assert (data != NULL);
+  assert (length > 0);
+  assert ((length & 0x7) == 0);
+
+  if (!self->multi_producer)
+    {
+      mapped_ring_buffer_advance (self, length);
+      return;
+    }
 
   header = get_header (self);
+  record = (MappedRingRecord *)data - 1;
+  size = sizeof *record + length;
+
+  assert (size <= record->size);
+
+  /* Give back what we over-allocated if nobody reserved after us. The
+   * released space is zeroed first so the reader cannot mistake our
+   * scratch data for the next record.
+   */
+  if (size < record->size)
+    {
+      size_t pos = (uint8_t *)record - (uint8_t *)get_body_at_pos (self, 0);
+      uint32_t old_tailpos;
+      uint32_t new_tailpos;
+
+      if (pos >= self->body_size)
+        pos -= self->body_size;
+
+      old_tailpos = (pos + record->size) % self->body_size;
+      new_tailpos = (pos + size) % self->body_size;
+
+      memset ((uint8_t *)record + size, 0, record->size - size);
+
+      if (__atomic_compare_exchange_n (&header->tail, &old_tailpos, new_tailpos, false,
+                                       __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+        record->size = size;
+    }
+
+  __atomic_store_n (&record->length, (uint32_t)length, __ATOMIC_RELEASE);
+}
+
+static bool
+mapped_ring_buffer_drain_records (MappedRingBuffer         *self,
+                                  MappedRingBufferCallback  callback,
+                                  void                     *user_data)
+{
+  MappedRingHeader *header = get_header (self);
+  uint32_t headpos;
+
+  __atomic_load (&header->head, &headpos, __ATOMIC_SEQ_CST);
+
+  assert (headpos < self->body_size);
+
+  for (;;)
+    {
+      MappedRingRecord *record = get_body_at_pos (self, headpos);
+      uint32_t available;
+      uint32_t tailpos;
+      uint32_t length;
+      uint32_t size;
+      size_t len;
+
+      /* Records are published out of order, stop at the first one
+       * which is still being written.
+       */
+      if (!(length = __atomic_load_n (&record->length, __ATOMIC_ACQUIRE)))
+        return true;
+
+      __atomic_load (&header->tail, &tailpos, __ATOMIC_ACQUIRE);
+
+      if (tailpos < headpos)
+        tailpos += self->body_size;
+      available = tailpos - headpos;
+
+      size = record->size;
+
+      if (size < sizeof *record + length || size > available || (size & 0x7) != 0)
+        return false;
+
+      len = length;
+
+      if (!callback (&record[1], &len, user_data))
+        return false;
+
+      if (len > length)
+        return false;
+
+      memset (record, 0, size);
+
+      headpos += size;
+      if (headpos >= self->body_size)
+        headpos -= self->body_size;
+
+      __atomic_store (&header->head, &headpos, __ATOMIC_SEQ_CST);
+    }
+}
+
+static bool
+mapped_ring_buffer_drain_frames (MappedRingBuffer         *self,
+                                 MappedRingBufferCallback  callback,
+                                 void                     *user_data)
+{
+  MappedRingHeader *header = get_header (self);
+  uint32_t headpos;
+  uint32_t tailpos;
+
   __atomic_load (&header->head, &headpos, __ATOMIC_SEQ_CST);
   __atomic_load (&header->tail, &tailpos, __ATOMIC_SEQ_CST);
 
@@ -642,6 +1000,89 @@ mapped_ring_buffer_drain (MappedRingBuffer         *self,
   return true;
 }
 
+/**
+ * mapped_ring_buffer_drain:
+ * @self: a #MappedRingBuffer
+ * @callback: (scope call): a callback to execute for each frame
+ * @user_data: closure data for @callback
+ *
+ * Drains the buffer by calling @callback for each frame.
+ *
+ * This should only be called by a reader created with
+ * mapped_ring_buffer_new_reader().
+ *
+ * Returns: %TRUE if the buffer was drained, %FALSE if @callback prematurely
+ *   returned while draining.
+ */
+bool
+mapped_ring_buffer_drain (MappedRingBuffer         *self,
+                          MappedRingBufferCallback  callback,
+                          void                     *user_data)
+{
+  MappedRingHeader *header;
+  bool ret;
+
+  assert (self != NULL);
+  assert (self->mode & MODE_READER);
+  assert (callback != NULL);
+
+  header = get_header (self);
+
+  if (__atomic_load_n (&header->multi_producer, __ATOMIC_ACQUIRE))
+    ret = mapped_ring_buffer_drain_records (self, callback, user_data);
+  else
+    ret = mapped_ring_buffer_drain_frames (self, callback, user_data);
+
+  mapped_ring_buffer_wake_writers (self);
+
+  return ret;
+}
+
+/**
+ * mapped_ring_buffer_set_policy:
+ * @self: a #MappedRingBuffer
+ * @policy: a #MappedRingBufferPolicy
+ *
+ * Sets what happens when the writer allocates while the buffer is full.
+ *
+ * With %MAPPED_RING_BUFFER_BLOCK, the default, allocation waits for the
+ * reader for up to a second. If the reader did not catch up, further
+ * allocations fail immediately until space is available again.
+ *
+ * With %MAPPED_RING_BUFFER_DROP, allocation fails immediately.
+ *
+ * With %MAPPED_RING_BUFFER_SAMPLE, allocation also fails immediately but
+ * an increasing share of allocations are refused as the buffer fills up.
+ *
+ * Every failed allocation is counted, see mapped_ring_buffer_get_dropped().
+ */
+void
+mapped_ring_buffer_set_policy (MappedRingBuffer       *self,
+                               MappedRingBufferPolicy  policy)
+{
+  assert (self != NULL);
+  assert (self->mode & MODE_WRITER);
+
+  self->policy = policy;
+}
+
+/**
+ * mapped_ring_buffer_get_dropped:
+ * @self: a #MappedRingBuffer
+ *
+ * Gets the number of allocations which failed because the reader did not
+ * keep up with the writer.
+ *
+ * Returns: the number of dropped records
+ */
+unsigned int
+mapped_ring_buffer_get_dropped (MappedRingBuffer *self)
+{
+  assert (self != NULL);
+
+  return __atomic_load_n (&get_header (self)->dropped, __ATOMIC_RELAXED);
+}
+
 /**
  * mapped_ring_buffer_is_empty:
  * @self: a #MappedRingBuffer
@@ -687,4 +1128,8 @@ mapped_ring_buffer_clear (MappedRingBuffer *self)
   header = get_header (self);
   header->head = 0;
   header->tail = 0;
+
+  /* Unpublished records must not look published after a clear */
+  if (header->multi_producer)
+    memset (get_body_at_pos (self, 0), 0, self->body_size);
 }
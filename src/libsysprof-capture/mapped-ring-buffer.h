@@ -65,6 +65,22 @@ SYSPROF_BEGIN_DECLS
 
 typedef struct _MappedRingBuffer MappedRingBuffer;
 
+/**
+ * MappedRingBufferPolicy:
+ * @MAPPED_RING_BUFFER_BLOCK: wait for the reader to make space
+ * @MAPPED_RING_BUFFER_DROP: drop the record immediately
+ * @MAPPED_RING_BUFFER_SAMPLE: drop a growing share of records as the
+ *   buffer fills up
+ *
+ * What the writer does when the buffer is full.
+ */
+typedef enum _MappedRingBufferPolicy
+{
+  MAPPED_RING_BUFFER_BLOCK,
+  MAPPED_RING_BUFFER_DROP,
+  MAPPED_RING_BUFFER_SAMPLE,
+} MappedRingBufferPolicy;
+
 /**
  * MappedRingBufferCallback:
  * @data: a pointer into the mapped buffer containing the data frame
@@ -109,6 +125,9 @@ void              mapped_ring_buffer_unref              (MappedRingBuffer
 SYSPROF_INTERNAL
 void              mapped_ring_buffer_clear              (MappedRingBuffer         *self);
 SYSPROF_INTERNAL
+bool              mapped_ring_buffer_enable_multi_producer
+                                                        (MappedRingBuffer         *self);
+SYSPROF_INTERNAL
 void             *mapped_ring_buffer_allocate_with_reserve
                                                         (MappedRingBuffer         *self,
                                                          size_t                    length,
@@ -120,10 +139,19 @@ SYSPROF_INTERNAL
 void              mapped_ring_buffer_advance            (MappedRingBuffer         *self,
                                                          size_t                    length);
 SYSPROF_INTERNAL
+void              mapped_ring_buffer_commit             (MappedRingBuffer         *self,
+                                                         void                     *data,
+                                                         size_t                    length);
+SYSPROF_INTERNAL
 bool              mapped_ring_buffer_drain              (MappedRingBuffer         *self,
                                                          MappedRingBufferCallback  callback,
                                                          void                     *user_data);
 SYSPROF_INTERNAL
 bool              mapped_ring_buffer_is_empty           (MappedRingBuffer         *self);
+SYSPROF_INTERNAL
+void              mapped_ring_buffer_set_policy         (MappedRingBuffer         *self,
+                                                         MappedRingBufferPolicy    policy);
+SYSPROF_INTERNAL
+unsigned int      mapped_ring_buffer_get_dropped        (MappedRingBuffer         *self);
 
 SYSPROF_END_DECLS
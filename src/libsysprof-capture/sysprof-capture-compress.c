@@ -0,0 +1,380 @@
+/* sysprof-capture-compress.c
+ *
+ * Copyright 2023 Christian Hergert <chergert@redhat.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * Subject to the terms and conditions of this license, each copyright holder
+ * and contributor hereby grants to those receiving rights under this license
+ * a perpetual, worldwide, non-exclusive, no-charge, royalty-free,
+ * irrevocable (except for failure to satisfy the conditions of this license)
+ * patent license to make, have made, use, offer to sell, sell, import, and
+ * otherwise transfer this software, where such license applies only to those
+ * patent claims, already acquired or hereafter acquired, licensable by such
+ * copyright holder or contributor that are necessarily infringed by:
+ *
+ * (a) their Contribution(s) (the licensed copyrights of copyright holders
+ *     and non-copyrightable additions of contributors, in source or binary
+ *     form) alone; or
+ *
+ * (b) combination of their Contribution(s) with the work of authorship to
+ *     which such Contribution(s) was added by such copyright holder or
+ *     contributor, if, at the time the Contribution is added, such addition
+ *     causes such combination to be necessarily infringed. The patent license
+ *     shall not apply to any other combinations which include the
+ *     Contribution.
+ *
+ * Except as expressly stated above, no rights or licenses from any copyright
+ * holder or contributor is granted under this license, whether expressly, by
+ * implication, estoppel or otherwise.
+ *
+ * DISCLAIMER
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause-Patent
+ */
+
+
+#include "config.h"
+
+#include <assert.h>
+#include <byteswap.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if HAVE_ZSTD
+# include <zstd.h>
+#endif
+
+#include "sysprof-capture-compress-private.h"
+#include "sysprof-capture-util-private.h"
+#include "sysprof-platform.h"
+
+#define COMPRESSION_LEVEL 3
+
+bool
+_sysprof_capture_compress_supported (void)
+{
+#if HAVE_ZSTD
+  return true;
+#else
+  return false;
+#endif
+}
+
+size_t
+_sysprof_capture_compress_bound (size_t len)
+{
+#if HAVE_ZSTD
+  return ZSTD_compressBound (len);
+#else
+  return 0;
+#endif
+}
+
+/* Returns the compressed length, or 0 on failure */
+size_t
+_sysprof_capture_compress (void       *dst,
+                           size_t      dst_len,
+                           const void *src,
+                           size_t      src_len)
+{
+#if HAVE_ZSTD
+  size_t ret;
+
+  assert (dst != NULL);
+  assert (src != NULL);
+
+  ret = ZSTD_compress (dst, dst_len, src, src_len, COMPRESSION_LEVEL);
+
+  if (ZSTD_isError (ret))
+    {
+      errno = ENOSPC;
+      return 0;
+    }
+
+  return ret;
+#else
+  errno = ENOTSUP;
+  return 0;
+#endif
+}
+
+bool
+_sysprof_capture_decompress (void       *dst,
+                             size_t      dst_len,
+                             const void *src,
+                             size_t      src_len)
+{
+#if HAVE_ZSTD
+  size_t ret;
+
+  assert (dst != NULL);
+  assert (src != NULL);
+
+  ret = ZSTD_decompress (dst, dst_len, src, src_len);
+
+  if (ZSTD_isError (ret) || ret != dst_len)
+    {
+      errno = EINVAL;
+      return false;
+    }
+
+  return true;
+#else
+  errno = ENOTSUP;
+  return false;
+#endif
+}
+
+static int
+compare_block_info (const void *a,
+                    const void *b)
+{
+  const SysprofCaptureBlockInfo *info_a = a;
+  const SysprofCaptureBlockInfo *info_b = b;
+
+  if (info_a->uncompressed_offset < info_b->uncompressed_offset)
+    return -1;
+  else if (info_a->uncompressed_offset > info_b->uncompressed_offset)
+    return 1;
+  else
+    return 0;
+}
+
+/*
+ * Walks the chain of blocks in a compressed capture starting from the
+ * last block noted in the file header. The result is sorted by position
+ * within the uncompressed capture and validated to cover it without gaps
+ * so that each block may be decompressed independently.
+ *
+ * Returns: an array of blocks to be freed with free(), or %NULL and errno
+ *   is set.
+ */
+SysprofCaptureBlockInfo *
+_sysprof_capture_list_blocks (const uint8_t *data,
+                              size_t         data_len,
+                              size_t        *n_blocks,
+                              size_t        *uncompressed_len)
+{
+  const SysprofCaptureFileHeader *header = (const SysprofCaptureFileHeader *)(const void *)data;
+  SysprofCaptureBlockInfo *blocks = NULL;
+  size_t n_alloc = 0;
+  size_t n = 0;
+  uint64_t position;
+  uint64_t expected;
+  bool needs_swap;
+
+  assert (data != NULL);
+  assert (n_blocks != NULL);
+  assert (uncompressed_len != NULL);
+
+  *n_blocks = 0;
+  *uncompressed_len = 0;
+
+  if (data_len < sizeof *header || !header->compressed)
+    goto einval;
+
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+  needs_swap = !header->little_endian;
+#else
+  needs_swap = !!header->little_endian;
+#endif
+
+  position = header->frame_index.last_block;
+  if (needs_swap)
+    position = bswap_64 (position);
+
+  while (position != 0)
+    {
+      const SysprofCaptureBlock *block;
+      SysprofCaptureBlockInfo *info;
+      uint32_t magic;
+
+      /* Blocks are written in order, so the chain must move backwards */
+      if (position < sizeof *header ||
+          position > data_len - sizeof *block ||
+          (n > 0 && position >= blocks[n - 1].offset - sizeof *block))
+        goto einval;
+
+      block = (const SysprofCaptureBlock *)(const void *)&data[position];
+
+      magic = needs_swap ? bswap_32 (block->magic) : block->magic;
+      if (magic != SYSPROF_CAPTURE_BLOCK_MAGIC)
+        goto einval;
+
+      if (n == n_alloc)
+        {
+          SysprofCaptureBlockInfo *new_blocks;
+
+          n_alloc = n_alloc ? n_alloc * 2 : 64;
+
+          if (!(new_blocks = _sysprof_reallocarray (blocks, n_alloc, sizeof *blocks)))
+            {
+              free (blocks);
+              errno = ENOMEM;
+              return NULL;
+            }
+
+          blocks = new_blocks;
+        }
+
+      info = &blocks[n++];
+      info->offset = position + sizeof *block;
+      info->compressed_len = needs_swap ? bswap_32 (block->compressed_len) : block->compressed_len;
+      info->uncompressed_len = needs_swap ? bswap_32 (block->uncompressed_len) : block->uncompressed_len;
+      info->uncompressed_offset = needs_swap ? bswap_64 (block->uncompressed_offset) : block->uncompressed_offset;
+
+      if (info->compressed_len > data_len - info->offset)
+        goto einval;
+
+      position = needs_swap ? bswap_64 (block->previous_block) : block->previous_block;
+    }
+
+  if (n > 0)
+    qsort (blocks, n, sizeof *blocks, compare_block_info);
+
+  expected = sizeof *header;
+
+  for (size_t i = 0; i < n; i++)
+    {
+      if (blocks[i].uncompressed_offset != expected)
+        goto einval;
+
+      expected += blocks[i].uncompressed_len;
+    }
+
+  *n_blocks = n;
+  *uncompressed_len = expected;
+
+  /* Allow an empty capture to return a non-NULL result */
+  if (blocks == NULL)
+    blocks = sysprof_malloc0 (sizeof *blocks);
+
+  return blocks;
+
+einval:
+  free (blocks);
+  errno = EINVAL;
+  return NULL;
+}
+
+/*
+ * Fills @out_header with the header to use for the decompressed form of
+ * a capture with @header.
+ */
+void
+_sysprof_capture_uncompressed_header (const SysprofCaptureFileHeader *header,
+                                      SysprofCaptureFileHeader       *out_header)
+{
+  assert (header != NULL);
+  assert (out_header != NULL);
+
+  *out_header = *header;
+  out_header->compressed = false;
+  out_header->frame_index.last_block = 0;
+}
+
+/*
+ * Decompresses the capture found in @fd into a new memfd which may be
+ * used as an uncompressed capture.
+ *
+ * Returns: a new file-descriptor, or -1 and errno is set.
+ */
+int
+_sysprof_capture_decompress_fd (int fd)
+{
+  SysprofCaptureBlockInfo *blocks = NULL;
+  SysprofCaptureFileHeader header;
+  struct stat stbuf;
+  uint8_t *data = MAP_FAILED;
+  uint8_t *out = MAP_FAILED;
+  size_t uncompressed_len = 0;
+  size_t n_blocks = 0;
+  int out_fd = -1;
+  int errsv;
+
+  assert (fd > -1);
+
+  if (fstat (fd, &stbuf) != 0)
+    return -1;
+
+  if (stbuf.st_size < (off_t)sizeof header)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+
+  if ((data = mmap (NULL, stbuf.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED)
+    return -1;
+
+  if (!(blocks = _sysprof_capture_list_blocks (data, stbuf.st_size, &n_blocks, &uncompressed_len)))
+    goto failure;
+
+  if ((out_fd = sysprof_memfd_create ("[sysprof-capture]")) == -1 ||
+      ftruncate (out_fd, uncompressed_len) != 0)
+    goto failure;
+
+  if ((out = mmap (NULL, uncompressed_len, PROT_READ | PROT_WRITE, MAP_SHARED, out_fd, 0)) == MAP_FAILED)
+    goto failure;
+
+  _sysprof_capture_uncompressed_header ((const SysprofCaptureFileHeader *)(const void *)data, &header);
+  memcpy (out, &header, sizeof header);
+
+  for (size_t i = 0; i < n_blocks; i++)
+    {
+      if (!_sysprof_capture_decompress (&out[blocks[i].uncompressed_offset],
+                                        blocks[i].uncompressed_len,
+                                        &data[blocks[i].offset],
+                                        blocks[i].compressed_len))
+        goto failure;
+    }
+
+  munmap (out, uncompressed_len);
+  munmap (data, stbuf.st_size);
+  free (blocks);
+
+  return out_fd;
+
+failure:
+  errsv = errno;
+
+  if (out != MAP_FAILED)
+    munmap (out, uncompressed_len);
+
+  if (data != MAP_FAILED)
+    munmap (data, stbuf.st_size);
+
+  if (out_fd != -1)
+    close (out_fd);
+
+  free (blocks);
+
+  errno = errsv;
+
+  return -1;
+}
@@ -61,7 +61,7 @@
 #include <stdlib.h>
 #include <string.h>
 
-#include "sysprof-capture-condition.h"
+#include "sysprof-capture-condition-private.h"
 #include "sysprof-capture-util-private.h"
 #include "sysprof-macros-internal.h"
 
@@ -529,3 +529,1219 @@ sysprof_capture_condition_new_where_file (const char *path)
 
   return self;
 }
+
+/*
+ * Walking the condition tree means a call per node and a linear scan of
+ * every set for each frame. Cursors instead compile their conditions once
+ * into a flat program. Nested AND/OR are flattened, operands of the same
+ * kind within a group are merged (type masks, sorted pid and counter sets,
+ * merged time ranges) and the operands of each group are ordered so that
+ * the cheapest and most decisive tests run first. Each instruction then
+ * jumps to another instruction or accepts or rejects the frame.
+ */
+
+#define PROGRAM_ACCEPT (-1)
+#define PROGRAM_REJECT (-2)
+#define ALL_TYPES      (~(uint64_t)0)
+#define TYPE_BIT(t)    (((unsigned int)(t) < 64) ? ((uint64_t)1 << (unsigned int)(t)) : 0)
+
+/* Ordered by the cost of evaluating the leaf */
+typedef enum
+{
+  NODE_FALSE,
+  NODE_TYPE_IN,
+  NODE_TIME_IN,
+  NODE_PID_IN,
+  NODE_COUNTER_IN,
+  NODE_FILE,
+  NODE_AND,
+  NODE_OR,
+} NodeKind;
+
+typedef struct
+{
+  int64_t begin;
+  int64_t end;
+} TimeRange;
+
+typedef struct _Node Node;
+
+typedef union
+{
+  uint64_t       types;
+  TimeRange     *ranges;
+  int32_t       *pids;
+  unsigned int  *counters;
+  char          *path;
+  Node         **children;
+} NodeData;
+
+struct _Node
+{
+  NodeKind kind;
+  size_t   len;
+  NodeData u;
+};
+
+typedef struct
+{
+  NodeKind kind;
+  int32_t  on_true;
+  int32_t  on_false;
+  size_t   len;
+  NodeData u;
+} Instruction;
+
+struct _SysprofCaptureConditionProgram
+{
+  uint64_t    may_match_types;
+  TimeRange   may_match_time;
+  size_t      n_instructions;
+  Instruction instructions[];
+};
+
+static void
+node_data_clear (NodeKind  kind,
+                 NodeData *u)
+{
+  switch (kind)
+    {
+    case NODE_TIME_IN:
+      free (u->ranges);
+      break;
+
+    case NODE_PID_IN:
+      free (u->pids);
+      break;
+
+    case NODE_COUNTER_IN:
+      free (u->counters);
+      break;
+
+    case NODE_FILE:
+      free (u->path);
+      break;
+
+    case NODE_FALSE:
+    case NODE_TYPE_IN:
+    case NODE_AND:
+    case NODE_OR:
+    default:
+      break;
+    }
+
+  memset (u, 0, sizeof *u);
+}
+
+static void
+node_free (Node *node)
+{
+  if (node == NULL)
+    return;
+
+  if (node->kind == NODE_AND || node->kind == NODE_OR)
+    {
+      for (size_t i = 0; i < node->len; i++)
+        node_free (node->u.children[i]);
+      free (node->u.children);
+    }
+  else
+    {
+      node_data_clear (node->kind, &node->u);
+    }
+
+  free (node);
+}
+
+static void
+node_set_false (Node *node)
+{
+  node_data_clear (node->kind, &node->u);
+  node->kind = NODE_FALSE;
+  node->len = 0;
+}
+
+static Node *
+node_new (NodeKind kind)
+{
+  Node *node;
+
+  if ((node = sysprof_malloc0 (sizeof *node)))
+    node->kind = kind;
+
+  return node;
+}
+
+static int
+compare_int32 (const void *a,
+               const void *b)
+{
+  int32_t x = *(const int32_t *)a;
+  int32_t y = *(const int32_t *)b;
+
+  return x < y ? -1 : x > y;
+}
+
+static int
+compare_uint (const void *a,
+              const void *b)
+{
+  unsigned int x = *(const unsigned int *)a;
+  unsigned int y = *(const unsigned int *)b;
+
+  return x < y ? -1 : x > y;
+}
+
+static int
+compare_time_range (const void *a,
+                    const void *b)
+{
+  const TimeRange *x = a;
+  const TimeRange *y = b;
+
+  return x->begin < y->begin ? -1 : x->begin > y->begin;
+}
+
+/* Sorts @data and removes duplicates, returning the new length */
+static size_t
+sort_unique (void    *data,
+             size_t   len,
+             size_t   size,
+             int    (*compare) (const void *, const void *))
+{
+  uint8_t *p = data;
+  size_t n = 0;
+
+  if (len == 0)
+    return 0;
+
+  qsort (data, len, size, compare);
+
+  for (size_t i = 1; i < len; i++)
+    {
+      if (compare (&p[n * size], &p[i * size]) != 0)
+        {
+          n++;
+          if (n != i)
+            memcpy (&p[n * size], &p[i * size], size);
+        }
+    }
+
+  return n + 1;
+}
+
+/* Returns NULL on allocation failure */
+static void *
+concat_unique (const void  *a,
+               size_t       a_len,
+               const void  *b,
+               size_t       b_len,
+               size_t       size,
+               int        (*compare) (const void *, const void *),
+               size_t      *len)
+{
+  uint8_t *data;
+
+  if (!(data = _sysprof_reallocarray (NULL, a_len + b_len + 1, size)))
+    return NULL;
+
+  if (a_len > 0)
+    memcpy (data, a, a_len * size);
+  if (b_len > 0)
+    memcpy (&data[a_len * size], b, b_len * size);
+
+  *len = sort_unique (data, a_len + b_len, size, compare);
+
+  return data;
+}
+
+/* Sorts @ranges by their beginning and coalesces overlapping ranges */
+static size_t
+merge_time_ranges (TimeRange *ranges,
+                   size_t     len)
+{
+  size_t n = 0;
+
+  if (len == 0)
+    return 0;
+
+  qsort (ranges, len, sizeof *ranges, compare_time_range);
+
+  for (size_t i = 1; i < len; i++)
+    {
+      if (ranges[i].begin <= ranges[n].end ||
+          (ranges[n].end != INT64_MAX && ranges[i].begin == ranges[n].end + 1))
+        {
+          if (ranges[i].end > ranges[n].end)
+            ranges[n].end = ranges[i].end;
+        }
+      else
+        {
+          ranges[++n] = ranges[i];
+        }
+    }
+
+  return n + 1;
+}
+
+static Node *
+node_new_leaf (const SysprofCaptureCondition *condition)
+{
+  Node *node;
+
+  if (!(node = node_new (NODE_FALSE)))
+    return NULL;
+
+  switch (condition->type)
+    {
+    case SYSPROF_CAPTURE_CONDITION_WHERE_TYPE_IN:
+      for (size_t i = 0; i < condition->u.where_type_in.len; i++)
+        node->u.types |= TYPE_BIT (condition->u.where_type_in.data[i]);
+      if (node->u.types != 0)
+        node->kind = NODE_TYPE_IN;
+      break;
+
+    case SYSPROF_CAPTURE_CONDITION_WHERE_TIME_BETWEEN:
+      if (!(node->u.ranges = malloc (sizeof (TimeRange))))
+        goto failure;
+      node->kind = NODE_TIME_IN;
+      node->u.ranges[0].begin = condition->u.where_time_between.begin;
+      node->u.ranges[0].end = condition->u.where_time_between.end;
+      node->len = 1;
+      break;
+
+    case SYSPROF_CAPTURE_CONDITION_WHERE_PID_IN:
+      if (condition->u.where_pid_in.len == 0)
+        break;
+      if (!(node->u.pids = concat_unique (condition->u.where_pid_in.data,
+                                          condition->u.where_pid_in.len,
+                                          NULL, 0, sizeof (int32_t),
+                                          compare_int32, &node->len)))
+        goto failure;
+      node->kind = NODE_PID_IN;
+      break;
+
+    case SYSPROF_CAPTURE_CONDITION_WHERE_COUNTER_IN:
+      if (condition->u.where_counter_in.len == 0)
+        break;
+      if (!(node->u.counters = concat_unique (condition->u.where_counter_in.data,
+                                              condition->u.where_counter_in.len,
+                                              NULL, 0, sizeof (unsigned int),
+                                              compare_uint, &node->len)))
+        goto failure;
+      node->kind = NODE_COUNTER_IN;
+      break;
+
+    case SYSPROF_CAPTURE_CONDITION_WHERE_FILE:
+      if (condition->u.where_file == NULL)
+        break;
+      if (!(node->u.path = sysprof_strdup (condition->u.where_file)))
+        goto failure;
+      node->kind = NODE_FILE;
+      break;
+
+    case SYSPROF_CAPTURE_CONDITION_AND:
+    case SYSPROF_CAPTURE_CONDITION_OR:
+    default:
+      sysprof_assert_not_reached ();
+      break;
+    }
+
+  return node;
+
+failure:
+  node_free (node);
+  return NULL;
+}
+
+/* Frame types which could possibly be matched by @node */
+static uint64_t
+node_types (const Node *node)
+{
+  uint64_t types;
+
+  switch (node->kind)
+    {
+    case NODE_FALSE:
+      return 0;
+
+    case NODE_TYPE_IN:
+      return node->u.types;
+
+    case NODE_COUNTER_IN:
+      return TYPE_BIT (SYSPROF_CAPTURE_FRAME_CTRSET) | TYPE_BIT (SYSPROF_CAPTURE_FRAME_CTRDEF);
+
+    case NODE_FILE:
+      return TYPE_BIT (SYSPROF_CAPTURE_FRAME_FILE_CHUNK);
+
+    case NODE_AND:
+      types = ALL_TYPES;
+      for (size_t i = 0; i < node->len; i++)
+        types &= node_types (node->u.children[i]);
+      return types;
+
+    case NODE_OR:
+      types = 0;
+      for (size_t i = 0; i < node->len; i++)
+        types |= node_types (node->u.children[i]);
+      return types;
+
+    case NODE_TIME_IN:
+    case NODE_PID_IN:
+    default:
+      return ALL_TYPES;
+    }
+}
+
+/* Hull of the frame times which could possibly be matched by @node,
+ * or false if no frame time could be matched.
+ */
+static bool
+node_time_range (const Node *node,
+                 TimeRange  *range)
+{
+  TimeRange child;
+
+  switch (node->kind)
+    {
+    case NODE_FALSE:
+      return false;
+
+    case NODE_TIME_IN:
+      range->begin = node->u.ranges[0].begin;
+      range->end = node->u.ranges[node->len - 1].end;
+      return true;
+
+    case NODE_AND:
+      range->begin = INT64_MIN;
+      range->end = INT64_MAX;
+      for (size_t i = 0; i < node->len; i++)
+        {
+          if (!node_time_range (node->u.children[i], &child))
+            return false;
+          if (child.begin > range->begin)
+            range->begin = child.begin;
+          if (child.end < range->end)
+            range->end = child.end;
+        }
+      return range->begin <= range->end;
+
+    case NODE_OR:
+      {
+        bool ret = false;
+
+        for (size_t i = 0; i < node->len; i++)
+          {
+            if (!node_time_range (node->u.children[i], &child))
+              continue;
+
+            if (!ret)
+              {
+                *range = child;
+                ret = true;
+              }
+            else
+              {
+                if (child.begin < range->begin)
+                  range->begin = child.begin;
+                if (child.end > range->end)
+                  range->end = child.end;
+              }
+          }
+
+        return ret;
+      }
+
+    case NODE_TYPE_IN:
+    case NODE_PID_IN:
+    case NODE_COUNTER_IN:
+    case NODE_FILE:
+    default:
+      range->begin = INT64_MIN;
+      range->end = INT64_MAX;
+      return true;
+    }
+}
+
+/* Number of instructions needed for @node */
+static size_t
+node_size (const Node *node)
+{
+  size_t size = 0;
+
+  if (node->kind != NODE_AND && node->kind != NODE_OR)
+    return 1;
+
+  for (size_t i = 0; i < node->len; i++)
+    size += node_size (node->u.children[i]);
+
+  return size;
+}
+
+static size_t
+node_cost (const Node *node)
+{
+  size_t cost = NODE_AND;
+
+  if (node->kind != NODE_AND && node->kind != NODE_OR)
+    return node->kind;
+
+  for (size_t i = 0; i < node->len; i++)
+    cost += node_cost (node->u.children[i]);
+
+  return cost;
+}
+
+/* A rough guess at how many values a leaf accepts, used to order
+ * operands of the same cost.
+ */
+static size_t
+node_breadth (const Node *node)
+{
+  switch (node->kind)
+    {
+    case NODE_TYPE_IN:
+      return __builtin_popcountll (node->u.types);
+
+    case NODE_PID_IN:
+    case NODE_COUNTER_IN:
+      return node->len;
+
+    case NODE_FALSE:
+    case NODE_TIME_IN:
+    case NODE_FILE:
+    case NODE_AND:
+    case NODE_OR:
+    default:
+      return 0;
+    }
+}
+
+/* AND operands run cheapest and then narrowest first so that frames are
+ * rejected early. OR operands run cheapest and then broadest first so that
+ * frames are accepted early.
+ */
+static int
+compare_and_operands (const void *a,
+                      const void *b)
+{
+  const Node *x = *(const Node * const *)a;
+  const Node *y = *(const Node * const *)b;
+  size_t x_cost = node_cost (x);
+  size_t y_cost = node_cost (y);
+
+  if (x_cost != y_cost)
+    return x_cost < y_cost ? -1 : 1;
+
+  return node_breadth (x) < node_breadth (y) ? -1 : node_breadth (x) > node_breadth (y);
+}
+
+static int
+compare_or_operands (const void *a,
+                     const void *b)
+{
+  const Node *x = *(const Node * const *)a;
+  const Node *y = *(const Node * const *)b;
+  size_t x_cost = node_cost (x);
+  size_t y_cost = node_cost (y);
+
+  if (x_cost != y_cost)
+    return x_cost < y_cost ? -1 : 1;
+
+  return node_breadth (x) > node_breadth (y) ? -1 : node_breadth (x) < node_breadth (y);
+}
+
+static bool
+node_can_merge (NodeKind group,
+                NodeKind kind)
+{
+  switch (kind)
+    {
+    case NODE_TYPE_IN:
+    case NODE_TIME_IN:
+    case NODE_PID_IN:
+      return true;
+
+    /* A counter set may contain counters from both sides of an AND, so
+     * those cannot be intersected.
+     */
+    case NODE_COUNTER_IN:
+      return group == NODE_OR;
+
+    case NODE_FALSE:
+    case NODE_FILE:
+    case NODE_AND:
+    case NODE_OR:
+    default:
+      return false;
+    }
+}
+
+/* Merges @from into @into, both leaves of @kind. Returns false on
+ * allocation failure.
+ */
+static bool
+node_merge (NodeKind  group,
+            Node     *into,
+            Node     *from)
+{
+  void *data;
+  size_t len = 0;
+
+  assert (into->kind == from->kind);
+
+  switch (into->kind)
+    {
+    case NODE_TYPE_IN:
+      if (group == NODE_AND)
+        into->u.types &= from->u.types;
+      else
+        into->u.types |= from->u.types;
+
+      if (into->u.types == 0)
+        node_set_false (into);
+
+      return true;
+
+    case NODE_PID_IN:
+      if (group == NODE_AND)
+        {
+          size_t i = 0, j = 0;
+
+          data = into->u.pids;
+
+          while (i < into->len && j < from->len)
+            {
+              if (into->u.pids[i] < from->u.pids[j])
+                i++;
+              else if (into->u.pids[i] > from->u.pids[j])
+                j++;
+              else
+                {
+                  into->u.pids[len++] = into->u.pids[i];
+                  i++;
+                  j++;
+                }
+            }
+        }
+      else if (!(data = concat_unique (into->u.pids, into->len,
+                                       from->u.pids, from->len,
+                                       sizeof (int32_t), compare_int32, &len)))
+        return false;
+      break;
+
+    case NODE_COUNTER_IN:
+      assert (group == NODE_OR);
+
+      if (!(data = concat_unique (into->u.counters, into->len,
+                                  from->u.counters, from->len,
+                                  sizeof (unsigned int), compare_uint, &len)))
+        return false;
+      break;
+
+    case NODE_TIME_IN:
+      if (group == NODE_AND)
+        {
+          size_t i = 0, j = 0;
+          TimeRange *ranges;
+
+          if (!(ranges = _sysprof_reallocarray (NULL, into->len + from->len, sizeof (TimeRange))))
+            return false;
+
+          while (i < into->len && j < from->len)
+            {
+              const TimeRange *x = &into->u.ranges[i];
+              const TimeRange *y = &from->u.ranges[j];
+              int64_t begin = x->begin > y->begin ? x->begin : y->begin;
+              int64_t end = x->end < y->end ? x->end : y->end;
+
+              if (begin <= end)
+                {
+                  ranges[len].begin = begin;
+                  ranges[len].end = end;
+                  len++;
+                }
+
+              if (x->end < y->end)
+                i++;
+              else
+                j++;
+            }
+
+          data = ranges;
+        }
+      else
+        {
+          TimeRange *ranges;
+
+          if (!(ranges = _sysprof_reallocarray (NULL, into->len + from->len, sizeof (TimeRange))))
+            return false;
+
+          memcpy (ranges, into->u.ranges, into->len * sizeof (TimeRange));
+          memcpy (&ranges[into->len], from->u.ranges, from->len * sizeof (TimeRange));
+          len = merge_time_ranges (ranges, into->len + from->len);
+
+          data = ranges;
+        }
+      break;
+
+    case NODE_FALSE:
+    case NODE_FILE:
+    case NODE_AND:
+    case NODE_OR:
+    default:
+      sysprof_assert_not_reached ();
+      return false;
+    }
+
+  /* Each kind of set is a single allocation at the same place in the
+   * union, so replacing it is the same for all of them.
+   */
+  if (data != into->u.pids)
+    {
+      node_data_clear (into->kind, &into->u);
+      into->u.pids = data;
+    }
+
+  into->len = len;
+
+  if (len == 0)
+    node_set_false (into);
+
+  return true;
+}
+
+static void
+node_free_range (Node   **nodes,
+                 size_t   begin,
+                 size_t   end)
+{
+  for (size_t i = begin; i < end; i++)
+    node_free (nodes[i]);
+}
+
+/* Takes ownership of @children and the nodes within it, even on failure. */
+static Node *
+node_new_group (NodeKind   kind,
+                Node     **children,
+                size_t     n_children)
+{
+  Node *merged[NODE_FILE + 1] = {0};
+  Node *node;
+  size_t n = 0;
+
+  assert (kind == NODE_AND || kind == NODE_OR);
+
+  for (size_t i = 0; i < n_children; i++)
+    {
+      Node *child = children[i];
+
+      if (child->kind == NODE_FALSE)
+        {
+          /* Nothing can match, so neither can the AND */
+          if (kind == NODE_AND)
+            {
+              node_free_range (children, 0, n);
+              node_free_range (children, i + 1, n_children);
+              free (children);
+              return child;
+            }
+
+          node_free (child);
+          continue;
+        }
+
+      if (node_can_merge (kind, child->kind))
+        {
+          Node *into = merged[child->kind];
+
+          if (into != NULL)
+            {
+              bool ret = node_merge (kind, into, child);
+
+              node_free (child);
+
+              if (!ret)
+                {
+                  node_free_range (children, 0, n);
+                  node_free_range (children, i + 1, n_children);
+                  free (children);
+                  return NULL;
+                }
+
+              /* Only intersecting can leave nothing to match */
+              if (into->kind == NODE_FALSE)
+                {
+                  assert (kind == NODE_AND);
+
+                  for (size_t j = 0; j < n; j++)
+                    {
+                      if (children[j] != into)
+                        node_free (children[j]);
+                    }
+                  node_free_range (children, i + 1, n_children);
+                  free (children);
+                  return into;
+                }
+
+              continue;
+            }
+
+          merged[child->kind] = child;
+        }
+
+      children[n++] = child;
+    }
+
+  n_children = n;
+
+  if (n_children == 0)
+    {
+      free (children);
+      return node_new (NODE_FALSE);
+    }
+
+  if (n_children == 1)
+    {
+      node = children[0];
+      free (children);
+      return node;
+    }
+
+  qsort (children,
+         n_children,
+         sizeof (Node *),
+         kind == NODE_AND ? compare_and_operands : compare_or_operands);
+
+  if (!(node = node_new (kind)))
+    {
+      node_free_range (children, 0, n_children);
+      free (children);
+      return NULL;
+    }
+
+  node->u.children = children;
+  node->len = n_children;
+
+  /* Such as a type mask which excludes counter frames along side a
+   * counter condition.
+   */
+  if (kind == NODE_AND && node_types (node) == 0)
+    {
+      node_free_range (children, 0, n_children);
+      free (children);
+
+      node->kind = NODE_FALSE;
+      node->len = 0;
+      memset (&node->u, 0, sizeof node->u);
+    }
+
+  return node;
+}
+
+static Node *node_new_from_condition (const SysprofCaptureCondition *condition);
+
+/* Collects the operands of nested @type conditions into @children */
+static bool
+gather_operands (const SysprofCaptureCondition   *condition,
+                 SysprofCaptureConditionType      type,
+                 Node                          ***children,
+                 size_t                          *n_children)
+{
+  Node **grown;
+  Node *child;
+
+  if (condition->type == type)
+    {
+      const SysprofCaptureCondition *left;
+      const SysprofCaptureCondition *right;
+
+      if (type == SYSPROF_CAPTURE_CONDITION_AND)
+        {
+          left = condition->u.and.left;
+          right = condition->u.and.right;
+        }
+      else
+        {
+          left = condition->u.or.left;
+          right = condition->u.or.right;
+        }
+
+      return gather_operands (left, type, children, n_children) &&
+             gather_operands (right, type, children, n_children);
+    }
+
+  if (!(child = node_new_from_condition (condition)))
+    return false;
+
+  if (!(grown = _sysprof_reallocarray (*children, *n_children + 1, sizeof (Node *))))
+    {
+      node_free (child);
+      return false;
+    }
+
+  *children = grown;
+  (*children)[(*n_children)++] = child;
+
+  return true;
+}
+
+static Node *
+node_new_group_from_conditions (SysprofCaptureConditionType      type,
+                                const SysprofCaptureCondition  **conditions,
+                                size_t                           n_conditions)
+{
+  Node **children = NULL;
+  size_t n_children = 0;
+
+  for (size_t i = 0; i < n_conditions; i++)
+    {
+      if (!gather_operands (conditions[i], type, &children, &n_children))
+        {
+          for (size_t j = 0; j < n_children; j++)
+            node_free (children[j]);
+          free (children);
+          return NULL;
+        }
+    }
+
+  return node_new_group (type == SYSPROF_CAPTURE_CONDITION_AND ? NODE_AND : NODE_OR,
+                         children,
+                         n_children);
+}
+
+static Node *
+node_new_from_condition (const SysprofCaptureCondition *condition)
+{
+  const SysprofCaptureCondition *operands[2];
+
+  switch (condition->type)
+    {
+    case SYSPROF_CAPTURE_CONDITION_AND:
+      operands[0] = condition->u.and.left;
+      operands[1] = condition->u.and.right;
+      return node_new_group_from_conditions (condition->type, operands, 2);
+
+    case SYSPROF_CAPTURE_CONDITION_OR:
+      operands[0] = condition->u.or.left;
+      operands[1] = condition->u.or.right;
+      return node_new_group_from_conditions (condition->type, operands, 2);
+
+    case SYSPROF_CAPTURE_CONDITION_WHERE_TYPE_IN:
+    case SYSPROF_CAPTURE_CONDITION_WHERE_TIME_BETWEEN:
+    case SYSPROF_CAPTURE_CONDITION_WHERE_PID_IN:
+    case SYSPROF_CAPTURE_CONDITION_WHERE_COUNTER_IN:
+    case SYSPROF_CAPTURE_CONDITION_WHERE_FILE:
+    default:
+      return node_new_leaf (condition);
+    }
+}
+
+/* Moves the leaves of @node into @program starting at @pos */
+static void
+program_emit (SysprofCaptureConditionProgram *program,
+              Node                           *node,
+              int32_t                         pos,
+              int32_t                         on_true,
+              int32_t                         on_false)
+{
+  Instruction *insn;
+
+  if (node->kind == NODE_AND || node->kind == NODE_OR)
+    {
+      for (size_t i = 0; i < node->len; i++)
+        {
+          Node *child = node->u.children[i];
+          int32_t next = pos + node_size (child);
+          bool last = i + 1 == node->len;
+
+          if (node->kind == NODE_AND)
+            program_emit (program, child, pos, last ? on_true : next, on_false);
+          else
+            program_emit (program, child, pos, on_true, last ? on_false : next);
+
+          pos = next;
+        }
+
+      return;
+    }
+
+  assert (pos >= 0 && (size_t)pos < program->n_instructions);
+
+  insn = &program->instructions[pos];
+  insn->kind = node->kind;
+  insn->on_true = on_true;
+  insn->on_false = on_false;
+  insn->len = node->len;
+  insn->u = node->u;
+
+  /* The instruction now owns the data */
+  memset (&node->u, 0, sizeof node->u);
+  node->kind = NODE_FALSE;
+}
+
+/*
+ * _sysprof_capture_condition_compile:
+ * @conditions: (array length=n_conditions): conditions of which any must match
+ * @n_conditions: number of @conditions
+ *
+ * Compiles @conditions into a program to be evaluated with
+ * _sysprof_capture_condition_program_match().
+ *
+ * Returns: (transfer full) (nullable): a new program, or %NULL on
+ *   allocation failure.
+ */
+SysprofCaptureConditionProgram *
+_sysprof_capture_condition_compile (SysprofCaptureCondition * const *conditions,
+                                    size_t                           n_conditions)
+{
+  SysprofCaptureConditionProgram *program;
+  Node *root;
+  size_t n_instructions;
+
+  assert (conditions != NULL || n_conditions == 0);
+
+  if (!(root = node_new_group_from_conditions (SYSPROF_CAPTURE_CONDITION_OR,
+                                               (const SysprofCaptureCondition **)conditions,
+                                               n_conditions)))
+    return NULL;
+
+  n_instructions = node_size (root);
+
+  if (n_instructions > INT32_MAX ||
+      !(program = sysprof_malloc0 (sizeof *program + n_instructions * sizeof (Instruction))))
+    {
+      node_free (root);
+      return NULL;
+    }
+
+  program->may_match_types = node_types (root);
+
+  if (program->may_match_types == 0 ||
+      !node_time_range (root, &program->may_match_time))
+    {
+      program->may_match_types = 0;
+      program->may_match_time.begin = INT64_MAX;
+      program->may_match_time.end = INT64_MIN;
+    }
+  program->n_instructions = n_instructions;
+
+  program_emit (program, root, 0, PROGRAM_ACCEPT, PROGRAM_REJECT);
+
+  node_free (root);
+
+  return program;
+}
+
+void
+_sysprof_capture_condition_program_free (SysprofCaptureConditionProgram *program)
+{
+  if (program == NULL)
+    return;
+
+  for (size_t i = 0; i < program->n_instructions; i++)
+    node_data_clear (program->instructions[i].kind, &program->instructions[i].u);
+
+  free (program);
+}
+
+/*
+ * _sysprof_capture_condition_program_may_match_type:
+ *
+ * Checks if frames of @type could ever be matched by @program so that
+ * callers may skip decoding those frames entirely.
+ */
+bool
+_sysprof_capture_condition_program_may_match_type (const SysprofCaptureConditionProgram *program,
+                                                   SysprofCaptureFrameType               type)
+{
+  assert (program != NULL);
+
+  return (unsigned int)type >= 64 || (program->may_match_types & TYPE_BIT (type)) != 0;
+}
+
+/*
+ * _sysprof_capture_condition_program_get_time_range:
+ *
+ * Gets the range of frame times which could possibly be matched by
+ * @program so that callers may avoid reading frames outside of it.
+ *
+ * Returns: %FALSE if no frame could ever be matched.
+ */
+bool
+_sysprof_capture_condition_program_get_time_range (const SysprofCaptureConditionProgram *program,
+                                                   int64_t                              *begin_time,
+                                                   int64_t                              *end_time)
+{
+  assert (program != NULL);
+  assert (begin_time != NULL);
+  assert (end_time != NULL);
+
+  *begin_time = program->may_match_time.begin;
+  *end_time = program->may_match_time.end;
+
+  return program->may_match_types != 0;
+}
+
+static inline bool
+pid_set_contains (const int32_t *pids,
+                  size_t         len,
+                  int32_t        pid)
+{
+  size_t lo = 0;
+  size_t hi = len;
+
+  while (lo < hi)
+    {
+      size_t mid = lo + (hi - lo) / 2;
+
+      if (pids[mid] < pid)
+        lo = mid + 1;
+      else if (pids[mid] > pid)
+        hi = mid;
+      else
+        return true;
+    }
+
+  return false;
+}
+
+static inline bool
+counter_set_contains (const unsigned int *counters,
+                      size_t              len,
+                      unsigned int        counter)
+{
+  size_t lo = 0;
+  size_t hi = len;
+
+  while (lo < hi)
+    {
+      size_t mid = lo + (hi - lo) / 2;
+
+      if (counters[mid] < counter)
+        lo = mid + 1;
+      else if (counters[mid] > counter)
+        hi = mid;
+      else
+        return true;
+    }
+
+  return false;
+}
+
+static inline bool
+time_ranges_contain (const TimeRange *ranges,
+                     size_t           len,
+                     int64_t          time)
+{
+  size_t lo = 0;
+  size_t hi = len;
+
+  /* Find the first range beginning after @time */
+  while (lo < hi)
+    {
+      size_t mid = lo + (hi - lo) / 2;
+
+      if (ranges[mid].begin <= time)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  return lo > 0 && time <= ranges[lo - 1].end;
+}
+
+static bool
+counters_match (const Instruction         *insn,
+                const SysprofCaptureFrame *frame)
+{
+  if (frame->type == SYSPROF_CAPTURE_FRAME_CTRSET)
+    {
+      const SysprofCaptureCounterSet *set = (const SysprofCaptureCounterSet *)frame;
+
+      for (unsigned int i = 0; i < set->n_values; i++)
+        {
+          for (unsigned int j = 0; j < SYSPROF_N_ELEMENTS (set->values[i].ids); j++)
+            {
+              if (counter_set_contains (insn->u.counters, insn->len, set->values[i].ids[j]))
+                return true;
+            }
+        }
+    }
+  else if (frame->type == SYSPROF_CAPTURE_FRAME_CTRDEF)
+    {
+      const SysprofCaptureCounterDefine *def = (const SysprofCaptureCounterDefine *)frame;
+
+      for (unsigned int i = 0; i < def->n_counters; i++)
+        {
+          if (counter_set_contains (insn->u.counters, insn->len, def->counters[i].id))
+            return true;
+        }
+    }
+
+  return false;
+}
+
+/*
+ * _sysprof_capture_condition_program_match:
+ *
+ * Like sysprof_capture_condition_match() for the conditions @program was
+ * compiled from, matching if any of them match.
+ */
+bool
+_sysprof_capture_condition_program_match (const SysprofCaptureConditionProgram *program,
+                                          const SysprofCaptureFrame            *frame)
+{
+  const Instruction *insns;
+  int32_t pc = 0;
+
+  assert (program != NULL);
+  assert (frame != NULL);
+
+  insns = program->instructions;
+
+  for (;;)
+    {
+      const Instruction *insn = &insns[pc];
+      bool ret;
+
+      switch (insn->kind)
+        {
+        case NODE_TYPE_IN:
+          ret = (insn->u.types & TYPE_BIT (frame->type)) != 0;
+          break;
+
+        case NODE_TIME_IN:
+          ret = time_ranges_contain (insn->u.ranges, insn->len, frame->time);
+          break;
+
+        case NODE_PID_IN:
+          ret = pid_set_contains (insn->u.pids, insn->len, frame->pid);
+          break;
+
+        case NODE_COUNTER_IN:
+          ret = counters_match (insn, frame);
+          break;
+
+        case NODE_FILE:
+          ret = frame->type == SYSPROF_CAPTURE_FRAME_FILE_CHUNK &&
+                strcmp (((const SysprofCaptureFileChunk *)frame)->path, insn->u.path) == 0;
+          break;
+
+        case NODE_FALSE:
+          ret = false;
+          break;
+
+        case NODE_AND:
+        case NODE_OR:
+        default:
+          sysprof_assert_not_reached ();
+          return false;
+        }
+
+      pc = ret ? insn->on_true : insn->on_false;
+
+      if (pc < 0)
+        return pc == PROGRAM_ACCEPT;
+    }
+}
@@ -57,11 +57,12 @@
 #include "config.h"
 
 #include <assert.h>
+#include <stdint.h>
 #include <stdlib.h>
 
-#include "sysprof-capture-condition.h"
+#include "sysprof-capture-condition-private.h"
 #include "sysprof-capture-cursor.h"
-#include "sysprof-capture-reader.h"
+#include "sysprof-capture-reader-private.h"
 #include "sysprof-capture-util-private.h"
 #include "sysprof-macros-internal.h"
 
@@ -74,6 +75,7 @@ struct _SysprofCaptureCursor
   volatile int          ref_count;
   SysprofCaptureCondition **conditions;  /* (nullable) (owned) */
   size_t                    n_conditions;
+  SysprofCaptureConditionProgram *program; /* (nullable) (owned) */
   SysprofCaptureReader *reader;
   unsigned int          reversed : 1;
 };
@@ -84,6 +86,7 @@ sysprof_capture_cursor_finalize (SysprofCaptureCursor *self)
   for (size_t i = 0; i < self->n_conditions; i++)
     sysprof_capture_condition_unref (self->conditions[i]);
   sysprof_clear_pointer (&self->conditions, free);
+  sysprof_clear_pointer (&self->program, _sysprof_capture_condition_program_free);
   sysprof_clear_pointer (&self->reader, sysprof_capture_reader_unref);
   free (self);
 }
@@ -138,32 +141,32 @@ sysprof_capture_cursor_unref (SysprofCaptureCursor *self)
     sysprof_capture_cursor_finalize (self);
 }
 
-/**
- * sysprof_capture_cursor_foreach:
- * @self: a #SysprofCaptureCursor
- * @callback: (scope call): a closure to execute
- * @user_data: user data for @callback
- *
+/* Returns false once @callback asks to stop or no more frames can be
+ * read, otherwise stops at the first frame starting at or after @end.
  */
-void
-sysprof_capture_cursor_foreach (SysprofCaptureCursor         *self,
-                                SysprofCaptureCursorCallback  callback,
-                                void                         *user_data)
+static bool
+sysprof_capture_cursor_foreach_until (SysprofCaptureCursor         *self,
+                                      SysprofCaptureCursorCallback  callback,
+                                      void                         *user_data,
+                                      uint64_t                      end)
 {
-  assert (self != NULL);
-  assert (callback != NULL);
-
-  if (self->reader == NULL)
-    return;
-
-  for (;;)
+  while (_sysprof_capture_reader_tell (self->reader) < end)
     {
       const SysprofCaptureFrame *frame;
       SysprofCaptureFrameType type = 0;
       ReadDelegate delegate = NULL;
 
       if (!sysprof_capture_reader_peek_type (self->reader, &type))
-        return;
+        return false;
+
+      /* Don't decode frames which could never match */
+      if (self->program != NULL &&
+          !_sysprof_capture_condition_program_may_match_type (self->program, type))
+        {
+          if (!sysprof_capture_reader_skip (self->reader))
+            return false;
+          continue;
+        }
 
       switch (type)
         {
@@ -235,9 +238,11 @@ sysprof_capture_cursor_foreach (SysprofCaptureCursor         *self,
           delegate = READ_DELEGATE (sysprof_capture_reader_read_overlay);
           break;
 
+        /* Skipping a stack records it for the frames referencing it */
+        case SYSPROF_CAPTURE_FRAME_STACK:
         default:
           if (!sysprof_capture_reader_skip (self->reader))
-            return;
+            return false;
           delegate = NULL;
           break;
         }
@@ -246,12 +251,18 @@ sysprof_capture_cursor_foreach (SysprofCaptureCursor         *self,
         continue;
 
       if (NULL == (frame = delegate (self->reader)))
-        return;
+        return false;
 
       if (self->n_conditions == 0)
         {
           if (!callback (frame, user_data))
-            return;
+            return false;
+        }
+      else if (self->program != NULL)
+        {
+          if (_sysprof_capture_condition_program_match (self->program, frame) &&
+              !callback (frame, user_data))
+            return false;
         }
       else
         {
@@ -262,12 +273,73 @@ sysprof_capture_cursor_foreach (SysprofCaptureCursor         *self,
               if (sysprof_capture_condition_match (condition, frame))
                 {
                   if (!callback (frame, user_data))
-                    return;
+                    return false;
                   break;
                 }
             }
         }
     }
+
+  return true;
+}
+
+/**
+ * sysprof_capture_cursor_foreach:
+ * @self: a #SysprofCaptureCursor
+ * @callback: (scope call): a closure to execute
+ * @user_data: user data for @callback
+ *
+ */
+void
+sysprof_capture_cursor_foreach (SysprofCaptureCursor         *self,
+                                SysprofCaptureCursorCallback  callback,
+                                void                         *user_data)
+{
+  assert (self != NULL);
+  assert (callback != NULL);
+
+  if (self->reader == NULL)
+    return;
+
+  /* Conditions are compiled once rather than walked for every frame. If
+   * that fails, fall back to matching each condition directly.
+   */
+  if (self->n_conditions > 0 && self->program == NULL)
+    self->program = _sysprof_capture_condition_compile (self->conditions, self->n_conditions);
+
+  /* When the conditions only match a window of time, use the frame index
+   * to read just the chunks which overlap it.
+   */
+  if (self->program != NULL &&
+      _sysprof_capture_reader_tell (self->reader) == sizeof (SysprofCaptureFileHeader))
+    {
+      SysprofCaptureReaderSpan spans[2];
+      size_t n_spans;
+      int64_t begin_time;
+      int64_t end_time;
+
+      if (!_sysprof_capture_condition_program_get_time_range (self->program, &begin_time, &end_time))
+        {
+          _sysprof_capture_reader_seek (self->reader, UINT64_MAX);
+          return;
+        }
+
+      if ((begin_time != INT64_MIN || end_time != INT64_MAX) &&
+          _sysprof_capture_reader_find_time_range (self->reader, begin_time, end_time, spans, &n_spans))
+        {
+          for (size_t i = 0; i < n_spans; i++)
+            {
+              _sysprof_capture_reader_seek (self->reader, spans[i].begin);
+
+              if (!sysprof_capture_cursor_foreach_until (self, callback, user_data, spans[i].end))
+                return;
+            }
+
+          return;
+        }
+    }
+
+  sysprof_capture_cursor_foreach_until (self, callback, user_data, UINT64_MAX);
 }
 
 void
@@ -313,6 +385,8 @@ sysprof_capture_cursor_add_condition (SysprofCaptureCursor    *self,
   assert (self->conditions != NULL);
 
   self->conditions[self->n_conditions - 1] = sysprof_steal_pointer (&condition);
+
+  sysprof_clear_pointer (&self->program, _sysprof_capture_condition_program_free);
 }
 
 /**
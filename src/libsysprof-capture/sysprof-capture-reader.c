@@ -60,17 +60,42 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
-#include "sysprof-capture-reader.h"
+#include "sysprof-capture-compress-private.h"
+#include "sysprof-capture-reader-private.h"
 #include "sysprof-capture-util-private.h"
 #include "sysprof-capture-writer.h"
 #include "sysprof-macros-internal.h"
 
+typedef struct
+{
+  /* Position of the addresses within stack_addrs */
+  size_t   offset;
+
+  /* Number of addresses, or 0 if the stack has not been seen */
+  uint32_t n_addrs;
+} SysprofCaptureReaderStack;
+
+typedef struct
+{
+  /* Offset of the first frame and just past the closing frame index */
+  uint64_t begin;
+  uint64_t end;
+
+  /* Least begin_time of this and every later chunk */
+  int64_t  min_begin_time;
+
+  /* Greatest end_time of this and every earlier chunk */
+  int64_t  max_end_time;
+} SysprofCaptureReaderChunk;
+
 struct _SysprofCaptureReader
 {
   volatile int              ref_count;
@@ -88,6 +113,32 @@ struct _SysprofCaptureReader
   unsigned int              st_buf_set : 1;
   char                    **list_files;
   size_t                    n_list_files;
+
+  /* When @map is set, @buf points just past the file header within the
+   * mapping and @len covers the rest of the file. Frames are then returned
+   * straight from the mapping rather than copied in with pread().
+   */
+  uint8_t                  *map;
+  size_t                    map_len;
+
+  /* Stacks seen so far indexed by id so that samples and allocations
+   * referencing them can be expanded. Expanded frames are built in
+   * @stack_frame which is only valid until the next read.
+   */
+  SysprofCaptureReaderStack *stacks;
+  size_t                     n_stacks;
+  SysprofCaptureAddress     *stack_addrs;
+  size_t                     stack_addrs_len;
+  size_t                     stack_addrs_pos;
+  uint8_t                   *stack_frame;
+  size_t                     stack_frame_len;
+
+  /* Chunks closed by a frame index, in file order. Loaded on first use
+   * and left empty if the capture has no usable index.
+   */
+  SysprofCaptureReaderChunk *chunks;
+  size_t                     n_chunks;
+  unsigned int               chunks_loaded : 1;
 };
 
 /* Sets @errno on failure. Sets @errno to EBADMSG if the file magic doesn’t
@@ -126,7 +177,14 @@ sysprof_capture_reader_finalize (SysprofCaptureReader *self)
       free (self->list_files);
 
       close (self->fd);
-      free (self->buf);
+      free (self->stacks);
+      free (self->stack_addrs);
+      free (self->stack_frame);
+      free (self->chunks);
+      if (self->map != NULL)
+        munmap (self->map, self->map_len);
+      else
+        free (self->buf);
       free (self->filename);
       free (self);
     }
@@ -197,6 +255,56 @@ sysprof_capture_reader_discover_end_time (SysprofCaptureReader *self)
   sysprof_capture_reader_reset (self);
 }
 
+/* Maps the capture (again, if it has grown since it was last mapped) so
+ * that frames may be read in place. The mapping is private and writable
+ * because readers fix up frames in place, such as NUL terminating strings.
+ * Only used for captures in host byte-order so those fixups never have to
+ * touch the pages in practice.
+ */
+static bool
+sysprof_capture_reader_map (SysprofCaptureReader *self)
+{
+  struct stat stbuf;
+  uint8_t *map;
+  size_t map_len;
+
+  assert (self != NULL);
+  assert (self->endian == __BYTE_ORDER);
+
+  if (fstat (self->fd, &stbuf) != 0 || !S_ISREG (stbuf.st_mode))
+    return false;
+
+  if (stbuf.st_size < (off_t)sizeof (SysprofCaptureFileHeader) ||
+      (uint64_t)stbuf.st_size > SIZE_MAX)
+    return false;
+
+  map_len = stbuf.st_size;
+
+  if (map_len <= self->map_len)
+    return false;
+
+  map = mmap (NULL, map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE, self->fd, 0);
+  if (map == MAP_FAILED)
+    return false;
+
+  madvise (map, map_len, MADV_SEQUENTIAL);
+
+  if (self->map != NULL)
+    munmap (self->map, self->map_len);
+  else
+    free (self->buf);
+
+  /* @pos is relative to the end of the header so it stays valid */
+  self->map = map;
+  self->map_len = map_len;
+  self->buf = &map[sizeof (SysprofCaptureFileHeader)];
+  self->len = map_len - sizeof (SysprofCaptureFileHeader);
+  self->bufsz = self->len;
+  self->fd_off = map_len;
+
+  return true;
+}
+
 /**
  * sysprof_capture_reader_new_from_fd:
  * @fd: an fd to take ownership from
@@ -211,6 +319,21 @@ sysprof_capture_reader_discover_end_time (SysprofCaptureReader *self)
  */
 SysprofCaptureReader *
 sysprof_capture_reader_new_from_fd (int fd)
+{
+  return _sysprof_capture_reader_new_from_fd_full (fd, true);
+}
+
+/*
+ * _sysprof_capture_reader_new_from_fd_full:
+ * @fd: an fd to take ownership from
+ * @use_mmap: if the capture may be mapped rather than read with pread()
+ *
+ * Like sysprof_capture_reader_new_from_fd() but allows disabling the
+ * mapped reader so both paths can be exercised by tests.
+ */
+SysprofCaptureReader *
+_sysprof_capture_reader_new_from_fd_full (int  fd,
+                                          bool use_mmap)
 {
   SysprofCaptureReader *self;
 
@@ -224,15 +347,6 @@ sysprof_capture_reader_new_from_fd (int fd)
     }
 
   self->ref_count = 1;
-  self->bufsz = USHRT_MAX * 2;
-  self->buf = sysprof_malloc0 (self->bufsz);
-  if (self->buf == NULL)
-    {
-      free (self);
-      errno = ENOMEM;
-      return NULL;
-    }
-
   self->len = 0;
   self->pos = 0;
   self->fd = fd;
@@ -246,11 +360,55 @@ sysprof_capture_reader_new_from_fd (int fd)
       return NULL;
     }
 
+  /* Compressed captures are read from a decompressed copy so that the
+   * positioned reads below continue to work.
+   */
+  if (self->header.compressed)
+    {
+      int decompressed_fd;
+
+      if (-1 == (decompressed_fd = _sysprof_capture_decompress_fd (fd)))
+        {
+          int errsv = errno;
+          sysprof_capture_reader_finalize (self);
+          errno = errsv;
+          return NULL;
+        }
+
+      close (fd);
+      self->fd = decompressed_fd;
+
+      if (!sysprof_capture_reader_read_file_header (self, &self->header))
+        {
+          int errsv = errno;
+          sysprof_capture_reader_finalize (self);
+          errno = errsv;
+          return NULL;
+        }
+    }
+
   if (self->header.little_endian)
     self->endian = __LITTLE_ENDIAN;
   else
     self->endian = __BIG_ENDIAN;
 
+  /* Byte-swapped captures are fixed up as they are read, so those always
+   * go through the copying path.
+   */
+  if (!use_mmap ||
+      self->endian != __BYTE_ORDER ||
+      !sysprof_capture_reader_map (self))
+    {
+      self->bufsz = USHRT_MAX * 2;
+      self->buf = sysprof_malloc0 (self->bufsz);
+      if (self->buf == NULL)
+        {
+          sysprof_capture_reader_finalize (self);
+          errno = ENOMEM;
+          return NULL;
+        }
+    }
+
   /* If we detect a capture file that did not get an end time, or an erroneous
    * end time, then we need to take a performance hit here and scan the file
    * and discover the end time with frame timings.
@@ -390,6 +548,15 @@ sysprof_capture_reader_ensure_space_for (SysprofCaptureReader *self,
   /* Ensure alignment of length to read */
   len = (len + SYSPROF_CAPTURE_ALIGN - 1) & ~(SYSPROF_CAPTURE_ALIGN - 1);
 
+  if (self->map != NULL)
+    {
+      /* The file may have grown since it was mapped */
+      if ((self->len - self->pos) < len)
+        sysprof_capture_reader_map (self);
+
+      return (self->len - self->pos) >= len;
+    }
+
   if ((self->len - self->pos) < len)
     {
       ssize_t r;
@@ -421,6 +588,157 @@ sysprof_capture_reader_ensure_space_for (SysprofCaptureReader *self,
   return (self->len - self->pos) >= len;
 }
 
+/* A writer of the other byte order allocates bit-fields from the other
+ * end of the word, so flags sharing a word with n_addrs are not where
+ * swapping n_addrs alone would leave them.
+ */
+static inline bool
+sysprof_capture_reader_swapped_flag (const void   *flags,
+                                     unsigned int  bit)
+{
+  uint32_t word;
+
+  memcpy (&word, flags, sizeof word);
+  word = bswap_32 (word);
+
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+  return (word >> (31 - bit)) & 1;
+#else
+  return (word >> bit) & 1;
+#endif
+}
+
+/* @stack must already have its frame header swapped */
+static void
+sysprof_capture_reader_remember_stack (SysprofCaptureReader *self,
+                                       SysprofCaptureStack  *stack)
+{
+  SysprofCaptureReaderStack *info;
+
+  assert (self != NULL);
+  assert (stack != NULL);
+
+  if (SYSPROF_UNLIKELY (self->endian != __BYTE_ORDER))
+    {
+      stack->id = bswap_32 (stack->id);
+      stack->n_addrs = bswap_16 (stack->n_addrs);
+    }
+
+  if (stack->frame.len < sizeof *stack + (sizeof (SysprofCaptureAddress) * stack->n_addrs))
+    return;
+
+  if (SYSPROF_UNLIKELY (self->endian != __BYTE_ORDER))
+    {
+      for (unsigned int i = 0; i < stack->n_addrs; i++)
+        stack->addrs[i] = bswap_64 (stack->addrs[i]);
+    }
+
+  /* Writers allocate ids sequentially, so anything far beyond what we
+   * have seen is corrupt and not worth growing the table for.
+   */
+  if (stack->id == 0 ||
+      stack->n_addrs == 0 ||
+      stack->id > (self->n_stacks * 2) + 4096)
+    return;
+
+  if (stack->id >= self->n_stacks)
+    {
+      size_t n_stacks = stack->id + 1 + (self->n_stacks / 2);
+      SysprofCaptureReaderStack *stacks;
+
+      if (!(stacks = _sysprof_reallocarray (self->stacks, n_stacks, sizeof *stacks)))
+        return;
+
+      memset (&stacks[self->n_stacks], 0, (n_stacks - self->n_stacks) * sizeof *stacks);
+
+      self->stacks = stacks;
+      self->n_stacks = n_stacks;
+    }
+
+  info = &self->stacks[stack->id];
+
+  if (info->n_addrs != 0)
+    return;
+
+  if (self->stack_addrs_pos + stack->n_addrs > self->stack_addrs_len)
+    {
+      size_t new_len = self->stack_addrs_len ? self->stack_addrs_len * 2 : 4096;
+      SysprofCaptureAddress *stack_addrs;
+
+      while (new_len < self->stack_addrs_pos + stack->n_addrs)
+        new_len *= 2;
+
+      if (!(stack_addrs = _sysprof_reallocarray (self->stack_addrs, new_len, sizeof *stack_addrs)))
+        return;
+
+      self->stack_addrs = stack_addrs;
+      self->stack_addrs_len = new_len;
+    }
+
+  memcpy (&self->stack_addrs[self->stack_addrs_pos],
+          stack->addrs,
+          stack->n_addrs * sizeof (SysprofCaptureAddress));
+
+  info->offset = self->stack_addrs_pos;
+  info->n_addrs = stack->n_addrs;
+
+  self->stack_addrs_pos += stack->n_addrs;
+}
+
+/* Copies the first @header_len bytes of @frame followed by the addresses
+ * of stack @stack_id into a scratch frame. Returns %NULL if the stack is
+ * unknown.
+ */
+static void *
+sysprof_capture_reader_expand_stack (SysprofCaptureReader      *self,
+                                     const SysprofCaptureFrame *frame,
+                                     size_t                     header_len,
+                                     uint64_t                   stack_id,
+                                     unsigned int              *n_addrs)
+{
+  const SysprofCaptureReaderStack *info;
+  SysprofCaptureFrame *expanded;
+  size_t len;
+
+  assert (self != NULL);
+  assert (frame != NULL);
+  assert (n_addrs != NULL);
+
+  if (stack_id == 0 ||
+      stack_id >= self->n_stacks ||
+      self->stacks[stack_id].n_addrs == 0)
+    return NULL;
+
+  info = &self->stacks[stack_id];
+  len = header_len + (info->n_addrs * sizeof (SysprofCaptureAddress));
+
+  if (len > UINT16_MAX)
+    return NULL;
+
+  if (len > self->stack_frame_len)
+    {
+      uint8_t *stack_frame;
+
+      if (!(stack_frame = realloc (self->stack_frame, len)))
+        return NULL;
+
+      self->stack_frame = stack_frame;
+      self->stack_frame_len = len;
+    }
+
+  memcpy (self->stack_frame, frame, header_len);
+  memcpy (self->stack_frame + header_len,
+          &self->stack_addrs[info->offset],
+          info->n_addrs * sizeof (SysprofCaptureAddress));
+
+  expanded = (SysprofCaptureFrame *)(void *)self->stack_frame;
+  expanded->len = len;
+
+  *n_addrs = info->n_addrs;
+
+  return self->stack_frame;
+}
+
 bool
 sysprof_capture_reader_skip (SysprofCaptureReader *self)
 {
@@ -443,6 +761,11 @@ sysprof_capture_reader_skip (SysprofCaptureReader *self)
 
   frame = (SysprofCaptureFrame *)(void *)&self->buf[self->pos];
 
+  /* Stacks must be tracked even when skipped */
+  if (frame->type == SYSPROF_CAPTURE_FRAME_STACK &&
+      frame->len >= sizeof (SysprofCaptureStack))
+    sysprof_capture_reader_remember_stack (self, (SysprofCaptureStack *)(void *)frame);
+
   self->pos += frame->len;
 
   if ((self->pos % SYSPROF_CAPTURE_ALIGN) != 0)
@@ -837,6 +1160,46 @@ sysprof_capture_reader_read_dbus_message (SysprofCaptureReader *self)
   return dbus_message;
 }
 
+const SysprofCaptureStack *
+sysprof_capture_reader_read_stack (SysprofCaptureReader *self)
+{
+  SysprofCaptureStack *stack;
+
+  assert (self != NULL);
+  assert ((self->pos % SYSPROF_CAPTURE_ALIGN) == 0);
+  assert (self->pos <= self->bufsz);
+
+  if (!sysprof_capture_reader_ensure_space_for (self, sizeof *stack))
+    return NULL;
+
+  stack = (SysprofCaptureStack *)(void *)&self->buf[self->pos];
+
+  sysprof_capture_reader_bswap_frame (self, &stack->frame);
+
+  if (stack->frame.type != SYSPROF_CAPTURE_FRAME_STACK)
+    return NULL;
+
+  if (stack->frame.len < sizeof *stack)
+    return NULL;
+
+  if (!sysprof_capture_reader_ensure_space_for (self, stack->frame.len))
+    return NULL;
+
+  stack = (SysprofCaptureStack *)(void *)&self->buf[self->pos];
+
+  sysprof_capture_reader_remember_stack (self, stack);
+
+  if (stack->frame.len < (sizeof *stack + (sizeof (SysprofCaptureAddress) * stack->n_addrs)))
+    return NULL;
+
+  self->pos += stack->frame.len;
+
+  if ((self->pos % SYSPROF_CAPTURE_ALIGN) != 0)
+    return NULL;
+
+  return stack;
+}
+
 const SysprofCaptureProcess *
 sysprof_capture_reader_read_process (SysprofCaptureReader *self)
 {
@@ -957,7 +1320,13 @@ sysprof_capture_reader_read_sample (SysprofCaptureReader *self)
     return NULL;
 
   if (self->endian != __BYTE_ORDER)
-    sample->n_addrs = bswap_16 (sample->n_addrs);
+    {
+      bool stack = sysprof_capture_reader_swapped_flag ((uint8_t *)sample + sizeof sample->frame, 16);
+
+      sample->n_addrs = bswap_16 (sample->n_addrs);
+      sample->stack = stack;
+      sample->padding1 = 0;
+    }
 
   if (sample->frame.len < (sizeof *sample + (sizeof(SysprofCaptureAddress) * sample->n_addrs)))
     return NULL;
@@ -977,6 +1346,25 @@ sysprof_capture_reader_read_sample (SysprofCaptureReader *self)
 
   self->pos += sample->frame.len;
 
+  if (sample->stack &&
+      sample->n_addrs == 0 &&
+      sample->frame.len >= sizeof *sample + sizeof (SysprofCaptureAddress))
+    {
+      SysprofCaptureSample *expanded;
+      uint64_t stack_id = sample->addrs[0];
+      unsigned int n_addrs;
+
+      if (SYSPROF_UNLIKELY (self->endian != __BYTE_ORDER))
+        stack_id = bswap_64 (stack_id);
+
+      if ((expanded = sysprof_capture_reader_expand_stack (self, &sample->frame, sizeof *sample, stack_id, &n_addrs)))
+        {
+          expanded->n_addrs = n_addrs;
+          expanded->stack = 0;
+          return expanded;
+        }
+    }
+
   return sample;
 }
 
@@ -1130,9 +1518,263 @@ sysprof_capture_reader_reset (SysprofCaptureReader *self)
 {
   assert (self != NULL);
 
-  self->fd_off = sizeof (SysprofCaptureFileHeader);
   self->pos = 0;
-  self->len = 0;
+
+  if (self->map == NULL)
+    {
+      self->fd_off = sizeof (SysprofCaptureFileHeader);
+      self->len = 0;
+    }
+
+  return true;
+}
+
+/*
+ * _sysprof_capture_reader_tell:
+ *
+ * Gets the file offset of the next frame to be read.
+ */
+uint64_t
+_sysprof_capture_reader_tell (SysprofCaptureReader *self)
+{
+  assert (self != NULL);
+
+  if (self->map != NULL)
+    return sizeof (SysprofCaptureFileHeader) + self->pos;
+
+  return self->fd_off - (self->len - self->pos);
+}
+
+/*
+ * _sysprof_capture_reader_seek:
+ *
+ * Moves the reader to the frame at @offset, which must have come from
+ * _sysprof_capture_reader_tell() or a frame index. Offsets past the end
+ * of the capture leave the reader at the end.
+ */
+void
+_sysprof_capture_reader_seek (SysprofCaptureReader *self,
+                              uint64_t              offset)
+{
+  assert (self != NULL);
+
+  if (offset < sizeof (SysprofCaptureFileHeader))
+    offset = sizeof (SysprofCaptureFileHeader);
+
+  offset -= sizeof (SysprofCaptureFileHeader);
+
+  if (self->map != NULL)
+    {
+      if (offset > self->len)
+        sysprof_capture_reader_map (self);
+
+      if (offset > self->len)
+        offset = self->len & ~(SYSPROF_CAPTURE_ALIGN - 1);
+
+      self->pos = offset;
+    }
+  else
+    {
+      if (offset > INT64_MAX - sizeof (SysprofCaptureFileHeader))
+        offset = INT64_MAX - sizeof (SysprofCaptureFileHeader);
+
+      self->fd_off = sizeof (SysprofCaptureFileHeader) + offset;
+      self->len = 0;
+      self->pos = 0;
+    }
+}
+
+/* Walks the frame index chain backwards from the file header. Indexes
+ * written before they carried time bounds are treated as no index at all.
+ */
+static bool
+sysprof_capture_reader_load_chunks (SysprofCaptureReader *self)
+{
+  SysprofCaptureReaderChunk *chunks = NULL;
+  size_t n_chunks = 0;
+  size_t n_alloc = 0;
+  uint64_t offset;
+
+  assert (self != NULL);
+
+  if (self->chunks_loaded)
+    return self->n_chunks > 0;
+
+  self->chunks_loaded = true;
+
+  /* The header is re-read in case the capture is still being written */
+  if (sizeof offset != _sysprof_pread (self->fd,
+                                       &offset,
+                                       sizeof offset,
+                                       offsetof (SysprofCaptureFileHeader, frame_index.last_frame_index)))
+    return false;
+
+  if (self->endian != __BYTE_ORDER)
+    offset = bswap_64 (offset);
+
+  while (offset != 0)
+    {
+      SysprofCaptureFrameIndex frame_index;
+
+      /* Each index must come before the one which refers to it */
+      if (offset < sizeof (SysprofCaptureFileHeader) ||
+          (offset % SYSPROF_CAPTURE_ALIGN) != 0 ||
+          (n_chunks > 0 && offset >= chunks[n_chunks - 1].begin))
+        goto failure;
+
+      if (sizeof frame_index != _sysprof_pread (self->fd, &frame_index, sizeof frame_index, offset))
+        goto failure;
+
+      sysprof_capture_reader_bswap_frame (self, &frame_index.frame);
+
+      if (self->endian != __BYTE_ORDER)
+        {
+          frame_index.frame.padding2 = bswap_32 (frame_index.frame.padding2);
+          frame_index.previous_frame_index = bswap_64 (frame_index.previous_frame_index);
+          frame_index.begin_time = bswap_64 (frame_index.begin_time);
+          frame_index.end_time = bswap_64 (frame_index.end_time);
+        }
+
+      if (frame_index.frame.type != SYSPROF_CAPTURE_FRAME_TIMESTAMP ||
+          frame_index.frame.padding2 != SYSPROF_CAPTURE_FRAME_INDEX_MAGIC ||
+          frame_index.frame.len != sizeof frame_index)
+        goto failure;
+
+      if (n_chunks == n_alloc)
+        {
+          size_t new_alloc = n_alloc ? n_alloc * 2 : 64;
+          SysprofCaptureReaderChunk *new_chunks;
+
+          if (!(new_chunks = _sysprof_reallocarray (chunks, new_alloc, sizeof *chunks)))
+            goto failure;
+
+          chunks = new_chunks;
+          n_alloc = new_alloc;
+        }
+
+      /* @begin holds the offset of the index until the chain is walked */
+      chunks[n_chunks].begin = offset;
+      chunks[n_chunks].end = offset + frame_index.frame.len;
+      chunks[n_chunks].min_begin_time = frame_index.begin_time;
+      chunks[n_chunks].max_end_time = frame_index.end_time;
+      n_chunks++;
+
+      offset = frame_index.previous_frame_index;
+    }
+
+  if (n_chunks == 0)
+    goto failure;
+
+  for (size_t i = 0; i < n_chunks / 2; i++)
+    {
+      SysprofCaptureReaderChunk tmp = chunks[i];
+      chunks[i] = chunks[n_chunks - 1 - i];
+      chunks[n_chunks - 1 - i] = tmp;
+    }
+
+  for (size_t i = 0; i < n_chunks; i++)
+    {
+      chunks[i].begin = i > 0 ? chunks[i - 1].end : sizeof (SysprofCaptureFileHeader);
+
+      if (i > 0 && chunks[i - 1].max_end_time > chunks[i].max_end_time)
+        chunks[i].max_end_time = chunks[i - 1].max_end_time;
+    }
+
+  for (size_t i = n_chunks - 1; i > 0; i--)
+    {
+      if (chunks[i].min_begin_time < chunks[i - 1].min_begin_time)
+        chunks[i - 1].min_begin_time = chunks[i].min_begin_time;
+    }
+
+  self->chunks = chunks;
+  self->n_chunks = n_chunks;
+
+  return true;
+
+failure:
+  free (chunks);
+
+  return false;
+}
+
+/*
+ * _sysprof_capture_reader_find_time_range:
+ * @spans: (out caller-allocates): location for the spans
+ * @n_spans: (out): location for the number of spans
+ *
+ * Uses the frame index to find the spans of the capture which may contain
+ * frames between @begin_time and @end_time. Every span starts on a chunk
+ * boundary so stacks referenced within it are always read first. The last
+ * span may extend past the end of the file.
+ *
+ * Returns: %FALSE if the capture has no usable frame index.
+ */
+bool
+_sysprof_capture_reader_find_time_range (SysprofCaptureReader     *self,
+                                         int64_t                   begin_time,
+                                         int64_t                   end_time,
+                                         SysprofCaptureReaderSpan  spans[2],
+                                         size_t                   *n_spans)
+{
+  size_t first;
+  size_t last;
+  size_t lo;
+  size_t hi;
+
+  assert (self != NULL);
+  assert (spans != NULL);
+  assert (n_spans != NULL);
+
+  *n_spans = 0;
+
+  if (!sysprof_capture_reader_load_chunks (self))
+    return false;
+
+  /* Chunks before @first only contain frames before @begin_time */
+  lo = 0;
+  hi = self->n_chunks;
+  while (lo < hi)
+    {
+      size_t mid = lo + (hi - lo) / 2;
+
+      if (self->chunks[mid].max_end_time < begin_time)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  first = lo;
+
+  /* Chunks from @last onwards only contain frames after @end_time */
+  hi = self->n_chunks;
+  while (lo < hi)
+    {
+      size_t mid = lo + (hi - lo) / 2;
+
+      if (self->chunks[mid].min_begin_time <= end_time)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  last = lo;
+
+  if (first < last)
+    {
+      spans[*n_spans].begin = self->chunks[first].begin;
+      spans[*n_spans].end = self->chunks[last - 1].end;
+      (*n_spans)++;
+    }
+
+  /* Nothing is known about frames after the last index */
+  if (*n_spans > 0 && last == self->n_chunks)
+    {
+      spans[*n_spans - 1].end = UINT64_MAX;
+    }
+  else
+    {
+      spans[*n_spans].begin = self->chunks[self->n_chunks - 1].end;
+      spans[*n_spans].end = UINT64_MAX;
+      (*n_spans)++;
+    }
 
   return true;
 }
@@ -1306,9 +1948,9 @@ sysprof_capture_reader_get_end_time (SysprofCaptureReader *self)
  * sysprof_capture_reader_copy:
  *
  * This function makes a copy of the reader. Since readers use
- * positioned reads with pread(), this allows you to have multiple
- * readers with the shared file descriptor. This uses dup() to create
- * another file descriptor.
+ * positioned reads with pread() or their own private mapping, this
+ * allows you to have multiple readers with the shared file descriptor.
+ * This uses dup() to create another file descriptor.
  *
  * Returns: (transfer full): A copy of @self with a new file-descriptor.
  */
@@ -1339,16 +1981,67 @@ sysprof_capture_reader_copy (SysprofCaptureReader *self)
   copy->st_buf = self->st_buf;
   copy->st_buf_set = self->st_buf_set;
 
-  copy->buf = malloc (self->bufsz);
-  if (copy->buf == NULL)
+  if (self->map != NULL)
     {
-      close (fd);
-      free (copy->filename);
-      free (copy);
-      return NULL;
+      /* Give the copy its own mapping so either may be unref'd first */
+      copy->map = NULL;
+      copy->map_len = 0;
+      copy->buf = NULL;
+
+      if (!sysprof_capture_reader_map (copy))
+        {
+          close (fd);
+          free (copy->filename);
+          free (copy);
+          return NULL;
+        }
+
+      copy->pos = self->pos;
+    }
+  else
+    {
+      copy->buf = malloc (self->bufsz);
+      if (copy->buf == NULL)
+        {
+          close (fd);
+          free (copy->filename);
+          free (copy);
+          return NULL;
+        }
+
+      memcpy (copy->buf, self->buf, self->bufsz);
+    }
+
+  copy->stacks = NULL;
+  copy->n_stacks = 0;
+  copy->stack_addrs = NULL;
+  copy->stack_addrs_len = 0;
+  copy->stack_addrs_pos = 0;
+  copy->stack_frame = NULL;
+  copy->stack_frame_len = 0;
+  copy->chunks = NULL;
+  copy->n_chunks = 0;
+  copy->chunks_loaded = false;
+
+  if (self->n_stacks > 0 &&
+      (copy->stacks = _sysprof_reallocarray (NULL, self->n_stacks, sizeof *copy->stacks)))
+    {
+      memcpy (copy->stacks, self->stacks, self->n_stacks * sizeof *copy->stacks);
+      copy->n_stacks = self->n_stacks;
     }
 
-  memcpy (copy->buf, self->buf, self->bufsz);
+  if (self->stack_addrs_pos > 0 &&
+      (copy->stack_addrs = _sysprof_reallocarray (NULL, self->stack_addrs_pos, sizeof *copy->stack_addrs)))
+    {
+      memcpy (copy->stack_addrs, self->stack_addrs, self->stack_addrs_pos * sizeof *copy->stack_addrs);
+      copy->stack_addrs_len = self->stack_addrs_pos;
+      copy->stack_addrs_pos = self->stack_addrs_pos;
+    }
+  else
+    {
+      /* Without the addresses the stacks cannot be expanded */
+      copy->n_stacks = 0;
+    }
 
   return copy;
 }
@@ -1665,10 +2358,20 @@ sysprof_capture_reader_read_allocation (SysprofCaptureReader *self)
 
   if (self->endian != __BYTE_ORDER)
     {
+      const uint8_t *flags = (uint8_t *)&ma->tid + sizeof ma->tid;
+      bool stack = sysprof_capture_reader_swapped_flag (flags, 16);
+      bool sampled = sysprof_capture_reader_swapped_flag (flags, 17);
+
       ma->n_addrs = bswap_16 (ma->n_addrs);
+      ma->stack = stack;
+      ma->sampled = sampled;
+      ma->padding1 = 0;
       ma->alloc_size = bswap_64 (ma->alloc_size);
       ma->alloc_addr = bswap_64 (ma->alloc_addr);
       ma->tid = bswap_32 (ma->tid);
+
+      if (ma->sampled)
+        ma->frame.padding2 = bswap_32 (ma->frame.padding2);
     }
 
   if (ma->frame.len < (sizeof *ma + (sizeof(SysprofCaptureAddress) * ma->n_addrs)))
@@ -1687,6 +2390,25 @@ sysprof_capture_reader_read_allocation (SysprofCaptureReader *self)
 
   self->pos += ma->frame.len;
 
+  if (ma->stack &&
+      ma->n_addrs == 0 &&
+      ma->frame.len >= sizeof *ma + sizeof (SysprofCaptureAddress))
+    {
+      SysprofCaptureAllocation *expanded;
+      uint64_t stack_id = ma->addrs[0];
+      unsigned int n_addrs;
+
+      if (SYSPROF_UNLIKELY (self->endian != __BYTE_ORDER))
+        stack_id = bswap_64 (stack_id);
+
+      if ((expanded = sysprof_capture_reader_expand_stack (self, &ma->frame, sizeof *ma, stack_id, &n_addrs)))
+        {
+          expanded->n_addrs = n_addrs;
+          expanded->stack = 0;
+          return expanded;
+        }
+    }
+
   return ma;
 }
 
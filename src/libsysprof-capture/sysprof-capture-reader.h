@@ -102,6 +102,8 @@ SYSPROF_AVAILABLE_IN_ALL
 const SysprofCaptureMetadata       *sysprof_capture_reader_read_metadata       (SysprofCaptureReader      *self);
 SYSPROF_AVAILABLE_IN_ALL
 const SysprofCaptureDBusMessage    *sysprof_capture_reader_read_dbus_message   (SysprofCaptureReader      *self);
+SYSPROF_AVAILABLE_IN_51
+const SysprofCaptureStack          *sysprof_capture_reader_read_stack          (SysprofCaptureReader      *self);
 SYSPROF_AVAILABLE_IN_ALL
 const SysprofCaptureExit           *sysprof_capture_reader_read_exit           (SysprofCaptureReader      *self);
 SYSPROF_AVAILABLE_IN_ALL
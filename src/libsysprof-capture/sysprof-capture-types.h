@@ -101,6 +101,7 @@ SYSPROF_STATIC_ASSERT (sizeof (void *) == sizeof (uintptr_t), "UINTPTR_MAX can
 #define SYSPROF_CAPTURE_COUNTER_DOUBLE 1
 
 #define SYSPROF_CAPTURE_FRAME_INDEX_MAGIC 0x53504958u
+#define SYSPROF_CAPTURE_BLOCK_MAGIC       0x53504243u
 
 typedef struct _SysprofCaptureReader    SysprofCaptureReader;
 typedef struct _SysprofCaptureWriter    SysprofCaptureWriter;
@@ -147,10 +148,11 @@ typedef enum
   SYSPROF_CAPTURE_FRAME_OVERLAY      = 15,
   SYSPROF_CAPTURE_FRAME_TRACE        = 16,
   SYSPROF_CAPTURE_FRAME_DBUS_MESSAGE = 17,
+  SYSPROF_CAPTURE_FRAME_STACK        = 18,
 } SysprofCaptureFrameType;
 
 /* Not part of ABI */
-#define SYSPROF_CAPTURE_FRAME_LAST 18
+#define SYSPROF_CAPTURE_FRAME_LAST 19
 
 SYSPROF_ALIGNED_BEGIN(1)
 typedef struct
@@ -158,7 +160,8 @@ typedef struct
   uint32_t magic;
   uint32_t version : 8;
   uint32_t little_endian : 1;
-  uint32_t padding : 23;
+  uint32_t compressed : 1;
+  uint32_t padding : 22;
   char     capture_time[64];
   int64_t  time;
   int64_t  end_time;
@@ -166,7 +169,8 @@ typedef struct
     char suffix[168];
     struct {
       uint64_t last_frame_index;
-      char     padding[160];
+      uint64_t last_block;
+      char     padding[152];
     } frame_index;
   };
 } SysprofCaptureFileHeader
@@ -227,12 +231,17 @@ typedef struct
 } SysprofCaptureProcess
 SYSPROF_ALIGNED_END(1);
 
+/*
+ * If @stack is set, @n_addrs is zero and addrs[0] contains the id of a
+ * previously written #SysprofCaptureStack holding the addresses.
+ */
 SYSPROF_ALIGNED_BEGIN(1)
 typedef struct
 {
   SysprofCaptureFrame   frame;
   uint32_t              n_addrs : 16;
-  uint32_t              padding1 : 16;
+  uint32_t              stack : 1;
+  uint32_t              padding1 : 15;
   int32_t               tid;
   SysprofCaptureAddress addrs[0];
 } SysprofCaptureSample
@@ -276,15 +285,46 @@ SYSPROF_ALIGNED_END(1);
  * Frame indexes are encoded as extended timestamp frames so that older
  * readers can continue to walk the capture. The padding2 marker identifies
  * the timestamp as an index rather than user-provided capture data.
+ *
+ * begin_time and end_time bound the times of every frame since the
+ * previous index, not including the index itself, so that readers may
+ * seek to a time range. Stacks are never referenced across an index either.
+ * Indexes written before those fields were added are only
+ * SYSPROF_CAPTURE_FRAME_INDEX_MIN_LEN bytes long.
  */
 SYSPROF_ALIGNED_BEGIN(1)
 typedef struct
 {
   SysprofCaptureFrame frame;
   uint64_t            previous_frame_index;
+  int64_t             begin_time;
+  int64_t             end_time;
 } SysprofCaptureFrameIndex
 SYSPROF_ALIGNED_END(1);
 
+#define SYSPROF_CAPTURE_FRAME_INDEX_MIN_LEN (sizeof (SysprofCaptureFrame) + sizeof (uint64_t))
+
+/*
+ * Compressed captures store the frames following the file header as a
+ * chain of independently compressed blocks, each preceded by this block
+ * header. Blocks end on frame index boundaries so that the uncompressed
+ * frames are identical to those of an uncompressed capture and may be
+ * decompressed in parallel. The file header's last_frame_index refers to
+ * a position within the uncompressed frames while last_block refers to
+ * the position of the last block header within the file.
+ */
+SYSPROF_ALIGNED_BEGIN(1)
+typedef struct
+{
+  uint32_t magic;
+  uint32_t compressed_len;
+  uint32_t uncompressed_len;
+  uint32_t padding;
+  uint64_t uncompressed_offset;
+  uint64_t previous_block;
+} SysprofCaptureBlock
+SYSPROF_ALIGNED_END(1);
+
 SYSPROF_ALIGNED_BEGIN(1)
 typedef struct
 {
@@ -376,6 +416,14 @@ typedef struct
 } SysprofCaptureFileChunk
 SYSPROF_ALIGNED_END(1);
 
+/*
+ * If @stack is set, @n_addrs is zero and addrs[0] contains the id of a
+ * previously written #SysprofCaptureStack holding the addresses.
+ *
+ * If @sampled is set, the allocation was chosen by sampling on average
+ * once every frame.padding2 bytes allocated and stands in for more than
+ * @alloc_size bytes. Only frees of sampled allocations are recorded.
+ */
 SYSPROF_ALIGNED_BEGIN(1)
 typedef struct
 {
@@ -384,11 +432,29 @@ typedef struct
   int64_t               alloc_size;
   int32_t               tid;
   uint32_t              n_addrs : 16;
-  uint32_t              padding1 : 16;
+  uint32_t              stack : 1;
+  uint32_t              sampled : 1;
+  uint32_t              padding1 : 14;
   SysprofCaptureAddress addrs[0];
 } SysprofCaptureAllocation
 SYSPROF_ALIGNED_END(1);
 
+/*
+ * Stacks are interned by the writer so that samples and allocations
+ * which repeat the same callchain only need to reference it by @id.
+ * A stack is always written before the first frame referencing it.
+ */
+SYSPROF_ALIGNED_BEGIN(1)
+typedef struct
+{
+  SysprofCaptureFrame   frame;
+  uint32_t              id;
+  uint32_t              n_addrs : 16;
+  uint32_t              padding1 : 16;
+  SysprofCaptureAddress addrs[0];
+} SysprofCaptureStack
+SYSPROF_ALIGNED_END(1);
+
 SYSPROF_ALIGNED_BEGIN(1)
 typedef struct
 {
@@ -418,7 +484,8 @@ SYSPROF_STATIC_ASSERT (sizeof (SysprofCaptureTrace) == 32, "SysprofCaptureTrace
 SYSPROF_STATIC_ASSERT (sizeof (SysprofCaptureFork) == 28, "SysprofCaptureFork changed size");
 SYSPROF_STATIC_ASSERT (sizeof (SysprofCaptureExit) == 24, "SysprofCaptureExit changed size");
 SYSPROF_STATIC_ASSERT (sizeof (SysprofCaptureTimestamp) == 24, "SysprofCaptureTimestamp changed size");
-SYSPROF_STATIC_ASSERT (sizeof (SysprofCaptureFrameIndex) == 32, "SysprofCaptureFrameIndex changed size");
+SYSPROF_STATIC_ASSERT (sizeof (SysprofCaptureFrameIndex) == 48, "SysprofCaptureFrameIndex changed size");
+SYSPROF_STATIC_ASSERT (sizeof (SysprofCaptureBlock) == 32, "SysprofCaptureBlock changed size");
 SYSPROF_STATIC_ASSERT (sizeof (SysprofCaptureCounter) == 128, "SysprofCaptureCounter changed size");
 SYSPROF_STATIC_ASSERT (sizeof (SysprofCaptureCounterValues) == 96, "SysprofCaptureCounterValues changed size");
 SYSPROF_STATIC_ASSERT (sizeof (SysprofCaptureCounterDefine) == 32, "SysprofCaptureCounterDefine changed size");
@@ -430,10 +497,12 @@ SYSPROF_STATIC_ASSERT (sizeof (SysprofCaptureFileChunk) == 284, "SysprofCaptureF
 SYSPROF_STATIC_ASSERT (sizeof (SysprofCaptureAllocation) == 48, "SysprofCaptureAllocation changed size");
 SYSPROF_STATIC_ASSERT (sizeof (SysprofCaptureOverlay) == 32, "SysprofCaptureOverlay changed size");
 SYSPROF_STATIC_ASSERT (sizeof (SysprofCaptureDBusMessage) == 28, "SysprofCaptureDBusMessage changed size");
+SYSPROF_STATIC_ASSERT (sizeof (SysprofCaptureStack) == 32, "SysprofCaptureStack changed size");
 
 SYSPROF_STATIC_ASSERT ((offsetof (SysprofCaptureAllocation, addrs) % SYSPROF_CAPTURE_ALIGN) == 0, "SysprofCaptureAllocation.addrs is not aligned");
 SYSPROF_STATIC_ASSERT ((offsetof (SysprofCaptureSample, addrs) % SYSPROF_CAPTURE_ALIGN) == 0, "SysprofCaptureSample.addrs is not aligned");
 SYSPROF_STATIC_ASSERT ((offsetof (SysprofCaptureTrace, addrs) % SYSPROF_CAPTURE_ALIGN) == 0, "SysprofCaptureTrace.addrs is not aligned");
+SYSPROF_STATIC_ASSERT ((offsetof (SysprofCaptureStack, addrs) % SYSPROF_CAPTURE_ALIGN) == 0, "SysprofCaptureStack.addrs is not aligned");
 
 static inline int
 sysprof_capture_address_compare (SysprofCaptureAddress a,
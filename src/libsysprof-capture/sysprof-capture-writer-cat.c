@@ -169,32 +169,19 @@ translate_table_translate (TranslateTable *tables,
   return item != NULL ? item->dst : src;
 }
 
-bool
-sysprof_capture_writer_cat (SysprofCaptureWriter *self,
-                            SysprofCaptureReader *reader)
+/* Copies the jitmaps of @reader into @self up front so that addresses in
+ * samples and traces can be translated no matter where the jitmap frame
+ * was flushed within the capture.
+ */
+static bool
+cat_jitmaps (SysprofCaptureWriter *self,
+             SysprofCaptureReader *reader,
+             TranslateTable       *tables)
 {
-  TranslateTable tables[N_TRANSLATE] = { 0, };
   SysprofCaptureFrameType type;
-  int64_t start_time;
-  int64_t first_start_time = INT64_MAX;
-  int64_t end_time = -1;
-
-  assert (self != NULL);
-  assert (reader != NULL);
 
   sysprof_capture_reader_reset (reader);
 
-  translate_table_clear (tables, TRANSLATE_CTR);
-  translate_table_clear (tables, TRANSLATE_ADDR);
-
-  start_time = sysprof_capture_reader_get_start_time (reader);
-
-  if (start_time < first_start_time)
-    first_start_time = start_time;
-
-  /* First we need to find all the JIT maps so that we can translate
-   * addresses later on and have the correct value.
-   */
   while (sysprof_capture_reader_peek_type (reader, &type))
     {
       const SysprofCaptureJitmap *jitmap;
@@ -205,12 +192,12 @@ sysprof_capture_writer_cat (SysprofCaptureWriter *self,
       if (type != SYSPROF_CAPTURE_FRAME_JITMAP)
         {
           if (!sysprof_capture_reader_skip (reader))
-            goto panic;
+            return false;
           continue;
         }
 
       if (!(jitmap = sysprof_capture_reader_read_jitmap (reader)))
-        goto panic;
+        return false;
 
       sysprof_capture_jitmap_iter_init (&iter, jitmap);
       while (sysprof_capture_jitmap_iter_next (&iter, &addr, &name))
@@ -228,391 +215,450 @@ sysprof_capture_writer_cat (SysprofCaptureWriter *self,
 
   sysprof_capture_reader_reset (reader);
 
-  while (sysprof_capture_reader_peek_type (reader, &type))
-    {
-      SysprofCaptureFrame fr;
-
-      if (sysprof_capture_reader_peek_frame (reader, &fr))
-        {
-          if (fr.time > end_time)
-            end_time = fr.time;
-        }
-
-      switch (type)
-        {
-        case SYSPROF_CAPTURE_FRAME_TIMESTAMP:
-          {
-            const SysprofCaptureTimestamp *frame;
-
-            if (!(frame = sysprof_capture_reader_read_timestamp (reader)))
-              goto panic;
-
-            if ((frame->frame.padding2 == SYSPROF_CAPTURE_FRAME_INDEX_MAGIC ||
-                 bswap_32 (frame->frame.padding2) == SYSPROF_CAPTURE_FRAME_INDEX_MAGIC) &&
-                frame->frame.len == sizeof (SysprofCaptureFrameIndex))
-              break;
-
-            sysprof_capture_writer_add_timestamp (self,
-                                                  frame->frame.time,
-                                                  frame->frame.cpu,
-                                                  frame->frame.pid);
-            break;
-          }
-
-        case SYSPROF_CAPTURE_FRAME_FILE_CHUNK:
-          {
-            const SysprofCaptureFileChunk *frame;
-
-            if (!(frame = sysprof_capture_reader_read_file (reader)))
-              goto panic;
-
-            sysprof_capture_writer_add_file (self,
-                                             frame->frame.time,
-                                             frame->frame.cpu,
-                                             frame->frame.pid,
-                                             frame->path,
-                                             frame->is_last,
-                                             frame->data,
-                                             frame->len);
-            break;
-          }
+  return true;
+}
 
-        case SYSPROF_CAPTURE_FRAME_LOG:
-          {
-            const SysprofCaptureLog *frame;
+/* Copies the next frame of @reader into @self, translating jitmap
+ * addresses and counter identifiers using @tables.
+ */
+static bool
+cat_frame (SysprofCaptureWriter    *self,
+           SysprofCaptureReader    *reader,
+           TranslateTable          *tables,
+           SysprofCaptureFrameType  type,
+           int64_t                 *end_time)
+{
+  SysprofCaptureFrame fr;
 
-            if (!(frame = sysprof_capture_reader_read_log (reader)))
-              goto panic;
+  if (sysprof_capture_reader_peek_frame (reader, &fr))
+    {
+      if (fr.time > *end_time)
+        *end_time = fr.time;
+    }
 
-            sysprof_capture_writer_add_log (self,
-                                            frame->frame.time,
-                                            frame->frame.cpu,
-                                            frame->frame.pid,
-                                            frame->severity,
-                                            frame->domain,
-                                            frame->message);
-            break;
-          }
+  switch (type)
+    {
+    case SYSPROF_CAPTURE_FRAME_TIMESTAMP:
+      {
+        const SysprofCaptureTimestamp *frame;
 
-        case SYSPROF_CAPTURE_FRAME_MAP:
-          {
-            const SysprofCaptureMap *frame;
+        if (!(frame = sysprof_capture_reader_read_timestamp (reader)))
+          return false;
 
-            if (!(frame = sysprof_capture_reader_read_map (reader)))
-              goto panic;
+        if ((frame->frame.padding2 == SYSPROF_CAPTURE_FRAME_INDEX_MAGIC ||
+             bswap_32 (frame->frame.padding2) == SYSPROF_CAPTURE_FRAME_INDEX_MAGIC) &&
+            (frame->frame.len == SYSPROF_CAPTURE_FRAME_INDEX_MIN_LEN ||
+             frame->frame.len == sizeof (SysprofCaptureFrameIndex)))
+          break;
 
-            sysprof_capture_writer_add_map (self,
+        sysprof_capture_writer_add_timestamp (self,
+                                              frame->frame.time,
+                                              frame->frame.cpu,
+                                              frame->frame.pid);
+        break;
+      }
+
+    case SYSPROF_CAPTURE_FRAME_FILE_CHUNK:
+      {
+        const SysprofCaptureFileChunk *frame;
+
+        if (!(frame = sysprof_capture_reader_read_file (reader)))
+          return false;
+
+        sysprof_capture_writer_add_file (self,
+                                         frame->frame.time,
+                                         frame->frame.cpu,
+                                         frame->frame.pid,
+                                         frame->path,
+                                         frame->is_last,
+                                         frame->data,
+                                         frame->len);
+        break;
+      }
+
+    case SYSPROF_CAPTURE_FRAME_LOG:
+      {
+        const SysprofCaptureLog *frame;
+
+        if (!(frame = sysprof_capture_reader_read_log (reader)))
+          return false;
+
+        sysprof_capture_writer_add_log (self,
+                                        frame->frame.time,
+                                        frame->frame.cpu,
+                                        frame->frame.pid,
+                                        frame->severity,
+                                        frame->domain,
+                                        frame->message);
+        break;
+      }
+
+    case SYSPROF_CAPTURE_FRAME_MAP:
+      {
+        const SysprofCaptureMap *frame;
+
+        if (!(frame = sysprof_capture_reader_read_map (reader)))
+          return false;
+
+        sysprof_capture_writer_add_map (self,
+                                        frame->frame.time,
+                                        frame->frame.cpu,
+                                        frame->frame.pid,
+                                        frame->start,
+                                        frame->end,
+                                        frame->offset,
+                                        frame->inode,
+                                        frame->filename);
+        break;
+      }
+
+    case SYSPROF_CAPTURE_FRAME_MARK:
+      {
+        const SysprofCaptureMark *frame;
+
+        if (!(frame = sysprof_capture_reader_read_mark (reader)))
+          return false;
+
+        sysprof_capture_writer_add_mark (self,
+                                         frame->frame.time,
+                                         frame->frame.cpu,
+                                         frame->frame.pid,
+                                         frame->duration,
+                                         frame->group,
+                                         frame->name,
+                                         frame->message);
+
+        if (frame->frame.time + frame->duration > *end_time)
+          *end_time = frame->frame.time + frame->duration;
+
+        break;
+      }
+
+    case SYSPROF_CAPTURE_FRAME_PROCESS:
+      {
+        const SysprofCaptureProcess *frame;
+
+        if (!(frame = sysprof_capture_reader_read_process (reader)))
+          return false;
+
+        sysprof_capture_writer_add_process (self,
                                             frame->frame.time,
                                             frame->frame.cpu,
                                             frame->frame.pid,
-                                            frame->start,
-                                            frame->end,
-                                            frame->offset,
-                                            frame->inode,
-                                            frame->filename);
-            break;
-          }
-
-        case SYSPROF_CAPTURE_FRAME_MARK:
-          {
-            const SysprofCaptureMark *frame;
-
-            if (!(frame = sysprof_capture_reader_read_mark (reader)))
-              goto panic;
-
-            sysprof_capture_writer_add_mark (self,
+                                            frame->cmdline);
+        break;
+      }
+
+    case SYSPROF_CAPTURE_FRAME_FORK:
+      {
+        const SysprofCaptureFork *frame;
+
+        if (!(frame = sysprof_capture_reader_read_fork (reader)))
+          return false;
+
+        sysprof_capture_writer_add_fork (self,
+                                         frame->frame.time,
+                                         frame->frame.cpu,
+                                         frame->frame.pid,
+                                         frame->child_pid);
+        break;
+      }
+
+    case SYSPROF_CAPTURE_FRAME_EXIT:
+      {
+        const SysprofCaptureExit *frame;
+
+        if (!(frame = sysprof_capture_reader_read_exit (reader)))
+          return false;
+
+        sysprof_capture_writer_add_exit (self,
+                                         frame->frame.time,
+                                         frame->frame.cpu,
+                                         frame->frame.pid);
+        break;
+      }
+
+    case SYSPROF_CAPTURE_FRAME_METADATA:
+      {
+        const SysprofCaptureMetadata *frame;
+
+        if (!(frame = sysprof_capture_reader_read_metadata (reader)))
+          return false;
+
+        sysprof_capture_writer_add_metadata (self,
                                              frame->frame.time,
                                              frame->frame.cpu,
                                              frame->frame.pid,
-                                             frame->duration,
-                                             frame->group,
-                                             frame->name,
-                                             frame->message);
+                                             frame->id,
+                                             frame->metadata,
+                                             frame->frame.len - offsetof (SysprofCaptureMetadata, metadata));
+        break;
+      }
 
-            if (frame->frame.time + frame->duration > end_time)
-              end_time = frame->frame.time + frame->duration;
+    case SYSPROF_CAPTURE_FRAME_DBUS_MESSAGE:
+      {
+        const SysprofCaptureDBusMessage *frame;
 
-            break;
-          }
+        if (!(frame = sysprof_capture_reader_read_dbus_message (reader)))
+          return false;
 
-        case SYSPROF_CAPTURE_FRAME_PROCESS:
-          {
-            const SysprofCaptureProcess *frame;
+        sysprof_capture_writer_add_dbus_message (self,
+                                                 frame->frame.time,
+                                                 frame->frame.cpu,
+                                                 frame->frame.pid,
+                                                 frame->bus_type,
+                                                 frame->flags,
+                                                 frame->message,
+                                                 frame->message_len);
+        break;
+      }
 
-            if (!(frame = sysprof_capture_reader_read_process (reader)))
-              goto panic;
+    case SYSPROF_CAPTURE_FRAME_SAMPLE:
+      {
+        const SysprofCaptureSample *frame;
 
-            sysprof_capture_writer_add_process (self,
-                                                frame->frame.time,
-                                                frame->frame.cpu,
-                                                frame->frame.pid,
-                                                frame->cmdline);
-            break;
-          }
+        if (!(frame = sysprof_capture_reader_read_sample (reader)))
+          return false;
 
-        case SYSPROF_CAPTURE_FRAME_FORK:
-          {
-            const SysprofCaptureFork *frame;
+        {
+          SysprofCaptureAddress addrs[frame->n_addrs];
 
-            if (!(frame = sysprof_capture_reader_read_fork (reader)))
-              goto panic;
+          for (unsigned int z = 0; z < frame->n_addrs; z++)
+            addrs[z] = translate_table_translate (tables, TRANSLATE_ADDR, frame->addrs[z]);
 
-            sysprof_capture_writer_add_fork (self,
+          sysprof_capture_writer_add_sample (self,
                                              frame->frame.time,
                                              frame->frame.cpu,
                                              frame->frame.pid,
-                                             frame->child_pid);
-            break;
-          }
-
-        case SYSPROF_CAPTURE_FRAME_EXIT:
-          {
-            const SysprofCaptureExit *frame;
+                                             frame->tid,
+                                             addrs,
+                                             frame->n_addrs);
+        }
 
-            if (!(frame = sysprof_capture_reader_read_exit (reader)))
-              goto panic;
+        break;
+      }
 
-            sysprof_capture_writer_add_exit (self,
-                                             frame->frame.time,
-                                             frame->frame.cpu,
-                                             frame->frame.pid);
-            break;
-          }
+    case SYSPROF_CAPTURE_FRAME_TRACE:
+      {
+        const SysprofCaptureTrace *frame;
 
-        case SYSPROF_CAPTURE_FRAME_METADATA:
-          {
-            const SysprofCaptureMetadata *frame;
+        if (!(frame = sysprof_capture_reader_read_trace (reader)))
+          return false;
 
-            if (!(frame = sysprof_capture_reader_read_metadata (reader)))
-              goto panic;
+        {
+          SysprofCaptureAddress addrs[frame->n_addrs];
 
-            sysprof_capture_writer_add_metadata (self,
-                                                 frame->frame.time,
-                                                 frame->frame.cpu,
-                                                 frame->frame.pid,
-                                                 frame->id,
-                                                 frame->metadata,
-                                                 frame->frame.len - offsetof (SysprofCaptureMetadata, metadata));
-            break;
-          }
+          for (unsigned int z = 0; z < frame->n_addrs; z++)
+            addrs[z] = translate_table_translate (tables, TRANSLATE_ADDR, frame->addrs[z]);
 
-        case SYSPROF_CAPTURE_FRAME_DBUS_MESSAGE:
-          {
-            const SysprofCaptureDBusMessage *frame;
+          sysprof_capture_writer_add_trace (self,
+                                            frame->frame.time,
+                                            frame->frame.cpu,
+                                            frame->frame.pid,
+                                            frame->tid,
+                                            addrs,
+                                            frame->n_addrs,
+                                            frame->entering);
+        }
 
-            if (!(frame = sysprof_capture_reader_read_dbus_message (reader)))
-              goto panic;
+        break;
+      }
 
-            sysprof_capture_writer_add_dbus_message (self,
-                                                     frame->frame.time,
-                                                     frame->frame.cpu,
-                                                     frame->frame.pid,
-                                                     frame->bus_type,
-                                                     frame->flags,
-                                                     frame->message,
-                                                     frame->message_len);
-            break;
-          }
+    case SYSPROF_CAPTURE_FRAME_CTRDEF:
+      {
+        const SysprofCaptureCounterDefine *frame;
 
-        case SYSPROF_CAPTURE_FRAME_SAMPLE:
-          {
-            const SysprofCaptureSample *frame;
+        if (!(frame = sysprof_capture_reader_read_counter_define (reader)))
+          return false;
 
-            if (!(frame = sysprof_capture_reader_read_sample (reader)))
-              goto panic;
+        {
+          SysprofCaptureCounter *counters = calloc (frame->n_counters, sizeof (*counters));
+          size_t n_counters = 0;
+          if (counters == NULL)
+            return false;
 
+          for (unsigned int z = 0; z < frame->n_counters; z++)
             {
-              SysprofCaptureAddress addrs[frame->n_addrs];
+              SysprofCaptureCounter c = frame->counters[z];
+              unsigned int src = c.id;
 
-              for (unsigned int z = 0; z < frame->n_addrs; z++)
-                addrs[z] = translate_table_translate (tables, TRANSLATE_ADDR, frame->addrs[z]);
+              c.id = sysprof_capture_writer_request_counter (self, 1);
 
-              sysprof_capture_writer_add_sample (self,
-                                                 frame->frame.time,
-                                                 frame->frame.cpu,
-                                                 frame->frame.pid,
-                                                 frame->tid,
-                                                 addrs,
-                                                 frame->n_addrs);
+              if (c.id != src)
+                translate_table_add (tables, TRANSLATE_CTR, src, c.id);
+
+              counters[n_counters++] = c;
             }
 
-            break;
-          }
+          sysprof_capture_writer_define_counters (self,
+                                                  frame->frame.time,
+                                                  frame->frame.cpu,
+                                                  frame->frame.pid,
+                                                  counters,
+                                                  n_counters);
 
-        case SYSPROF_CAPTURE_FRAME_TRACE:
-          {
-            const SysprofCaptureTrace *frame;
+          free (counters);
 
-            if (!(frame = sysprof_capture_reader_read_trace (reader)))
-              goto panic;
+          translate_table_sort (tables, TRANSLATE_CTR);
+        }
 
-            {
-              SysprofCaptureAddress addrs[frame->n_addrs];
-
-              for (unsigned int z = 0; z < frame->n_addrs; z++)
-                addrs[z] = translate_table_translate (tables, TRANSLATE_ADDR, frame->addrs[z]);
-
-              sysprof_capture_writer_add_trace (self,
-                                                frame->frame.time,
-                                                frame->frame.cpu,
-                                                frame->frame.pid,
-                                                frame->tid,
-                                                addrs,
-                                                frame->n_addrs,
-                                                frame->entering);
-            }
+        break;
+      }
 
-            break;
-          }
+    case SYSPROF_CAPTURE_FRAME_CTRSET:
+      {
+        const SysprofCaptureCounterSet *frame;
 
-        case SYSPROF_CAPTURE_FRAME_CTRDEF:
-          {
-            const SysprofCaptureCounterDefine *frame;
+        if (!(frame = sysprof_capture_reader_read_counter_set (reader)))
+          return false;
 
-            if (!(frame = sysprof_capture_reader_read_counter_define (reader)))
-              goto panic;
+        {
+          unsigned int *ids = NULL;
+          SysprofCaptureCounterValue *values = NULL;
+          size_t n_elements = 0;
+          size_t n_elements_allocated = 0;
 
+          for (unsigned int z = 0; z < frame->n_values; z++)
             {
-              SysprofCaptureCounter *counters = calloc (frame->n_counters, sizeof (*counters));
-              size_t n_counters = 0;
-              if (counters == NULL)
-                goto panic;
+              const SysprofCaptureCounterValues *v = &frame->values[z];
 
-              for (unsigned int z = 0; z < frame->n_counters; z++)
+              for (unsigned int y = 0; y < SYSPROF_N_ELEMENTS (v->ids); y++)
                 {
-                  SysprofCaptureCounter c = frame->counters[z];
-                  unsigned int src = c.id;
-
-                  c.id = sysprof_capture_writer_request_counter (self, 1);
+                  if (v->ids[y])
+                    {
+                      unsigned int dst = translate_table_translate (tables, TRANSLATE_CTR, v->ids[y]);
+                      SysprofCaptureCounterValue value = v->values[y];
 
-                  if (c.id != src)
-                    translate_table_add (tables, TRANSLATE_CTR, src, c.id);
+                      if (n_elements == n_elements_allocated)
+                        {
+                          n_elements_allocated = (n_elements_allocated > 0) ? n_elements_allocated * 2 : 4;
+                          ids = _sysprof_reallocarray (ids, n_elements_allocated, sizeof (*ids));
+                          values = _sysprof_reallocarray (values, n_elements_allocated, sizeof (*values));
+                          if (ids == NULL || values == NULL)
+                            return false;
+                        }
 
-                  counters[n_counters++] = c;
+                      ids[n_elements] = dst;
+                      values[n_elements] = value;
+                      n_elements++;
+                      assert (n_elements <= n_elements_allocated);
+                    }
                 }
+            }
 
-              sysprof_capture_writer_define_counters (self,
-                                                      frame->frame.time,
-                                                      frame->frame.cpu,
-                                                      frame->frame.pid,
-                                                      counters,
-                                                      n_counters);
+          sysprof_capture_writer_set_counters (self,
+                                               frame->frame.time,
+                                               frame->frame.cpu,
+                                               frame->frame.pid,
+                                               ids,
+                                               values,
+                                               n_elements);
 
-              translate_table_sort (tables, TRANSLATE_CTR);
-            }
+          free (ids);
+          free (values);
+        }
 
-            break;
-          }
+        break;
+      }
 
-        case SYSPROF_CAPTURE_FRAME_CTRSET:
-          {
-            const SysprofCaptureCounterSet *frame;
+    case SYSPROF_CAPTURE_FRAME_JITMAP:
+      /* We already did this */
+      if (!sysprof_capture_reader_skip (reader))
+        return false;
+      break;
 
-            if (!(frame = sysprof_capture_reader_read_counter_set (reader)))
-              goto panic;
+    case SYSPROF_CAPTURE_FRAME_STACK:
+      /* Stacks are expanded when reading and interned again on write */
+      if (!sysprof_capture_reader_skip (reader))
+        return false;
+      break;
 
-            {
-              unsigned int *ids = NULL;
-              SysprofCaptureCounterValue *values = NULL;
-              size_t n_elements = 0;
-              size_t n_elements_allocated = 0;
+    case SYSPROF_CAPTURE_FRAME_ALLOCATION: {
+      const SysprofCaptureAllocation *frame;
 
-              for (unsigned int z = 0; z < frame->n_values; z++)
-                {
-                  const SysprofCaptureCounterValues *v = &frame->values[z];
+      if (!(frame = sysprof_capture_reader_read_allocation (reader)))
+        return false;
 
-                  for (unsigned int y = 0; y < SYSPROF_N_ELEMENTS (v->ids); y++)
-                    {
-                      if (v->ids[y])
-                        {
-                          unsigned int dst = translate_table_translate (tables, TRANSLATE_CTR, v->ids[y]);
-                          SysprofCaptureCounterValue value = v->values[y];
-
-                          if (n_elements == n_elements_allocated)
-                            {
-                              n_elements_allocated = (n_elements_allocated > 0) ? n_elements_allocated * 2 : 4;
-                              ids = _sysprof_reallocarray (ids, n_elements_allocated, sizeof (*ids));
-                              values = _sysprof_reallocarray (values, n_elements_allocated, sizeof (*values));
-                              if (ids == NULL || values == NULL)
-                                goto panic;
-                            }
-
-                          ids[n_elements] = dst;
-                          values[n_elements] = value;
-                          n_elements++;
-                          assert (n_elements <= n_elements_allocated);
-                        }
-                    }
-                }
+      sysprof_capture_writer_add_allocation_sampled (self,
+                                                     frame->frame.time,
+                                                     frame->frame.cpu,
+                                                     frame->frame.pid,
+                                                     frame->tid,
+                                                     frame->alloc_addr,
+                                                     frame->alloc_size,
+                                                     frame->sampled ? frame->frame.padding2 : 0,
+                                                     frame->addrs,
+                                                     frame->n_addrs);
+      break;
+    }
 
-              sysprof_capture_writer_set_counters (self,
-                                                   frame->frame.time,
-                                                   frame->frame.cpu,
-                                                   frame->frame.pid,
-                                                   ids,
-                                                   values,
-                                                   n_elements);
-            }
+    case SYSPROF_CAPTURE_FRAME_OVERLAY:
+      {
+        const SysprofCaptureOverlay *frame;
+        const char *src;
+        const char *dst;
 
-            break;
-          }
+        if (!(frame = sysprof_capture_reader_read_overlay (reader)))
+          return false;
 
-        case SYSPROF_CAPTURE_FRAME_JITMAP:
-          /* We already did this */
-          if (!sysprof_capture_reader_skip (reader))
-            goto panic;
-          break;
+        /* This should have been verified alrady when decoding */
+        assert (frame->frame.len >= (sizeof *frame + frame->src_len + 1 + frame->dst_len + 1));
 
-        case SYSPROF_CAPTURE_FRAME_ALLOCATION: {
-          const SysprofCaptureAllocation *frame;
-
-          if (!(frame = sysprof_capture_reader_read_allocation (reader)))
-            goto panic;
-
-          sysprof_capture_writer_add_allocation_copy (self,
-                                                      frame->frame.time,
-                                                      frame->frame.cpu,
-                                                      frame->frame.pid,
-                                                      frame->tid,
-                                                      frame->alloc_addr,
-                                                      frame->alloc_size,
-                                                      frame->addrs,
-                                                      frame->n_addrs);
-          break;
-        }
+        src = &frame->data[0];
+        dst = &frame->data[frame->src_len+1];
 
-        case SYSPROF_CAPTURE_FRAME_OVERLAY:
-          {
-            const SysprofCaptureOverlay *frame;
-            const char *src;
-            const char *dst;
-
-            if (!(frame = sysprof_capture_reader_read_overlay (reader)))
-              goto panic;
-
-            /* This should have been verified alrady when decoding */
-            assert (frame->frame.len >= (sizeof *frame + frame->src_len + 1 + frame->dst_len + 1));
-
-            src = &frame->data[0];
-            dst = &frame->data[frame->src_len+1];
-
-            sysprof_capture_writer_add_overlay (self,
-                                                frame->frame.time,
-                                                frame->frame.cpu,
-                                                frame->frame.pid,
-                                                frame->layer,
-                                                src,
-                                                dst);
-            break;
-          }
-
-        default:
-          /* Silently drop, which is better than looping. We could potentially
-           * copy this over using the raw bytes at some point.
-           */
-          sysprof_capture_reader_skip (reader);
-          break;
-        }
+        sysprof_capture_writer_add_overlay (self,
+                                            frame->frame.time,
+                                            frame->frame.cpu,
+                                            frame->frame.pid,
+                                            frame->layer,
+                                            src,
+                                            dst);
+        break;
+      }
+
+    default:
+      /* Silently drop, which is better than looping. We could potentially
+       * copy this over using the raw bytes at some point.
+       */
+      sysprof_capture_reader_skip (reader);
+      break;
+    }
+
+  return true;
+}
+
+bool
+sysprof_capture_writer_cat (SysprofCaptureWriter *self,
+                            SysprofCaptureReader *reader)
+{
+  TranslateTable tables[N_TRANSLATE] = { 0, };
+  SysprofCaptureFrameType type;
+  int64_t start_time;
+  int64_t first_start_time = INT64_MAX;
+  int64_t end_time = -1;
+
+  assert (self != NULL);
+  assert (reader != NULL);
+
+  translate_table_clear (tables, TRANSLATE_CTR);
+  translate_table_clear (tables, TRANSLATE_ADDR);
+
+  start_time = sysprof_capture_reader_get_start_time (reader);
+
+  if (start_time < first_start_time)
+    first_start_time = start_time;
+
+  /* First we need to find all the JIT maps so that we can translate
+   * addresses later on and have the correct value.
+   */
+  if (!cat_jitmaps (self, reader, tables))
+    goto panic;
+
+  while (sysprof_capture_reader_peek_type (reader, &type))
+    {
+      if (!cat_frame (self, reader, tables, type, &end_time))
+        goto panic;
     }
 
   sysprof_capture_writer_flush (self);
@@ -632,3 +678,188 @@ panic:
   errno = EIO;
   return false;
 }
+
+typedef struct
+{
+  SysprofCaptureReader *reader;
+  TranslateTable        tables[N_TRANSLATE];
+  int64_t               time;
+  unsigned int          index;
+} MergeInput;
+
+static inline bool
+merge_input_before (const MergeInput *a,
+                    const MergeInput *b)
+{
+  return a->time < b->time || (a->time == b->time && a->index < b->index);
+}
+
+static void
+merge_heap_sift_down (MergeInput   **heap,
+                      unsigned int   n_heap,
+                      unsigned int   pos)
+{
+  MergeInput *item = heap[pos];
+
+  for (;;)
+    {
+      unsigned int child = pos * 2 + 1;
+
+      if (child >= n_heap)
+        break;
+
+      if (child + 1 < n_heap && merge_input_before (heap[child + 1], heap[child]))
+        child++;
+
+      if (!merge_input_before (heap[child], item))
+        break;
+
+      heap[pos] = heap[child];
+      pos = child;
+    }
+
+  heap[pos] = item;
+}
+
+/* Loads the time of the next frame, returning false at end of stream.
+ *
+ * Jitmaps were copied up front and frame indexes are never copied, and
+ * neither is stamped with a time in order with the frames around it, so
+ * skip past them instead of letting them hold up the merge.
+ */
+static bool
+merge_input_peek (MergeInput *input)
+{
+  SysprofCaptureFrame fr;
+
+  while (sysprof_capture_reader_peek_frame (input->reader, &fr))
+    {
+      if (fr.type == SYSPROF_CAPTURE_FRAME_JITMAP ||
+          (fr.type == SYSPROF_CAPTURE_FRAME_TIMESTAMP &&
+           (fr.len == SYSPROF_CAPTURE_FRAME_INDEX_MIN_LEN ||
+            fr.len == sizeof (SysprofCaptureFrameIndex)) &&
+           (fr.padding2 == SYSPROF_CAPTURE_FRAME_INDEX_MAGIC ||
+            bswap_32 (fr.padding2) == SYSPROF_CAPTURE_FRAME_INDEX_MAGIC)))
+        {
+          if (!sysprof_capture_reader_skip (input->reader))
+            return false;
+          continue;
+        }
+
+      input->time = fr.time;
+
+      return true;
+    }
+
+  return false;
+}
+
+/**
+ * sysprof_capture_writer_merge:
+ * @self: a #SysprofCaptureWriter
+ * @readers: (array length=n_readers): readers to merge
+ * @n_readers: the number of readers in @readers
+ *
+ * Merges the frames of @readers into @self ordered by time.
+ *
+ * Each reader is expected to be in time order itself, as captures from a
+ * single writer are, so only the next frame of each reader is considered
+ * at a time. That keeps memory use independent of the size of the inputs.
+ *
+ * Jitmap addresses and counter identifiers are rewritten so they do not
+ * collide between readers.
+ *
+ * Returns: %TRUE if successful; otherwise %FALSE and errno is set.
+ *
+ * Since: 51
+ */
+bool
+sysprof_capture_writer_merge (SysprofCaptureWriter  *self,
+                              SysprofCaptureReader **readers,
+                              unsigned int           n_readers)
+{
+  MergeInput *inputs = NULL;
+  MergeInput **heap = NULL;
+  unsigned int n_heap = 0;
+  int64_t first_start_time = INT64_MAX;
+  int64_t end_time = -1;
+  bool ret = false;
+
+  assert (self != NULL);
+  assert (readers != NULL || n_readers == 0);
+
+  if (n_readers == 0)
+    return true;
+
+  inputs = calloc (n_readers, sizeof *inputs);
+  heap = calloc (n_readers, sizeof *heap);
+
+  if (inputs == NULL || heap == NULL)
+    goto cleanup;
+
+  for (unsigned int i = 0; i < n_readers; i++)
+    {
+      MergeInput *input = &inputs[i];
+      int64_t start_time;
+
+      assert (readers[i] != NULL);
+
+      input->reader = readers[i];
+      input->index = i;
+
+      start_time = sysprof_capture_reader_get_start_time (input->reader);
+
+      if (start_time < first_start_time)
+        first_start_time = start_time;
+
+      if (!cat_jitmaps (self, input->reader, input->tables))
+        goto cleanup;
+
+      if (merge_input_peek (input))
+        heap[n_heap++] = input;
+    }
+
+  for (unsigned int i = n_heap / 2; i > 0; i--)
+    merge_heap_sift_down (heap, n_heap, i - 1);
+
+  while (n_heap > 0)
+    {
+      MergeInput *input = heap[0];
+      SysprofCaptureFrameType type;
+
+      if (!sysprof_capture_reader_peek_type (input->reader, &type) ||
+          !cat_frame (self, input->reader, input->tables, type, &end_time))
+        goto cleanup;
+
+      if (!merge_input_peek (input))
+        heap[0] = heap[--n_heap];
+
+      if (n_heap > 0)
+        merge_heap_sift_down (heap, n_heap, 0);
+    }
+
+  sysprof_capture_writer_flush (self);
+
+  /* do this after flushing as it uses pwrite() to replace data */
+  _sysprof_capture_writer_set_time_range (self, first_start_time, end_time);
+
+  ret = true;
+
+cleanup:
+  if (inputs != NULL)
+    {
+      for (unsigned int i = 0; i < n_readers; i++)
+        {
+          translate_table_clear (inputs[i].tables, TRANSLATE_ADDR);
+          translate_table_clear (inputs[i].tables, TRANSLATE_CTR);
+        }
+    }
+
+  free (inputs);
+  free (heap);
+
+  if (!ret)
+    errno = EIO;
+
+  return ret;
+}
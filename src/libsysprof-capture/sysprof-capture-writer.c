@@ -65,12 +65,14 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "sysprof-capture-compress-private.h"
 #include "sysprof-capture-reader.h"
 #include "sysprof-capture-util-private.h"
 #include "sysprof-capture-writer.h"
@@ -79,9 +81,14 @@
 
 #define DEFAULT_BUFFER_SIZE (_sysprof_getpagesize() * 64L)
 #define FRAME_INDEX_INTERVAL (64L * 1024L)
+#define MAX_BLOCK_SIZE      (4L * 1024L * 1024L)
+#define N_ASYNC_BUFFERS     3
 #define INVALID_ADDRESS     (SYSPROF_UINT64_CONSTANT(0))
 #define MAX_COUNTERS        ((1 << 24) - 1)
 #define MAX_UNWIND_DEPTH    64
+#define STACK_HASH_SIZE     (1 << 16)
+#define MAX_STACKS          (STACK_HASH_SIZE / 2)
+#define MAX_STACK_ADDRS     (1 << 22)
 
 typedef struct
 {
@@ -92,6 +99,20 @@ typedef struct
   uint64_t addr;
 } SysprofCaptureJitmapBucket;
 
+typedef struct
+{
+  /* Hash of the addresses within the stack */
+  uint64_t hash;
+
+  /* Position of the addresses within stack_addrs */
+  size_t offset;
+
+  /* The id of the stack frame, or 0 if the bucket is empty */
+  uint32_t id;
+
+  uint32_t n_addrs;
+} SysprofCaptureStackBucket;
+
 struct _SysprofCaptureWriter
 {
   /*
@@ -146,20 +167,102 @@ struct _SysprofCaptureWriter
   uint64_t last_frame_index;
   size_t frames_since_index;
 
+  /* Bounds of the frame times since the last frame index */
+  int64_t index_begin_time;
+  int64_t index_end_time;
+
+  /*
+   * Closed hash table of stacks which have already been written so
+   * that samples and allocations may reference them by id. The table
+   * is reset when full, which only costs re-emitting stacks.
+   */
+  SysprofCaptureStackBucket *stack_hash;
+  SysprofCaptureAddress *stack_addrs;
+  size_t stack_addrs_len;
+  size_t stack_addrs_pos;
+  unsigned int stack_hash_size;
+  uint32_t next_stack_id;
+
+  /*
+   * When compressing, everything following the file header is collected
+   * into @block until the next frame index and then written as a single
+   * compressed block. @block_offset is the position of @block within the
+   * uncompressed capture and @last_block the position of the previous
+   * block header within the file.
+   */
+  uint8_t *block;
+  size_t block_len;
+  size_t block_alloc;
+  uint8_t *compressed_buf;
+  size_t compressed_alloc;
+  uint64_t block_offset;
+  uint64_t last_block;
+
+  /*
+   * In asynchronous mode, filled write buffers are queued to @io_thread
+   * and a free buffer is taken in exchange. @io_offset is the position
+   * in the file at which @buf will land once everything queued has been
+   * written. Everything below @io_mutex is protected by it.
+   */
+  pthread_t io_thread;
+  uint64_t io_offset;
+  unsigned int io_counter_base;
+  pthread_mutex_t io_mutex;
+  pthread_cond_t io_cond;
+  uint8_t *io_free[N_ASYNC_BUFFERS];
+  unsigned int n_io_free;
+  struct {
+    uint8_t *data;
+    size_t len;
+  } io_queue[N_ASYNC_BUFFERS];
+  unsigned int io_queue_head;
+  unsigned int n_io_queue;
+  int io_errno;
+  uint64_t io_bytes_written;
+  uint64_t io_stalls;
+  int64_t io_stall_nsec;
+  bool io_busy;
+  bool io_shutdown;
+
   unsigned int initialized : 1;
   unsigned int seekable : 1;
+  unsigned int deduplicate_stacks : 1;
+  unsigned int compressed : 1;
+  unsigned int async : 1;
+
+  /* Set while a frame referencing an interned stack is being added so
+   * that no frame index is written between the two.
+   */
+  unsigned int hold_index : 1;
 };
 
+static void sysprof_capture_writer_reset_stacks (SysprofCaptureWriter *self);
+
+static inline void
+sysprof_capture_writer_track_time (SysprofCaptureWriter *self,
+                                   int64_t               time_)
+{
+  if (time_ < self->index_begin_time)
+    self->index_begin_time = time_;
+
+  if (time_ > self->index_end_time)
+    self->index_end_time = time_;
+}
+
 static inline void
-sysprof_capture_writer_frame_init (SysprofCaptureFrame     *frame_,
+sysprof_capture_writer_frame_init (SysprofCaptureWriter    *self,
+                                   SysprofCaptureFrame     *frame_,
                                    int                      len,
                                    int                      cpu,
                                    int32_t                  pid,
                                    int64_t                  time_,
                                    SysprofCaptureFrameType  type)
 {
+  assert (self != NULL);
   assert (frame_ != NULL);
 
+  sysprof_capture_writer_track_time (self, time_);
+
   frame_->len = len;
   frame_->cpu = cpu;
   frame_->pid = pid;
@@ -175,6 +278,7 @@ sysprof_capture_writer_finalize (SysprofCaptureWriter *self)
   if (self != NULL)
     {
       sysprof_capture_writer_flush (self);
+      sysprof_capture_writer_set_async (self, false);
 
       if (self->fd != -1)
         {
@@ -182,6 +286,10 @@ sysprof_capture_writer_finalize (SysprofCaptureWriter *self)
           self->fd = -1;
         }
 
+      free (self->stack_hash);
+      free (self->stack_addrs);
+      free (self->block);
+      free (self->compressed_buf);
       free (self->buf);
       free (self);
     }
@@ -208,6 +316,90 @@ sysprof_capture_writer_unref (SysprofCaptureWriter *self)
     sysprof_capture_writer_finalize (self);
 }
 
+static bool
+sysprof_capture_writer_append_block (SysprofCaptureWriter *self,
+                                     const void           *data,
+                                     size_t                len)
+{
+  assert (self != NULL);
+  assert (self->compressed);
+
+  if (len > self->block_alloc - self->block_len)
+    {
+      size_t block_alloc = self->block_alloc ? self->block_alloc : MAX_BLOCK_SIZE;
+      uint8_t *block;
+
+      while (len > block_alloc - self->block_len)
+        block_alloc *= 2;
+
+      /* Blocks lengths are stored as 32-bit */
+      if (block_alloc > UINT32_MAX)
+        {
+          errno = EFBIG;
+          return false;
+        }
+
+      if (!(block = realloc (self->block, block_alloc)))
+        return false;
+
+      self->block = block;
+      self->block_alloc = block_alloc;
+    }
+
+  memcpy (&self->block[self->block_len], data, len);
+  self->block_len += len;
+
+  return true;
+}
+
+static bool
+sysprof_capture_writer_submit (SysprofCaptureWriter *self)
+{
+  unsigned int tail;
+  int errsv;
+
+  assert (self != NULL);
+  assert (self->async);
+
+  pthread_mutex_lock (&self->io_mutex);
+
+  tail = (self->io_queue_head + self->n_io_queue) % N_ASYNC_BUFFERS;
+  self->io_queue[tail].data = self->buf;
+  self->io_queue[tail].len = self->pos;
+  self->n_io_queue++;
+
+  pthread_cond_broadcast (&self->io_cond);
+
+  self->io_offset += self->pos;
+  self->buf = NULL;
+  self->pos = 0;
+
+  /* Back-pressure, the I/O thread has not kept up with us */
+  if (self->n_io_free == 0)
+    {
+      int64_t begin = SYSPROF_CAPTURE_CURRENT_TIME;
+
+      while (self->n_io_free == 0)
+        pthread_cond_wait (&self->io_cond, &self->io_mutex);
+
+      self->io_stalls++;
+      self->io_stall_nsec += SYSPROF_CAPTURE_CURRENT_TIME - begin;
+    }
+
+  self->buf = self->io_free[--self->n_io_free];
+  errsv = self->io_errno;
+
+  pthread_mutex_unlock (&self->io_mutex);
+
+  if (errsv != 0)
+    {
+      errno = errsv;
+      return false;
+    }
+
+  return true;
+}
+
 static bool
 sysprof_capture_writer_flush_data (SysprofCaptureWriter *self)
 {
@@ -222,6 +414,19 @@ sysprof_capture_writer_flush_data (SysprofCaptureWriter *self)
   if (self->pos == 0)
     return true;
 
+  if (self->compressed)
+    {
+      if (!sysprof_capture_writer_append_block (self, self->buf, self->pos))
+        return false;
+
+      self->pos = 0;
+
+      return true;
+    }
+
+  if (self->async)
+    return sysprof_capture_writer_submit (self);
+
   buf = self->buf;
   to_write = self->pos;
 
@@ -246,9 +451,9 @@ sysprof_capture_writer_flush_data (SysprofCaptureWriter *self)
 }
 
 static bool
-sysprof_capture_writer_write_all (SysprofCaptureWriter *self,
-                                  const void           *data,
-                                  size_t                len)
+sysprof_capture_writer_write_fd (SysprofCaptureWriter *self,
+                                 const void           *data,
+                                 size_t                len)
 {
   const uint8_t *buf = data;
 
@@ -277,6 +482,148 @@ sysprof_capture_writer_write_all (SysprofCaptureWriter *self,
   return true;
 }
 
+static void *
+sysprof_capture_writer_io_thread (void *data)
+{
+  SysprofCaptureWriter *self = data;
+
+  pthread_mutex_lock (&self->io_mutex);
+
+  for (;;)
+    {
+      uint8_t *buf;
+      size_t len;
+      bool failed;
+      int errsv = 0;
+
+      while (self->n_io_queue == 0 && !self->io_shutdown)
+        pthread_cond_wait (&self->io_cond, &self->io_mutex);
+
+      if (self->n_io_queue == 0)
+        break;
+
+      buf = self->io_queue[self->io_queue_head].data;
+      len = self->io_queue[self->io_queue_head].len;
+      self->io_queue_head = (self->io_queue_head + 1) % N_ASYNC_BUFFERS;
+      self->n_io_queue--;
+      self->io_busy = true;
+
+      /* Once a write has failed the capture is truncated, so only
+       * recycle the remaining buffers.
+       */
+      failed = self->io_errno != 0;
+
+      pthread_mutex_unlock (&self->io_mutex);
+
+      if (!failed && !sysprof_capture_writer_write_fd (self, buf, len))
+        errsv = errno ? errno : EIO;
+
+      pthread_mutex_lock (&self->io_mutex);
+
+      if (errsv != 0)
+        self->io_errno = errsv;
+      else if (!failed)
+        self->io_bytes_written += len;
+
+      self->io_free[self->n_io_free++] = buf;
+      self->io_busy = false;
+
+      pthread_cond_broadcast (&self->io_cond);
+    }
+
+  pthread_mutex_unlock (&self->io_mutex);
+
+  return NULL;
+}
+
+/*
+ * Flushes the write buffer and, in asynchronous mode, waits for the I/O
+ * thread to go idle so that the file-descriptor may be used directly.
+ */
+static bool
+sysprof_capture_writer_drain (SysprofCaptureWriter *self)
+{
+  int errsv;
+
+  assert (self != NULL);
+
+  if (!sysprof_capture_writer_flush_data (self))
+    return false;
+
+  if (!self->async)
+    return true;
+
+  pthread_mutex_lock (&self->io_mutex);
+  while (self->n_io_queue > 0 || self->io_busy)
+    pthread_cond_wait (&self->io_cond, &self->io_mutex);
+  errsv = self->io_errno;
+  pthread_mutex_unlock (&self->io_mutex);
+
+  if (errsv != 0)
+    {
+      errno = errsv;
+      return false;
+    }
+
+  return true;
+}
+
+/* Copies @data into the write buffer, for data which is not a frame */
+static bool
+sysprof_capture_writer_write_buffered (SysprofCaptureWriter *self,
+                                       const void           *data,
+                                       size_t                len)
+{
+  const uint8_t *buf = data;
+
+  assert (self != NULL);
+  assert (data != NULL);
+
+  while (len > 0)
+    {
+      size_t to_copy;
+
+      if (self->pos == self->len && !sysprof_capture_writer_flush_data (self))
+        return false;
+
+      to_copy = self->len - self->pos;
+      if (to_copy > len)
+        to_copy = len;
+
+      memcpy (&self->buf[self->pos], buf, to_copy);
+
+      self->pos += to_copy;
+      buf += to_copy;
+      len -= to_copy;
+    }
+
+  return true;
+}
+
+static bool
+sysprof_capture_writer_write_all (SysprofCaptureWriter *self,
+                                  const void           *data,
+                                  size_t                len)
+{
+  assert (self != NULL);
+  assert (data != NULL);
+
+  if (self->compressed)
+    return sysprof_capture_writer_append_block (self, data, len);
+
+  /* The I/O thread owns the file position */
+  if (self->async)
+    return sysprof_capture_writer_write_buffered (self, data, len);
+
+  return sysprof_capture_writer_write_fd (self, data, len);
+}
+
+static inline void
+sysprof_capture_writer_realign (size_t *pos)
+{
+  *pos = (*pos + SYSPROF_CAPTURE_ALIGN - 1) & ~(SYSPROF_CAPTURE_ALIGN - 1);
+}
+
 static void
 sysprof_capture_writer_update_frame_index (SysprofCaptureWriter *self)
 {
@@ -293,6 +640,105 @@ again:
 
   if (ret < 0 && errno == EAGAIN)
     goto again;
+
+  if (!self->compressed)
+    return;
+
+again_block:
+  ret = _sysprof_pwrite (self->fd,
+                         &self->last_block,
+                         sizeof self->last_block,
+                         offsetof (SysprofCaptureFileHeader,
+                                   frame_index.last_block));
+
+  if (ret < 0 && errno == EAGAIN)
+    goto again_block;
+}
+
+static bool
+sysprof_capture_writer_write_block (SysprofCaptureWriter *self)
+{
+  SysprofCaptureBlock block;
+  size_t compressed_len;
+  size_t bound;
+  off_t offset;
+
+  assert (self != NULL);
+  assert (self->compressed);
+
+  if (self->block_len == 0)
+    return true;
+
+  /* Leave room to pad the block so the next header is aligned */
+  bound = _sysprof_capture_compress_bound (self->block_len) + SYSPROF_CAPTURE_ALIGN;
+
+  if (bound > self->compressed_alloc)
+    {
+      uint8_t *compressed_buf;
+
+      if (!(compressed_buf = realloc (self->compressed_buf, bound)))
+        return false;
+
+      self->compressed_buf = compressed_buf;
+      self->compressed_alloc = bound;
+    }
+
+  if (!(compressed_len = _sysprof_capture_compress (self->compressed_buf,
+                                                    self->compressed_alloc - SYSPROF_CAPTURE_ALIGN,
+                                                    self->block,
+                                                    self->block_len)))
+    return false;
+
+  if ((offset = lseek (self->fd, 0L, SEEK_CUR)) < 0)
+    return false;
+
+  block.magic = SYSPROF_CAPTURE_BLOCK_MAGIC;
+  block.compressed_len = compressed_len;
+  block.uncompressed_len = self->block_len;
+  block.padding = 0;
+  block.uncompressed_offset = self->block_offset;
+  block.previous_block = self->last_block;
+
+  /* Keep block headers aligned within the file */
+  memset (&self->compressed_buf[compressed_len], 0, SYSPROF_CAPTURE_ALIGN);
+  sysprof_capture_writer_realign (&compressed_len);
+
+  if (!sysprof_capture_writer_write_fd (self, &block, sizeof block) ||
+      !sysprof_capture_writer_write_fd (self, self->compressed_buf, compressed_len))
+    return false;
+
+  self->last_block = offset;
+  self->block_offset += self->block_len;
+  self->block_len = 0;
+
+  return true;
+}
+
+static bool
+sysprof_capture_writer_add_io_counters (SysprofCaptureWriter *self)
+{
+  SysprofCaptureCounterValue values[3];
+  unsigned int ids[3];
+
+  assert (self != NULL);
+  assert (self->async);
+
+  pthread_mutex_lock (&self->io_mutex);
+  values[0].v64 = self->io_bytes_written;
+  values[1].v64 = self->io_stalls;
+  values[2].v64 = self->io_stall_nsec;
+  pthread_mutex_unlock (&self->io_mutex);
+
+  for (unsigned int i = 0; i < SYSPROF_N_ELEMENTS (ids); i++)
+    ids[i] = self->io_counter_base + i;
+
+  return sysprof_capture_writer_set_counters (self,
+                                              SYSPROF_CAPTURE_CURRENT_TIME,
+                                              -1,
+                                              -1,
+                                              ids,
+                                              values,
+                                              SYSPROF_N_ELEMENTS (ids));
 }
 
 static bool
@@ -307,16 +753,30 @@ sysprof_capture_writer_write_frame_index (SysprofCaptureWriter *self,
   if (!self->seekable || self->frames_since_index == 0)
     return true;
 
-  if (!force && self->frames_since_index < FRAME_INDEX_INTERVAL)
+  if (!force && self->hold_index)
+    return true;
+
+  if (!force &&
+      self->frames_since_index < FRAME_INDEX_INTERVAL &&
+      !(self->compressed && self->block_len >= MAX_BLOCK_SIZE))
     return true;
 
   if (!sysprof_capture_writer_flush_data (self))
     return false;
 
-  if ((offset = lseek (self->fd, 0L, SEEK_CUR)) < 0)
+  if (self->compressed)
+    offset = self->block_offset + self->block_len;
+  else if (self->async)
+    offset = self->io_offset + self->pos;
+  else if ((offset = lseek (self->fd, 0L, SEEK_CUR)) < 0)
     return false;
 
-  sysprof_capture_writer_frame_init (&frame_index.frame,
+  /* Bounds are taken first as they do not cover the index itself */
+  frame_index.begin_time = self->index_begin_time;
+  frame_index.end_time = self->index_end_time;
+
+  sysprof_capture_writer_frame_init (self,
+                                     &frame_index.frame,
                                      sizeof frame_index,
                                      -1,
                                      -1,
@@ -330,16 +790,24 @@ sysprof_capture_writer_write_frame_index (SysprofCaptureWriter *self,
 
   self->last_frame_index = offset;
   self->frames_since_index = 0;
+  self->index_begin_time = INT64_MAX;
+  self->index_end_time = INT64_MIN;
+
+  /* Readers may seek to any index, so stacks must not be referenced
+   * from beyond the index they were written before.
+   */
+  sysprof_capture_writer_reset_stacks (self);
+
+  /* Blocks always end with a frame index */
+  if (self->compressed && !sysprof_capture_writer_write_block (self))
+    return false;
 
   sysprof_capture_writer_update_frame_index (self);
 
-  return true;
-}
+  if (self->async && !sysprof_capture_writer_add_io_counters (self))
+    return false;
 
-static inline void
-sysprof_capture_writer_realign (size_t *pos)
-{
-  *pos = (*pos + SYSPROF_CAPTURE_ALIGN - 1) & ~(SYSPROF_CAPTURE_ALIGN - 1);
+  return true;
 }
 
 static inline bool
@@ -372,6 +840,8 @@ sysprof_capture_writer_allocate (SysprofCaptureWriter *self,
   if (self->initialized && !sysprof_capture_writer_write_frame_index (self, false))
     return NULL;
 
+  self->hold_index = false;
+
   sysprof_capture_writer_realign (len);
 
   if (!sysprof_capture_writer_ensure_space_for (self, *len))
@@ -410,7 +880,8 @@ sysprof_capture_writer_flush_jitmap (SysprofCaptureWriter *self)
 
   sysprof_capture_writer_realign (&len);
 
-  sysprof_capture_writer_frame_init (&jitmap.frame,
+  sysprof_capture_writer_frame_init (self,
+                                     &jitmap.frame,
                                      len,
                                      -1,
                                      _sysprof_getpid (),
@@ -418,12 +889,21 @@ sysprof_capture_writer_flush_jitmap (SysprofCaptureWriter *self)
                                      SYSPROF_CAPTURE_FRAME_JITMAP);
   jitmap.n_jitmaps = self->addr_hash_size;
 
-  if (sizeof jitmap != _sysprof_write (self->fd, &jitmap, sizeof jitmap))
-    return false;
+  if (self->compressed || self->async)
+    {
+      if (!sysprof_capture_writer_write_all (self, &jitmap, sizeof jitmap) ||
+          !sysprof_capture_writer_write_all (self, self->addr_buf, len - sizeof jitmap))
+        return false;
+    }
+  else
+    {
+      if (sizeof jitmap != _sysprof_write (self->fd, &jitmap, sizeof jitmap))
+        return false;
 
-  r = _sysprof_write (self->fd, self->addr_buf, len - sizeof jitmap);
-  if (r < 0 || (size_t)r != (len - sizeof jitmap))
-    return false;
+      r = _sysprof_write (self->fd, self->addr_buf, len - sizeof jitmap);
+      if (r < 0 || (size_t)r != (len - sizeof jitmap))
+        return false;
+    }
 
   self->addr_buf_pos = 0;
   self->addr_hash_size = 0;
@@ -650,6 +1130,8 @@ sysprof_capture_writer_new_from_fd (int    fd,
       return NULL;
     }
 
+  self->index_begin_time = INT64_MAX;
+  self->index_end_time = INT64_MIN;
   self->initialized = true;
 
   assert (self->pos == 0);
@@ -710,7 +1192,8 @@ sysprof_capture_writer_add_map (SysprofCaptureWriter *self,
   if (!ev)
     return false;
 
-  sysprof_capture_writer_frame_init (&ev->frame,
+  sysprof_capture_writer_frame_init (self,
+                                     &ev->frame,
                                      len,
                                      cpu,
                                      pid,
@@ -767,7 +1250,8 @@ sysprof_capture_writer_add_map_with_build_id (SysprofCaptureWriter *self,
   if (!ev)
     return false;
 
-  sysprof_capture_writer_frame_init (&ev->frame,
+  sysprof_capture_writer_frame_init (self,
+                                     &ev->frame,
                                      len,
                                      cpu,
                                      pid,
@@ -816,7 +1300,8 @@ sysprof_capture_writer_add_mark (SysprofCaptureWriter *self,
   if (!ev)
     return false;
 
-  sysprof_capture_writer_frame_init (&ev->frame,
+  sysprof_capture_writer_frame_init (self,
+                                     &ev->frame,
                                      len,
                                      cpu,
                                      pid,
@@ -862,7 +1347,8 @@ sysprof_capture_writer_add_metadata (SysprofCaptureWriter *self,
   if (!ev)
     return false;
 
-  sysprof_capture_writer_frame_init (&ev->frame,
+  sysprof_capture_writer_frame_init (self,
+                                     &ev->frame,
                                      len,
                                      cpu,
                                      pid,
@@ -907,7 +1393,8 @@ sysprof_capture_writer_add_dbus_message (SysprofCaptureWriter *self,
   if (!ev)
     return false;
 
-  sysprof_capture_writer_frame_init (&ev->frame,
+  sysprof_capture_writer_frame_init (self,
+                                     &ev->frame,
                                      len,
                                      cpu,
                                      pid,
@@ -962,7 +1449,8 @@ sysprof_capture_writer_add_process (SysprofCaptureWriter *self,
   if (!ev)
     return false;
 
-  sysprof_capture_writer_frame_init (&ev->frame,
+  sysprof_capture_writer_frame_init (self,
+                                     &ev->frame,
                                      len,
                                      cpu,
                                      pid,
@@ -977,6 +1465,147 @@ sysprof_capture_writer_add_process (SysprofCaptureWriter *self,
   return true;
 }
 
+static inline uint64_t
+sysprof_capture_stack_hash (const SysprofCaptureAddress *addrs,
+                            unsigned int                 n_addrs)
+{
+  uint64_t h = n_addrs;
+
+  for (unsigned int i = 0; i < n_addrs; i++)
+    {
+      h ^= addrs[i];
+      h *= SYSPROF_UINT64_CONSTANT (0x9e3779b97f4a7c15);
+      h ^= h >> 29;
+    }
+
+  return h;
+}
+
+static void
+sysprof_capture_writer_reset_stacks (SysprofCaptureWriter *self)
+{
+  assert (self != NULL);
+
+  if (self->stack_hash != NULL)
+    memset (self->stack_hash, 0, STACK_HASH_SIZE * sizeof *self->stack_hash);
+
+  self->stack_hash_size = 0;
+  self->stack_addrs_pos = 0;
+}
+
+/* Returns the id of a stack frame containing @addrs, writing one if
+ * necessary, or 0 if the addresses should be stored inline.
+ */
+static uint32_t
+sysprof_capture_writer_intern_stack (SysprofCaptureWriter        *self,
+                                     int64_t                      time,
+                                     int                          cpu,
+                                     int32_t                      pid,
+                                     const SysprofCaptureAddress *addrs,
+                                     unsigned int                 n_addrs)
+{
+  SysprofCaptureStackBucket *bucket;
+  SysprofCaptureStack *ev;
+  uint64_t hash;
+  size_t mask = STACK_HASH_SIZE - 1;
+  size_t len;
+  size_t i;
+
+  assert (self != NULL);
+
+  /* A reference costs as much as one address */
+  if (!self->deduplicate_stacks || n_addrs < 2 || n_addrs > UINT16_MAX)
+    return 0;
+
+  if (self->stack_hash == NULL &&
+      !(self->stack_hash = calloc (STACK_HASH_SIZE, sizeof *self->stack_hash)))
+    return 0;
+
+  /* Write any index that is due now, as none may be written between
+   * here and the frame referencing the stack.
+   */
+  if (!sysprof_capture_writer_write_frame_index (self, false))
+    return 0;
+
+  hash = sysprof_capture_stack_hash (addrs, n_addrs);
+
+  for (i = hash & mask; self->stack_hash[i].id != 0; i = (i + 1) & mask)
+    {
+      bucket = &self->stack_hash[i];
+
+      if (bucket->hash == hash &&
+          bucket->n_addrs == n_addrs &&
+          memcmp (&self->stack_addrs[bucket->offset], addrs, n_addrs * sizeof *addrs) == 0)
+        {
+          self->hold_index = true;
+          return bucket->id;
+        }
+    }
+
+  if (self->next_stack_id == UINT32_MAX)
+    return 0;
+
+  if (self->stack_hash_size >= MAX_STACKS ||
+      self->stack_addrs_pos + n_addrs > MAX_STACK_ADDRS)
+    {
+      sysprof_capture_writer_reset_stacks (self);
+
+      for (i = hash & mask; self->stack_hash[i].id != 0; i = (i + 1) & mask) { }
+    }
+
+  if (self->stack_addrs_pos + n_addrs > self->stack_addrs_len)
+    {
+      size_t new_len = self->stack_addrs_len ? self->stack_addrs_len * 2 : 4096;
+      SysprofCaptureAddress *stack_addrs;
+
+      while (new_len < self->stack_addrs_pos + n_addrs)
+        new_len *= 2;
+
+      if (!(stack_addrs = _sysprof_reallocarray (self->stack_addrs, new_len, sizeof *stack_addrs)))
+        return 0;
+
+      self->stack_addrs = stack_addrs;
+      self->stack_addrs_len = new_len;
+    }
+
+  len = sizeof *ev + (n_addrs * sizeof (SysprofCaptureAddress));
+
+  if (!(ev = (SysprofCaptureStack *)sysprof_capture_writer_allocate (self, &len)))
+    return 0;
+
+  sysprof_capture_writer_frame_init (self,
+                                     &ev->frame,
+                                     len,
+                                     cpu,
+                                     pid,
+                                     time,
+                                     SYSPROF_CAPTURE_FRAME_STACK);
+  ev->id = ++self->next_stack_id;
+  ev->n_addrs = n_addrs;
+  ev->padding1 = 0;
+  memcpy (ev->addrs, addrs, n_addrs * sizeof *addrs);
+
+  /* Allocating may have written a frame index, emptying the table */
+  if (self->stack_hash_size == 0)
+    for (i = hash & mask; self->stack_hash[i].id != 0; i = (i + 1) & mask) { }
+
+  memcpy (&self->stack_addrs[self->stack_addrs_pos], addrs, n_addrs * sizeof *addrs);
+
+  bucket = &self->stack_hash[i];
+  bucket->hash = hash;
+  bucket->offset = self->stack_addrs_pos;
+  bucket->id = ev->id;
+  bucket->n_addrs = n_addrs;
+
+  self->stack_addrs_pos += n_addrs;
+  self->stack_hash_size++;
+
+  /* The frame referencing the stack must land in the same chunk */
+  self->hold_index = true;
+
+  return ev->id;
+}
+
 bool
 sysprof_capture_writer_add_sample (SysprofCaptureWriter        *self,
                                    int64_t                      time,
@@ -987,26 +1616,42 @@ sysprof_capture_writer_add_sample (SysprofCaptureWriter        *self,
                                    unsigned int                 n_addrs)
 {
   SysprofCaptureSample *ev;
+  uint32_t stack_id;
   size_t len;
 
   assert (self != NULL);
 
-  len = sizeof *ev + (n_addrs * sizeof (SysprofCaptureAddress));
+  if ((stack_id = sysprof_capture_writer_intern_stack (self, time, cpu, pid, addrs, n_addrs)))
+    len = sizeof *ev + sizeof (SysprofCaptureAddress);
+  else
+    len = sizeof *ev + (n_addrs * sizeof (SysprofCaptureAddress));
 
   ev = (SysprofCaptureSample *)sysprof_capture_writer_allocate (self, &len);
   if (!ev)
     return false;
 
-  sysprof_capture_writer_frame_init (&ev->frame,
+  sysprof_capture_writer_frame_init (self,
+                                     &ev->frame,
                                      len,
                                      cpu,
                                      pid,
                                      time,
                                      SYSPROF_CAPTURE_FRAME_SAMPLE);
-  ev->n_addrs = n_addrs;
+  ev->padding1 = 0;
   ev->tid = tid;
 
-  memcpy (ev->addrs, addrs, (n_addrs * sizeof (SysprofCaptureAddress)));
+  if (stack_id != 0)
+    {
+      ev->n_addrs = 0;
+      ev->stack = 1;
+      ev->addrs[0] = stack_id;
+    }
+  else
+    {
+      ev->n_addrs = n_addrs;
+      ev->stack = 0;
+      memcpy (ev->addrs, addrs, (n_addrs * sizeof (SysprofCaptureAddress)));
+    }
 
   self->stat.frame_count[SYSPROF_CAPTURE_FRAME_SAMPLE]++;
 
@@ -1034,7 +1679,8 @@ sysprof_capture_writer_add_trace (SysprofCaptureWriter        *self,
   if (!ev)
     return false;
 
-  sysprof_capture_writer_frame_init (&ev->frame,
+  sysprof_capture_writer_frame_init (self,
+                                     &ev->frame,
                                      len,
                                      cpu,
                                      pid,
@@ -1065,7 +1711,8 @@ sysprof_capture_writer_add_fork (SysprofCaptureWriter *self,
   if (!ev)
     return false;
 
-  sysprof_capture_writer_frame_init (&ev->frame,
+  sysprof_capture_writer_frame_init (self,
+                                     &ev->frame,
                                      len,
                                      cpu,
                                      pid,
@@ -1103,7 +1750,8 @@ sysprof_capture_writer_add_overlay (SysprofCaptureWriter *self,
   if (!ev)
     return false;
 
-  sysprof_capture_writer_frame_init (&ev->frame,
+  sysprof_capture_writer_frame_init (self,
+                                     &ev->frame,
                                      len,
                                      cpu,
                                      pid,
@@ -1140,7 +1788,8 @@ sysprof_capture_writer_add_exit (SysprofCaptureWriter *self,
   if (!ev)
     return false;
 
-  sysprof_capture_writer_frame_init (&ev->frame,
+  sysprof_capture_writer_frame_init (self,
+                                     &ev->frame,
                                      len,
                                      cpu,
                                      pid,
@@ -1167,7 +1816,8 @@ sysprof_capture_writer_add_timestamp (SysprofCaptureWriter *self,
   if (!ev)
     return false;
 
-  sysprof_capture_writer_frame_init (&ev->frame,
+  sysprof_capture_writer_frame_init (self,
+                                     &ev->frame,
                                      len,
                                      cpu,
                                      pid,
@@ -1206,11 +1856,260 @@ sysprof_capture_writer_flush (SysprofCaptureWriter *self)
 {
   assert (self != NULL);
 
+  /* Compressed captures are only readable up to the last block */
+  if (self->compressed)
+    return sysprof_capture_writer_flush_jitmap (self) &&
+           sysprof_capture_writer_write_frame_index (self, true) &&
+           sysprof_capture_writer_flush_end_time (self);
+
+  if (self->async && !sysprof_capture_writer_add_io_counters (self))
+    return false;
+
   return sysprof_capture_writer_flush_jitmap (self) &&
-         sysprof_capture_writer_flush_data (self) &&
+         sysprof_capture_writer_drain (self) &&
          sysprof_capture_writer_flush_end_time (self);
 }
 
+/**
+ * sysprof_capture_writer_set_compressed:
+ * @self: A #SysprofCaptureWriter
+ * @compressed: if the capture should be compressed
+ *
+ * Sets whether frames are written as independently compressed blocks.
+ *
+ * Compressed captures are much smaller but require a seekable
+ * file-descriptor and can only be read back by readers which support
+ * compression. This must be called before any frames are added.
+ *
+ * `errno` is set to `ENOTSUP` if compression is not available or the
+ * file-descriptor is not seekable, or `EBUSY` if frames have already
+ * been written.
+ *
+ * Returns: %TRUE if successful, otherwise %FALSE and `errno` is set.
+ *
+ * Since: 51
+ */
+bool
+sysprof_capture_writer_set_compressed (SysprofCaptureWriter *self,
+                                       bool                  compressed)
+{
+  SysprofCaptureFileHeader header;
+  ssize_t ret;
+
+  assert (self != NULL);
+
+  compressed = !!compressed;
+
+  if (compressed == self->compressed)
+    return true;
+
+  if (self->pos > 0 || self->frames_since_index > 0 || self->last_frame_index != 0)
+    {
+      errno = EBUSY;
+      return false;
+    }
+
+  if (compressed && (!self->seekable || !_sysprof_capture_compress_supported ()))
+    {
+      errno = ENOTSUP;
+      return false;
+    }
+
+  if (_sysprof_pread (self->fd, &header, sizeof header, 0) != sizeof header)
+    return false;
+
+  header.compressed = compressed;
+  header.frame_index.last_block = 0;
+
+again:
+  ret = _sysprof_pwrite (self->fd, &header, sizeof header, 0);
+
+  if (ret < 0 && errno == EAGAIN)
+    goto again;
+
+  if (ret != sizeof header)
+    return false;
+
+  self->compressed = compressed;
+  self->block_offset = sizeof header;
+  self->block_len = 0;
+  self->last_block = 0;
+
+  return true;
+}
+
+static bool
+sysprof_capture_writer_define_io_counters (SysprofCaptureWriter *self)
+{
+  static const struct {
+    const char *name;
+    const char *description;
+  } info[] = {
+    { "Bytes Written", "Bytes written to the capture by the writer thread" },
+    { "Write Stalls", "Number of times the writer waited for a free buffer" },
+    { "Stall Time", "Nanoseconds spent waiting for a free buffer" },
+  };
+  SysprofCaptureCounter counters[SYSPROF_N_ELEMENTS (info)];
+  unsigned int base;
+
+  assert (self != NULL);
+
+  if (self->io_counter_base != 0)
+    return true;
+
+  if (!(base = sysprof_capture_writer_request_counter (self, SYSPROF_N_ELEMENTS (info))))
+    return false;
+
+  memset (counters, 0, sizeof counters);
+
+  for (unsigned int i = 0; i < SYSPROF_N_ELEMENTS (info); i++)
+    {
+      _sysprof_strlcpy (counters[i].category, "Capture", sizeof counters[i].category);
+      _sysprof_strlcpy (counters[i].name, info[i].name, sizeof counters[i].name);
+      _sysprof_strlcpy (counters[i].description, info[i].description, sizeof counters[i].description);
+      counters[i].id = base + i;
+      counters[i].type = SYSPROF_CAPTURE_COUNTER_INT64;
+    }
+
+  if (!sysprof_capture_writer_define_counters (self,
+                                               SYSPROF_CAPTURE_CURRENT_TIME,
+                                               -1,
+                                               -1,
+                                               counters,
+                                               SYSPROF_N_ELEMENTS (counters)))
+    return false;
+
+  self->io_counter_base = base;
+
+  return true;
+}
+
+/**
+ * sysprof_capture_writer_set_async:
+ * @self: A #SysprofCaptureWriter
+ * @async: if buffers should be written from a separate thread
+ *
+ * Sets whether filled write buffers are handed to a dedicated I/O thread
+ * instead of being written by the caller.
+ *
+ * This allows the caller to continue adding frames while a previous
+ * buffer is written, which avoids blocking the thread producing frames
+ * on a slow disk. Only if all buffers are in flight does adding a frame
+ * wait for the I/O thread.
+ *
+ * The number of bytes written, the number of such stalls and the time
+ * spent in them are recorded in the capture as counters in the
+ * "Capture" category.
+ *
+ * Compressed captures are always written synchronously, in which case
+ * `errno` is set to `ENOTSUP`.
+ *
+ * Returns: %TRUE if successful, otherwise %FALSE and `errno` is set.
+ *
+ * Since: 51
+ */
+bool
+sysprof_capture_writer_set_async (SysprofCaptureWriter *self,
+                                  bool                  async)
+{
+  unsigned int i;
+  off_t offset;
+  bool ret;
+  int errsv;
+
+  assert (self != NULL);
+
+  async = !!async;
+
+  if (async == self->async)
+    return true;
+
+  if (!async)
+    {
+      ret = sysprof_capture_writer_drain (self);
+      errsv = errno;
+
+      pthread_mutex_lock (&self->io_mutex);
+      self->io_shutdown = true;
+      pthread_cond_broadcast (&self->io_cond);
+      pthread_mutex_unlock (&self->io_mutex);
+
+      pthread_join (self->io_thread, NULL);
+
+      for (i = 0; i < self->n_io_free; i++)
+        free (self->io_free[i]);
+      self->n_io_free = 0;
+
+      pthread_cond_destroy (&self->io_cond);
+      pthread_mutex_destroy (&self->io_mutex);
+
+      self->async = false;
+
+      errno = errsv;
+      return ret;
+    }
+
+  if (self->compressed)
+    {
+      errno = ENOTSUP;
+      return false;
+    }
+
+  if (!sysprof_capture_writer_flush_data (self))
+    return false;
+
+  /* Pipes have no position, but also never get a frame index */
+  if ((offset = lseek (self->fd, 0L, SEEK_CUR)) < 0)
+    offset = 0;
+
+  self->io_offset = offset;
+  self->io_queue_head = 0;
+  self->n_io_queue = 0;
+  self->n_io_free = 0;
+  self->io_errno = 0;
+  self->io_busy = false;
+  self->io_shutdown = false;
+
+  for (i = 0; i < N_ASYNC_BUFFERS - 1; i++)
+    {
+      if (!(self->io_free[i] = sysprof_malloc0 (self->len)))
+        goto failure;
+      self->n_io_free++;
+    }
+
+  pthread_mutex_init (&self->io_mutex, NULL);
+  pthread_cond_init (&self->io_cond, NULL);
+
+  if ((errsv = pthread_create (&self->io_thread, NULL, sysprof_capture_writer_io_thread, self)) != 0)
+    {
+      pthread_cond_destroy (&self->io_cond);
+      pthread_mutex_destroy (&self->io_mutex);
+      errno = errsv;
+      goto failure;
+    }
+
+  self->async = true;
+
+  if (!sysprof_capture_writer_define_io_counters (self))
+    {
+      errsv = errno;
+      sysprof_capture_writer_set_async (self, false);
+      errno = errsv;
+      return false;
+    }
+
+  return true;
+
+failure:
+  errsv = errno;
+  for (i = 0; i < self->n_io_free; i++)
+    free (self->io_free[i]);
+  self->n_io_free = 0;
+  errno = errsv;
+
+  return false;
+}
+
 /**
  * sysprof_capture_writer_save_as:
  * @self: A #SysprofCaptureWriter
@@ -1316,6 +2215,13 @@ _sysprof_capture_writer_splice_from_fd (SysprofCaptureWriter *self,
   assert (self != NULL);
   assert (self->fd != -1);
 
+  /* Frames must be re-encoded to be added to a block */
+  if (self->compressed)
+    {
+      errno = ENOTSUP;
+      return false;
+    }
+
   if (-1 == fstat (fd, &stbuf))
     goto handle_errno;
 
@@ -1325,7 +2231,8 @@ _sysprof_capture_writer_splice_from_fd (SysprofCaptureWriter *self,
       return false;
     }
 
-  if (!sysprof_capture_writer_write_frame_index (self, true))
+  if (!sysprof_capture_writer_write_frame_index (self, true) ||
+      !sysprof_capture_writer_drain (self))
     goto handle_errno;
 
   in_off = 256;
@@ -1349,7 +2256,12 @@ _sysprof_capture_writer_splice_from_fd (SysprofCaptureWriter *self,
     }
 
   if (stbuf.st_size > 256)
-    self->frames_since_index = FRAME_INDEX_INTERVAL;
+    {
+      /* Nothing is known about the times of the spliced frames */
+      self->frames_since_index = FRAME_INDEX_INTERVAL;
+      self->index_begin_time = INT64_MIN;
+      self->index_end_time = INT64_MAX;
+    }
 
   return true;
 
@@ -1387,6 +2299,12 @@ sysprof_capture_writer_splice (SysprofCaptureWriter *self,
   assert (dest != NULL);
   assert (dest->fd != -1);
 
+  if (self->compressed)
+    {
+      errno = ENOTSUP;
+      return false;
+    }
+
   /* Flush before writing anything to ensure consistency */
   if (!sysprof_capture_writer_flush (self) || !sysprof_capture_writer_flush (dest))
     goto handle_errno;
@@ -1507,7 +2425,8 @@ sysprof_capture_writer_define_counters (SysprofCaptureWriter        *self,
   if (!def)
     return false;
 
-  sysprof_capture_writer_frame_init (&def->frame,
+  sysprof_capture_writer_frame_init (self,
+                                     &def->frame,
                                      len,
                                      cpu,
                                      pid,
@@ -1565,7 +2484,8 @@ sysprof_capture_writer_set_counters (SysprofCaptureWriter             *self,
 
   memset (set, 0, len);
 
-  sysprof_capture_writer_frame_init (&set->frame,
+  sysprof_capture_writer_frame_init (self,
+                                     &set->frame,
                                      len,
                                      cpu,
                                      pid,
@@ -1684,6 +2604,31 @@ sysprof_capture_writer_get_buffer_size (SysprofCaptureWriter *self)
   return self->len;
 }
 
+/**
+ * sysprof_capture_writer_set_deduplicate_stacks:
+ * @self: a #SysprofCaptureWriter
+ * @deduplicate_stacks: if stacks should be deduplicated
+ *
+ * When enabled, samples and allocations which repeat a callchain that
+ * was already written will reference a #SysprofCaptureStack by id rather
+ * than storing the addresses again. This can shrink captures with deep,
+ * repetitive stacks considerably.
+ *
+ * Readers older than the introduction of %SYSPROF_CAPTURE_FRAME_STACK
+ * will see such samples as having no addresses.
+ *
+ * Since: 51
+ */
+void
+sysprof_capture_writer_set_deduplicate_stacks (SysprofCaptureWriter *self,
+                                               bool                  deduplicate_stacks)
+{
+  assert (self != NULL);
+
+  self->deduplicate_stacks = !!deduplicate_stacks;
+}
+
+
 bool
 sysprof_capture_writer_add_log (SysprofCaptureWriter *self,
                                 int64_t               time,
@@ -1711,7 +2656,8 @@ sysprof_capture_writer_add_log (SysprofCaptureWriter *self,
   if (!ev)
     return false;
 
-  sysprof_capture_writer_frame_init (&ev->frame,
+  sysprof_capture_writer_frame_init (self,
+                                     &ev->frame,
                                      len,
                                      cpu,
                                      pid,
@@ -1749,7 +2695,8 @@ sysprof_capture_writer_add_file (SysprofCaptureWriter *self,
   if (!ev)
     return false;
 
-  sysprof_capture_writer_frame_init (&ev->frame,
+  sysprof_capture_writer_frame_init (self,
+                                     &ev->frame,
                                      len,
                                      cpu,
                                      pid,
@@ -1819,6 +2766,20 @@ sysprof_capture_writer_add_allocation (SysprofCaptureWriter  *self,
   assert (self != NULL);
   assert (backtrace_func != NULL);
 
+  /* The stack must be known before the frame is allocated */
+  if (self->deduplicate_stacks)
+    {
+      SysprofCaptureAddress addrs[MAX_UNWIND_DEPTH];
+
+      if ((n_addrs = backtrace_func (addrs, MAX_UNWIND_DEPTH, backtrace_data)) < 0 ||
+          n_addrs > MAX_UNWIND_DEPTH)
+        n_addrs = 0;
+
+      return sysprof_capture_writer_add_allocation_copy (self, time, cpu, pid, tid,
+                                                         alloc_addr, alloc_size,
+                                                         addrs, n_addrs);
+    }
+
   len = sizeof *ev + (MAX_UNWIND_DEPTH * sizeof (SysprofCaptureAddress));
   ev = (SysprofCaptureAllocation *)sysprof_capture_writer_allocate (self, &len);
   if (!ev)
@@ -1827,7 +2788,8 @@ sysprof_capture_writer_add_allocation (SysprofCaptureWriter  *self,
   if ((n_addrs = backtrace_func (ev->addrs, MAX_UNWIND_DEPTH, backtrace_data)) < 0)
     n_addrs = 0;
 
-  sysprof_capture_writer_frame_init (&ev->frame,
+  sysprof_capture_writer_frame_init (self,
+                                     &ev->frame,
                                      len,
                                      cpu,
                                      pid,
@@ -1837,6 +2799,8 @@ sysprof_capture_writer_add_allocation (SysprofCaptureWriter  *self,
   ev->alloc_size = alloc_size;
   ev->alloc_addr = alloc_addr;
   ev->padding1 = 0;
+  ev->stack = 0;
+  ev->sampled = 0;
   ev->tid = tid;
   ev->n_addrs = 0;
 
@@ -1866,8 +2830,36 @@ sysprof_capture_writer_add_allocation_copy (SysprofCaptureWriter        *self,
                                             int64_t                      alloc_size,
                                             const SysprofCaptureAddress *addrs,
                                             unsigned int                 n_addrs)
+{
+  return sysprof_capture_writer_add_allocation_sampled (self, time, cpu, pid, tid,
+                                                        alloc_addr, alloc_size, 0,
+                                                        addrs, n_addrs);
+}
+
+/**
+ * sysprof_capture_writer_add_allocation_sampled:
+ * @sample_interval: mean number of bytes allocated between samples, or
+ *   0 if every allocation is recorded
+ *
+ * Like sysprof_capture_writer_add_allocation_copy() but for allocations
+ * chosen by sampling, so that readers may scale @alloc_size back up.
+ *
+ * Since: 51
+ */
+bool
+sysprof_capture_writer_add_allocation_sampled (SysprofCaptureWriter        *self,
+                                               int64_t                      time,
+                                               int                          cpu,
+                                               int32_t                      pid,
+                                               int32_t                      tid,
+                                               SysprofCaptureAddress        alloc_addr,
+                                               int64_t                      alloc_size,
+                                               uint32_t                     sample_interval,
+                                               const SysprofCaptureAddress *addrs,
+                                               unsigned int                 n_addrs)
 {
   SysprofCaptureAllocation *ev;
+  uint32_t stack_id;
   size_t len;
 
   assert (self != NULL);
@@ -1875,25 +2867,42 @@ sysprof_capture_writer_add_allocation_copy (SysprofCaptureWriter        *self,
   if (n_addrs > 0xFFF)
     n_addrs = 0xFFF;
 
-  len = sizeof *ev + (n_addrs * sizeof (SysprofCaptureAddress));
+  if ((stack_id = sysprof_capture_writer_intern_stack (self, time, cpu, pid, addrs, n_addrs)))
+    len = sizeof *ev + sizeof (SysprofCaptureAddress);
+  else
+    len = sizeof *ev + (n_addrs * sizeof (SysprofCaptureAddress));
+
   ev = (SysprofCaptureAllocation *)sysprof_capture_writer_allocate (self, &len);
   if (!ev)
     return false;
 
-  sysprof_capture_writer_frame_init (&ev->frame,
+  sysprof_capture_writer_frame_init (self,
+                                     &ev->frame,
                                      len,
                                      cpu,
                                      pid,
                                      time,
                                      SYSPROF_CAPTURE_FRAME_ALLOCATION);
 
+  ev->frame.padding2 = sample_interval;
   ev->alloc_size = alloc_size;
   ev->alloc_addr = alloc_addr;
   ev->padding1 = 0;
+  ev->sampled = sample_interval != 0;
   ev->tid = tid;
-  ev->n_addrs = n_addrs;
 
-  memcpy (ev->addrs, addrs, sizeof (SysprofCaptureAddress) * n_addrs);
+  if (stack_id != 0)
+    {
+      ev->n_addrs = 0;
+      ev->stack = 1;
+      ev->addrs[0] = stack_id;
+    }
+  else
+    {
+      ev->n_addrs = n_addrs;
+      ev->stack = 0;
+      memcpy (ev->addrs, addrs, sizeof (SysprofCaptureAddress) * n_addrs);
+    }
 
   self->stat.frame_count[SYSPROF_CAPTURE_FRAME_ALLOCATION]++;
 
@@ -1912,7 +2921,8 @@ _sysprof_capture_writer_add_raw (SysprofCaptureWriter      *self,
   if (fr->type == SYSPROF_CAPTURE_FRAME_TIMESTAMP &&
       (fr->padding2 == SYSPROF_CAPTURE_FRAME_INDEX_MAGIC ||
        bswap_32 (fr->padding2) == SYSPROF_CAPTURE_FRAME_INDEX_MAGIC) &&
-      fr->len == sizeof (SysprofCaptureFrameIndex))
+      (fr->len == SYSPROF_CAPTURE_FRAME_INDEX_MIN_LEN ||
+       fr->len == sizeof (SysprofCaptureFrameIndex)))
     return true;
 
   assert ((fr->len & 0x7) == 0);
@@ -1928,6 +2938,8 @@ _sysprof_capture_writer_add_raw (SysprofCaptureWriter      *self,
 
   memcpy (begin, fr, fr->len);
 
+  sysprof_capture_writer_track_time (self, fr->time);
+
   if (fr->type < SYSPROF_N_ELEMENTS (self->stat.frame_count))
     self->stat.frame_count[fr->type]++;
 
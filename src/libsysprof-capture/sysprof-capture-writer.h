@@ -75,6 +75,15 @@ SysprofCaptureWriter *sysprof_capture_writer_new_from_fd                     (in
                                                                               size_t                             buffer_size);
 SYSPROF_AVAILABLE_IN_ALL
 size_t                sysprof_capture_writer_get_buffer_size                 (SysprofCaptureWriter              *self);
+SYSPROF_AVAILABLE_IN_51
+void                  sysprof_capture_writer_set_deduplicate_stacks          (SysprofCaptureWriter              *self,
+                                                                              bool                               deduplicate_stacks);
+SYSPROF_AVAILABLE_IN_51
+bool                  sysprof_capture_writer_set_compressed                  (SysprofCaptureWriter              *self,
+                                                                              bool                               compressed);
+SYSPROF_AVAILABLE_IN_51
+bool                  sysprof_capture_writer_set_async                       (SysprofCaptureWriter              *self,
+                                                                              bool                               async);
 SYSPROF_AVAILABLE_IN_ALL
 SysprofCaptureWriter *sysprof_capture_writer_ref                             (SysprofCaptureWriter              *self);
 SYSPROF_AVAILABLE_IN_ALL
@@ -221,6 +230,17 @@ bool                  sysprof_capture_writer_add_allocation_copy             (Sy
                                                                               int64_t                            alloc_size,
                                                                               const SysprofCaptureAddress       *addrs,
                                                                               unsigned int                       n_addrs);
+SYSPROF_AVAILABLE_IN_51
+bool                  sysprof_capture_writer_add_allocation_sampled          (SysprofCaptureWriter              *self,
+                                                                              int64_t                            time,
+                                                                              int                                cpu,
+                                                                              int32_t                            pid,
+                                                                              int32_t                            tid,
+                                                                              SysprofCaptureAddress              alloc_addr,
+                                                                              int64_t                            alloc_size,
+                                                                              uint32_t                           sample_interval,
+                                                                              const SysprofCaptureAddress       *addrs,
+                                                                              unsigned int                       n_addrs);
 SYSPROF_AVAILABLE_IN_3_40
 bool                  sysprof_capture_writer_add_overlay                     (SysprofCaptureWriter              *self,
                                                                               int64_t                            time,
@@ -254,6 +274,10 @@ bool                  sysprof_capture_writer_splice                          (Sy
 SYSPROF_AVAILABLE_IN_ALL
 bool                  sysprof_capture_writer_cat                             (SysprofCaptureWriter              *self,
                                                                               SysprofCaptureReader              *reader);
+SYSPROF_AVAILABLE_IN_51
+bool                  sysprof_capture_writer_merge                           (SysprofCaptureWriter              *self,
+                                                                              SysprofCaptureReader             **readers,
+                                                                              unsigned int                       n_readers);
 SYSPROF_INTERNAL
 bool                  _sysprof_capture_writer_add_raw                        (SysprofCaptureWriter              *self,
                                                                               const SysprofCaptureFrame         *frame);
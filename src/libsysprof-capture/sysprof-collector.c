@@ -96,6 +96,7 @@ typedef struct
 {
   MappedRingBuffer *buffer;
   bool is_shared;
+  bool needs_lock;
   int tid;
   int pid;
   int next_counter_id;
@@ -328,6 +329,26 @@ close_fds_err:
   return -1;
 }
 
+/* SYSPROF_COLLECTOR_POLICY picks what to do when the reader cannot
+ * keep up: "block" (the default), "drop" or "sample".
+ */
+static MappedRingBufferPolicy
+get_ring_policy (void)
+{
+  const char *policy = getenv ("SYSPROF_COLLECTOR_POLICY");
+
+  if (policy == NULL)
+    return MAPPED_RING_BUFFER_BLOCK;
+
+  if (strcmp (policy, "drop") == 0)
+    return MAPPED_RING_BUFFER_DROP;
+
+  if (strcmp (policy, "sample") == 0)
+    return MAPPED_RING_BUFFER_SAMPLE;
+
+  return MAPPED_RING_BUFFER_BLOCK;
+}
+
 /* Called with @control_fd_lock held. */
 static MappedRingBuffer *
 request_writer (void)
@@ -365,6 +386,9 @@ request_writer (void)
             {
               buffer = mapped_ring_buffer_new_writer (ring_fd);
               close (ring_fd);
+
+              if (buffer != NULL)
+                mapped_ring_buffer_set_policy (buffer, get_ring_policy ());
             }
         }
     }
@@ -379,6 +403,11 @@ write_final_frame (MappedRingBuffer *ring)
 
   assert (ring != NULL);
 
+  /* The space for this was reserved by every other allocation, so it
+   * must never be dropped or sampled away.
+   */
+  mapped_ring_buffer_set_policy (ring, MAPPED_RING_BUFFER_BLOCK);
+
   if ((fr = mapped_ring_buffer_allocate (ring, sizeof *fr)))
     {
       fr->len = sizeof *fr; /* aligned */
@@ -386,7 +415,7 @@ write_final_frame (MappedRingBuffer *ring)
       fr->cpu = -1;
       fr->pid = -1;
       fr->time = SYSPROF_CAPTURE_CURRENT_TIME;
-      mapped_ring_buffer_advance (ring, fr->len);
+      mapped_ring_buffer_commit (ring, fr, fr->len);
     }
 }
 
@@ -469,6 +498,12 @@ sysprof_collector_get (void)
 
     if (self->is_shared)
       {
+        /* Threads can share the buffer without locking if the reader
+         * understands multi-producer framing.
+         */
+        self->needs_lock = self->buffer != NULL &&
+                           !mapped_ring_buffer_enable_multi_producer (self->buffer);
+
         if (pthread_setspecific (collector_key, COLLECTOR_INVALID) != 0)
           goto fail;
         sysprof_collector_free (old_collector);
@@ -522,7 +557,7 @@ sysprof_collector_init (void)
     const SysprofCollector *collector = sysprof_collector_get (); \
     if SYSPROF_LIKELY (collector->buffer)                         \
       {                                                           \
-        if SYSPROF_UNLIKELY (collector->is_shared)                \
+        if SYSPROF_UNLIKELY (collector->needs_lock)               \
           pthread_mutex_lock (&control_fd_lock);                  \
                                                                   \
         {
@@ -530,7 +565,7 @@ sysprof_collector_init (void)
 #define COLLECTOR_END                                             \
         }                                                         \
                                                                   \
-        if SYSPROF_UNLIKELY (collector->is_shared)                \
+        if SYSPROF_UNLIKELY (collector->needs_lock)               \
           pthread_mutex_unlock (&control_fd_lock);                \
       }                                                           \
   } while (0)
@@ -540,6 +575,26 @@ sysprof_collector_allocate (SysprofCaptureAddress   alloc_addr,
                             int64_t                 alloc_size,
                             SysprofBacktraceFunc    backtrace_func,
                             void                   *backtrace_data)
+{
+  sysprof_collector_allocate_sampled (alloc_addr, alloc_size, 0, backtrace_func, backtrace_data);
+}
+
+/*
+ * sysprof_collector_allocate_sampled:
+ * @sample_interval: mean number of bytes allocated between samples, or
+ *   0 if every allocation is recorded
+ *
+ * Like sysprof_collector_allocate() for allocators which only record a
+ * sample of their allocations, and the frees of those allocations.
+ *
+ * Since: 51
+ */
+void
+sysprof_collector_allocate_sampled (SysprofCaptureAddress   alloc_addr,
+                                    int64_t                 alloc_size,
+                                    uint32_t                sample_interval,
+                                    SysprofBacktraceFunc    backtrace_func,
+                                    void                   *backtrace_data)
 {
   COLLECTOR_BEGIN {
     SysprofCaptureAllocation *ev;
@@ -573,12 +628,16 @@ sysprof_collector_allocate (SysprofCaptureAddress   alloc_addr,
         ev->frame.cpu = _do_getcpu ();
         ev->frame.pid = collector->pid;
         ev->frame.time = SYSPROF_CAPTURE_CURRENT_TIME;
+        ev->frame.padding1 = 0;
+        ev->frame.padding2 = sample_interval;
         ev->tid = collector->tid;
         ev->alloc_addr = alloc_addr;
         ev->alloc_size = alloc_size;
+        ev->stack = 0;
+        ev->sampled = sample_interval != 0;
         ev->padding1 = 0;
 
-        mapped_ring_buffer_advance (collector->buffer, ev->frame.len);
+        mapped_ring_buffer_commit (collector->buffer, ev, ev->frame.len);
       }
 
   } COLLECTOR_END;
@@ -613,7 +672,7 @@ sysprof_collector_sample (SysprofBacktraceFunc  backtrace_func,
         ev->tid = collector->tid;
         ev->padding1 = 0;
 
-        mapped_ring_buffer_advance (collector->buffer, ev->frame.len);
+        mapped_ring_buffer_commit (collector->buffer, ev, ev->frame.len);
       }
 
   } COLLECTOR_END;
@@ -650,7 +709,7 @@ sysprof_collector_trace (SysprofBacktraceFunc  backtrace_func,
         ev->entering = !!entering;
         ev->padding1 = 0;
 
-        mapped_ring_buffer_advance (collector->buffer, ev->frame.len);
+        mapped_ring_buffer_commit (collector->buffer, ev, ev->frame.len);
       }
 
   } COLLECTOR_END;
@@ -693,7 +752,7 @@ sysprof_collector_mark (int64_t     time,
         memcpy (ev->message, message, sl);
         ev->message[sl] = 0;
 
-        mapped_ring_buffer_advance (collector->buffer, ev->frame.len);
+        mapped_ring_buffer_commit (collector->buffer, ev, ev->frame.len);
       }
 
   } COLLECTOR_END;
@@ -759,7 +818,7 @@ sysprof_collector_mark_vprintf (int64_t     time,
         vsnprintf (ev->message, sl + 1, message_format, args2);
         ev->message[sl] = 0;
 
-        mapped_ring_buffer_advance (collector->buffer, ev->frame.len);
+        mapped_ring_buffer_commit (collector->buffer, ev, ev->frame.len);
       }
 
     va_end (args2);
@@ -799,7 +858,7 @@ sysprof_collector_log (int             severity,
         memcpy (ev->message, message, sl);
         ev->message[sl] = 0;
 
-        mapped_ring_buffer_advance (collector->buffer, ev->frame.len);
+        mapped_ring_buffer_commit (collector->buffer, ev, ev->frame.len);
       }
 
   } COLLECTOR_END;
@@ -842,7 +901,7 @@ sysprof_collector_log_printf (int             severity,
         memcpy (ev->message, formatted, sl);
         ev->message[sl] = 0;
 
-        mapped_ring_buffer_advance (collector->buffer, ev->frame.len);
+        mapped_ring_buffer_commit (collector->buffer, ev, ev->frame.len);
       }
   } COLLECTOR_END;
 }
@@ -872,7 +931,7 @@ sysprof_collector_define_counters (const SysprofCaptureCounter *counters,
         def->n_counters = n_counters;
         memcpy (def->counters, counters, sizeof *counters * n_counters);
 
-        mapped_ring_buffer_advance (collector->buffer, def->frame.len);
+        mapped_ring_buffer_commit (collector->buffer, def, def->frame.len);
       }
   } COLLECTOR_END;
 }
@@ -930,7 +989,7 @@ sysprof_collector_set_counters (const unsigned int               *counters_ids,
               }
           }
 
-        mapped_ring_buffer_advance (collector->buffer, set->frame.len);
+        mapped_ring_buffer_commit (collector->buffer, set, set->frame.len);
       }
   } COLLECTOR_END;
 }
@@ -944,8 +1003,9 @@ sysprof_collector_request_counters (unsigned int n_counters)
     return 0;
 
   COLLECTOR_BEGIN {
-    ret = collector->next_counter_id;
-    ((SysprofCollector *)collector)->next_counter_id += n_counters;
+    ret = __atomic_fetch_add (&((SysprofCollector *)collector)->next_counter_id,
+                              n_counters,
+                              __ATOMIC_RELAXED);
   } COLLECTOR_END;
 
   return ret;
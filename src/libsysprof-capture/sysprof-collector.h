@@ -73,6 +73,12 @@ void         sysprof_collector_allocate         (SysprofCaptureAddress
                                                  int64_t                           alloc_size,
                                                  SysprofBacktraceFunc              backtrace_func,
                                                  void                             *backtrace_data);
+SYSPROF_AVAILABLE_IN_51
+void         sysprof_collector_allocate_sampled (SysprofCaptureAddress             alloc_addr,
+                                                 int64_t                           alloc_size,
+                                                 uint32_t                          sample_interval,
+                                                 SysprofBacktraceFunc              backtrace_func,
+                                                 void                             *backtrace_data);
 SYSPROF_AVAILABLE_IN_3_36
 void         sysprof_collector_sample           (SysprofBacktraceFunc              backtrace_func,
                                                  void                             *backtrace_data);
@@ -94,6 +94,7 @@
 #define SYSPROF_VERSION_48   (SYSPROF_ENCODE_VERSION (48, 0, 0))
 #define SYSPROF_VERSION_49   (SYSPROF_ENCODE_VERSION (49, 0, 0))
 #define SYSPROF_VERSION_50   (SYSPROF_ENCODE_VERSION (50, 0, 0))
+#define SYSPROF_VERSION_51   (SYSPROF_ENCODE_VERSION (51, 0, 0))
 
 #if (SYSPROF_MINOR_VERSION == 99)
 # define SYSPROF_VERSION_CUR_STABLE (SYSPROF_ENCODE_VERSION (SYSPROF_MAJOR_VERSION + 1, 0, 0))
@@ -277,3 +278,17 @@
 #else
 # define SYSPROF_AVAILABLE_IN_50                   _SYSPROF_EXTERN
 #endif
+
+#if SYSPROF_VERSION_MIN_REQUIRED >= SYSPROF_VERSION_51
+# define SYSPROF_DEPRECATED_IN_51                  SYSPROF_DEPRECATED
+# define SYSPROF_DEPRECATED_IN_51_FOR(f)           SYSPROF_DEPRECATED_FOR(f)
+#else
+# define SYSPROF_DEPRECATED_IN_51                  _SYSPROF_EXTERN
+# define SYSPROF_DEPRECATED_IN_51_FOR(f)           _SYSPROF_EXTERN
+#endif
+
+#if SYSPROF_VERSION_MAX_ALLOWED < SYSPROF_VERSION_51
+# define SYSPROF_AVAILABLE_IN_51                   SYSPROF_UNAVAILABLE(51, 0)
+#else
+# define SYSPROF_AVAILABLE_IN_51                   _SYSPROF_EXTERN
+#endif
@@ -0,0 +1,369 @@
+/* test-capture-condition.c
+ *
+ * Copyright 2023 Christian Hergert <chergert@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "config.h"
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <sysprof-capture.h>
+
+#include "sysprof-capture-condition-private.h"
+
+#define N_PIDS     1000
+#define N_COUNTERS 50
+#define MAX_TIME   1000000
+
+static const SysprofCaptureFrameType frame_types[] = {
+  SYSPROF_CAPTURE_FRAME_SAMPLE,
+  SYSPROF_CAPTURE_FRAME_MARK,
+  SYSPROF_CAPTURE_FRAME_LOG,
+  SYSPROF_CAPTURE_FRAME_PROCESS,
+  SYSPROF_CAPTURE_FRAME_CTRDEF,
+  SYSPROF_CAPTURE_FRAME_CTRSET,
+  SYSPROF_CAPTURE_FRAME_FILE_CHUNK,
+  SYSPROF_CAPTURE_FRAME_ALLOCATION,
+};
+
+static SysprofCaptureFrame *
+make_frame (GRand *rand)
+{
+  SysprofCaptureFrameType type = frame_types[g_rand_int_range (rand, 0, G_N_ELEMENTS (frame_types))];
+  SysprofCaptureFrame *frame;
+
+  switch (type)
+    {
+    case SYSPROF_CAPTURE_FRAME_CTRSET:
+      {
+        SysprofCaptureCounterSet *set;
+
+        set = g_malloc0 (sizeof *set + sizeof (SysprofCaptureCounterValues));
+        set->n_values = 1;
+        for (guint i = 0; i < G_N_ELEMENTS (set->values[0].ids); i++)
+          set->values[0].ids[i] = g_rand_int_range (rand, 1, N_COUNTERS);
+        frame = &set->frame;
+      }
+      break;
+
+    case SYSPROF_CAPTURE_FRAME_CTRDEF:
+      {
+        SysprofCaptureCounterDefine *def;
+
+        def = g_malloc0 (sizeof *def + sizeof (SysprofCaptureCounter));
+        def->n_counters = 1;
+        def->counters[0].id = g_rand_int_range (rand, 1, N_COUNTERS);
+        frame = &def->frame;
+      }
+      break;
+
+    case SYSPROF_CAPTURE_FRAME_FILE_CHUNK:
+      {
+        SysprofCaptureFileChunk *chunk;
+
+        chunk = g_malloc0 (sizeof *chunk);
+        g_strlcpy (chunk->path, g_rand_boolean (rand) ? "/a" : "/b", sizeof chunk->path);
+        frame = &chunk->frame;
+      }
+      break;
+
+    default:
+      frame = g_malloc0 (sizeof (SysprofCaptureSample));
+      break;
+    }
+
+  frame->type = type;
+  frame->pid = g_rand_int_range (rand, 0, N_PIDS);
+  frame->time = g_rand_int_range (rand, 0, MAX_TIME);
+
+  return frame;
+}
+
+static GPtrArray *
+make_frames (GRand *rand,
+             guint  n_frames)
+{
+  GPtrArray *frames = g_ptr_array_new_full (n_frames, g_free);
+
+  for (guint i = 0; i < n_frames; i++)
+    g_ptr_array_add (frames, make_frame (rand));
+
+  return frames;
+}
+
+static SysprofCaptureCondition *
+make_pid_in (GRand *rand,
+             guint  n_pids)
+{
+  g_autofree gint32 *pids = g_new (gint32, MAX (1, n_pids));
+
+  for (guint i = 0; i < n_pids; i++)
+    pids[i] = g_rand_int_range (rand, 0, N_PIDS);
+
+  return sysprof_capture_condition_new_where_pid_in (n_pids, pids);
+}
+
+static SysprofCaptureCondition *
+make_condition (GRand *rand,
+                guint  depth)
+{
+  switch (depth > 0 ? g_rand_int_range (rand, 0, 7) : g_rand_int_range (rand, 2, 7))
+    {
+    case 0:
+      return sysprof_capture_condition_new_and (make_condition (rand, depth - 1),
+                                                make_condition (rand, depth - 1));
+
+    case 1:
+      return sysprof_capture_condition_new_or (make_condition (rand, depth - 1),
+                                               make_condition (rand, depth - 1));
+
+    case 2:
+      {
+        SysprofCaptureFrameType types[4];
+        guint n_types = g_rand_int_range (rand, 0, G_N_ELEMENTS (types) + 1);
+
+        for (guint i = 0; i < n_types; i++)
+          types[i] = frame_types[g_rand_int_range (rand, 0, G_N_ELEMENTS (frame_types))];
+
+        return sysprof_capture_condition_new_where_type_in (n_types, types);
+      }
+
+    case 3:
+      return sysprof_capture_condition_new_where_time_between (g_rand_int_range (rand, 0, MAX_TIME),
+                                                               g_rand_int_range (rand, 0, MAX_TIME));
+
+    case 4:
+      return make_pid_in (rand, g_rand_int_range (rand, 0, 300));
+
+    case 5:
+      {
+        guint counters[5];
+        guint n_counters = g_rand_int_range (rand, 0, G_N_ELEMENTS (counters) + 1);
+
+        for (guint i = 0; i < n_counters; i++)
+          counters[i] = g_rand_int_range (rand, 1, N_COUNTERS);
+
+        return sysprof_capture_condition_new_where_counter_in (n_counters, counters);
+      }
+
+    case 6:
+    default:
+      return sysprof_capture_condition_new_where_file (g_rand_boolean (rand) ? "/a" : "/c");
+    }
+}
+
+static gboolean
+match_any (SysprofCaptureCondition   **conditions,
+           guint                       n_conditions,
+           const SysprofCaptureFrame  *frame)
+{
+  for (guint i = 0; i < n_conditions; i++)
+    {
+      if (sysprof_capture_condition_match (conditions[i], frame))
+        return TRUE;
+    }
+
+  return FALSE;
+}
+
+static void
+test_condition_compile (void)
+{
+  g_autoptr(GRand) rand = g_rand_new_with_seed (1234);
+  g_autoptr(GPtrArray) frames = make_frames (rand, 2000);
+
+  for (guint round = 0; round < 500; round++)
+    {
+      SysprofCaptureCondition *conditions[3];
+      SysprofCaptureConditionProgram *program;
+      guint n_conditions = g_rand_int_range (rand, 1, G_N_ELEMENTS (conditions) + 1);
+
+      for (guint i = 0; i < n_conditions; i++)
+        conditions[i] = make_condition (rand, 4);
+
+      program = _sysprof_capture_condition_compile (conditions, n_conditions);
+      g_assert_nonnull (program);
+
+      for (guint i = 0; i < frames->len; i++)
+        {
+          const SysprofCaptureFrame *frame = g_ptr_array_index (frames, i);
+          gboolean expected = match_any (conditions, n_conditions, frame);
+
+          g_assert_cmpint (expected, ==, _sysprof_capture_condition_program_match (program, frame));
+
+          if (expected)
+            g_assert_true (_sysprof_capture_condition_program_may_match_type (program, frame->type));
+        }
+
+      _sysprof_capture_condition_program_free (program);
+
+      for (guint i = 0; i < n_conditions; i++)
+        sysprof_capture_condition_unref (conditions[i]);
+    }
+}
+
+static void
+test_condition_merge (void)
+{
+  static const SysprofCaptureFrameType samples[] = { SYSPROF_CAPTURE_FRAME_SAMPLE };
+  static const SysprofCaptureFrameType marks[] = { SYSPROF_CAPTURE_FRAME_MARK };
+  static const guint counters[] = { 1 };
+  SysprofCaptureConditionProgram *program;
+  SysprofCaptureCondition *condition;
+
+  /* Types which can never be the same frame */
+  condition = sysprof_capture_condition_new_and (sysprof_capture_condition_new_where_type_in (1, samples),
+                                                 sysprof_capture_condition_new_where_type_in (1, marks));
+  program = _sysprof_capture_condition_compile (&condition, 1);
+  g_assert_false (_sysprof_capture_condition_program_may_match_type (program, SYSPROF_CAPTURE_FRAME_SAMPLE));
+  g_assert_false (_sysprof_capture_condition_program_may_match_type (program, SYSPROF_CAPTURE_FRAME_MARK));
+  _sysprof_capture_condition_program_free (program);
+  sysprof_capture_condition_unref (condition);
+
+  /* Counters only ever match counter frames */
+  condition = sysprof_capture_condition_new_or (sysprof_capture_condition_new_where_counter_in (1, counters),
+                                                sysprof_capture_condition_new_where_type_in (1, marks));
+  program = _sysprof_capture_condition_compile (&condition, 1);
+  g_assert_true (_sysprof_capture_condition_program_may_match_type (program, SYSPROF_CAPTURE_FRAME_CTRSET));
+  g_assert_true (_sysprof_capture_condition_program_may_match_type (program, SYSPROF_CAPTURE_FRAME_MARK));
+  g_assert_false (_sysprof_capture_condition_program_may_match_type (program, SYSPROF_CAPTURE_FRAME_SAMPLE));
+  _sysprof_capture_condition_program_free (program);
+  sysprof_capture_condition_unref (condition);
+}
+
+static void
+test_condition_benchmark (void)
+{
+  g_autoptr(GRand) rand = g_rand_new_with_seed (4321);
+  g_autoptr(GPtrArray) frames = make_frames (rand, g_test_perf () ? 5000000 : 200000);
+  static const SysprofCaptureFrameType types[] = {
+    SYSPROF_CAPTURE_FRAME_SAMPLE,
+    SYSPROF_CAPTURE_FRAME_ALLOCATION,
+  };
+  SysprofCaptureConditionProgram *program;
+  SysprofCaptureCondition *condition;
+  guint tree_matches = 0;
+  guint program_matches = 0;
+  gint64 begin;
+  gint64 tree_usec;
+  gint64 program_usec;
+
+  /* Samples and allocations from a few hundred pids in two time ranges,
+   * much like filtering a capture to a selection of processes.
+   */
+  condition = sysprof_capture_condition_new_and (
+      sysprof_capture_condition_new_and (
+        make_pid_in (rand, 300),
+        sysprof_capture_condition_new_where_type_in (G_N_ELEMENTS (types), types)),
+      sysprof_capture_condition_new_or (
+        sysprof_capture_condition_new_where_time_between (0, MAX_TIME / 4),
+        sysprof_capture_condition_new_where_time_between (MAX_TIME / 2, MAX_TIME)));
+
+  begin = g_get_monotonic_time ();
+  for (guint i = 0; i < frames->len; i++)
+    tree_matches += sysprof_capture_condition_match (condition, g_ptr_array_index (frames, i));
+  tree_usec = g_get_monotonic_time () - begin;
+
+  begin = g_get_monotonic_time ();
+  program = _sysprof_capture_condition_compile (&condition, 1);
+  for (guint i = 0; i < frames->len; i++)
+    program_matches += _sysprof_capture_condition_program_match (program, g_ptr_array_index (frames, i));
+  program_usec = g_get_monotonic_time () - begin;
+
+  g_assert_cmpint (tree_matches, ==, program_matches);
+
+  g_test_message ("%u frames, %u matches: tree %"G_GINT64_FORMAT" usec, compiled %"G_GINT64_FORMAT" usec",
+                  frames->len, tree_matches, tree_usec, program_usec);
+
+  if (g_test_perf ())
+    g_test_maximized_result ((double)tree_usec / MAX (1, program_usec), "compiled to tree speedup");
+
+  _sysprof_capture_condition_program_free (program);
+  sysprof_capture_condition_unref (condition);
+}
+
+static bool
+count_cb (const SysprofCaptureFrame *frame,
+          void                      *user_data)
+{
+  guint *count = user_data;
+  (*count)++;
+  return true;
+}
+
+static void
+test_condition_cursor (void)
+{
+  static const SysprofCaptureFrameType marks[] = { SYSPROF_CAPTURE_FRAME_MARK };
+  static const gint32 pids[] = { 3, 1 };
+  SysprofCaptureWriter *writer;
+  SysprofCaptureReader *reader;
+  SysprofCaptureCursor *cursor;
+  gint64 t = SYSPROF_CAPTURE_CURRENT_TIME;
+  guint count = 0;
+
+  writer = sysprof_capture_writer_new ("capture-condition.syscap", 0);
+  g_assert_nonnull (writer);
+
+  for (guint i = 0; i < 1000; i++)
+    {
+      SysprofCaptureAddress addr = 0x1000 + i;
+
+      g_assert_true (sysprof_capture_writer_add_sample (writer, t + i, -1, i % 4, i % 4, &addr, 1));
+      g_assert_true (sysprof_capture_writer_add_mark (writer, t + i, -1, i % 4, 1, "group", "name", "message"));
+    }
+
+  g_assert_true (sysprof_capture_writer_flush (writer));
+  reader = sysprof_capture_writer_create_reader (writer);
+  g_assert_nonnull (reader);
+  sysprof_capture_writer_unref (writer);
+
+  /* Marks from pid 1 or 3, along with every frame in the first 100 nsec */
+  cursor = sysprof_capture_cursor_new (reader);
+  sysprof_capture_cursor_add_condition (cursor,
+                                        sysprof_capture_condition_new_and (
+                                          sysprof_capture_condition_new_where_type_in (1, marks),
+                                          sysprof_capture_condition_new_where_pid_in (G_N_ELEMENTS (pids), pids)));
+  sysprof_capture_cursor_foreach (cursor, count_cb, &count);
+  g_assert_cmpint (count, ==, 500);
+
+  /* Adding a condition must recompile */
+  count = 0;
+  sysprof_capture_cursor_add_condition (cursor, sysprof_capture_condition_new_where_time_between (t, t + 99));
+  sysprof_capture_cursor_reset (cursor);
+  sysprof_capture_cursor_foreach (cursor, count_cb, &count);
+  g_assert_cmpint (count, ==, 500 + 100 + 50);
+
+  sysprof_capture_cursor_unref (cursor);
+  sysprof_capture_reader_unref (reader);
+
+  g_unlink ("capture-condition.syscap");
+}
+
+int
+main (int argc,
+      char *argv[])
+{
+  sysprof_clock_init ();
+  g_test_init (&argc, &argv, NULL);
+  g_test_add_func ("/SysprofCapture/Condition/compile", test_condition_compile);
+  g_test_add_func ("/SysprofCapture/Condition/merge", test_condition_merge);
+  g_test_add_func ("/SysprofCapture/Condition/cursor", test_condition_cursor);
+  g_test_add_func ("/SysprofCapture/Condition/benchmark", test_condition_benchmark);
+  return g_test_run ();
+}
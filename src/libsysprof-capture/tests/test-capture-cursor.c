@@ -18,10 +18,21 @@
  * SPDX-License-Identifier: GPL-3.0-or-later
  */
 
+#include <fcntl.h>
 #include <glib.h>
 #include <glib/gstdio.h>
 #include <sysprof-capture.h>
 
+#include "sysprof-capture-reader-private.h"
+
+#define N_TIME_RANGE_SAMPLES 200000
+
+typedef struct
+{
+  guint   count;
+  guint64 checksum;
+} TimeRangeResult;
+
 static bool
 increment (const SysprofCaptureFrame *frame,
            void                      *user_data)
@@ -79,6 +90,108 @@ test_cursor_null (void)
   g_clear_pointer (&cursor, sysprof_capture_cursor_unref);
 }
 
+static bool
+sum_samples (const SysprofCaptureFrame *frame,
+             void                      *user_data)
+{
+  TimeRangeResult *result = user_data;
+  const SysprofCaptureSample *sample = (const SysprofCaptureSample *)frame;
+
+  g_assert_cmpint (frame->type, ==, SYSPROF_CAPTURE_FRAME_SAMPLE);
+
+  result->count++;
+  for (guint i = 0; i < sample->n_addrs; i++)
+    result->checksum += sample->addrs[i] * (i + 1);
+
+  return true;
+}
+
+static void
+check_time_range (SysprofCaptureReader *reader,
+                  gint64                t,
+                  gint64                begin,
+                  gint64                end)
+{
+  SysprofCaptureFrameType type = SYSPROF_CAPTURE_FRAME_SAMPLE;
+  SysprofCaptureCursor *cursor;
+  TimeRangeResult expected = {0};
+  TimeRangeResult result = {0};
+
+  /* Samples were written at t + i with the stack { i % 13, 1, 2, 3 } */
+  for (gint64 i = MAX (0, begin - t); i < N_TIME_RANGE_SAMPLES && t + i <= end; i++)
+    {
+      expected.count++;
+      expected.checksum += (i % 13) * 1 + 1 * 2 + 2 * 3 + 3 * 4;
+    }
+
+  cursor = sysprof_capture_cursor_new (reader);
+  sysprof_capture_cursor_add_condition (cursor,
+                                        sysprof_capture_condition_new_and (
+                                          sysprof_capture_condition_new_where_type_in (1, &type),
+                                          sysprof_capture_condition_new_where_time_between (begin, end)));
+  sysprof_capture_cursor_foreach (cursor, sum_samples, &result);
+  sysprof_capture_cursor_unref (cursor);
+
+  g_assert_cmpint (result.count, ==, expected.count);
+  g_assert_cmpuint (result.checksum, ==, expected.checksum);
+}
+
+static void
+test_cursor_time_range (void)
+{
+  SysprofCaptureWriter *writer;
+  SysprofCaptureReaderSpan spans[2];
+  gint64 t = SYSPROF_CAPTURE_CURRENT_TIME;
+  gsize n_spans;
+
+  writer = sysprof_capture_writer_new ("capture-cursor-time-range", 0);
+  g_assert_nonnull (writer);
+  sysprof_capture_writer_set_deduplicate_stacks (writer, TRUE);
+
+  /* Enough samples for several frame indexes, sharing a few stacks so
+   * that seeking past the chunk a stack was first written in matters.
+   */
+  for (guint i = 0; i < N_TIME_RANGE_SAMPLES; i++)
+    {
+      SysprofCaptureAddress addrs[4] = { i % 13, 1, 2, 3 };
+
+      g_assert_true (sysprof_capture_writer_add_sample (writer, t + i, -1, 100, 100, addrs, 4));
+    }
+
+  g_assert_true (sysprof_capture_writer_flush (writer));
+  sysprof_capture_writer_unref (writer);
+
+  for (guint use_mmap = 0; use_mmap < 2; use_mmap++)
+    {
+      SysprofCaptureReader *reader;
+      int fd;
+
+      fd = g_open ("capture-cursor-time-range", O_RDONLY, 0);
+      g_assert_cmpint (fd, !=, -1);
+
+      reader = _sysprof_capture_reader_new_from_fd_full (fd, use_mmap);
+      g_assert_nonnull (reader);
+
+      /* A window in the middle need not read the first chunk */
+      g_assert_true (_sysprof_capture_reader_find_time_range (reader, t + 150000, t + 150010, spans, &n_spans));
+      g_assert_cmpint (n_spans, >=, 1);
+      g_assert_cmpuint (spans[0].begin, >, sizeof (SysprofCaptureFileHeader));
+      g_assert_cmpuint (spans[n_spans - 1].end, ==, G_MAXUINT64);
+
+      check_time_range (reader, t, t, t);
+      check_time_range (reader, t, t + 100, t + 200);
+      check_time_range (reader, t, t + 65000, t + 70000);
+      check_time_range (reader, t, t + 150000, t + 150010);
+      check_time_range (reader, t, t + N_TIME_RANGE_SAMPLES - 10, t + N_TIME_RANGE_SAMPLES * 2);
+      check_time_range (reader, t, t - 1000, t + N_TIME_RANGE_SAMPLES);
+      check_time_range (reader, t, t + N_TIME_RANGE_SAMPLES * 2, t + N_TIME_RANGE_SAMPLES * 3);
+
+      sysprof_capture_reader_unref (reader);
+    }
+
+  g_unlink ("capture-cursor-time-range");
+}
+
 int
 main (int argc,
       char *argv[])
@@ -87,5 +200,6 @@ main (int argc,
   g_test_init (&argc, &argv, NULL);
   g_test_add_func ("/SysprofCaptureCursor/basic", test_cursor_basic);
   g_test_add_func ("/SysprofCaptureCursor/null", test_cursor_null);
+  g_test_add_func ("/SysprofCaptureCursor/time-range", test_cursor_time_range);
   return g_test_run ();
 }
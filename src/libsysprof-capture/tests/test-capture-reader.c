@@ -0,0 +1,357 @@
+/* test-capture-reader.c
+ *
+ * Copyright 2023 Christian Hergert <chergert@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "config.h"
+
+#include <fcntl.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <sysprof-capture.h>
+
+#include "sysprof-capture-reader-private.h"
+
+#define CAPTURE_FILE "capture-reader.syscap"
+
+typedef struct
+{
+  guint   n_frames;
+  guint   n_samples;
+  guint64 checksum;
+} ReadResult;
+
+static void
+write_capture (guint n_rounds)
+{
+  SysprofCaptureWriter *writer;
+  SysprofCaptureCounter counter = {{0}};
+  gint64 t = SYSPROF_CAPTURE_CURRENT_TIME;
+  guint counter_id;
+
+  writer = sysprof_capture_writer_new (CAPTURE_FILE, 0);
+  g_assert_nonnull (writer);
+
+  counter.id = counter_id = sysprof_capture_writer_request_counter (writer, 1);
+  counter.type = SYSPROF_CAPTURE_COUNTER_INT64;
+  g_strlcpy (counter.category, "Reader", sizeof counter.category);
+  g_strlcpy (counter.name, "Counter", sizeof counter.name);
+  g_assert_true (sysprof_capture_writer_define_counters (writer, t, -1, -1, &counter, 1));
+
+  g_assert_true (sysprof_capture_writer_add_process (writer, t, -1, 100, "process"));
+  g_assert_true (sysprof_capture_writer_add_map (writer, t, -1, 100, 0x1000, 0x2000, 0, 0, "/usr/lib/libfoo.so"));
+
+  for (guint i = 0; i < n_rounds; i++)
+    {
+      SysprofCaptureAddress addrs[16];
+      SysprofCaptureCounterValue value = { .v64 = i };
+      guint n_addrs = 1 + (i % G_N_ELEMENTS (addrs));
+
+      for (guint j = 0; j < n_addrs; j++)
+        addrs[j] = 0x1000 + i + j;
+
+      g_assert_true (sysprof_capture_writer_add_sample (writer, t + i, i % 4, 100, 100 + (i % 3), addrs, n_addrs));
+
+      if (i % 10 == 0)
+        g_assert_true (sysprof_capture_writer_add_mark (writer, t + i, -1, 100, 5, "group", "name", "message"));
+
+      if (i % 25 == 0)
+        g_assert_true (sysprof_capture_writer_add_log (writer, t + i, -1, 100, 0, "domain", "a log message"));
+
+      if (i % 50 == 0)
+        g_assert_true (sysprof_capture_writer_set_counters (writer, t + i, -1, -1, &counter_id, &value, 1));
+    }
+
+  g_assert_true (sysprof_capture_writer_flush (writer));
+
+  sysprof_capture_writer_unref (writer);
+}
+
+static SysprofCaptureReader *
+open_reader (gboolean use_mmap)
+{
+  SysprofCaptureReader *reader;
+  int fd;
+
+  fd = g_open (CAPTURE_FILE, O_RDONLY, 0);
+  g_assert_cmpint (fd, !=, -1);
+
+  reader = _sysprof_capture_reader_new_from_fd_full (fd, use_mmap);
+  g_assert_nonnull (reader);
+
+  return reader;
+}
+
+static void
+read_all (SysprofCaptureReader *reader,
+          ReadResult           *result)
+{
+  SysprofCaptureFrameType type;
+
+  memset (result, 0, sizeof *result);
+
+  while (sysprof_capture_reader_peek_type (reader, &type))
+    {
+      const SysprofCaptureFrame *frame = NULL;
+
+      switch (type)
+        {
+        case SYSPROF_CAPTURE_FRAME_SAMPLE:
+          {
+            const SysprofCaptureSample *sample = sysprof_capture_reader_read_sample (reader);
+
+            g_assert_nonnull (sample);
+
+            for (guint i = 0; i < sample->n_addrs; i++)
+              result->checksum += sample->addrs[i];
+
+            result->n_samples++;
+            frame = &sample->frame;
+          }
+          break;
+
+        case SYSPROF_CAPTURE_FRAME_MARK:
+          {
+            const SysprofCaptureMark *mark = sysprof_capture_reader_read_mark (reader);
+
+            g_assert_nonnull (mark);
+            g_assert_cmpstr (mark->message, ==, "message");
+            result->checksum += mark->duration;
+            frame = &mark->frame;
+          }
+          break;
+
+        case SYSPROF_CAPTURE_FRAME_LOG:
+          frame = (const SysprofCaptureFrame *)sysprof_capture_reader_read_log (reader);
+          break;
+
+        case SYSPROF_CAPTURE_FRAME_CTRSET:
+          frame = (const SysprofCaptureFrame *)sysprof_capture_reader_read_counter_set (reader);
+          break;
+
+        case SYSPROF_CAPTURE_FRAME_CTRDEF:
+          frame = (const SysprofCaptureFrame *)sysprof_capture_reader_read_counter_define (reader);
+          break;
+
+        case SYSPROF_CAPTURE_FRAME_PROCESS:
+          frame = (const SysprofCaptureFrame *)sysprof_capture_reader_read_process (reader);
+          break;
+
+        case SYSPROF_CAPTURE_FRAME_MAP:
+          frame = (const SysprofCaptureFrame *)sysprof_capture_reader_read_map (reader);
+          break;
+
+        default:
+          g_assert_true (sysprof_capture_reader_skip (reader));
+          result->n_frames++;
+          continue;
+        }
+
+      g_assert_nonnull (frame);
+
+      result->checksum += frame->time + frame->type + frame->len;
+      result->n_frames++;
+    }
+}
+
+static void
+test_reader_mapped (void)
+{
+  SysprofCaptureReader *mapped;
+  SysprofCaptureReader *copied;
+  SysprofCaptureReader *copy;
+  ReadResult a, b, c;
+
+  write_capture (10000);
+
+  mapped = open_reader (TRUE);
+  copied = open_reader (FALSE);
+
+  read_all (mapped, &a);
+  read_all (copied, &b);
+
+  g_assert_cmpint (a.n_samples, ==, 10000);
+  g_assert_cmpint (a.n_frames, ==, b.n_frames);
+  g_assert_cmpint (a.n_samples, ==, b.n_samples);
+  g_assert_cmpuint (a.checksum, ==, b.checksum);
+
+  /* Resetting must rewind the mapping too */
+  g_assert_true (sysprof_capture_reader_reset (mapped));
+  read_all (mapped, &c);
+  g_assert_cmpint (a.n_frames, ==, c.n_frames);
+  g_assert_cmpuint (a.checksum, ==, c.checksum);
+
+  /* Copies outlive the reader they were copied from */
+  g_assert_true (sysprof_capture_reader_reset (mapped));
+  copy = sysprof_capture_reader_copy (mapped);
+  g_assert_nonnull (copy);
+  sysprof_capture_reader_unref (mapped);
+  read_all (copy, &c);
+  g_assert_cmpint (a.n_frames, ==, c.n_frames);
+  g_assert_cmpuint (a.checksum, ==, c.checksum);
+
+  sysprof_capture_reader_unref (copy);
+  sysprof_capture_reader_unref (copied);
+
+  g_unlink (CAPTURE_FILE);
+}
+
+static void
+test_reader_mapped_grows (void)
+{
+  SysprofCaptureWriter *writer;
+  SysprofCaptureReader *reader;
+  SysprofCaptureAddress addr = 0x1000;
+  ReadResult result;
+  gint64 t = SYSPROF_CAPTURE_CURRENT_TIME;
+
+  writer = sysprof_capture_writer_new (CAPTURE_FILE, 0);
+  g_assert_nonnull (writer);
+
+  g_assert_true (sysprof_capture_writer_add_sample (writer, t, -1, 100, 100, &addr, 1));
+  g_assert_true (sysprof_capture_writer_flush (writer));
+
+  reader = open_reader (TRUE);
+  read_all (reader, &result);
+  g_assert_cmpint (result.n_samples, ==, 1);
+
+  /* Frames written after the reader was created must still be found */
+  for (guint i = 1; i < 1000; i++)
+    g_assert_true (sysprof_capture_writer_add_sample (writer, t + i, -1, 100, 100, &addr, 1));
+  g_assert_true (sysprof_capture_writer_flush (writer));
+
+  g_assert_true (sysprof_capture_reader_reset (reader));
+  read_all (reader, &result);
+  g_assert_cmpint (result.n_samples, ==, 1000);
+
+  sysprof_capture_reader_unref (reader);
+  sysprof_capture_writer_unref (writer);
+
+  g_unlink (CAPTURE_FILE);
+}
+
+static void
+test_reader_allocation_sampled (void)
+{
+  SysprofCaptureWriter *writer;
+  SysprofCaptureReader *reader;
+  const SysprofCaptureAllocation *alloc;
+  SysprofCaptureAddress addrs[2] = { 0x1000, 0x2000 };
+  gint64 t = SYSPROF_CAPTURE_CURRENT_TIME;
+
+  writer = sysprof_capture_writer_new (CAPTURE_FILE, 0);
+  g_assert_nonnull (writer);
+
+  g_assert_true (sysprof_capture_writer_add_allocation_copy (writer, t, -1, 100, 100, 0x10, 32, addrs, 2));
+  g_assert_true (sysprof_capture_writer_add_allocation_sampled (writer, t + 1, -1, 100, 100, 0x20, 64, 4096, addrs, 2));
+  g_assert_true (sysprof_capture_writer_add_allocation_sampled (writer, t + 2, -1, 100, 100, 0x20, 0, 4096, NULL, 0));
+  g_assert_true (sysprof_capture_writer_flush (writer));
+  sysprof_capture_writer_unref (writer);
+
+  reader = open_reader (TRUE);
+
+  alloc = sysprof_capture_reader_read_allocation (reader);
+  g_assert_nonnull (alloc);
+  g_assert_cmpint (alloc->alloc_size, ==, 32);
+  g_assert_false (alloc->sampled);
+
+  alloc = sysprof_capture_reader_read_allocation (reader);
+  g_assert_nonnull (alloc);
+  g_assert_cmpint (alloc->alloc_size, ==, 64);
+  g_assert_cmpint (alloc->n_addrs, ==, 2);
+  g_assert_true (alloc->sampled);
+  g_assert_cmpint (alloc->frame.padding2, ==, 4096);
+
+  /* Frees of sampled allocations carry the interval too */
+  alloc = sysprof_capture_reader_read_allocation (reader);
+  g_assert_nonnull (alloc);
+  g_assert_cmpint (alloc->alloc_size, ==, 0);
+  g_assert_true (alloc->sampled);
+  g_assert_cmpint (alloc->frame.padding2, ==, 4096);
+
+  g_assert_null (sysprof_capture_reader_read_allocation (reader));
+
+  sysprof_capture_reader_unref (reader);
+
+  g_unlink (CAPTURE_FILE);
+}
+
+static double
+measure_throughput (gboolean use_mmap,
+                    guint    n_passes,
+                    goffset  size)
+{
+  SysprofCaptureReader *reader = open_reader (use_mmap);
+  ReadResult result;
+  gint64 begin;
+  gint64 end;
+
+  begin = g_get_monotonic_time ();
+
+  for (guint i = 0; i < n_passes; i++)
+    {
+      g_assert_true (sysprof_capture_reader_reset (reader));
+      read_all (reader, &result);
+    }
+
+  end = g_get_monotonic_time ();
+
+  sysprof_capture_reader_unref (reader);
+
+  return (double)size * n_passes / MAX (1, end - begin);
+}
+
+static void
+test_reader_throughput (void)
+{
+  guint n_passes = g_test_perf () ? 50 : 3;
+  GStatBuf stbuf;
+  double mapped;
+  double copied;
+
+  write_capture (g_test_perf () ? 1000000 : 50000);
+
+  g_assert_cmpint (g_stat (CAPTURE_FILE, &stbuf), ==, 0);
+
+  /* Warm the page cache so both paths read from memory */
+  measure_throughput (FALSE, 1, stbuf.st_size);
+
+  copied = measure_throughput (FALSE, n_passes, stbuf.st_size);
+  mapped = measure_throughput (TRUE, n_passes, stbuf.st_size);
+
+  g_test_message ("%"G_GINT64_FORMAT" bytes: pread() %.1lf MB/s, mmap() %.1lf MB/s",
+                  (gint64)stbuf.st_size, copied, mapped);
+
+  if (g_test_perf ())
+    g_test_maximized_result (mapped / copied, "mmap() to pread() throughput ratio");
+
+  g_unlink (CAPTURE_FILE);
+}
+
+int
+main (int argc,
+      char *argv[])
+{
+  sysprof_clock_init ();
+  g_test_init (&argc, &argv, NULL);
+  g_test_add_func ("/SysprofCapture/Reader/mapped", test_reader_mapped);
+  g_test_add_func ("/SysprofCapture/Reader/mapped-grows", test_reader_mapped_grows);
+  g_test_add_func ("/SysprofCapture/Reader/allocation-sampled", test_reader_allocation_sampled);
+  g_test_add_func ("/SysprofCapture/Reader/throughput", test_reader_throughput);
+  return g_test_run ();
+}
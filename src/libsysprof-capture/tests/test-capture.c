@@ -1074,6 +1074,439 @@ test_writer_frame_index (void)
   g_unlink ("frame-index.syscap");
 }
 
+static int
+stack_backtrace_cb (SysprofCaptureAddress *addrs,
+                    unsigned int           n_addrs,
+                    void                  *user_data)
+{
+  guint *i = user_data;
+  guint depth = MIN (n_addrs, 2 + (*i % 6));
+
+  for (guint j = 0; j < depth; j++)
+    addrs[j] = 0x1000 + j + ((*i % 50) * 0x100);
+
+  return depth;
+}
+
+static void
+assert_stacks (SysprofCaptureReader *reader,
+               guint                 n_frames,
+               guint                 n_stacks)
+{
+  SysprofCaptureFrameType type;
+  guint n_samples = 0;
+  guint n_allocations = 0;
+  guint n_stack_frames = 0;
+
+  while (sysprof_capture_reader_peek_type (reader, &type))
+    {
+      const SysprofCaptureAddress *addrs;
+      guint n_addrs;
+      gint64 i;
+
+      if (type == SYSPROF_CAPTURE_FRAME_SAMPLE)
+        {
+          const SysprofCaptureSample *sample = sysprof_capture_reader_read_sample (reader);
+
+          g_assert_nonnull (sample);
+          g_assert_false (sample->stack);
+          addrs = sample->addrs;
+          n_addrs = sample->n_addrs;
+          i = sample->frame.time;
+          n_samples++;
+        }
+      else if (type == SYSPROF_CAPTURE_FRAME_ALLOCATION)
+        {
+          const SysprofCaptureAllocation *alloc = sysprof_capture_reader_read_allocation (reader);
+
+          g_assert_nonnull (alloc);
+          g_assert_false (alloc->stack);
+          addrs = alloc->addrs;
+          n_addrs = alloc->n_addrs;
+          i = alloc->frame.time;
+          n_allocations++;
+        }
+      else
+        {
+          if (type == SYSPROF_CAPTURE_FRAME_STACK)
+            n_stack_frames++;
+          g_assert_true (sysprof_capture_reader_skip (reader));
+          continue;
+        }
+
+      g_assert_cmpint (n_addrs, ==, 2 + (i % 6));
+
+      for (guint j = 0; j < n_addrs; j++)
+        g_assert_cmphex (addrs[j], ==, 0x1000 + j + ((i % 50) * 0x100));
+    }
+
+  g_assert_cmpint (n_samples, ==, n_frames / 2);
+  g_assert_cmpint (n_allocations, ==, n_frames / 2);
+  g_assert_cmpint (n_stack_frames, ==, n_stacks);
+}
+
+static void
+test_reader_writer_stacks (void)
+{
+  const guint n_frames = 20000;
+  SysprofCaptureWriter *writer;
+  SysprofCaptureWriter *joined;
+  SysprofCaptureReader *reader;
+
+  writer = sysprof_capture_writer_new ("stacks.syscap", 0);
+  g_assert_nonnull (writer);
+  sysprof_capture_writer_set_deduplicate_stacks (writer, TRUE);
+
+  for (guint i = 0; i < n_frames; i++)
+    {
+      SysprofCaptureAddress addrs[8];
+      guint n_addrs = stack_backtrace_cb (addrs, G_N_ELEMENTS (addrs), &i);
+
+      if (i % 2)
+        g_assert_true (sysprof_capture_writer_add_sample (writer, i, -1, 1, 1, addrs, n_addrs));
+      else
+        g_assert_true (sysprof_capture_writer_add_allocation (writer, i, -1, 1, 1, 0x8000, 32, stack_backtrace_cb, &i));
+    }
+
+  reader = sysprof_capture_writer_create_reader (writer);
+  g_assert_nonnull (reader);
+  sysprof_capture_writer_unref (writer);
+
+  /* Every distinct stack is stored exactly once */
+  assert_stacks (reader, n_frames, 150);
+
+  /* Joining expands the stacks since the destination does not dedup */
+  joined = sysprof_capture_writer_new ("stacks-joined.syscap", 0);
+  g_assert_true (sysprof_capture_reader_reset (reader));
+  g_assert_true (sysprof_capture_writer_cat (joined, reader));
+  sysprof_capture_reader_unref (reader);
+
+  reader = sysprof_capture_writer_create_reader (joined);
+  g_assert_nonnull (reader);
+  sysprof_capture_writer_unref (joined);
+
+  assert_stacks (reader, n_frames, 0);
+
+  sysprof_capture_reader_unref (reader);
+
+  g_unlink ("stacks.syscap");
+  g_unlink ("stacks-joined.syscap");
+}
+
+static void
+test_writer_compressed (void)
+{
+  const guint n_frames = 200000;
+  SysprofCaptureWriter *writer;
+  SysprofCaptureReader *reader;
+  SysprofCaptureFrameType type;
+  GStatBuf stbuf;
+  guint n_samples = 0;
+  guint n_logs = 0;
+
+  writer = sysprof_capture_writer_new ("compressed.syscap", 0);
+  g_assert_nonnull (writer);
+
+  if (!sysprof_capture_writer_set_compressed (writer, TRUE))
+    {
+      g_assert_cmpint (errno, ==, ENOTSUP);
+      sysprof_capture_writer_unref (writer);
+      g_unlink ("compressed.syscap");
+      g_test_skip ("Compression is not supported");
+      return;
+    }
+
+  for (guint i = 0; i < n_frames; i++)
+    {
+      SysprofCaptureAddress addrs[4] = { 0x1000, 0x2000, 0x3000, 0x4000 + (i % 16) };
+
+      g_assert_true (sysprof_capture_writer_add_sample (writer, i + 1, -1, 1, 1, addrs, G_N_ELEMENTS (addrs)));
+
+      if (i % 100 == 0)
+        g_assert_true (sysprof_capture_writer_add_log (writer, i + 1, -1, 1, 0, "domain", "message"));
+    }
+
+  /* The container must only be chosen before frames are written */
+  g_assert_false (sysprof_capture_writer_set_compressed (writer, FALSE));
+  g_assert_cmpint (errno, ==, EBUSY);
+
+  g_assert_true (sysprof_capture_writer_flush (writer));
+  sysprof_capture_writer_unref (writer);
+
+  g_assert_cmpint (g_stat ("compressed.syscap", &stbuf), ==, 0);
+  g_assert_cmpint (stbuf.st_size, <, (n_frames * (sizeof (SysprofCaptureSample) + 4 * sizeof (SysprofCaptureAddress))) / 4);
+
+  reader = sysprof_capture_reader_new ("compressed.syscap");
+  g_assert_nonnull (reader);
+
+  while (sysprof_capture_reader_peek_type (reader, &type))
+    {
+      if (type == SYSPROF_CAPTURE_FRAME_SAMPLE)
+        {
+          const SysprofCaptureSample *sample = sysprof_capture_reader_read_sample (reader);
+
+          g_assert_nonnull (sample);
+          g_assert_cmpint (sample->frame.time, ==, n_samples + 1);
+          g_assert_cmpint (sample->n_addrs, ==, 4);
+          g_assert_cmphex (sample->addrs[3], ==, 0x4000 + (n_samples % 16));
+          n_samples++;
+        }
+      else if (type == SYSPROF_CAPTURE_FRAME_LOG)
+        {
+          g_assert_nonnull (sysprof_capture_reader_read_log (reader));
+          n_logs++;
+        }
+      else
+        {
+          g_assert_true (sysprof_capture_reader_skip (reader));
+        }
+    }
+
+  g_assert_cmpint (n_samples, ==, n_frames);
+  g_assert_cmpint (n_logs, ==, n_frames / 100);
+
+  sysprof_capture_reader_unref (reader);
+
+  g_unlink ("compressed.syscap");
+}
+
+static void
+test_writer_async (void)
+{
+  const guint n_frames = 200000;
+  SysprofCaptureWriter *writer;
+  SysprofCaptureReader *reader;
+  SysprofCaptureFrameType type;
+  gint64 bytes_written = 0;
+  guint n_samples = 0;
+  guint n_jitmaps = 0;
+  guint n_counters = 0;
+
+  /* A small buffer so many buffers are handed to the writer thread */
+  writer = sysprof_capture_writer_new ("async.syscap", _sysprof_getpagesize ());
+  g_assert_nonnull (writer);
+  g_assert_true (sysprof_capture_writer_set_async (writer, TRUE));
+
+  for (guint i = 0; i < n_frames; i++)
+    {
+      SysprofCaptureAddress addrs[3] = { 0x1000, 0x2000, 0x3000 + i };
+
+      g_assert_true (sysprof_capture_writer_add_sample (writer, i + 1, -1, 1, 1, addrs, G_N_ELEMENTS (addrs)));
+
+      /* Jitmaps are not frames and must still land in order */
+      if (i % 1000 == 0)
+        {
+          g_autofree char *name = g_strdup_printf ("jit-%u", i);
+          g_assert_cmphex (sysprof_capture_writer_add_jitmap (writer, name), !=, 0);
+        }
+
+      if (i == n_frames / 2)
+        g_assert_true (sysprof_capture_writer_flush (writer));
+    }
+
+  reader = sysprof_capture_writer_create_reader (writer);
+  g_assert_nonnull (reader);
+
+  g_assert_true (sysprof_capture_writer_set_async (writer, FALSE));
+  sysprof_capture_writer_unref (writer);
+
+  while (sysprof_capture_reader_peek_type (reader, &type))
+    {
+      if (type == SYSPROF_CAPTURE_FRAME_SAMPLE)
+        {
+          const SysprofCaptureSample *sample = sysprof_capture_reader_read_sample (reader);
+
+          g_assert_nonnull (sample);
+          g_assert_cmpint (sample->frame.time, ==, n_samples + 1);
+          g_assert_cmpint (sample->n_addrs, ==, 3);
+          g_assert_cmphex (sample->addrs[2], ==, 0x3000 + n_samples);
+          n_samples++;
+        }
+      else if (type == SYSPROF_CAPTURE_FRAME_JITMAP)
+        {
+          const SysprofCaptureJitmap *jitmap = sysprof_capture_reader_read_jitmap (reader);
+
+          g_assert_nonnull (jitmap);
+          n_jitmaps += jitmap->n_jitmaps;
+        }
+      else if (type == SYSPROF_CAPTURE_FRAME_CTRSET)
+        {
+          const SysprofCaptureCounterSet *set = sysprof_capture_reader_read_counter_set (reader);
+
+          g_assert_nonnull (set);
+          g_assert_cmpint (set->n_values, ==, 1);
+          g_assert_cmpint (set->values[0].values[0].v64, >=, bytes_written);
+          bytes_written = set->values[0].values[0].v64;
+          n_counters++;
+        }
+      else
+        {
+          g_assert_true (sysprof_capture_reader_skip (reader));
+        }
+    }
+
+  g_assert_cmpint (n_samples, ==, n_frames);
+  g_assert_cmpint (n_jitmaps, ==, n_frames / 1000);
+  g_assert_cmpint (n_counters, >, 0);
+  g_assert_cmpint (bytes_written, >, 0);
+
+  sysprof_capture_reader_unref (reader);
+
+  g_unlink ("async.syscap");
+}
+
+static void
+test_writer_merge (void)
+{
+  const guint n_writers = 16;
+  const guint n_samples = 2000;
+  g_autoptr(GHashTable) jitmaps = g_hash_table_new_full (NULL, NULL, NULL, g_free);
+  g_autoptr(GHashTable) counters = g_hash_table_new (NULL, NULL);
+  SysprofCaptureReader *readers[16];
+  SysprofCaptureWriter *merged;
+  SysprofCaptureReader *reader;
+  SysprofCaptureFrameType type;
+  gint64 last_time = G_MININT64;
+  guint n_read = 0;
+  guint n_sets = 0;
+
+  for (guint w = 0; w < n_writers; w++)
+    {
+      g_autofree char *filename = g_strdup_printf ("merge%u.syscap", w);
+      g_autofree char *name = g_strdup_printf ("jit-%u", w);
+      SysprofCaptureWriter *writer;
+      SysprofCaptureCounter counter = {{0}};
+      SysprofCaptureAddress addrs[2];
+      guint counter_id;
+
+      writer = sysprof_capture_writer_new (filename, 0);
+      g_assert_nonnull (writer);
+
+      /* Every writer allocates the same counter and jitmap ids */
+      counter.id = counter_id = sysprof_capture_writer_request_counter (writer, 1);
+      counter.type = SYSPROF_CAPTURE_COUNTER_INT64;
+      g_strlcpy (counter.category, "Merge", sizeof counter.category);
+      g_snprintf (counter.name, sizeof counter.name, "writer-%u", w);
+      g_assert_true (sysprof_capture_writer_define_counters (writer, w, -1, w, &counter, 1));
+
+      addrs[0] = sysprof_capture_writer_add_jitmap (writer, name);
+      addrs[1] = 0x1000 + w;
+
+      /* Interleave times across writers so no input can be appended whole */
+      for (guint i = 0; i < n_samples; i++)
+        {
+          gint64 t = 100 + (gint64)i * n_writers + (n_writers - 1 - w);
+          SysprofCaptureCounterValue value = { .v64 = i };
+
+          g_assert_true (sysprof_capture_writer_add_sample (writer, t, -1, w, w, addrs, G_N_ELEMENTS (addrs)));
+
+          if (i % 100 == 0)
+            g_assert_true (sysprof_capture_writer_set_counters (writer, t, -1, w, &counter_id, &value, 1));
+        }
+
+      readers[w] = sysprof_capture_writer_create_reader (writer);
+      g_assert_nonnull (readers[w]);
+
+      sysprof_capture_writer_unref (writer);
+    }
+
+  merged = sysprof_capture_writer_new ("merged.syscap", 0);
+  g_assert_true (sysprof_capture_writer_merge (merged, readers, n_writers));
+
+  for (guint w = 0; w < n_writers; w++)
+    {
+      g_autofree char *filename = g_strdup_printf ("merge%u.syscap", w);
+
+      sysprof_capture_reader_unref (readers[w]);
+      g_unlink (filename);
+    }
+
+  reader = sysprof_capture_writer_create_reader (merged);
+  g_assert_nonnull (reader);
+  sysprof_capture_writer_unref (merged);
+
+  /* Jitmaps are flushed at the end, so collect them first */
+  while (sysprof_capture_reader_peek_type (reader, &type))
+    {
+      if (type == SYSPROF_CAPTURE_FRAME_JITMAP)
+        {
+          const SysprofCaptureJitmap *jitmap = sysprof_capture_reader_read_jitmap (reader);
+          SysprofCaptureJitmapIter iter;
+          SysprofCaptureAddress addr;
+          const char *name;
+
+          g_assert_nonnull (jitmap);
+
+          sysprof_capture_jitmap_iter_init (&iter, jitmap);
+          while (sysprof_capture_jitmap_iter_next (&iter, &addr, &name))
+            g_hash_table_insert (jitmaps, GSIZE_TO_POINTER (addr), g_strdup (name));
+        }
+      else
+        {
+          g_assert_true (sysprof_capture_reader_skip (reader));
+        }
+    }
+
+  g_assert_cmpint (g_hash_table_size (jitmaps), ==, n_writers);
+
+  sysprof_capture_reader_reset (reader);
+
+  while (sysprof_capture_reader_peek_type (reader, &type))
+    {
+      if (type == SYSPROF_CAPTURE_FRAME_SAMPLE)
+        {
+          const SysprofCaptureSample *sample = sysprof_capture_reader_read_sample (reader);
+          g_autofree char *expected = NULL;
+
+          g_assert_nonnull (sample);
+          g_assert_cmpint (sample->frame.time, >=, last_time);
+          last_time = sample->frame.time;
+
+          expected = g_strdup_printf ("jit-%d", sample->frame.pid);
+          g_assert_cmpint (sample->n_addrs, ==, 2);
+          g_assert_cmpstr (g_hash_table_lookup (jitmaps, GSIZE_TO_POINTER (sample->addrs[0])), ==, expected);
+          g_assert_cmphex (sample->addrs[1], ==, 0x1000 + sample->frame.pid);
+
+          n_read++;
+        }
+      else if (type == SYSPROF_CAPTURE_FRAME_CTRDEF)
+        {
+          const SysprofCaptureCounterDefine *def = sysprof_capture_reader_read_counter_define (reader);
+
+          g_assert_nonnull (def);
+          g_assert_cmpint (def->n_counters, ==, 1);
+          g_assert_false (g_hash_table_contains (counters, GUINT_TO_POINTER (def->counters[0].id)));
+          g_hash_table_insert (counters, GUINT_TO_POINTER (def->counters[0].id), GINT_TO_POINTER (def->frame.pid));
+        }
+      else if (type == SYSPROF_CAPTURE_FRAME_CTRSET)
+        {
+          const SysprofCaptureCounterSet *set = sysprof_capture_reader_read_counter_set (reader);
+
+          g_assert_nonnull (set);
+          g_assert_cmpint (set->frame.time, >=, last_time);
+          last_time = set->frame.time;
+
+          /* Values must be attributed to the writer's own counter */
+          g_assert_true (g_hash_table_contains (counters, GUINT_TO_POINTER (set->values[0].ids[0])));
+          g_assert_cmpint (GPOINTER_TO_INT (g_hash_table_lookup (counters, GUINT_TO_POINTER (set->values[0].ids[0]))), ==, set->frame.pid);
+
+          n_sets++;
+        }
+      else
+        {
+          g_assert_true (sysprof_capture_reader_skip (reader));
+        }
+    }
+
+  g_assert_cmpint (n_read, ==, n_writers * n_samples);
+  g_assert_cmpint (n_sets, ==, n_writers * (n_samples / 100));
+  g_assert_cmpint (g_hash_table_size (counters), ==, n_writers);
+
+  sysprof_capture_reader_unref (reader);
+
+  g_unlink ("merged.syscap");
+}
+
 int
 main (int argc,
       char *argv[])
@@ -1090,6 +1523,10 @@ main (int argc,
   g_test_add_func ("/SysprofCapture/ReaderWriter/metadata", test_reader_writer_metadata);
   g_test_add_func ("/SysprofCapture/ReaderWriter/file", test_reader_writer_file);
   g_test_add_func ("/SysprofCapture/ReaderWriter/cat-jitmap", test_reader_writer_cat_jitmap);
+  g_test_add_func ("/SysprofCapture/ReaderWriter/merge", test_writer_merge);
   g_test_add_func ("/SysprofCapture/ReaderWriter/overlay", test_reader_writer_overlay);
+  g_test_add_func ("/SysprofCapture/ReaderWriter/stacks", test_reader_writer_stacks);
+  g_test_add_func ("/SysprofCapture/ReaderWriter/compressed", test_writer_compressed);
+  g_test_add_func ("/SysprofCapture/ReaderWriter/async", test_writer_async);
   return g_test_run ();
 }
@@ -223,6 +223,209 @@ test_allocate_with_reserve (void)
   mapped_ring_buffer_unref (reader);
 }
 
+#define N_PRODUCERS          64
+#define N_PRODUCER_RECORDS   5000
+#define MAX_PRODUCER_PAYLOAD 16
+
+typedef struct
+{
+  gint64 producer;
+  gint64 seq;
+  gint64 n_payload;
+  gint64 payload[0];
+} ProducerRecord;
+
+typedef struct
+{
+  MappedRingBuffer *writer;
+  guint             producer;
+} Producer;
+
+typedef struct
+{
+  gint64 next_seq[N_PRODUCERS];
+  guint  n_records;
+} ProducerState;
+
+static void *
+multi_producer_writer (gpointer data)
+{
+  Producer *producer = data;
+
+  for (guint seq = 0; seq < N_PRODUCER_RECORDS; seq++)
+    {
+      guint n_payload = (seq + producer->producer) % MAX_PRODUCER_PAYLOAD;
+      ProducerRecord *record;
+
+      /* Over-allocate and commit less, like the collector does */
+      while (!(record = mapped_ring_buffer_allocate (producer->writer,
+                                                     sizeof *record + sizeof (gint64) * MAX_PRODUCER_PAYLOAD)))
+        g_usleep (G_USEC_PER_SEC / 10000); /* .1msec */
+
+      record->producer = producer->producer;
+      record->seq = seq;
+      record->n_payload = n_payload;
+
+      for (guint i = 0; i < MAX_PRODUCER_PAYLOAD; i++)
+        record->payload[i] = i < n_payload ? (gint64)(producer->producer * N_PRODUCER_RECORDS + seq) : -1;
+
+      mapped_ring_buffer_commit (producer->writer, record, sizeof *record + sizeof (gint64) * n_payload);
+    }
+
+  return NULL;
+}
+
+static bool
+multi_producer_drain_cb (const void *data,
+                         size_t     *len,
+                         void       *user_data)
+{
+  const ProducerRecord *record = data;
+  ProducerState *state = user_data;
+
+  g_assert_cmpint (*len, >=, sizeof *record);
+  g_assert_cmpint (record->producer, >=, 0);
+  g_assert_cmpint (record->producer, <, N_PRODUCERS);
+  g_assert_cmpint (*len, ==, sizeof *record + sizeof (gint64) * record->n_payload);
+
+  /* Records from a single producer are seen in order, exactly once */
+  g_assert_cmpint (record->seq, ==, state->next_seq[record->producer]);
+  state->next_seq[record->producer]++;
+
+  for (guint i = 0; i < record->n_payload; i++)
+    g_assert_cmpint (record->payload[i], ==, record->producer * N_PRODUCER_RECORDS + record->seq);
+
+  state->n_records++;
+
+  return true;
+}
+
+static void
+test_multi_producer (void)
+{
+  GThread *threads[N_PRODUCERS];
+  Producer producers[N_PRODUCERS];
+  ProducerState state = {{0}};
+  MappedRingBuffer *reader;
+  MappedRingBuffer *writer;
+  gint64 *ptr;
+  int fd;
+
+  reader = mapped_ring_buffer_new_reader (4096*16);
+  g_assert_nonnull (reader);
+
+  fd = mapped_ring_buffer_get_fd (reader);
+  g_assert_cmpint (fd, >, -1);
+
+  writer = mapped_ring_buffer_new_writer (fd);
+  g_assert_nonnull (writer);
+  g_assert_true (mapped_ring_buffer_enable_multi_producer (writer));
+
+  for (guint i = 0; i < N_PRODUCERS; i++)
+    {
+      producers[i].writer = writer;
+      producers[i].producer = i;
+      threads[i] = g_thread_new ("producer", multi_producer_writer, &producers[i]);
+    }
+
+  while (state.n_records < N_PRODUCERS * N_PRODUCER_RECORDS)
+    {
+      g_assert_true (mapped_ring_buffer_drain (reader, multi_producer_drain_cb, &state));
+      g_thread_yield ();
+    }
+
+  for (guint i = 0; i < N_PRODUCERS; i++)
+    {
+      g_thread_join (threads[i]);
+      g_assert_cmpint (state.next_seq[i], ==, N_PRODUCER_RECORDS);
+    }
+
+  g_assert_true (mapped_ring_buffer_is_empty (reader));
+
+  mapped_ring_buffer_unref (writer);
+  mapped_ring_buffer_unref (reader);
+
+  /* The framing cannot change once something was written */
+  reader = mapped_ring_buffer_new_readwrite (4096*16);
+  g_assert_nonnull (reader);
+  ptr = mapped_ring_buffer_allocate (reader, sizeof *ptr);
+  g_assert_nonnull (ptr);
+  *ptr = 1;
+  mapped_ring_buffer_commit (reader, ptr, sizeof *ptr);
+  g_assert_false (mapped_ring_buffer_enable_multi_producer (reader));
+  mapped_ring_buffer_unref (reader);
+}
+
+static bool
+drain_all_cb (const void *data,
+              size_t     *len,
+              void       *user_data)
+{
+  *len = sizeof (gint64);
+  return G_SOURCE_CONTINUE;
+}
+
+static void *
+blocked_writer (gpointer data)
+{
+  MappedRingBuffer *writer = data;
+  gint64 *ptr;
+
+  /* Blocks until the reader drains */
+  ptr = mapped_ring_buffer_allocate (writer, sizeof *ptr);
+  g_assert_nonnull (ptr);
+  *ptr = 1;
+  mapped_ring_buffer_advance (writer, sizeof *ptr);
+
+  return NULL;
+}
+
+static void
+test_policies (void)
+{
+  MappedRingBuffer *ring;
+  GThread *thread;
+  gint64 *ptr;
+  guint n_written = 0;
+
+  ring = mapped_ring_buffer_new_readwrite (4096*16);
+  g_assert_nonnull (ring);
+
+  /* Dropping fails immediately and counts what was lost */
+  mapped_ring_buffer_set_policy (ring, MAPPED_RING_BUFFER_DROP);
+  while ((ptr = mapped_ring_buffer_allocate (ring, sizeof *ptr)))
+    mapped_ring_buffer_advance (ring, sizeof *ptr);
+  g_assert_cmpint (mapped_ring_buffer_get_dropped (ring), ==, 1);
+  g_assert_null (mapped_ring_buffer_allocate (ring, sizeof *ptr));
+  g_assert_cmpint (mapped_ring_buffer_get_dropped (ring), ==, 2);
+
+  /* A blocked writer is woken up once the reader makes space */
+  mapped_ring_buffer_set_policy (ring, MAPPED_RING_BUFFER_BLOCK);
+  thread = g_thread_new ("blocked-writer", blocked_writer, ring);
+  g_usleep (G_USEC_PER_SEC / 100);
+  mapped_ring_buffer_drain (ring, drain_all_cb, NULL);
+  g_thread_join (thread);
+  g_assert_cmpint (mapped_ring_buffer_get_dropped (ring), ==, 2);
+  mapped_ring_buffer_drain (ring, drain_all_cb, NULL);
+  g_assert_true (mapped_ring_buffer_is_empty (ring));
+
+  /* Sampling gives up on some records before the buffer is full */
+  mapped_ring_buffer_set_policy (ring, MAPPED_RING_BUFFER_SAMPLE);
+  for (guint i = 0; i < (4096*16) / sizeof *ptr; i++)
+    {
+      if ((ptr = mapped_ring_buffer_allocate (ring, sizeof *ptr)))
+        {
+          mapped_ring_buffer_advance (ring, sizeof *ptr);
+          n_written++;
+        }
+    }
+  g_assert_cmpint (mapped_ring_buffer_get_dropped (ring), >, 2);
+  g_assert_cmpint (n_written, <, (4096*16) / sizeof *ptr - 1);
+  g_assert_cmpint (n_written, >, (4096*16) / sizeof *ptr / 2);
+
+  mapped_ring_buffer_unref (ring);
+}
+
 gint
 main (gint argc,
       gchar *argv[])
@@ -232,5 +435,7 @@ main (gint argc,
   g_test_add_func ("/MappedRingBuffer/readwrite", test_readwrite);
   g_test_add_func ("/MappedRingBuffer/allocate_with_reserve", test_allocate_with_reserve);
   g_test_add_func ("/MappedRingBuffer/threaded_movements", test_threaded_movements);
+  g_test_add_func ("/MappedRingBuffer/multi_producer", test_multi_producer);
+  g_test_add_func ("/MappedRingBuffer/policies", test_policies);
   return g_test_run ();
 }
@@ -0,0 +1,47 @@
+/* sysprof-address-table-private.h
+ *
+ * Copyright 2023 Christian Hergert <chergert@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <glib.h>
+
+#include "sysprof-symbol.h"
+
+G_BEGIN_DECLS
+
+typedef struct _SysprofAddressTable SysprofAddressTable;
+
+void                 sysprof_address_sort_unique       (SysprofAddress            *addresses,
+                                                        guint                     *n_addresses);
+SysprofAddressTable *sysprof_address_table_new         (const SysprofAddress      *addresses,
+                                                        guint                      n_addresses);
+void                 sysprof_address_table_free        (SysprofAddressTable       *self);
+guint                sysprof_address_table_get_size    (const SysprofAddressTable *self);
+SysprofAddress       sysprof_address_table_get_address (const SysprofAddressTable *self,
+                                                        guint                      position);
+void                 sysprof_address_table_set         (SysprofAddressTable       *self,
+                                                        guint                      position,
+                                                        SysprofSymbol             *symbol);
+SysprofSymbol       *sysprof_address_table_lookup      (const SysprofAddressTable *self,
+                                                        SysprofAddress             address);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (SysprofAddressTable, sysprof_address_table_free)
+
+G_END_DECLS
@@ -0,0 +1,220 @@
+/* sysprof-address-table.c
+ *
+ * Copyright 2023 Christian Hergert <chergert@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "config.h"
+
+#include "sysprof-address-table-private.h"
+
+/* SysprofAddressTable is a flat, sorted map of exact addresses to the
+ * symbol that was resolved for them. Captures tend to contain a small
+ * number of unique instruction pointers repeated across millions of
+ * stack traces, so resolving each unique address once and then using a
+ * binary search over a contiguous array is much cheaper than walking the
+ * interval tree in SysprofSymbolCache for every address of every stack.
+ *
+ * Symbols are not referenced by the table. They are expected to be owned
+ * by a SysprofSymbolCache which outlives the table.
+ */
+struct _SysprofAddressTable
+{
+  SysprofAddress  *addresses;
+  SysprofSymbol  **symbols;
+  guint            len;
+};
+
+/**
+ * sysprof_address_sort_unique:
+ * @addresses: (array length=n_addresses): an array of addresses
+ * @n_addresses: (inout): the number of addresses in @addresses
+ *
+ * Sorts @addresses using a LSD radix sort and removes duplicates, updating
+ * @n_addresses to the number of unique addresses remaining.
+ */
+void
+sysprof_address_sort_unique (SysprofAddress *addresses,
+                             guint          *n_addresses)
+{
+  g_autofree SysprofAddress *scratch = NULL;
+  SysprofAddress *src;
+  SysprofAddress *dst;
+  guint n;
+  guint len;
+
+  g_return_if_fail (n_addresses != NULL);
+  g_return_if_fail (addresses != NULL || *n_addresses == 0);
+
+  if ((n = *n_addresses) < 2)
+    return;
+
+  scratch = g_new (SysprofAddress, n);
+  src = addresses;
+  dst = scratch;
+
+  for (guint shift = 0; shift < 64; shift += 8)
+    {
+      gsize counts[256] = {0};
+      SysprofAddress *tmp;
+      gsize offset = 0;
+
+      for (guint i = 0; i < n; i++)
+        counts[(src[i] >> shift) & 0xFF]++;
+
+      /* Addresses commonly share their upper bytes, so skip any pass
+       * where every address has the same digit.
+       */
+      if (counts[(src[0] >> shift) & 0xFF] == n)
+        continue;
+
+      for (guint d = 0; d < G_N_ELEMENTS (counts); d++)
+        {
+          gsize count = counts[d];
+          counts[d] = offset;
+          offset += count;
+        }
+
+      for (guint i = 0; i < n; i++)
+        dst[counts[(src[i] >> shift) & 0xFF]++] = src[i];
+
+      tmp = src;
+      src = dst;
+      dst = tmp;
+    }
+
+  /* Compacting forward is safe even when @src is @addresses */
+  addresses[0] = src[0];
+  len = 1;
+
+  for (guint i = 1; i < n; i++)
+    {
+      if (src[i] != addresses[len-1])
+        addresses[len++] = src[i];
+    }
+
+  *n_addresses = len;
+}
+
+/**
+ * sysprof_address_table_new:
+ * @addresses: (array length=n_addresses): sorted, unique addresses
+ * @n_addresses: the number of addresses
+ *
+ * Creates a new table for @addresses with no symbols set. Use
+ * sysprof_address_sort_unique() to prepare @addresses.
+ *
+ * Returns: (transfer full): a new #SysprofAddressTable
+ */
+SysprofAddressTable *
+sysprof_address_table_new (const SysprofAddress *addresses,
+                           guint                 n_addresses)
+{
+  SysprofAddressTable *self;
+
+  g_return_val_if_fail (addresses != NULL || n_addresses == 0, NULL);
+
+  self = g_new0 (SysprofAddressTable, 1);
+  self->addresses = g_memdup2 (addresses, sizeof *addresses * n_addresses);
+  self->symbols = g_new0 (SysprofSymbol *, n_addresses);
+  self->len = n_addresses;
+
+#ifndef G_DISABLE_ASSERT
+  for (guint i = 1; i < n_addresses; i++)
+    g_assert (addresses[i-1] < addresses[i]);
+#endif
+
+  return self;
+}
+
+void
+sysprof_address_table_free (SysprofAddressTable *self)
+{
+  if (self == NULL)
+    return;
+
+  g_clear_pointer (&self->addresses, g_free);
+  g_clear_pointer (&self->symbols, g_free);
+  g_free (self);
+}
+
+guint
+sysprof_address_table_get_size (const SysprofAddressTable *self)
+{
+  g_return_val_if_fail (self != NULL, 0);
+
+  return self->len;
+}
+
+SysprofAddress
+sysprof_address_table_get_address (const SysprofAddressTable *self,
+                                   guint                      position)
+{
+  g_return_val_if_fail (self != NULL, 0);
+  g_return_val_if_fail (position < self->len, 0);
+
+  return self->addresses[position];
+}
+
+void
+sysprof_address_table_set (SysprofAddressTable *self,
+                           guint                position,
+                           SysprofSymbol       *symbol)
+{
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (position < self->len);
+
+  self->symbols[position] = symbol;
+}
+
+/**
+ * sysprof_address_table_lookup:
+ * @self: a #SysprofAddressTable
+ * @address: the address to locate
+ *
+ * Returns: (transfer none) (nullable): the symbol resolved for exactly
+ *   @address, or %NULL if @address is unknown or could not be resolved.
+ */
+SysprofSymbol *
+sysprof_address_table_lookup (const SysprofAddressTable *self,
+                              SysprofAddress             address)
+{
+  const SysprofAddress *base;
+  guint len;
+
+  g_return_val_if_fail (self != NULL, NULL);
+
+  if (self->len == 0)
+    return NULL;
+
+  base = self->addresses;
+  len = self->len;
+
+  while (len > 1)
+    {
+      guint half = len / 2;
+
+      if (base[half] <= address)
+        base += half;
+      len -= half;
+    }
+
+  if (*base == address)
+    return self->symbols[base - self->addresses];
+
+  return NULL;
+}
@@ -33,6 +33,8 @@ G_BEGIN_DECLS
 #define SYSPROF_CALLGRAPH_CATEGORY_INHERIT   (1 << 6)
 #define SYSPROF_CALLGRAPH_CATEGORY_UNMASK(c) (c & ~(SYSPROF_CALLGRAPH_CATEGORY_INHERIT))
 
+typedef struct _SysprofCallgraphChildIndex SysprofCallgraphChildIndex;
+
 typedef struct _SysprofCallgraphSummary
 {
   SysprofSymbol *symbol;
@@ -52,6 +54,8 @@ struct _SysprofCallgraphNode
   guint                     category : 7;
   guint                     is_toplevel : 1;
   guint                     count : 24;
+  guint                     n_children;
+  SysprofCallgraphChildIndex *child_index;
 };
 
 struct _SysprofCallgraph
@@ -90,10 +94,25 @@ void                      _sysprof_callgraph_new_async          (SysprofDocument
                                                                  gpointer                  user_data);
 SysprofCallgraph         *_sysprof_callgraph_new_finish         (GAsyncResult             *result,
                                                                  GError                  **error);
+SysprofCallgraph         *_sysprof_callgraph_new_with_shards    (SysprofDocument          *document,
+                                                                 SysprofCallgraphFlags     flags,
+                                                                 GListModel               *traceables,
+                                                                 gsize                     augment_size,
+                                                                 SysprofAugmentationFunc   augment_func,
+                                                                 gpointer                  augment_func_data,
+                                                                 GDestroyNotify            augment_func_data_destroy,
+                                                                 guint                     n_shards);
 gpointer                  _sysprof_callgraph_get_symbol_augment (SysprofCallgraph         *self,
                                                                  SysprofSymbol            *symbol);
 void                      _sysprof_callgraph_node_free          (SysprofCallgraphNode     *self,
                                                                  gboolean                  free_self);
+SysprofCallgraphNode     *_sysprof_callgraph_node_find_child    (SysprofCallgraphNode     *parent,
+                                                                 SysprofCallgraphSummary  *summary);
+void                      _sysprof_callgraph_node_add_child     (SysprofCallgraphNode     *parent,
+                                                                 SysprofCallgraphNode     *child,
+                                                                 SysprofAllocator         *allocator);
+void                      _sysprof_callgraph_set_child_index_threshold
+                                                                (guint                     threshold);
 SysprofCallgraphCategory  _sysprof_callgraph_node_categorize    (SysprofCallgraphNode     *node);
 void                      _sysprof_callgraph_categorize         (SysprofCallgraph         *self,
                                                                  SysprofCallgraphNode     *node);
@@ -20,6 +20,8 @@
 
 #include "config.h"
 
+#include <libdex.h>
+
 #include "timsort/gtktimsortprivate.h"
 
 #include "sysprof-callgraph-private.h"
@@ -33,8 +35,52 @@
 
 #include "eggbitset.h"
 
-#define MAX_STACK_DEPTH     1024
-#define INLINE_AUGMENT_SIZE (GLIB_SIZEOF_VOID_P*2)
+#define MAX_STACK_DEPTH          1024
+#define INLINE_AUGMENT_SIZE      (GLIB_SIZEOF_VOID_P*2)
+#define MIN_TRACEABLES_PER_SHARD 4096
+#define CHILD_INDEX_THRESHOLD    32
+
+/* Nodes such as "All Processes" or a busy dispatch function can have
+ * thousands of children which makes a linear scan per frame expensive.
+ * Once a node passes CHILD_INDEX_THRESHOLD children, we attach an open
+ * addressing table keyed by summary so lookups become O(1). The table
+ * is allocated from the tree's allocator and grows by doubling, so any
+ * abandoned tables are bounded by the size of the final one.
+ */
+struct _SysprofCallgraphChildIndex
+{
+  guint                 mask;
+  guint                 n_items;
+  SysprofCallgraphNode *buckets[];
+};
+
+static guint child_index_threshold = CHILD_INDEX_THRESHOLD;
+
+typedef struct _SysprofCallgraphToplevel
+{
+  guint                 position;
+  SysprofCallgraphNode *node;
+} SysprofCallgraphToplevel;
+
+/* A shard is the state required to build a node tree over a range of
+ * the traceables. When building serially there is a single shard which
+ * shares the allocator, summaries, and root of the #SysprofCallgraph.
+ * When building in parallel, each shard has its own private tree which
+ * is merged into the callgraph once all shards have completed.
+ */
+typedef struct _SysprofCallgraphShard
+{
+  SysprofCallgraph     *callgraph;
+  SysprofAllocator     *allocator;
+  GHashTable           *symbol_to_summary;
+  GPtrArray            *symbols;
+  SysprofCallgraphNode *root;
+  GArray               *toplevels;
+  guint                 begin;
+  guint                 end;
+  guint                 height;
+  SysprofCallgraphNode  private_root;
+} SysprofCallgraphShard;
 
 static GType
 sysprof_callgraph_get_item_type (GListModel *model)
@@ -95,25 +141,80 @@ sysprof_callgraph_summary_free_self (SysprofCallgraphSummary *summary)
 }
 
 static inline SysprofCallgraphSummary *
-sysprof_callgraph_get_summary (SysprofCallgraph *self,
-                               SysprofSymbol    *symbol)
+sysprof_callgraph_get_summary (SysprofCallgraphShard *shard,
+                               SysprofSymbol         *symbol)
 {
   SysprofCallgraphSummary *summary;
 
-  if G_UNLIKELY (!(summary = g_hash_table_lookup (self->symbol_to_summary, symbol)))
+  if G_UNLIKELY (!(summary = g_hash_table_lookup (shard->symbol_to_summary, symbol)))
     {
       summary = g_new0 (SysprofCallgraphSummary, 1);
       summary->traceables = egg_bitset_new_empty ();
       summary->callers = g_ptr_array_new ();
       summary->symbol = symbol;
 
-      g_hash_table_insert (self->symbol_to_summary, symbol, summary);
-      g_ptr_array_add (self->symbols, symbol);
+      g_hash_table_insert (shard->symbol_to_summary, symbol, summary);
+      g_ptr_array_add (shard->symbols, symbol);
     }
 
   return summary;
 }
 
+static void
+sysprof_callgraph_shard_init (SysprofCallgraphShard *shard,
+                              SysprofCallgraph      *self)
+{
+  g_assert (shard != NULL);
+  g_assert (SYSPROF_IS_CALLGRAPH (self));
+
+  memset (shard, 0, sizeof *shard);
+
+  shard->callgraph = self;
+  shard->allocator = self->allocator;
+  shard->symbol_to_summary = self->symbol_to_summary;
+  shard->symbols = self->symbols;
+  shard->root = &self->root;
+  shard->height = self->height;
+}
+
+static SysprofCallgraphShard *
+sysprof_callgraph_shard_new (SysprofCallgraph *self,
+                             guint             begin,
+                             guint             end)
+{
+  SysprofCallgraphShard *shard;
+
+  g_assert (SYSPROF_IS_CALLGRAPH (self));
+  g_assert (begin <= end);
+
+  shard = g_new0 (SysprofCallgraphShard, 1);
+  shard->callgraph = self;
+  shard->allocator = sysprof_allocator_new ();
+  shard->symbol_to_summary = g_hash_table_new_full ((GHashFunc)sysprof_symbol_hash,
+                                                    (GEqualFunc)sysprof_symbol_equal,
+                                                    NULL,
+                                                    (GDestroyNotify)sysprof_callgraph_summary_free_self);
+  shard->symbols = g_ptr_array_new ();
+  shard->toplevels = g_array_new (FALSE, FALSE, sizeof (SysprofCallgraphToplevel));
+  shard->root = &shard->private_root;
+  shard->begin = begin;
+  shard->end = end;
+
+  shard->root->summary = sysprof_callgraph_get_summary (shard, everything);
+
+  return shard;
+}
+
+static void
+sysprof_callgraph_shard_free (SysprofCallgraphShard *shard)
+{
+  g_clear_pointer (&shard->toplevels, g_array_unref);
+  g_clear_pointer (&shard->symbols, g_ptr_array_unref);
+  g_clear_pointer (&shard->symbol_to_summary, g_hash_table_unref);
+  g_clear_pointer (&shard->allocator, sysprof_allocator_unref);
+  g_free (shard);
+}
+
 static void
 sysprof_callgraph_dispose (GObject *object)
 {
@@ -170,12 +271,131 @@ sysprof_callgraph_init (SysprofCallgraph *self)
   self->allocator = sysprof_allocator_new ();
 }
 
+static inline guint
+sysprof_callgraph_child_index_hash (const SysprofCallgraphSummary *summary)
+{
+  /* Summaries are heap allocated, so the low bits carry no entropy. Use
+   * a fibonacci hash to spread the rest across the table.
+   */
+  return (guint)(((guint64)GPOINTER_TO_SIZE (summary) >> 4) * G_GUINT64_CONSTANT (0x9E3779B97F4A7C15) >> 32);
+}
+
+static inline void
+sysprof_callgraph_child_index_insert (SysprofCallgraphChildIndex *index,
+                                      SysprofCallgraphNode       *node)
+{
+  guint pos = sysprof_callgraph_child_index_hash (node->summary) & index->mask;
+
+  while (index->buckets[pos] != NULL)
+    pos = (pos + 1) & index->mask;
+
+  index->buckets[pos] = node;
+  index->n_items++;
+}
+
+static inline SysprofCallgraphNode *
+sysprof_callgraph_child_index_lookup (const SysprofCallgraphChildIndex *index,
+                                      const SysprofCallgraphSummary    *summary)
+{
+  guint pos = sysprof_callgraph_child_index_hash (summary) & index->mask;
+
+  for (;;)
+    {
+      SysprofCallgraphNode *node = index->buckets[pos];
+
+      if (node == NULL || node->summary == summary)
+        return node;
+
+      pos = (pos + 1) & index->mask;
+    }
+}
+
+static SysprofCallgraphChildIndex *
+sysprof_callgraph_child_index_new (SysprofAllocator           *allocator,
+                                   const SysprofCallgraphNode *parent,
+                                   guint                       n_buckets)
+{
+  SysprofCallgraphChildIndex *index;
+
+  g_assert (allocator != NULL);
+  g_assert (parent != NULL);
+  g_assert (n_buckets > 0);
+  g_assert ((n_buckets & (n_buckets - 1)) == 0);
+
+  index = sysprof_allocator_alloc0 (allocator,
+                                    sizeof (SysprofCallgraphChildIndex) +
+                                    (sizeof (SysprofCallgraphNode *) * n_buckets));
+  index->mask = n_buckets - 1;
+
+  for (SysprofCallgraphNode *iter = parent->children; iter; iter = iter->next)
+    sysprof_callgraph_child_index_insert (index, iter);
+
+  return index;
+}
+
+void
+_sysprof_callgraph_set_child_index_threshold (guint threshold)
+{
+  child_index_threshold = threshold;
+}
+
+SysprofCallgraphNode *
+_sysprof_callgraph_node_find_child (SysprofCallgraphNode    *parent,
+                                    SysprofCallgraphSummary *summary)
+{
+  g_assert (parent != NULL);
+  g_assert (summary != NULL);
+
+  if (parent->child_index != NULL)
+    return sysprof_callgraph_child_index_lookup (parent->child_index, summary);
+
+  for (SysprofCallgraphNode *iter = parent->children; iter; iter = iter->next)
+    {
+      if (iter->summary == summary)
+        return iter;
+    }
+
+  return NULL;
+}
+
+void
+_sysprof_callgraph_node_add_child (SysprofCallgraphNode *parent,
+                                   SysprofCallgraphNode *child,
+                                   SysprofAllocator     *allocator)
+{
+  g_assert (parent != NULL);
+  g_assert (child != NULL);
+  g_assert (child->summary != NULL);
+  g_assert (allocator != NULL);
+
+  child->parent = parent;
+  child->prev = NULL;
+  child->next = parent->children;
+  if (parent->children)
+    parent->children->prev = child;
+  parent->children = child;
+  parent->n_children++;
+
+  if (parent->child_index != NULL)
+    {
+      /* Keep the load factor under 1/2 so probe sequences stay short */
+      if ((parent->child_index->n_items + 1) * 2 > parent->child_index->mask + 1)
+        parent->child_index = sysprof_callgraph_child_index_new (allocator,
+                                                                 parent,
+                                                                 (parent->child_index->mask + 1) * 2);
+      else
+        sysprof_callgraph_child_index_insert (parent->child_index, child);
+    }
+  else if (parent->n_children >= child_index_threshold)
+    parent->child_index = sysprof_callgraph_child_index_new (allocator,
+                                                             parent,
+                                                             1u << g_bit_storage (parent->n_children * 2));
+}
+
 static void
-sysprof_callgraph_populate_callers (SysprofCallgraph     *self,
-                                    SysprofCallgraphNode *node,
+sysprof_callgraph_populate_callers (SysprofCallgraphNode *node,
                                     guint                 list_model_index)
 {
-  g_assert (SYSPROF_IS_CALLGRAPH (self));
   g_assert (node != NULL);
 
   for (const SysprofCallgraphNode *iter = node;
@@ -199,19 +419,19 @@ sysprof_callgraph_populate_callers (SysprofCallgraph     *self,
 }
 
 static SysprofCallgraphNode *
-sysprof_callgraph_add_trace (SysprofCallgraph  *self,
-                             SysprofSymbol    **symbols,
-                             guint              n_symbols,
-                             guint              list_model_index,
-                             gboolean           hide_system_libraries)
+sysprof_callgraph_add_trace (SysprofCallgraphShard  *shard,
+                             SysprofSymbol         **symbols,
+                             guint                   n_symbols,
+                             guint                   list_model_index,
+                             gboolean                hide_system_libraries)
 {
   SysprofCallgraphNode *parent = NULL;
 
-  g_assert (SYSPROF_IS_CALLGRAPH (self));
+  g_assert (shard != NULL);
   g_assert (n_symbols >= 2);
   g_assert (symbols[n_symbols-1] == everything);
 
-  parent = &self->root;
+  parent = shard->root;
   parent->count++;
 
   for (guint i = n_symbols - 1; i > 0; i--)
@@ -223,55 +443,64 @@ sysprof_callgraph_add_trace (SysprofCallgraph  *self,
       if (hide_system_libraries && _sysprof_symbol_is_system_library (symbol))
         continue;
 
-      summary = sysprof_callgraph_get_summary (self, symbol);
+      summary = sysprof_callgraph_get_summary (shard, symbol);
 
-      /* Try to find @symbol within the children of @parent */
-      for (SysprofCallgraphNode *iter = parent->children;
-           iter != NULL;
-           iter = iter->next)
+      /* Try to find @symbol within the children of @parent. Wide nodes
+       * have an index, otherwise the list is short enough to scan.
+       */
+      if G_UNLIKELY (parent->child_index != NULL)
         {
-          g_assert (iter != NULL);
-          g_assert (iter->summary != NULL);
-          g_assert (iter->summary->symbol != NULL);
-          g_assert (symbol != NULL);
-
-          if (iter->summary == summary)
+          if ((node = sysprof_callgraph_child_index_lookup (parent->child_index, summary)))
             {
-              node = iter;
               node->count++;
+              goto next_symbol;
+            }
+        }
+      else
+        {
+          for (SysprofCallgraphNode *iter = parent->children;
+               iter != NULL;
+               iter = iter->next)
+            {
+              g_assert (iter != NULL);
+              g_assert (iter->summary != NULL);
+              g_assert (iter->summary->symbol != NULL);
+              g_assert (symbol != NULL);
 
-              if (iter != parent->children)
+              if (iter->summary == summary)
                 {
-                  iter->prev->next = iter->next;
+                  node = iter;
+                  node->count++;
 
-                  if (iter->next != NULL)
-                    iter->next->prev = iter->prev;
+                  if (iter != parent->children)
+                    {
+                      iter->prev->next = iter->next;
 
-                  iter->prev = NULL;
-                  iter->next = parent->children;
-                  parent->children->prev = iter;
-                  parent->children = iter;
-                }
+                      if (iter->next != NULL)
+                        iter->next->prev = iter->prev;
 
-              goto next_symbol;
+                      iter->prev = NULL;
+                      iter->next = parent->children;
+                      parent->children->prev = iter;
+                      parent->children = iter;
+                    }
+
+                  goto next_symbol;
+                }
             }
         }
 
       /* Otherwise create a new node */
-      node = sysprof_allocator_new0 (self->allocator, SysprofCallgraphNode);
+      node = sysprof_allocator_new0 (shard->allocator, SysprofCallgraphNode);
       node->summary = summary;
-      node->parent = parent;
-      node->next = parent->children;
       node->count = 1;
-      if (parent->children)
-        parent->children->prev = node;
-      parent->children = node;
+      _sysprof_callgraph_node_add_child (parent, node, shard->allocator);
 
     next_symbol:
       parent = node;
     }
 
-  sysprof_callgraph_populate_callers (self, parent, list_model_index);
+  sysprof_callgraph_populate_callers (parent, list_model_index);
 
   return parent;
 }
@@ -346,49 +575,48 @@ _sysprof_callgraph_categorize (SysprofCallgraph     *self,
     }
 }
 
-static void
-sysprof_callgraph_add_traceable (SysprofCallgraph         *self,
-                                 SysprofDocumentTraceable *traceable,
-                                 guint                     list_model_index)
+static SysprofCallgraphNode *
+sysprof_callgraph_add_traceable (SysprofCallgraphShard              *shard,
+                                 const SysprofDocumentTraceableView *traceable)
 {
+  SysprofCallgraph *self;
   SysprofAddressContext final_context;
-  SysprofCallgraphNode *node;
   SysprofSymbol **symbols;
   SysprofSymbol *process_symbol;
   guint stack_depth;
   guint n_symbols;
   int pid;
-  int tid;
 
-  g_assert (SYSPROF_IS_CALLGRAPH (self));
-  g_assert (SYSPROF_IS_DOCUMENT_TRACEABLE (traceable));
+  g_assert (shard != NULL);
+  g_assert (SYSPROF_IS_CALLGRAPH (shard->callgraph));
+  g_assert (traceable != NULL);
 
-  pid = sysprof_document_frame_get_pid (SYSPROF_DOCUMENT_FRAME (traceable));
+  self = shard->callgraph;
+  pid = traceable->pid;
 
   /* Ignore "Process 0" (the Idle process) if requested */
   if (pid == 0 && (self->flags & SYSPROF_CALLGRAPH_FLAGS_IGNORE_PROCESS_0) != 0)
-    return;
+    return NULL;
 
   /* Ignore kernel processes if requested */
   process_symbol = _sysprof_document_process_symbol (self->document, pid, !!(self->flags & SYSPROF_CALLGRAPH_FLAGS_MERGE_SIMILAR_PROCESSES));
   if (process_symbol->is_kernel_process && (self->flags & SYSPROF_CALLGRAPH_FLAGS_IGNORE_KERNEL_PROCESSES))
-    return;
-
-  tid = sysprof_document_traceable_get_thread_id (traceable);
+    return NULL;
 
   /* Early ignore anything with empty or too large a stack */
-  stack_depth = sysprof_document_traceable_get_stack_depth (traceable);
+  stack_depth = traceable->n_addresses;
   if (stack_depth == 0 || stack_depth > MAX_STACK_DEPTH)
-    return;
+    return NULL;
 
   symbols = g_newa (SysprofSymbol *, stack_depth + 4);
-  n_symbols = sysprof_document_symbolize_traceable (self->document,
-                                                    traceable,
-                                                    symbols,
-                                                    stack_depth,
-                                                    &final_context);
+  n_symbols = _sysprof_document_symbolize_addresses (self->document,
+                                                     pid,
+                                                     traceable->addresses,
+                                                     stack_depth,
+                                                     symbols,
+                                                     &final_context);
   if (n_symbols == 0)
-    return;
+    return NULL;
 
   g_assert (n_symbols <= stack_depth);
 
@@ -430,31 +658,38 @@ sysprof_callgraph_add_traceable (SysprofCallgraph         *self,
    * insert a symbol for that before the real stacks.
    */
   if ((self->flags & SYSPROF_CALLGRAPH_FLAGS_INCLUDE_THREADS) != 0)
-    symbols[n_symbols++] = _sysprof_document_thread_symbol (self->document, pid, tid);
+    symbols[n_symbols++] = _sysprof_document_thread_symbol (self->document, pid, traceable->tid);
 
   symbols[n_symbols++] = process_symbol;
   symbols[n_symbols++] = everything;
 
-  if (n_symbols > self->height)
-    self->height = n_symbols;
+  if (n_symbols > shard->height)
+    shard->height = n_symbols;
 
-  node = sysprof_callgraph_add_trace (self,
+  return sysprof_callgraph_add_trace (shard,
                                       symbols,
                                       n_symbols,
-                                      list_model_index,
+                                      traceable->position,
                                       !!(self->flags & SYSPROF_CALLGRAPH_FLAGS_HIDE_SYSTEM_LIBRARIES));
+}
 
-  if (node != NULL)
-    {
-      node->is_toplevel = TRUE;
-
-      if (self->augment_func)
-        self->augment_func (self,
-                            node,
-                            SYSPROF_DOCUMENT_FRAME (traceable),
-                            TRUE,
-                            self->augment_func_data);
-    }
+static void
+sysprof_callgraph_complete_toplevel (SysprofCallgraph     *self,
+                                     SysprofCallgraphNode *node,
+                                     SysprofDocumentFrame *frame)
+{
+  g_assert (SYSPROF_IS_CALLGRAPH (self));
+  g_assert (node != NULL);
+  g_assert (!self->augment_func || SYSPROF_IS_DOCUMENT_TRACEABLE (frame));
+
+  node->is_toplevel = TRUE;
+
+  if (self->augment_func)
+    self->augment_func (self,
+                        node,
+                        frame,
+                        TRUE,
+                        self->augment_func_data);
 
   if ((self->flags & SYSPROF_CALLGRAPH_FLAGS_CATEGORIZE_FRAMES) != 0)
     _sysprof_callgraph_categorize (self, node);
@@ -525,62 +760,282 @@ sort_children (SysprofCallgraphNode  *node,
 }
 
 static void
-sysprof_callgraph_new_worker (GTask        *task,
-                              gpointer      source_object,
-                              gpointer      task_data,
-                              GCancellable *cancellable)
+sysprof_callgraph_build_serial (SysprofCallgraph *self)
 {
-  SysprofCallgraph *self = task_data;
+  SysprofDocumentTraceableCursor cursor;
+  SysprofDocumentTraceableView traceable;
+  SysprofCallgraphShard shard;
+
+  g_assert (SYSPROF_IS_CALLGRAPH (self));
+
+  sysprof_callgraph_shard_init (&shard, self);
+
+  _sysprof_document_traceable_cursor_init (&cursor, self->document, self->traceables, NULL);
+
+  while (_sysprof_document_traceable_cursor_next (&cursor, &traceable))
+    {
+      SysprofCallgraphNode *node;
+
+      if ((node = sysprof_callgraph_add_traceable (&shard, &traceable)))
+        {
+          g_autoptr(SysprofDocumentFrame) frame = NULL;
+
+          /* Only materialize a frame object when someone needs to see it */
+          if (self->augment_func != NULL)
+            frame = _sysprof_document_traceable_cursor_dup_frame (&cursor, &traceable);
+
+          sysprof_callgraph_complete_toplevel (self, node, frame);
+        }
+    }
+
+  _sysprof_document_traceable_cursor_clear (&cursor);
+
+  self->height = shard.height;
+}
+
+static DexFuture *
+sysprof_callgraph_shard_thread (gpointer user_data)
+{
+  SysprofCallgraphShard *shard = user_data;
+  SysprofDocumentTraceableCursor cursor;
+  SysprofDocumentTraceableView traceable;
+
+  g_assert (shard != NULL);
+  g_assert (SYSPROF_IS_CALLGRAPH (shard->callgraph));
+
+  _sysprof_document_traceable_cursor_init_range (&cursor,
+                                                 shard->callgraph->document,
+                                                 shard->callgraph->traceables,
+                                                 shard->begin,
+                                                 shard->end);
+
+  while (_sysprof_document_traceable_cursor_next (&cursor, &traceable))
+    {
+      SysprofCallgraphToplevel toplevel;
+
+      if ((toplevel.node = sysprof_callgraph_add_traceable (shard, &traceable)))
+        {
+          toplevel.position = traceable.position;
+          g_array_append_val (shard->toplevels, toplevel);
+        }
+    }
+
+  _sysprof_document_traceable_cursor_clear (&cursor);
+
+  return dex_future_new_for_boolean (TRUE);
+}
+
+static void
+sysprof_callgraph_merge_summaries (SysprofCallgraphShard *main,
+                                   SysprofCallgraphShard *shard)
+{
+  g_assert (main != NULL);
+  g_assert (shard != NULL);
+
+  /* Walk symbols in the order the shard discovered them so that the
+   * resulting symbol list is the same as when building serially.
+   */
+  for (guint i = 0; i < shard->symbols->len; i++)
+    {
+      SysprofSymbol *symbol = g_ptr_array_index (shard->symbols, i);
+      SysprofCallgraphSummary *src = g_hash_table_lookup (shard->symbol_to_summary, symbol);
+      SysprofCallgraphSummary *dst = sysprof_callgraph_get_summary (main, symbol);
+
+      g_assert (src != NULL);
+      g_assert (dst != NULL);
+
+      egg_bitset_union (dst->traceables, src->traceables);
+
+      for (guint j = 0; j < src->callers->len; j++)
+        {
+          SysprofSymbol *caller = g_ptr_array_index (src->callers, j);
+          guint pos;
+
+          if (!g_ptr_array_find (dst->callers, caller, &pos))
+            g_ptr_array_add (dst->callers, caller);
+        }
+
+      /* Augmentation is never run on shard summaries, so we can use
+       * that space to track which summary we were merged into.
+       */
+      src->augment[0] = dst;
+    }
+}
+
+static void
+sysprof_callgraph_merge_node (SysprofCallgraphShard *main,
+                              SysprofCallgraphNode  *dst,
+                              SysprofCallgraphNode  *src)
+{
+  g_assert (main != NULL);
+  g_assert (dst != NULL);
+  g_assert (src != NULL);
+
+  dst->count += src->count;
+
+  /* Like summaries, shard nodes are never augmented so use that space
+   * to track the node we merged into for replaying toplevels.
+   */
+  src->augment[0] = dst;
+
+  for (SysprofCallgraphNode *child = src->children; child; child = child->next)
+    {
+      SysprofCallgraphSummary *summary = child->summary->augment[0];
+      SysprofCallgraphNode *node;
+
+      g_assert (summary != NULL);
+
+      if (!(node = _sysprof_callgraph_node_find_child (dst, summary)))
+        {
+          node = sysprof_allocator_new0 (main->allocator, SysprofCallgraphNode);
+          node->summary = summary;
+          _sysprof_callgraph_node_add_child (dst, node, main->allocator);
+        }
+
+      sysprof_callgraph_merge_node (main, node, child);
+    }
+}
+
+static gboolean
+sysprof_callgraph_build_sharded (SysprofCallgraph *self,
+                                 guint             n_shards)
+{
+  g_autoptr(DexThreadPool) pool = NULL;
+  g_autoptr(GPtrArray) futures = NULL;
+  g_autoptr(GPtrArray) shards = NULL;
+  SysprofCallgraphShard main;
   guint n_items;
+  guint begin = 0;
 
-  g_assert (G_IS_TASK (task));
-  g_assert (source_object == NULL);
   g_assert (SYSPROF_IS_CALLGRAPH (self));
-  g_assert (!cancellable || G_IS_CANCELLABLE (cancellable));
+  g_assert (n_shards > 1);
 
   n_items = g_list_model_get_n_items (self->traceables);
 
-  for (guint i = 0; i < n_items; i++)
+  if (!(pool = dex_thread_pool_new (MIN (g_get_num_processors (), n_shards))))
+    return FALSE;
+
+  shards = g_ptr_array_new_with_free_func ((GDestroyNotify)sysprof_callgraph_shard_free);
+  futures = g_ptr_array_new_with_free_func (dex_unref);
+
+  for (guint i = 0; i < n_shards; i++)
     {
-      g_autoptr(SysprofDocumentTraceable) traceable = g_list_model_get_item (self->traceables, i);
+      guint end = (i + 1 == n_shards) ? n_items : begin + (n_items / n_shards);
+      SysprofCallgraphShard *shard = sysprof_callgraph_shard_new (self, begin, end);
+
+      g_ptr_array_add (shards, shard);
+      g_ptr_array_add (futures,
+                       dex_thread_pool_submit (pool,
+                                               "[sysprof-callgraph-shard]",
+                                               sysprof_callgraph_shard_thread,
+                                               shard,
+                                               NULL));
+
+      begin = end;
+    }
 
-      /* Currently, we might be racing against changes in the model. And we
-       * definitely need to address that. But this at least keeps things
-       * recovering in the meantime.
-       */
-      if (traceable == NULL)
-        break;
+  dex_thread_wait_for (dex_future_allv ((DexFuture **)futures->pdata, futures->len), NULL);
+  dex_thread_wait_for (dex_thread_pool_close (pool, DEX_THREAD_POOL_SHUTDOWN_DRAIN), NULL);
+
+  /* Merge shards in order so that the result is deterministic and
+   * matches what would have been produced by a serial build.
+   */
+  sysprof_callgraph_shard_init (&main, self);
+
+  for (guint i = 0; i < shards->len; i++)
+    {
+      SysprofCallgraphShard *shard = g_ptr_array_index (shards, i);
 
-      sysprof_callgraph_add_traceable (self, traceable, i);
+      sysprof_callgraph_merge_summaries (&main, shard);
+      sysprof_callgraph_merge_node (&main, main.root, shard->root);
+
+      if (shard->height > self->height)
+        self->height = shard->height;
     }
 
+  /* Now replay toplevels against the merged tree, in the same order as
+   * the serial build, as augmentation and categorization are only valid
+   * against the final tree.
+   */
+  for (guint i = 0; i < shards->len; i++)
+    {
+      SysprofCallgraphShard *shard = g_ptr_array_index (shards, i);
+
+      for (guint j = 0; j < shard->toplevels->len; j++)
+        {
+          const SysprofCallgraphToplevel *toplevel = &g_array_index (shard->toplevels, SysprofCallgraphToplevel, j);
+          SysprofCallgraphNode *node = toplevel->node->augment[0];
+
+          g_autoptr(SysprofDocumentFrame) frame = NULL;
+
+          g_assert (node != NULL);
+
+          if (self->augment_func != NULL &&
+              !(frame = g_list_model_get_item (self->traceables, toplevel->position)))
+            continue;
+
+          sysprof_callgraph_complete_toplevel (self, node, frame);
+        }
+    }
+
+  return TRUE;
+}
+
+static void
+sysprof_callgraph_build (SysprofCallgraph *self,
+                         guint             n_shards)
+{
+  g_assert (SYSPROF_IS_CALLGRAPH (self));
+
+  if (n_shards == 0)
+    {
+      guint n_items = g_list_model_get_n_items (self->traceables);
+
+      n_shards = MIN (g_get_num_processors (), n_items / MIN_TRACEABLES_PER_SHARD);
+    }
+
+  if (n_shards < 2 || !sysprof_callgraph_build_sharded (self, n_shards))
+    sysprof_callgraph_build_serial (self);
+
   /* Sort callgraph nodes alphabetically so that we can use them in the
    * flamegraph without any further processing.
    */
   sort_children (&self->root, self->flags);
+}
+
+static void
+sysprof_callgraph_new_worker (GTask        *task,
+                              gpointer      source_object,
+                              gpointer      task_data,
+                              GCancellable *cancellable)
+{
+  SysprofCallgraph *self = task_data;
+
+  g_assert (G_IS_TASK (task));
+  g_assert (source_object == NULL);
+  g_assert (SYSPROF_IS_CALLGRAPH (self));
+  g_assert (!cancellable || G_IS_CANCELLABLE (cancellable));
+
+  sysprof_callgraph_build (self, 0);
 
   g_task_return_pointer (task, g_object_ref (self), g_object_unref);
 }
 
-void
-_sysprof_callgraph_new_async (SysprofDocument         *document,
-                              SysprofCallgraphFlags    flags,
-                              GListModel              *traceables,
-                              gsize                    augment_size,
-                              SysprofAugmentationFunc  augment_func,
-                              gpointer                 augment_func_data,
-                              GDestroyNotify           augment_func_data_destroy,
-                              GCancellable            *cancellable,
-                              GAsyncReadyCallback      callback,
-                              gpointer                 user_data)
+static SysprofCallgraph *
+sysprof_callgraph_new_internal (SysprofDocument         *document,
+                                SysprofCallgraphFlags    flags,
+                                GListModel              *traceables,
+                                gsize                    augment_size,
+                                SysprofAugmentationFunc  augment_func,
+                                gpointer                 augment_func_data,
+                                GDestroyNotify           augment_func_data_destroy)
 {
-  g_autoptr(SysprofCallgraph) self = NULL;
-  g_autoptr(GTask) task = NULL;
+  SysprofCallgraphShard shard;
+  SysprofCallgraph *self;
   GDestroyNotify summary_free;
 
-  g_return_if_fail (SYSPROF_IS_DOCUMENT (document));
-  g_return_if_fail (G_IS_LIST_MODEL (traceables));
-  g_return_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable));
+  g_assert (SYSPROF_IS_DOCUMENT (document));
+  g_assert (G_IS_LIST_MODEL (traceables));
 
   if (augment_size > INLINE_AUGMENT_SIZE)
     summary_free = (GDestroyNotify)sysprof_callgraph_summary_free_all;
@@ -600,7 +1055,39 @@ _sysprof_callgraph_new_async (SysprofDocument         *document,
                                                    NULL,
                                                    summary_free);
   self->symbols = g_ptr_array_new ();
-  self->root.summary = sysprof_callgraph_get_summary (self, everything);
+
+  sysprof_callgraph_shard_init (&shard, self);
+  self->root.summary = sysprof_callgraph_get_summary (&shard, everything);
+
+  return self;
+}
+
+void
+_sysprof_callgraph_new_async (SysprofDocument         *document,
+                              SysprofCallgraphFlags    flags,
+                              GListModel              *traceables,
+                              gsize                    augment_size,
+                              SysprofAugmentationFunc  augment_func,
+                              gpointer                 augment_func_data,
+                              GDestroyNotify           augment_func_data_destroy,
+                              GCancellable            *cancellable,
+                              GAsyncReadyCallback      callback,
+                              gpointer                 user_data)
+{
+  g_autoptr(SysprofCallgraph) self = NULL;
+  g_autoptr(GTask) task = NULL;
+
+  g_return_if_fail (SYSPROF_IS_DOCUMENT (document));
+  g_return_if_fail (G_IS_LIST_MODEL (traceables));
+  g_return_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable));
+
+  self = sysprof_callgraph_new_internal (document,
+                                         flags,
+                                         traceables,
+                                         augment_size,
+                                         augment_func,
+                                         augment_func_data,
+                                         augment_func_data_destroy);
 
   task = g_task_new (NULL, cancellable, callback, user_data);
   g_task_set_source_tag (task, _sysprof_callgraph_new_async);
@@ -608,6 +1095,45 @@ _sysprof_callgraph_new_async (SysprofDocument         *document,
   g_task_run_in_thread (task, sysprof_callgraph_new_worker);
 }
 
+/**
+ * _sysprof_callgraph_new_with_shards:
+ * @n_shards: the number of shards to build with, or 0 for automatic
+ *
+ * Synchronously builds a callgraph, splitting @traceables into @n_shards
+ * ranges which are built in parallel and then merged. A value of 1 for
+ * @n_shards will build the callgraph serially.
+ *
+ * This is primarily useful to compare sharded and serial builds.
+ *
+ * Returns: (transfer full): a #SysprofCallgraph
+ */
+SysprofCallgraph *
+_sysprof_callgraph_new_with_shards (SysprofDocument         *document,
+                                    SysprofCallgraphFlags    flags,
+                                    GListModel              *traceables,
+                                    gsize                    augment_size,
+                                    SysprofAugmentationFunc  augment_func,
+                                    gpointer                 augment_func_data,
+                                    GDestroyNotify           augment_func_data_destroy,
+                                    guint                    n_shards)
+{
+  SysprofCallgraph *self;
+
+  g_return_val_if_fail (SYSPROF_IS_DOCUMENT (document), NULL);
+  g_return_val_if_fail (G_IS_LIST_MODEL (traceables), NULL);
+
+  self = sysprof_callgraph_new_internal (document,
+                                         flags,
+                                         traceables,
+                                         augment_size,
+                                         augment_func,
+                                         augment_func_data,
+                                         augment_func_data_destroy);
+  sysprof_callgraph_build (self, n_shards);
+
+  return self;
+}
+
 SysprofCallgraph *
 _sysprof_callgraph_new_finish (GAsyncResult  *result,
                                GError       **error)
@@ -854,26 +1380,27 @@ filter_by_prefix_free (FilterByPrefix *state)
 }
 
 static gboolean
-traceable_has_prefix (SysprofDocument          *document,
-                      SysprofDocumentTraceable *traceable,
-                      GPtrArray                *prefix)
+traceable_has_prefix (SysprofDocument                    *document,
+                      const SysprofDocumentTraceableView *traceable,
+                      GPtrArray                          *prefix)
 {
   SysprofAddressContext final_context;
   SysprofSymbol **symbols;
-  SysprofAddress *addresses;
   guint s = 0;
   guint stack_depth;
   guint n_symbols;
 
-  stack_depth = sysprof_document_traceable_get_stack_depth (traceable);
+  stack_depth = traceable->n_addresses;
   if (stack_depth > MAX_STACK_DEPTH)
     return FALSE;
 
-  addresses = g_alloca (sizeof (SysprofAddress) * stack_depth);
-  sysprof_document_traceable_get_stack_addresses (traceable, addresses, stack_depth);
-
-  symbols = g_alloca (sizeof (SysprofSymbol *) * stack_depth);
-  n_symbols = sysprof_document_symbolize_traceable (document, traceable, symbols, stack_depth, &final_context);
+  symbols = g_alloca (sizeof (SysprofSymbol *) * (stack_depth + 1));
+  n_symbols = _sysprof_document_symbolize_addresses (document,
+                                                     traceable->pid,
+                                                     traceable->addresses,
+                                                     stack_depth,
+                                                     symbols,
+                                                     &final_context);
 
   if (n_symbols < prefix->len)
     return FALSE;
@@ -901,12 +1428,12 @@ filter_by_prefix_worker (GTask        *task,
 {
   FilterByPrefix *state = task_data;
   g_autoptr(EggBitset) bitset = NULL;
+  SysprofDocumentTraceableCursor cursor;
+  SysprofDocumentTraceableView traceable;
   SysprofDocument *document;
   GListModel *model;
   GPtrArray *prefix;
-  EggBitsetIter iter;
   guint n_results = 0;
-  guint i;
 
   g_assert (G_IS_TASK (task));
   g_assert (SYSPROF_IS_CALLGRAPH (source_object));
@@ -923,22 +1450,20 @@ filter_by_prefix_worker (GTask        *task,
   document = state->document;
   prefix = state->prefix;
 
-  if (egg_bitset_iter_init_first (&iter, state->bitset, &i))
+  _sysprof_document_traceable_cursor_init (&cursor, document, model, state->bitset);
+
+  while (n_results < state->max_results &&
+         _sysprof_document_traceable_cursor_next (&cursor, &traceable))
     {
-      do
+      if (traceable_has_prefix (document, &traceable, prefix))
         {
-          g_autoptr(SysprofDocumentTraceable) traceable = g_list_model_get_item (model, i);
-
-          if (traceable_has_prefix (document, traceable, prefix))
-            {
-              egg_bitset_add (bitset, i);
-              n_results++;
-            }
+          egg_bitset_add (bitset, traceable.position);
+          n_results++;
         }
-      while (n_results < state->max_results &&
-             egg_bitset_iter_next (&iter, &i));
     }
 
+  _sysprof_document_traceable_cursor_clear (&cursor);
+
   g_task_return_pointer (task,
                          _sysprof_document_bitset_index_new (model, bitset),
                          g_object_unref);
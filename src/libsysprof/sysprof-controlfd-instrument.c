@@ -60,10 +60,62 @@ G_DEFINE_FINAL_TYPE (SysprofControlfdInstrument, sysprof_controlfd_instrument, S
 typedef struct _RingData
 {
   SysprofCaptureWriter *writer;
+  MappedRingBuffer *ring_buffer;
   GArray *source_ids;
   guint id;
+  guint dropped;
+  guint dropped_counter_id;
+  int pid;
 } RingData;
 
+/* Records how many frames the collector had to give up on so that
+ * lost data is visible in the capture.
+ */
+static void
+ring_data_update_dropped (RingData *ring_data)
+{
+  SysprofCaptureCounterValue value;
+  guint dropped;
+
+  dropped = mapped_ring_buffer_get_dropped (ring_data->ring_buffer);
+
+  if G_LIKELY (dropped == ring_data->dropped)
+    return;
+
+  if (ring_data->dropped_counter_id == 0)
+    {
+      SysprofCaptureCounter counter = {0};
+
+      if (!(ring_data->dropped_counter_id = sysprof_capture_writer_request_counter (ring_data->writer, 1)))
+        return;
+
+      g_strlcpy (counter.category, "Collector", sizeof counter.category);
+      g_strlcpy (counter.name, "Dropped Records", sizeof counter.name);
+      g_strlcpy (counter.description, "Records the collector could not write in time", sizeof counter.description);
+      counter.id = ring_data->dropped_counter_id;
+      counter.type = SYSPROF_CAPTURE_COUNTER_INT64;
+
+      sysprof_capture_writer_define_counters (ring_data->writer,
+                                              SYSPROF_CAPTURE_CURRENT_TIME,
+                                              -1,
+                                              ring_data->pid,
+                                              &counter,
+                                              1);
+    }
+
+  value.v64 = dropped;
+
+  sysprof_capture_writer_set_counters (ring_data->writer,
+                                       SYSPROF_CAPTURE_CURRENT_TIME,
+                                       -1,
+                                       ring_data->pid,
+                                       &ring_data->dropped_counter_id,
+                                       &value,
+                                       1);
+
+  ring_data->dropped = dropped;
+}
+
 static void
 ring_data_free (gpointer data)
 {
@@ -83,7 +135,12 @@ ring_data_free (gpointer data)
 
   ring_data->id = 0;
 
+  /* Frames which were dropped after the last one we saw */
+  if (ring_data->ring_buffer != NULL && ring_data->pid > 0)
+    ring_data_update_dropped (ring_data);
+
   g_clear_pointer (&ring_data->writer, sysprof_capture_writer_unref);
+  g_clear_pointer (&ring_data->ring_buffer, mapped_ring_buffer_unref);
   g_array_unref (ring_data->source_ids);
   g_free (ring_data);
 }
@@ -181,6 +238,8 @@ sysprof_controlfd_instrument_frame_cb (gconstpointer  data,
     return G_SOURCE_REMOVE;
 
   _sysprof_capture_writer_add_raw (ring_data->writer, fr);
+  ring_data->pid = fr->pid;
+  ring_data_update_dropped (ring_data);
 
   *length = fr->len;
 
@@ -191,10 +250,9 @@ static DexFuture *
 sysprof_controlfd_instrument_record_fiber (gpointer user_data)
 {
   SysprofControlfdRecording *state = user_data;
-  g_autoptr(SysprofCaptureWriter) temp_writer = NULL;
+  g_autoptr(GPtrArray) temp_writers = NULL;
   SysprofCaptureWriter *writer;
   g_autoptr(GError) error = NULL;
-  g_autofd int mem_fd = -1;
   GInputStream *input;
 
   g_assert (state != NULL);
@@ -204,10 +262,10 @@ sysprof_controlfd_instrument_record_fiber (gpointer user_data)
 
   input = g_io_stream_get_input_stream (G_IO_STREAM (state->stream));
 
-  if (!(mem_fd = sysprof_memfd_create ("[controlfd-memfd]")))
-    return dex_future_new_for_errno (errno);
-
-  temp_writer = sysprof_capture_writer_new_from_fd (g_steal_fd (&mem_fd), 0);
+  /* Each ring buffer gets its own capture so that every one of them is
+   * in time order and they can be merged into the recording at the end.
+   */
+  temp_writers = g_ptr_array_new_with_free_func ((GDestroyNotify)sysprof_capture_writer_unref);
   writer = _sysprof_recording_writer (state->recording);
 
   for (;;)
@@ -236,10 +294,26 @@ sysprof_controlfd_instrument_record_fiber (gpointer user_data)
       if ((ring_buffer = mapped_ring_buffer_new_reader (0)))
         {
           int fd = mapped_ring_buffer_get_fd (ring_buffer);
+          SysprofCaptureWriter *temp_writer;
+          g_autofd int mem_fd = -1;
           RingData *ring_data;
 
+          if (-1 == (mem_fd = sysprof_memfd_create ("[controlfd-memfd]")) ||
+              !(temp_writer = sysprof_capture_writer_new_from_fd (g_steal_fd (&mem_fd), 0)))
+            {
+              int errsv = errno;
+              g_set_error_literal (&error,
+                                   G_IO_ERROR,
+                                   g_io_error_from_errno (errsv),
+                                   g_strerror (errsv));
+              goto handle_error;
+            }
+
+          g_ptr_array_add (temp_writers, temp_writer);
+
           ring_data = g_new0 (RingData, 1);
           ring_data->writer = sysprof_capture_writer_ref (temp_writer);
+          ring_data->ring_buffer = mapped_ring_buffer_ref (ring_buffer);
           ring_data->source_ids = g_array_ref (state->source_ids);
           ring_data->id = mapped_ring_buffer_create_source_full (G_PRIORITY_HIGH,
                                                                  ring_buffer,
@@ -262,12 +336,21 @@ handle_error:
       g_source_remove (id);
     }
 
-  if (temp_writer != NULL)
+  if (temp_writers->len > 0)
     {
-      g_autoptr(SysprofCaptureReader) reader = sysprof_capture_writer_create_reader (temp_writer);
+      g_autoptr(GPtrArray) readers = g_ptr_array_new_with_free_func ((GDestroyNotify)sysprof_capture_reader_unref);
+
+      for (guint i = 0; i < temp_writers->len; i++)
+        {
+          SysprofCaptureReader *reader = sysprof_capture_writer_create_reader (g_ptr_array_index (temp_writers, i));
+
+          if (reader != NULL)
+            g_ptr_array_add (readers, reader);
+        }
 
-      if (reader != NULL)
-        sysprof_capture_writer_cat (writer, reader);
+      sysprof_capture_writer_merge (writer,
+                                    (SysprofCaptureReader **)readers->pdata,
+                                    readers->len);
     }
 
   if (error != NULL)
@@ -42,6 +42,11 @@ struct _SysprofDebuginfodSymbolizer
 
   GWeakRef           loader_wr;
 
+  /* Guards @client, @loader, @cache, and @failed as symbolize() may be
+   * called from multiple threads at once.
+   */
+  GMutex             mutex;
+
   debuginfod_client *client;
   SysprofElfLoader  *loader;
   GHashTable        *cache;
@@ -106,8 +111,9 @@ sysprof_debuginfod_symbolizer_symbolize (SysprofSymbolizer        *symbolizer,
 {
 #if HAVE_DEBUGINFOD
   SysprofDebuginfodSymbolizer *self = SYSPROF_DEBUGINFOD_SYMBOLIZER (symbolizer);
+  g_autoptr(GMutexLocker) locker = NULL;
   g_autoptr(SysprofElf) elf = NULL;
-  g_autofree char *name = NULL;
+  const char *name;
   SysprofSymbol *sym = NULL;
   SysprofDocumentMmap *map;
   const char *build_id;
@@ -135,6 +141,11 @@ sysprof_debuginfod_symbolizer_symbolize (SysprofSymbolizer        *symbolizer,
   file_offset = sysprof_document_mmap_get_file_offset (map);
   path = sysprof_document_mmap_get_file (map);
 
+  /* Everything past here touches shared state, including the ELF objects
+   * we attach debuginfo to, so only symbolize one address at a time.
+   */
+  locker = g_mutex_locker_new (&self->mutex);
+
   if (g_hash_table_contains (self->failed, path))
     return NULL;
 
@@ -184,7 +195,7 @@ sysprof_debuginfod_symbolizer_symbolize (SysprofSymbolizer        *symbolizer,
   if (end_address == begin_address)
     end_address++;
 
-  sym = _sysprof_symbol_new (sysprof_strings_get (strings, name),
+  sym = _sysprof_symbol_new (sysprof_strings_get_demangled (strings, name),
                              sysprof_strings_get (strings, path),
                              sysprof_strings_get (strings, sysprof_elf_get_nick (elf)),
                              map_begin + (begin_address - file_offset),
@@ -234,6 +245,8 @@ sysprof_debuginfod_symbolizer_finalize (GObject *object)
 
   g_weak_ref_clear (&self->loader_wr);
 
+  g_mutex_clear (&self->mutex);
+
   G_OBJECT_CLASS (sysprof_debuginfod_symbolizer_parent_class)->finalize (object);
 }
 
@@ -254,6 +267,7 @@ static void
 sysprof_debuginfod_symbolizer_init (SysprofDebuginfodSymbolizer *self)
 {
   g_weak_ref_init (&self->loader_wr, NULL);
+  g_mutex_init (&self->mutex);
 
   self->loader = sysprof_elf_loader_new ();
   self->cache = g_hash_table_new_full (NULL, NULL, g_object_unref, NULL);
@@ -119,39 +119,24 @@ sysprof_descendants_model_add_trace (SysprofDescendantsModel  *self,
       SysprofCallgraphNode *node = NULL;
       SysprofCallgraphSummary *summary;
 
-      /* Try to find @symbol within the children of @parent */
-      for (SysprofCallgraphNode *iter = parent->children;
-           iter != NULL;
-           iter = iter->next)
+      if (!(summary = g_hash_table_lookup (self->callgraph->symbol_to_summary, symbol)))
         {
-          g_assert (iter != NULL);
-          g_assert (iter->summary != NULL);
-          g_assert (iter->summary->symbol != NULL);
-          g_assert (symbol != NULL);
-
-          if (_sysprof_symbol_equal (iter->summary->symbol, symbol))
-            {
-              node = iter;
-              node->count++;
-              goto next_symbol;
-            }
+          node = parent;
+          goto next_symbol;
         }
 
-      if (!(summary = g_hash_table_lookup (self->callgraph->symbol_to_summary, symbol)))
+      /* Try to find @symbol within the children of @parent */
+      if ((node = _sysprof_callgraph_node_find_child (parent, summary)))
         {
-          node = parent;
+          node->count++;
           goto next_symbol;
         }
 
       /* Otherwise create a new node */
       node = sysprof_allocator_new0 (self->allocator, SysprofCallgraphNode);
       node->summary = summary;
-      node->parent = parent;
-      node->next = parent->children;
       node->count = 1;
-      if (parent->children)
-        parent->children->prev = node;
-      parent->children = node;
+      _sysprof_callgraph_node_add_child (parent, node, self->allocator);
 
       g_assert (node->summary != NULL);
 
@@ -163,12 +148,13 @@ sysprof_descendants_model_add_trace (SysprofDescendantsModel  *self,
 }
 
 static void
-sysprof_descendants_model_add_traceable (SysprofDescendantsModel  *self,
-                                         SysprofDocument          *document,
-                                         SysprofDocumentTraceable *traceable,
-                                         SysprofSymbol            *from_symbol,
-                                         gboolean                  include_threads,
-                                         gboolean                  merge_similar_processes)
+sysprof_descendants_model_add_traceable (SysprofDescendantsModel            *self,
+                                         SysprofDocument                    *document,
+                                         SysprofDocumentTraceableCursor     *cursor,
+                                         const SysprofDocumentTraceableView *traceable,
+                                         SysprofSymbol                      *from_symbol,
+                                         gboolean                            include_threads,
+                                         gboolean                            merge_similar_processes)
 {
   SysprofAddressContext final_context;
   SysprofSymbol **symbols;
@@ -178,26 +164,27 @@ sysprof_descendants_model_add_traceable (SysprofDescendantsModel  *self,
 
   g_assert (SYSPROF_IS_DESCENDANTS_MODEL (self));
   g_assert (SYSPROF_IS_DOCUMENT (document));
-  g_assert (SYSPROF_IS_DOCUMENT_TRACEABLE (traceable));
+  g_assert (cursor != NULL);
+  g_assert (traceable != NULL);
   g_assert (SYSPROF_IS_SYMBOL (from_symbol));
 
-  stack_depth = MIN (MAX_STACK_DEPTH, sysprof_document_traceable_get_stack_depth (traceable));
+  stack_depth = MIN (MAX_STACK_DEPTH, traceable->n_addresses);
   symbols = g_alloca (sizeof (SysprofSymbol *) * (stack_depth + 2));
-  n_symbols = sysprof_document_symbolize_traceable (document, traceable, symbols, stack_depth, &final_context);
+  n_symbols = _sysprof_document_symbolize_addresses (document,
+                                                     traceable->pid,
+                                                     traceable->addresses,
+                                                     stack_depth,
+                                                     symbols,
+                                                     &final_context);
 
   kind = sysprof_symbol_get_kind (from_symbol);
 
   if (kind == SYSPROF_SYMBOL_KIND_PROCESS || kind == SYSPROF_SYMBOL_KIND_THREAD)
     {
-      int pid = sysprof_document_frame_get_pid (SYSPROF_DOCUMENT_FRAME (traceable));
-
       if (include_threads)
-        {
-          int thread_id = sysprof_document_traceable_get_thread_id (traceable);
-          symbols[n_symbols++] = _sysprof_document_thread_symbol (document, pid, thread_id);
-        }
+        symbols[n_symbols++] = _sysprof_document_thread_symbol (document, traceable->pid, traceable->tid);
 
-      symbols[n_symbols++] = _sysprof_document_process_symbol (document, pid, merge_similar_processes);
+      symbols[n_symbols++] = _sysprof_document_process_symbol (document, traceable->pid, merge_similar_processes);
     }
 
   for (guint i = n_symbols; i > 0; i--)
@@ -219,11 +206,15 @@ sysprof_descendants_model_add_traceable (SysprofDescendantsModel  *self,
       node->is_toplevel = TRUE;
 
       if (node && self->callgraph->augment_func)
-        self->callgraph->augment_func (self->callgraph,
-                                       node,
-                                       SYSPROF_DOCUMENT_FRAME (traceable),
-                                       FALSE,
-                                       self->callgraph->augment_func_data);
+        {
+          g_autoptr(SysprofDocumentFrame) frame = _sysprof_document_traceable_cursor_dup_frame (cursor, traceable);
+
+          self->callgraph->augment_func (self->callgraph,
+                                         node,
+                                         frame,
+                                         FALSE,
+                                         self->callgraph->augment_func_data);
+        }
 
       if ((self->callgraph->flags & SYSPROF_CALLGRAPH_FLAGS_CATEGORIZE_FRAMES) != 0)
         _sysprof_callgraph_categorize (self->callgraph, node);
@@ -237,9 +228,10 @@ _sysprof_descendants_model_new (SysprofCallgraph *callgraph,
   SysprofDescendantsModel *self;
   g_autoptr(SysprofDocument) document = NULL;
   g_autoptr(GListModel) model = NULL;
+  SysprofDocumentTraceableCursor cursor;
+  SysprofDocumentTraceableView traceable;
   gboolean include_threads;
   gboolean merge_similar_processes;
-  guint n_items;
 
   g_return_val_if_fail (SYSPROF_IS_CALLGRAPH (callgraph), NULL);
   g_return_val_if_fail (SYSPROF_IS_SYMBOL (symbol), NULL);
@@ -258,19 +250,18 @@ _sysprof_descendants_model_new (SysprofCallgraph *callgraph,
   include_threads = (callgraph->flags & SYSPROF_CALLGRAPH_FLAGS_INCLUDE_THREADS) != 0;
   merge_similar_processes = (callgraph->flags & SYSPROF_CALLGRAPH_FLAGS_MERGE_SIMILAR_PROCESSES) != 0;
 
-  n_items = g_list_model_get_n_items (model);
+  _sysprof_document_traceable_cursor_init (&cursor, document, model, NULL);
 
-  for (guint i = 0; i < n_items; i++)
-    {
-      g_autoptr(SysprofDocumentTraceable) traceable = g_list_model_get_item (model, i);
-
-      sysprof_descendants_model_add_traceable (self,
-                                               document,
-                                               traceable,
-                                               symbol,
-                                               include_threads,
-                                               merge_similar_processes);
-    }
+  while (_sysprof_document_traceable_cursor_next (&cursor, &traceable))
+    sysprof_descendants_model_add_traceable (self,
+                                             document,
+                                             &cursor,
+                                             &traceable,
+                                             symbol,
+                                             include_threads,
+                                             merge_similar_processes);
+
+  _sysprof_document_traceable_cursor_clear (&cursor);
 
   return G_LIST_MODEL (self);
 }
@@ -20,6 +20,8 @@
 
 #include "config.h"
 
+#include <math.h>
+
 #include <glib/gi18n.h>
 
 #include "sysprof-document-frame-private.h"
@@ -40,7 +42,9 @@ struct _SysprofDocumentAllocationClass
 enum {
   PROP_0,
   PROP_ADDRESS,
+  PROP_ESTIMATED_SIZE,
   PROP_IS_FREE,
+  PROP_SAMPLE_INTERVAL,
   PROP_SIZE,
   PROP_STACK_DEPTH,
   PROP_THREAD_ID,
@@ -51,6 +55,10 @@ static guint
 sysprof_document_allocation_get_stack_depth (SysprofDocumentTraceable *traceable)
 {
   const SysprofCaptureAllocation *allocation = SYSPROF_DOCUMENT_FRAME_GET (traceable, SysprofCaptureAllocation);
+  const SysprofCaptureStack *stack = SYSPROF_DOCUMENT_FRAME (traceable)->stack;
+
+  if (stack != NULL)
+    return SYSPROF_DOCUMENT_FRAME_UINT16 (traceable, stack->n_addrs);
 
   return SYSPROF_DOCUMENT_FRAME_UINT16 (traceable, allocation->n_addrs);
 }
@@ -60,8 +68,12 @@ sysprof_document_allocation_get_stack_address (SysprofDocumentTraceable *traceab
                                                guint                     position)
 {
   const SysprofCaptureAllocation *allocation = SYSPROF_DOCUMENT_FRAME_GET (traceable, SysprofCaptureAllocation);
+  const SysprofCaptureStack *stack = SYSPROF_DOCUMENT_FRAME (traceable)->stack;
 
-  return SYSPROF_DOCUMENT_FRAME_UINT16 (traceable, allocation->addrs[position]);
+  if (stack != NULL)
+    return SYSPROF_DOCUMENT_FRAME_UINT64 (traceable, stack->addrs[position]);
+
+  return SYSPROF_DOCUMENT_FRAME_UINT64 (traceable, allocation->addrs[position]);
 }
 
 static guint
@@ -70,10 +82,18 @@ sysprof_document_allocation_get_stack_addresses (SysprofDocumentTraceable *trace
                                                  guint                     n_addresses)
 {
   const SysprofCaptureAllocation *allocation = SYSPROF_DOCUMENT_FRAME_GET (traceable, SysprofCaptureAllocation);
+  const SysprofCaptureStack *stack = SYSPROF_DOCUMENT_FRAME (traceable)->stack;
+  const SysprofCaptureAddress *addrs = allocation->addrs;
   guint depth = MIN (n_addresses, SYSPROF_DOCUMENT_FRAME_UINT16 (traceable, allocation->n_addrs));
 
+  if (stack != NULL)
+    {
+      addrs = stack->addrs;
+      depth = MIN (n_addresses, SYSPROF_DOCUMENT_FRAME_UINT16 (traceable, stack->n_addrs));
+    }
+
   for (guint i = 0; i < depth; i++)
-    addresses[i] = SYSPROF_DOCUMENT_FRAME_UINT64 (traceable, allocation->addrs[i]);
+    addresses[i] = SYSPROF_DOCUMENT_FRAME_UINT64 (traceable, addrs[i]);
 
   return depth;
 }
@@ -119,10 +139,18 @@ sysprof_document_allocation_get_property (GObject    *object,
       g_value_set_uint64 (value, sysprof_document_allocation_get_address (self));
       break;
 
+    case PROP_ESTIMATED_SIZE:
+      g_value_set_int64 (value, sysprof_document_allocation_get_estimated_size (self));
+      break;
+
     case PROP_IS_FREE:
       g_value_set_boolean (value, sysprof_document_allocation_is_free (self));
       break;
 
+    case PROP_SAMPLE_INTERVAL:
+      g_value_set_uint (value, sysprof_document_allocation_get_sample_interval (self));
+      break;
+
     case PROP_SIZE:
       g_value_set_int64 (value, sysprof_document_allocation_get_size (self));
       break;
@@ -188,6 +216,32 @@ sysprof_document_allocation_class_init (SysprofDocumentAllocationClass *klass)
                         G_MININT64, G_MAXINT64, 0,
                         (G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
 
+  /**
+   * SysprofDocumentAllocation:estimated-size:
+   *
+   * The number of bytes this allocation record stands for, which is
+   * larger than #SysprofDocumentAllocation:size for sampled allocations.
+   *
+   * Since: 51
+   */
+  properties [PROP_ESTIMATED_SIZE] =
+    g_param_spec_int64 ("estimated-size", NULL, NULL,
+                        G_MININT64, G_MAXINT64, 0,
+                        (G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * SysprofDocumentAllocation:sample-interval:
+   *
+   * The mean number of bytes allocated between sampled allocations,
+   * or 0 if every allocation was recorded.
+   *
+   * Since: 51
+   */
+  properties [PROP_SAMPLE_INTERVAL] =
+    g_param_spec_uint ("sample-interval", NULL, NULL,
+                       0, G_MAXUINT32, 0,
+                       (G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
   /**
    * SysprofDocumentAllocation:is-free:
    *
@@ -256,3 +310,60 @@ sysprof_document_allocation_is_free (SysprofDocumentAllocation *self)
 
   return allocation->alloc_size == 0;
 }
+
+/**
+ * sysprof_document_allocation_get_sample_interval:
+ * @self: a #SysprofDocumentAllocation
+ *
+ * Gets the mean number of bytes allocated between sampled allocations
+ * when the allocator only recorded a sample of them.
+ *
+ * Returns: the sample interval in bytes, or 0 if not sampled
+ *
+ * Since: 51
+ */
+guint
+sysprof_document_allocation_get_sample_interval (SysprofDocumentAllocation *self)
+{
+  const SysprofCaptureAllocation *allocation;
+
+  g_return_val_if_fail (SYSPROF_IS_DOCUMENT_ALLOCATION (self), 0);
+
+  allocation = SYSPROF_DOCUMENT_FRAME_GET (self, SysprofCaptureAllocation);
+
+  if (!_sysprof_document_frame_flag (SYSPROF_DOCUMENT_FRAME_NEEDS_SWAP (self),
+                                     SYSPROF_DOCUMENT_ALLOCATION_FLAGS (allocation),
+                                     SYSPROF_DOCUMENT_FRAME_SAMPLED_BIT))
+    return 0;
+
+  return SYSPROF_DOCUMENT_FRAME_UINT32 (self, allocation->frame.padding2);
+}
+
+/**
+ * sysprof_document_allocation_get_estimated_size:
+ * @self: a #SysprofDocumentAllocation
+ *
+ * Gets the number of bytes this allocation stands for. For sampled
+ * allocations that is the size divided by the chance the allocation had
+ * of being sampled, which makes sums of sizes unbiased estimates.
+ *
+ * Returns: the estimated size in bytes
+ *
+ * Since: 51
+ */
+gint64
+sysprof_document_allocation_get_estimated_size (SysprofDocumentAllocation *self)
+{
+  guint sample_interval;
+  gint64 size;
+
+  g_return_val_if_fail (SYSPROF_IS_DOCUMENT_ALLOCATION (self), 0);
+
+  size = sysprof_document_allocation_get_size (self);
+  sample_interval = sysprof_document_allocation_get_sample_interval (self);
+
+  if (size <= 0 || sample_interval == 0)
+    return size;
+
+  return size / -expm1 (-(double)size / sample_interval);
+}
@@ -33,15 +33,19 @@ typedef struct _SysprofDocumentAllocation      SysprofDocumentAllocation;
 typedef struct _SysprofDocumentAllocationClass SysprofDocumentAllocationClass;
 
 SYSPROF_AVAILABLE_IN_ALL
-GType    sysprof_document_allocation_get_type    (void) G_GNUC_CONST;
+GType    sysprof_document_allocation_get_type            (void) G_GNUC_CONST;
 SYSPROF_AVAILABLE_IN_ALL
-guint64  sysprof_document_allocation_get_address (SysprofDocumentAllocation *self);
+guint64  sysprof_document_allocation_get_address         (SysprofDocumentAllocation *self);
 SYSPROF_AVAILABLE_IN_ALL
-gint64   sysprof_document_allocation_get_size    (SysprofDocumentAllocation *self);
+gint64   sysprof_document_allocation_get_size            (SysprofDocumentAllocation *self);
 SYSPROF_AVAILABLE_IN_ALL
-int      sysprof_document_allocation_get_tid     (SysprofDocumentAllocation *self);
+int      sysprof_document_allocation_get_tid             (SysprofDocumentAllocation *self);
 SYSPROF_AVAILABLE_IN_ALL
-gboolean sysprof_document_allocation_is_free     (SysprofDocumentAllocation *self);
+gboolean sysprof_document_allocation_is_free             (SysprofDocumentAllocation *self);
+SYSPROF_AVAILABLE_IN_51
+guint    sysprof_document_allocation_get_sample_interval (SysprofDocumentAllocation *self);
+SYSPROF_AVAILABLE_IN_51
+gint64   sysprof_document_allocation_get_estimated_size  (SysprofDocumentAllocation *self);
 
 G_DEFINE_AUTOPTR_CLEANUP_FUNC (SysprofDocumentAllocation, g_object_unref)
 
@@ -29,10 +29,12 @@ G_BEGIN_DECLS
 
 G_DECLARE_FINAL_TYPE (SysprofDocumentBitsetIndex, sysprof_document_bitset_index, SYSPROF, DOCUMENT_BITSET_INDEX, GObject)
 
-GListModel *_sysprof_document_bitset_index_new      (GListModel *model,
-                                                     EggBitset  *bitset);
-GListModel *_sysprof_document_bitset_index_new_full (GListModel *model,
-                                                     EggBitset  *bitset,
-                                                     GType       type);
+GListModel *_sysprof_document_bitset_index_new        (GListModel                 *model,
+                                                       EggBitset                  *bitset);
+GListModel *_sysprof_document_bitset_index_new_full   (GListModel                 *model,
+                                                       EggBitset                  *bitset,
+                                                       GType                       type);
+GListModel *_sysprof_document_bitset_index_get_model  (SysprofDocumentBitsetIndex *self);
+EggBitset  *_sysprof_document_bitset_index_get_bitset (SysprofDocumentBitsetIndex *self);
 
 G_END_DECLS
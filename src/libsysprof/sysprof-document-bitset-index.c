@@ -165,3 +165,19 @@ _sysprof_document_bitset_index_new (GListModel *model,
 {
   return _sysprof_document_bitset_index_new_full (model, bitset, G_TYPE_INVALID);
 }
+
+GListModel *
+_sysprof_document_bitset_index_get_model (SysprofDocumentBitsetIndex *self)
+{
+  g_return_val_if_fail (SYSPROF_IS_DOCUMENT_BITSET_INDEX (self), NULL);
+
+  return self->model;
+}
+
+EggBitset *
+_sysprof_document_bitset_index_get_bitset (SysprofDocumentBitsetIndex *self)
+{
+  g_return_val_if_fail (SYSPROF_IS_DOCUMENT_BITSET_INDEX (self), NULL);
+
+  return self->bitset;
+}
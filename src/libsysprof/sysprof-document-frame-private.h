@@ -20,6 +20,8 @@
 
 #pragma once
 
+#include <string.h>
+
 #include <sysprof-capture.h>
 
 #include "sysprof-document-frame.h"
@@ -31,6 +33,8 @@ struct _SysprofDocumentFrame
   GObject                    parent;
   GMappedFile               *mapped_file;
   const SysprofCaptureFrame *frame;
+  /* Set when a sample or allocation references a shared stack */
+  const SysprofCaptureStack *stack;
   gint64                     time_offset;
   guint32                    frame_len : 16;
   guint32                    needs_swap : 1;
@@ -91,6 +95,38 @@ SysprofDocumentFrame *_sysprof_document_frame_new (GMappedFile               *ma
    (SYSPROF_DOCUMENT_FRAME_NEEDS_SWAP(obj) ? GINT64_TO_BE(val) : (val))
 #endif
 
+/* Flags sharing a bit-field word with n_addrs. A writer of the other
+ * byte order allocates bit-fields from the other end of the word, so once
+ * swapped a flag is found counting from the opposite side.
+ */
+#define SYSPROF_DOCUMENT_FRAME_STACK_BIT   16
+#define SYSPROF_DOCUMENT_FRAME_SAMPLED_BIT 17
+
+#define SYSPROF_DOCUMENT_SAMPLE_FLAGS(sample) \
+  ((const guint8 *)(sample) + sizeof (SysprofCaptureFrame))
+#define SYSPROF_DOCUMENT_ALLOCATION_FLAGS(alloc) \
+  ((const guint8 *)&(alloc)->tid + sizeof (alloc)->tid)
+
+static inline gboolean
+_sysprof_document_frame_flag (gboolean      needs_swap,
+                              gconstpointer flags,
+                              guint         bit)
+{
+  guint32 word;
+
+  memcpy (&word, flags, sizeof word);
+
+#if G_BYTE_ORDER == G_LITTLE_ENDIAN
+  if (needs_swap)
+    return (GUINT32_SWAP_LE_BE (word) >> (31 - bit)) & 1;
+  return (word >> bit) & 1;
+#else
+  if (needs_swap)
+    return (GUINT32_SWAP_LE_BE (word) >> bit) & 1;
+  return (word >> (31 - bit)) & 1;
+#endif
+}
+
 static inline const char *
 _SYSPROF_DOCUMENT_FRAME_CSTRING (SysprofDocumentFrame *self,
                                  const char           *str)
@@ -46,6 +46,46 @@ typedef struct _SysprofDocumentTimedValue
   };
 } SysprofDocumentTimedValue;
 
+#define SYSPROF_DOCUMENT_TRACEABLE_CURSOR_MAX_DEPTH 4
+
+/* A view into a traceable frame within the mapped capture. Everything
+ * has been converted to host byte-order and @addresses remains valid
+ * until the next call to _sysprof_document_traceable_cursor_next().
+ */
+typedef struct _SysprofDocumentTraceableView
+{
+  const SysprofCaptureFrame *frame;
+  const SysprofAddress      *addresses;
+  gint64                     time;
+  SysprofAddress             address;
+  gint64                     size;
+  guint                      position;
+  guint                      n_addresses;
+  int                        pid;
+  int                        tid;
+  int                        cpu;
+  guint16                    frame_len;
+  guint8                     type;
+} SysprofDocumentTraceableView;
+
+typedef struct _SysprofDocumentTraceableCursor
+{
+  /*< private >*/
+  SysprofDocument      *document;
+  GListModel           *model;
+  EggBitset            *selection;
+  EggBitset            *chain[SYSPROF_DOCUMENT_TRACEABLE_CURSOR_MAX_DEPTH];
+  SysprofDocumentFrame *item;
+  SysprofAddress       *scratch;
+  EggBitsetIter         iter;
+  guint                 position;
+  guint                 end;
+  guint                 scratch_len;
+  guint                 n_chain : 8;
+  guint                 direct : 1;
+  guint                 started : 1;
+} SysprofDocumentTraceableCursor;
+
 typedef void (*ProgressFunc) (double      fraction,
                               const char *message,
                               gpointer    user_data);
@@ -87,5 +127,26 @@ const SysprofDocumentFramePointer *_sysprof_document_get_frames        (SysprofD
                                                                         guint                *n_frames);
 EggBitset                         *_sysprof_document_get_allocations   (SysprofDocument      *self);
 DexFuture                         *_sysprof_document_serialize_symbols (SysprofDocument      *self);
+guint                              _sysprof_document_symbolize_addresses (SysprofDocument       *self,
+                                                                          int                    pid,
+                                                                          const SysprofAddress  *addresses,
+                                                                          guint                  n_addresses,
+                                                                          SysprofSymbol        **symbols,
+                                                                          SysprofAddressContext *final_context);
+
+void                  _sysprof_document_traceable_cursor_init       (SysprofDocumentTraceableCursor     *cursor,
+                                                                     SysprofDocument                    *document,
+                                                                     GListModel                         *model,
+                                                                     EggBitset                          *selection);
+void                  _sysprof_document_traceable_cursor_init_range (SysprofDocumentTraceableCursor     *cursor,
+                                                                     SysprofDocument                    *document,
+                                                                     GListModel                         *model,
+                                                                     guint                               begin,
+                                                                     guint                               end);
+gboolean              _sysprof_document_traceable_cursor_next       (SysprofDocumentTraceableCursor     *cursor,
+                                                                     SysprofDocumentTraceableView       *view);
+SysprofDocumentFrame *_sysprof_document_traceable_cursor_dup_frame  (SysprofDocumentTraceableCursor     *cursor,
+                                                                     const SysprofDocumentTraceableView *view);
+void                  _sysprof_document_traceable_cursor_clear      (SysprofDocumentTraceableCursor     *cursor);
 
 G_END_DECLS
@@ -48,6 +48,10 @@ static guint
 sysprof_document_sample_get_stack_depth (SysprofDocumentTraceable *traceable)
 {
   const SysprofCaptureSample *sample = SYSPROF_DOCUMENT_FRAME_GET (traceable, SysprofCaptureSample);
+  const SysprofCaptureStack *stack = SYSPROF_DOCUMENT_FRAME (traceable)->stack;
+
+  if (stack != NULL)
+    return SYSPROF_DOCUMENT_FRAME_UINT16 (traceable, stack->n_addrs);
 
   return SYSPROF_DOCUMENT_FRAME_UINT16 (traceable, sample->n_addrs);
 }
@@ -57,8 +61,12 @@ sysprof_document_sample_get_stack_address (SysprofDocumentTraceable *traceable,
                                            guint                     position)
 {
   const SysprofCaptureSample *sample = SYSPROF_DOCUMENT_FRAME_GET (traceable, SysprofCaptureSample);
+  const SysprofCaptureStack *stack = SYSPROF_DOCUMENT_FRAME (traceable)->stack;
+
+  if (stack != NULL)
+    return SYSPROF_DOCUMENT_FRAME_UINT64 (traceable, stack->addrs[position]);
 
-  return SYSPROF_DOCUMENT_FRAME_UINT16 (traceable, sample->addrs[position]);
+  return SYSPROF_DOCUMENT_FRAME_UINT64 (traceable, sample->addrs[position]);
 }
 
 static guint
@@ -67,10 +75,18 @@ sysprof_document_sample_get_stack_addresses (SysprofDocumentTraceable *traceable
                                              guint                     n_addresses)
 {
   const SysprofCaptureSample *sample = SYSPROF_DOCUMENT_FRAME_GET (traceable, SysprofCaptureSample);
+  const SysprofCaptureStack *stack = SYSPROF_DOCUMENT_FRAME (traceable)->stack;
+  const SysprofCaptureAddress *addrs = sample->addrs;
   guint depth = MIN (n_addresses, SYSPROF_DOCUMENT_FRAME_UINT16 (traceable, sample->n_addrs));
 
+  if (stack != NULL)
+    {
+      addrs = stack->addrs;
+      depth = MIN (n_addresses, SYSPROF_DOCUMENT_FRAME_UINT16 (traceable, stack->n_addrs));
+    }
+
   for (guint i = 0; i < depth; i++)
-    addresses[i] = SYSPROF_DOCUMENT_FRAME_UINT64 (traceable, sample->addrs[i]);
+    addresses[i] = SYSPROF_DOCUMENT_FRAME_UINT64 (traceable, addrs[i]);
 
   return depth;
 }
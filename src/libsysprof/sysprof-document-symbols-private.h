@@ -20,6 +20,7 @@
 
 #pragma once
 
+#include "sysprof-address-table-private.h"
 #include "sysprof-document.h"
 #include "sysprof-process-info-private.h"
 #include "sysprof-symbol-cache-private.h"
@@ -34,9 +35,10 @@ G_DECLARE_FINAL_TYPE (SysprofDocumentSymbols, sysprof_document_symbols, SYSPROF,
 
 struct _SysprofDocumentSymbols
 {
-  GObject             parent_instance;
-  SysprofSymbol      *context_switches[SYSPROF_ADDRESS_CONTEXT_GUEST_USER+1];
-  SysprofSymbolCache *kernel_symbols;
+  GObject              parent_instance;
+  SysprofSymbol       *context_switches[SYSPROF_ADDRESS_CONTEXT_GUEST_USER+1];
+  SysprofSymbolCache  *kernel_symbols;
+  SysprofAddressTable *kernel_addresses;
 };
 
 void                    _sysprof_document_symbols_new        (SysprofDocument           *document,
@@ -22,6 +22,8 @@
 
 #include <glib/gi18n.h>
 
+#include <libdex.h>
+
 #include "sysprof-address-layout-private.h"
 #include "sysprof-document-private.h"
 #include "sysprof-document-symbols-private.h"
@@ -31,6 +33,8 @@
 #include "sysprof-symbol-private.h"
 #include "sysprof-symbolizer-private.h"
 
+#define COMPACT_MIN_ADDRESSES 4096
+
 G_DEFINE_FINAL_TYPE (SysprofDocumentSymbols, sysprof_document_symbols, G_TYPE_OBJECT)
 
 static void
@@ -41,6 +45,7 @@ sysprof_document_symbols_finalize (GObject *object)
   for (guint i = 0; i < G_N_ELEMENTS (self->context_switches); i++)
     g_clear_object (&self->context_switches[i]);
 
+  g_clear_pointer (&self->kernel_addresses, sysprof_address_table_free);
   g_clear_object (&self->kernel_symbols);
 
   G_OBJECT_CLASS (sysprof_document_symbols_parent_class)->finalize (object);
@@ -144,29 +149,79 @@ do_symbolize (SysprofSymbolizer     *symbolizer,
   return ret;
 }
 
+typedef struct _SymbolizeProcess
+{
+  Symbolize          *state;
+  SysprofProcessInfo *process_info;
+  EggBitset          *traceables;
+  guint              *count;
+  guint               n_items;
+} SymbolizeProcess;
+
 static void
-add_traceable (SysprofDocumentSymbols   *self,
-               SysprofStrings           *strings,
-               SysprofProcessInfo       *process_info,
-               SysprofDocumentTraceable *traceable,
-               SysprofSymbolizer        *symbolizer)
+symbolize_process_free (SymbolizeProcess *process)
 {
-  SysprofAddressContext last_context;
-  guint64 *addresses;
-  guint n_addresses;
+  g_clear_pointer (&process->traceables, egg_bitset_unref);
+  g_free (process);
+}
 
-  g_assert (SYSPROF_IS_DOCUMENT_TRACEABLE (traceable));
-  g_assert (SYSPROF_IS_SYMBOLIZER (symbolizer));
+static int
+symbolize_process_compare (gconstpointer a,
+                           gconstpointer b)
+{
+  const SymbolizeProcess *process_a = *(const SymbolizeProcess * const *)a;
+  const SymbolizeProcess *process_b = *(const SymbolizeProcess * const *)b;
+  guint64 size_a = egg_bitset_get_size (process_a->traceables);
+  guint64 size_b = egg_bitset_get_size (process_b->traceables);
+
+  /* Largest first so the long running processes start early */
+  if (size_a > size_b)
+    return -1;
+  else if (size_a < size_b)
+    return 1;
+  else
+    return 0;
+}
+
+/* Stack traces repeat the same instruction pointers over and over, so
+ * rather than symbolizing each address as we see it, gather them up and
+ * resolve every unique address once. The array is compacted whenever it
+ * grows well beyond the number of unique addresses seen so far so that
+ * memory stays proportional to the unique set.
+ */
+static inline void
+collect_address (GArray         *addresses,
+                 guint          *compact_at,
+                 SysprofAddress  address)
+{
+  g_array_append_val (addresses, address);
+
+  if (addresses->len >= *compact_at)
+    {
+      guint len = addresses->len;
 
-  n_addresses = sysprof_document_traceable_get_stack_depth (traceable);
-  addresses = g_alloca (sizeof (guint64) * n_addresses);
-  sysprof_document_traceable_get_stack_addresses (traceable, addresses, n_addresses);
+      sysprof_address_sort_unique (&g_array_index (addresses, SysprofAddress, 0), &len);
+      g_array_set_size (addresses, len);
+
+      *compact_at = MAX (len * 2, COMPACT_MIN_ADDRESSES);
+    }
+}
+
+static void
+collect_kernel_addresses (const SysprofDocumentTraceableView *traceable,
+                          GArray                             *addresses,
+                          guint                              *compact_at)
+{
+  SysprofAddressContext last_context;
+
+  g_assert (traceable != NULL);
+  g_assert (addresses != NULL);
 
   last_context = SYSPROF_ADDRESS_CONTEXT_NONE;
 
-  for (guint i = 0; i < n_addresses; i++)
+  for (guint i = 0; i < traceable->n_addresses; i++)
     {
-      SysprofAddress address = addresses[i];
+      SysprofAddress address = traceable->addresses[i];
       SysprofAddressContext context = SYSPROF_ADDRESS_CONTEXT_NONE;
 
       if (sysprof_address_is_context_switch (address, &context))
@@ -176,27 +231,188 @@ add_traceable (SysprofDocumentSymbols   *self,
         }
 
       if (last_context == SYSPROF_ADDRESS_CONTEXT_KERNEL)
+        collect_address (addresses, compact_at, address);
+    }
+}
+
+static void
+collect_user_addresses (SysprofStrings                     *strings,
+                        SysprofProcessInfo                 *process_info,
+                        const SysprofDocumentTraceableView *traceable,
+                        SysprofSymbolizer                  *symbolizer,
+                        GArray                             *addresses,
+                        guint                              *compact_at)
+{
+  SysprofAddressContext last_context;
+
+  g_assert (process_info != NULL);
+  g_assert (traceable != NULL);
+  g_assert (SYSPROF_IS_SYMBOLIZER (symbolizer));
+
+  last_context = SYSPROF_ADDRESS_CONTEXT_NONE;
+
+  for (guint i = 0; i < traceable->n_addresses; i++)
+    {
+      SysprofAddress address = traceable->addresses[i];
+      SysprofAddressContext context = SYSPROF_ADDRESS_CONTEXT_NONE;
+      g_autoptr(SysprofSymbol) symbol = NULL;
+
+      if (sysprof_address_is_context_switch (address, &context))
         {
-          g_autoptr(SysprofSymbol) symbol = NULL;
+          last_context = context;
+          continue;
+        }
 
-          if (sysprof_symbol_cache_lookup (self->kernel_symbols, address) != NULL)
-            continue;
+      if (last_context == SYSPROF_ADDRESS_CONTEXT_KERNEL)
+        continue;
 
-          if ((symbol = do_symbolize (symbolizer, strings, process_info, last_context, address)))
-            sysprof_symbol_cache_take (self->kernel_symbols, g_steal_pointer (&symbol));
+      if (last_context == SYSPROF_ADDRESS_CONTEXT_NONE ||
+          last_context == SYSPROF_ADDRESS_CONTEXT_USER)
+        {
+          collect_address (addresses, compact_at, address);
+          continue;
         }
-      else
+
+      /* Guest and hypervisor addresses are rare and symbolizers treat
+       * them differently than user addresses, so resolve them inline.
+       */
+      if (sysprof_symbol_cache_lookup (process_info->symbol_cache, address) != NULL)
+        continue;
+
+      if ((symbol = do_symbolize (symbolizer, strings, process_info, last_context, address)))
+        sysprof_symbol_cache_take (process_info->symbol_cache, g_steal_pointer (&symbol));
+    }
+}
+
+static SysprofAddressTable *
+resolve_addresses (SysprofSymbolizer     *symbolizer,
+                   SysprofStrings        *strings,
+                   SysprofProcessInfo    *process_info,
+                   SysprofAddressContext  context,
+                   SysprofSymbolCache    *symbol_cache,
+                   GArray                *addresses)
+{
+  SysprofAddressTable *table;
+  guint len = addresses->len;
+
+  g_assert (SYSPROF_IS_SYMBOLIZER (symbolizer));
+  g_assert (SYSPROF_IS_SYMBOL_CACHE (symbol_cache));
+  g_assert (addresses != NULL);
+
+  sysprof_address_sort_unique (&g_array_index (addresses, SysprofAddress, 0), &len);
+
+  table = sysprof_address_table_new (&g_array_index (addresses, SysprofAddress, 0), len);
+
+  for (guint i = 0; i < len; i++)
+    {
+      SysprofAddress address = g_array_index (addresses, SysprofAddress, i);
+      SysprofSymbol *symbol;
+
+      if (!(symbol = sysprof_symbol_cache_lookup (symbol_cache, address)))
         {
-          g_autoptr(SysprofSymbol) symbol = NULL;
+          g_autoptr(SysprofSymbol) resolved = NULL;
 
-          if (process_info != NULL &&
-              sysprof_symbol_cache_lookup (process_info->symbol_cache, address) != NULL)
-            continue;
+          if ((resolved = do_symbolize (symbolizer, strings, process_info, context, address)))
+            sysprof_symbol_cache_take (symbol_cache, g_steal_pointer (&resolved));
 
-          if ((symbol = do_symbolize (symbolizer, strings, process_info, last_context, address)))
-            sysprof_symbol_cache_take (process_info->symbol_cache, g_steal_pointer (&symbol));
+          symbol = sysprof_symbol_cache_lookup (symbol_cache, address);
         }
+
+      sysprof_address_table_set (table, i, symbol);
+    }
+
+  return table;
+}
+
+static void
+symbolize_process (SymbolizeProcess *process)
+{
+  Symbolize *state = process->state;
+  SysprofDocumentTraceableCursor cursor;
+  SysprofDocumentTraceableView traceable;
+  g_autoptr(GArray) addresses = NULL;
+  guint compact_at = COMPACT_MIN_ADDRESSES;
+
+  g_assert (process != NULL);
+  g_assert (process->process_info != NULL);
+
+  addresses = g_array_new (FALSE, FALSE, sizeof (SysprofAddress));
+
+  _sysprof_document_traceable_cursor_init (&cursor,
+                                           state->document,
+                                           G_LIST_MODEL (state->document),
+                                           process->traceables);
+
+  while (_sysprof_document_traceable_cursor_next (&cursor, &traceable))
+    {
+      guint count;
+
+      collect_user_addresses (state->strings,
+                              process->process_info,
+                              &traceable,
+                              state->symbolizer,
+                              addresses,
+                              &compact_at);
+
+      count = g_atomic_int_add (process->count, 1) + 1;
+
+      if (state->progress_func != NULL && count % 100 == 0)
+        state->progress_func (count / (double)process->n_items, _("Symbolizing stack traces"), state->progress_data);
+    }
+
+  _sysprof_document_traceable_cursor_clear (&cursor);
+
+  g_clear_pointer (&process->process_info->address_table, sysprof_address_table_free);
+  process->process_info->address_table = resolve_addresses (state->symbolizer,
+                                                            state->strings,
+                                                            process->process_info,
+                                                            SYSPROF_ADDRESS_CONTEXT_USER,
+                                                            process->process_info->symbol_cache,
+                                                            addresses);
+
+  /* Nothing else is added to the cache once symbolized */
+  sysprof_symbol_cache_freeze (process->process_info->symbol_cache);
+}
+
+static DexFuture *
+symbolize_process_thread (gpointer data)
+{
+  symbolize_process (data);
+  return dex_future_new_for_boolean (TRUE);
+}
+
+static void
+symbolize_processes (GPtrArray *processes)
+{
+  g_autoptr(DexThreadPool) pool = NULL;
+  g_autoptr(GPtrArray) futures = NULL;
+  guint n_threads;
+
+  g_assert (processes != NULL);
+
+  n_threads = MIN (g_get_num_processors (), processes->len);
+
+  if (n_threads < 2 || !(pool = dex_thread_pool_new (n_threads)))
+    {
+      for (guint i = 0; i < processes->len; i++)
+        symbolize_process (g_ptr_array_index (processes, i));
+      return;
     }
+
+  g_ptr_array_sort (processes, symbolize_process_compare);
+
+  futures = g_ptr_array_new_with_free_func (dex_unref);
+
+  for (guint i = 0; i < processes->len; i++)
+    g_ptr_array_add (futures,
+                     dex_thread_pool_submit (pool,
+                                             "[sysprof-document-symbolize]",
+                                             symbolize_process_thread,
+                                             g_ptr_array_index (processes, i),
+                                             NULL));
+
+  dex_thread_wait_for (dex_future_allv ((DexFuture **)futures->pdata, futures->len), NULL);
+  dex_thread_wait_for (dex_thread_pool_close (pool, DEX_THREAD_POOL_SHUTDOWN_DRAIN), NULL);
 }
 
 static void
@@ -218,11 +434,9 @@ sysprof_document_symbols_worker (GTask        *task,
   };
   g_autoptr(GRefString) context_switch = g_ref_string_new_intern ("Context Switch");
   Symbolize *state = task_data;
-  EggBitsetIter iter;
+  SysprofDocumentTraceableCursor cursor;
+  SysprofDocumentTraceableView traceable;
   EggBitset *bitset;
-  GListModel *model;
-  guint count = 0;
-  guint i;
 
   g_assert (source_object == NULL);
   g_assert (G_IS_TASK (task));
@@ -233,7 +447,6 @@ sysprof_document_symbols_worker (GTask        *task,
   g_assert (SYSPROF_IS_DOCUMENT_SYMBOLS (state->symbols));
 
   bitset = _sysprof_document_traceables (state->document);
-  model = G_LIST_MODEL (state->document);
 
   /* Create static symbols for context switch use */
   for (guint cs = 0; cs < G_N_ELEMENTS (context_switches); cs++)
@@ -253,29 +466,67 @@ sysprof_document_symbols_worker (GTask        *task,
     }
 
   /* Walk through the available traceables which need symbols extracted */
-  if (!SYSPROF_IS_NO_SYMBOLIZER (state->symbolizer) &&
-      egg_bitset_iter_init_first (&iter, bitset, &i))
+  if (!SYSPROF_IS_NO_SYMBOLIZER (state->symbolizer))
     {
+      g_autoptr(GHashTable) pid_to_process = NULL;
+      g_autoptr(GPtrArray) processes = NULL;
+      g_autoptr(GArray) kernel_addresses = NULL;
+      guint compact_at = COMPACT_MIN_ADDRESSES;
       guint n_items = egg_bitset_get_size (bitset);
+      guint count = 0;
+
+      pid_to_process = g_hash_table_new (NULL, NULL);
+      processes = g_ptr_array_new_with_free_func ((GDestroyNotify)symbolize_process_free);
+      kernel_addresses = g_array_new (FALSE, FALSE, sizeof (SysprofAddress));
 
-      do
+      /* Kernel symbols are shared by every process, so gather those up
+       * front while partitioning the traceables by process. Each process
+       * has its own address layout, mount namespace, and symbol cache so
+       * the user-space addresses can then be symbolized concurrently.
+       */
+      _sysprof_document_traceable_cursor_init (&cursor,
+                                               state->document,
+                                               G_LIST_MODEL (state->document),
+                                               bitset);
+
+      while (_sysprof_document_traceable_cursor_next (&cursor, &traceable))
         {
-          g_autoptr(SysprofDocumentTraceable) traceable = g_list_model_get_item (model, i);
-          int pid = sysprof_document_frame_get_pid (SYSPROF_DOCUMENT_FRAME (traceable));
-          SysprofProcessInfo *process_info = g_hash_table_lookup (state->pid_to_process_info, GINT_TO_POINTER (pid));
+          SysprofProcessInfo *process_info = g_hash_table_lookup (state->pid_to_process_info, GINT_TO_POINTER (traceable.pid));
+          SymbolizeProcess *process;
+
+          collect_kernel_addresses (&traceable, kernel_addresses, &compact_at);
+
+          /* Without process info there is no cache to store results in */
+          if (process_info == NULL)
+            continue;
 
-          add_traceable (state->symbols,
-                         state->strings,
-                         process_info,
-                         traceable,
-                         state->symbolizer);
+          if (!(process = g_hash_table_lookup (pid_to_process, GINT_TO_POINTER (traceable.pid))))
+            {
+              process = g_new0 (SymbolizeProcess, 1);
+              process->state = state;
+              process->process_info = process_info;
+              process->traceables = egg_bitset_new_empty ();
+              process->count = &count;
+              process->n_items = n_items;
 
-          count++;
+              g_hash_table_insert (pid_to_process, GINT_TO_POINTER (traceable.pid), process);
+              g_ptr_array_add (processes, process);
+            }
 
-          if (state->progress_func != NULL && count % 100 == 0)
-            state->progress_func (count / (double)n_items, _("Symbolizing stack traces"), state->progress_data);
+          egg_bitset_add (process->traceables, traceable.position);
         }
-      while (egg_bitset_iter_next (&iter, &i));
+
+      _sysprof_document_traceable_cursor_clear (&cursor);
+
+      state->symbols->kernel_addresses = resolve_addresses (state->symbolizer,
+                                                            state->strings,
+                                                            NULL,
+                                                            SYSPROF_ADDRESS_CONTEXT_KERNEL,
+                                                            state->symbols->kernel_symbols,
+                                                            kernel_addresses);
+      sysprof_symbol_cache_freeze (state->symbols->kernel_symbols);
+
+      symbolize_processes (processes);
     }
 
   g_task_return_pointer (task,
@@ -346,6 +597,7 @@ _sysprof_document_symbols_lookup (SysprofDocumentSymbols   *self,
                                   SysprofAddress            address)
 {
   SysprofAddressContext new_context;
+  SysprofSymbol *symbol;
 
   g_return_val_if_fail (SYSPROF_IS_DOCUMENT_SYMBOLS (self), NULL);
   g_return_val_if_fail (context <= SYSPROF_ADDRESS_CONTEXT_GUEST_USER, NULL);
@@ -357,10 +609,22 @@ _sysprof_document_symbols_lookup (SysprofDocumentSymbols   *self,
     return self->context_switches[context];
 
   if (context == SYSPROF_ADDRESS_CONTEXT_KERNEL)
-    return sysprof_symbol_cache_lookup (self->kernel_symbols, address);
+    {
+      if (self->kernel_addresses != NULL &&
+          (symbol = sysprof_address_table_lookup (self->kernel_addresses, address)))
+        return symbol;
+
+      return sysprof_symbol_cache_lookup (self->kernel_symbols, address);
+    }
 
   if (process_info != NULL)
-    return sysprof_symbol_cache_lookup (process_info->symbol_cache, address);
+    {
+      if (process_info->address_table != NULL &&
+          (symbol = sysprof_address_table_lookup (process_info->address_table, address)))
+        return symbol;
+
+      return sysprof_symbol_cache_lookup (process_info->symbol_cache, address);
+    }
 
   return NULL;
 }
@@ -21,6 +21,7 @@
 #include "config.h"
 
 #include <fcntl.h>
+#include <sys/mman.h>
 
 #include <glib/gstdio.h>
 #include <glib/gi18n.h>
@@ -32,6 +33,7 @@
 #include "sysprof-document-private.h"
 
 #include "sysprof-bundled-symbolizer-private.h"
+#include "sysprof-capture-compress-private.h"
 #include "sysprof-callgraph-private.h"
 #include "sysprof-cpu-info-private.h"
 #include "sysprof-document-allocation.h"
@@ -66,6 +68,22 @@
 #define GDK_ARRAY_TYPE_NAME SysprofDocumentFrames
 #include "gdkarrayimpl.c"
 
+/* The sort key is copied out of the capture while scanning so that
+ * sorting and merging never need to touch the mapped file again.
+ */
+typedef struct _FrameSortEntry
+{
+  gint64                      time;
+  gint64                      duration;
+  SysprofDocumentFramePointer ptr;
+} FrameSortEntry;
+
+#define GDK_ARRAY_ELEMENT_TYPE FrameSortEntry
+#define GDK_ARRAY_NAME frame_sort_entries
+#define GDK_ARRAY_TYPE_NAME FrameSortEntries
+#define GDK_ARRAY_BY_VALUE 1
+#include "gdkarrayimpl.c"
+
 struct _SysprofDocument
 {
   GObject                   parent_instance;
@@ -107,6 +125,8 @@ struct _SysprofDocument
   GHashTable               *pid_to_process_info;
   GHashTable               *tid_to_symbol;
   GHashTable               *mark_groups;
+  /* stack id -> const SysprofCaptureStack * */
+  GHashTable               *stacks;
 
   SysprofMountNamespace    *mount_namespace;
 
@@ -224,6 +244,81 @@ sysprof_document_get_n_items (GListModel *model)
   return sysprof_document_frames_get_size (&self->frames);
 }
 
+/*
+ * Resolves the shared stack for a sample or allocation which references
+ * one instead of carrying its own addresses.
+ */
+static const SysprofCaptureStack *
+sysprof_document_lookup_stack (SysprofDocument           *self,
+                               const SysprofCaptureFrame *frame,
+                               guint16                    frame_len)
+{
+  const SysprofCaptureAddress *addrs;
+  guint64 stack_id;
+  gsize header_len;
+  guint n_addrs;
+  gboolean stack;
+
+  if (g_hash_table_size (self->stacks) == 0)
+    return NULL;
+
+  if (frame->type == SYSPROF_CAPTURE_FRAME_SAMPLE)
+    {
+      const SysprofCaptureSample *sample = (const SysprofCaptureSample *)frame;
+
+      header_len = sizeof *sample;
+      addrs = sample->addrs;
+      n_addrs = swap_uint16 (self->needs_swap, sample->n_addrs);
+      stack = _sysprof_document_frame_flag (self->needs_swap,
+                                            SYSPROF_DOCUMENT_SAMPLE_FLAGS (sample),
+                                            SYSPROF_DOCUMENT_FRAME_STACK_BIT);
+    }
+  else if (frame->type == SYSPROF_CAPTURE_FRAME_ALLOCATION)
+    {
+      const SysprofCaptureAllocation *alloc = (const SysprofCaptureAllocation *)frame;
+
+      header_len = sizeof *alloc;
+      addrs = alloc->addrs;
+      n_addrs = swap_uint16 (self->needs_swap, alloc->n_addrs);
+      stack = _sysprof_document_frame_flag (self->needs_swap,
+                                            SYSPROF_DOCUMENT_ALLOCATION_FLAGS (alloc),
+                                            SYSPROF_DOCUMENT_FRAME_STACK_BIT);
+    }
+  else
+    {
+      return NULL;
+    }
+
+  if (!stack || n_addrs != 0 || frame_len < header_len + sizeof (SysprofCaptureAddress))
+    return NULL;
+
+  stack_id = swap_uint64 (self->needs_swap, addrs[0]);
+
+  if (stack_id == 0 || stack_id > G_MAXUINT32)
+    return NULL;
+
+  return g_hash_table_lookup (self->stacks, GUINT_TO_POINTER ((guint)stack_id));
+}
+
+static gboolean
+addresses_have_context_switch (gboolean                     needs_swap,
+                               const SysprofCaptureAddress *addrs,
+                               guint                        n_addrs)
+{
+  SysprofAddressContext last_context = SYSPROF_ADDRESS_CONTEXT_USER;
+
+  for (guint i = 0; i < n_addrs; i++)
+    {
+      SysprofAddress addr = swap_uint64 (needs_swap, addrs[i]);
+
+      if (sysprof_address_is_context_switch (addr, &last_context) &&
+          last_context == SYSPROF_ADDRESS_CONTEXT_KERNEL)
+        return TRUE;
+    }
+
+  return FALSE;
+}
+
 static gpointer
 sysprof_document_get_item (GListModel *model,
                            guint       position)
@@ -243,6 +338,9 @@ sysprof_document_get_item (GListModel *model,
                                      self->header.time,
                                      self->header.end_time);
 
+  if (SYSPROF_IS_DOCUMENT_TRACEABLE (ret))
+    ret->stack = sysprof_document_lookup_stack (self, ret->frame, ret->frame_len);
+
   /* Annotate processes with pre-calculated info */
   if (SYSPROF_IS_DOCUMENT_PROCESS (ret))
     {
@@ -390,6 +488,7 @@ sysprof_document_finalize (GObject *object)
   g_clear_pointer (&self->traceables, egg_bitset_unref);
 
   g_clear_pointer (&self->mark_groups, g_hash_table_unref);
+  g_clear_pointer (&self->stacks, g_hash_table_unref);
 
   g_clear_object (&self->counters);
   g_clear_pointer (&self->counter_id_to_values, g_hash_table_unref);
@@ -602,6 +701,7 @@ sysprof_document_init (SysprofDocument *self)
   self->pid_to_process_info = g_hash_table_new_full (NULL, NULL, NULL, (GDestroyNotify)sysprof_process_info_unref);
   self->tid_to_symbol = g_hash_table_new_full (NULL, NULL, NULL, (GDestroyNotify)g_object_unref);
   self->mark_groups = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_hash_table_unref);
+  self->stacks = g_hash_table_new (NULL, NULL);
 
   self->mount_namespace = sysprof_mount_namespace_new ();
 }
@@ -1009,6 +1109,7 @@ is_data_type (SysprofCaptureFrameType type)
     case SYSPROF_CAPTURE_FRAME_JITMAP:
     case SYSPROF_CAPTURE_FRAME_METADATA:
     case SYSPROF_CAPTURE_FRAME_OVERLAY:
+    case SYSPROF_CAPTURE_FRAME_STACK:
     case SYSPROF_CAPTURE_FRAME_TIMESTAMP:
     default:
       return FALSE;
@@ -1047,84 +1148,41 @@ load_progress (Load       *load,
     load->progress (fraction, message, load->progress_data);
 }
 
-static int
-sort_by_time (gconstpointer a,
-              gconstpointer b,
-              gpointer      base)
+/* Frames are ordered by time, with longer marks first so that they
+ * nest around the shorter marks they contain. Everything else at the
+ * same time keeps the order it was written in.
+ */
+static inline int
+frame_sort_entry_compare (const FrameSortEntry *a,
+                          const FrameSortEntry *b)
 {
-  const SysprofDocumentFramePointer *aptr = a;
-  const SysprofDocumentFramePointer *bptr = b;
-  const SysprofCaptureFrame *aframe = (const SysprofCaptureFrame *)((const guint8 *)base + aptr->offset);
-  const SysprofCaptureFrame *bframe = (const SysprofCaptureFrame *)((const guint8 *)base + bptr->offset);
-
-  if (aframe->time < bframe->time)
+  if (a->time < b->time)
     return -1;
 
-  if (aframe->time > bframe->time)
+  if (a->time > b->time)
     return 1;
 
-  if (aframe->type == SYSPROF_CAPTURE_FRAME_MARK && bframe->type == SYSPROF_CAPTURE_FRAME_MARK)
-    {
-      const SysprofCaptureMark *amark = (const SysprofCaptureMark *)aframe;
-      const SysprofCaptureMark *bmark = (const SysprofCaptureMark *)bframe;
+  if (a->duration > b->duration)
+    return -1;
 
-      if (amark->duration > bmark->duration)
-        return -1;
-      else if (amark->duration < bmark->duration)
-        return 1;
-    }
+  if (a->duration < b->duration)
+    return 1;
 
   return 0;
 }
 
 static int
-sort_by_time_swapped (gconstpointer a,
-                      gconstpointer b,
-                      gpointer      base)
-{
-  const SysprofDocumentFramePointer *aptr = a;
-  const SysprofDocumentFramePointer *bptr = b;
-  const SysprofCaptureFrame *aframe = (const SysprofCaptureFrame *)((const guint8 *)base + aptr->offset);
-  const SysprofCaptureFrame *bframe = (const SysprofCaptureFrame *)((const guint8 *)base + bptr->offset);
-#if G_BYTE_ORDER == G_LITTLE_ENDIAN
-  gint64 atime = GINT64_FROM_BE (aframe->time);
-  gint64 btime = GINT64_FROM_BE (bframe->time);
-#else
-  gint64 atime = GINT64_FROM_LE (aframe->time);
-  gint64 btime = GINT64_FROM_LE (bframe->time);
-#endif
-
-  if (atime < btime)
-    return -1;
-
-  if (atime > btime)
-    return 1;
-
-  if (aframe->type == SYSPROF_CAPTURE_FRAME_MARK && bframe->type == SYSPROF_CAPTURE_FRAME_MARK)
-    {
-      const SysprofCaptureMark *amark = (const SysprofCaptureMark *)aframe;
-      const SysprofCaptureMark *bmark = (const SysprofCaptureMark *)bframe;
-#if G_BYTE_ORDER == G_LITTLE_ENDIAN
-      gint64 aduration = GINT64_FROM_BE (amark->duration);
-      gint64 bduration = GINT64_FROM_BE (bmark->duration);
-#else
-      gint64 aduration = GINT64_FROM_LE (amark->duration);
-      gint64 bduration = GINT64_FROM_LE (bmark->duration);
-#endif
-
-      if (aduration > bduration)
-        return -1;
-      else if (aduration < bduration)
-        return 1;
-    }
-
-  return 0;
+sort_by_time (gconstpointer a,
+              gconstpointer b,
+              gpointer      user_data)
+{
+  return frame_sort_entry_compare (a, b);
 }
 
 typedef struct _FrameScan
 {
   const guint8 *base;
-  SysprofDocumentFrames frames;
+  FrameSortEntries entries;
   GCancellable *cancellable;
   gsize begin;
   gsize end;
@@ -1135,7 +1193,7 @@ typedef struct _FrameScan
 static void
 frame_scan_free (FrameScan *scan)
 {
-  sysprof_document_frames_clear (&scan->frames);
+  frame_sort_entries_clear (&scan->entries);
   g_clear_object (&scan->cancellable);
   g_free (scan);
 }
@@ -1156,7 +1214,7 @@ frame_scan_new (const guint8 *base,
 
   scan = g_new0 (FrameScan, 1);
   scan->base = base;
-  sysprof_document_frames_init (&scan->frames);
+  frame_sort_entries_init (&scan->entries);
   scan->cancellable = cancellable ? g_object_ref (cancellable) : NULL;
   scan->begin = begin;
   scan->end = end;
@@ -1174,7 +1232,8 @@ frame_is_index (const SysprofCaptureFrame *frame,
   return frame->type == SYSPROF_CAPTURE_FRAME_TIMESTAMP &&
          (frame->padding2 == SYSPROF_CAPTURE_FRAME_INDEX_MAGIC ||
           GUINT32_SWAP_LE_BE (frame->padding2) == SYSPROF_CAPTURE_FRAME_INDEX_MAGIC) &&
-         frame_len == sizeof (SysprofCaptureFrameIndex);
+         (frame_len == sizeof (SysprofCaptureFrameIndex) ||
+          frame_len == SYSPROF_CAPTURE_FRAME_INDEX_MIN_LEN);
 }
 
 static gboolean
@@ -1192,7 +1251,6 @@ frame_scan_run (FrameScan *scan)
   while (pos < scan->end)
     {
       const SysprofCaptureFrame *frame;
-      SysprofDocumentFramePointer ptr;
       guint16 frame_len;
 
       if (scan->end - pos < sizeof (SysprofCaptureFrame))
@@ -1210,9 +1268,19 @@ frame_scan_run (FrameScan *scan)
 
       if (!frame_is_index (frame, frame_len))
         {
-          ptr.offset = pos;
-          ptr.length = frame_len;
-          sysprof_document_frames_append (&scan->frames, ptr);
+          FrameSortEntry entry;
+
+          entry.time = swap_int64 (scan->needs_swap, frame->time);
+          entry.duration = 0;
+          entry.ptr.offset = pos;
+          entry.ptr.length = frame_len;
+
+          if (frame->type == SYSPROF_CAPTURE_FRAME_MARK &&
+              frame_len >= sizeof (SysprofCaptureMark))
+            entry.duration = swap_int64 (scan->needs_swap,
+                                         ((const SysprofCaptureMark *)frame)->duration);
+
+          frame_sort_entries_append (&scan->entries, &entry);
         }
 
       pos += frame_len;
@@ -1226,18 +1294,11 @@ frame_scan_run (FrameScan *scan)
 
   scan->valid = pos == scan->end;
 
-  if G_UNLIKELY (scan->needs_swap)
-    gtk_tim_sort (sysprof_document_frames_get_data (&scan->frames),
-                  sysprof_document_frames_get_size (&scan->frames),
-                  sizeof (SysprofDocumentFramePointer),
-                  sort_by_time_swapped,
-                  (gpointer)scan->base);
-  else
-    gtk_tim_sort (sysprof_document_frames_get_data (&scan->frames),
-                  sysprof_document_frames_get_size (&scan->frames),
-                  sizeof (SysprofDocumentFramePointer),
-                  sort_by_time,
-                  (gpointer)scan->base);
+  gtk_tim_sort (frame_sort_entries_get_data (&scan->entries),
+                frame_sort_entries_get_size (&scan->entries),
+                sizeof (FrameSortEntry),
+                sort_by_time,
+                NULL);
 
   return TRUE;
 }
@@ -1289,16 +1350,17 @@ sysprof_document_create_frame_scans (SysprofDocument *self,
       guint16 frame_len;
 
       if (current < sizeof self->header ||
-          current > len - sizeof (SysprofCaptureFrameIndex) ||
+          current > len - SYSPROF_CAPTURE_FRAME_INDEX_MIN_LEN ||
           current % SYSPROF_CAPTURE_ALIGN != 0 ||
-          offsets->len > len / sizeof (SysprofCaptureFrameIndex))
+          offsets->len > len / SYSPROF_CAPTURE_FRAME_INDEX_MIN_LEN)
         return NULL;
 
+      /* Older indexes lack the trailing time bounds */
       frame_index = (const SysprofCaptureFrameIndex *)(const void *)&self->base[current];
       frame_len = swap_uint16 (self->needs_swap, frame_index->frame.len);
 
       if (!frame_is_index (&frame_index->frame, frame_len) ||
-          frame_len != sizeof *frame_index)
+          frame_len > len - current)
         return NULL;
 
       previous = swap_uint64 (self->needs_swap,
@@ -1327,6 +1389,7 @@ sysprof_document_create_frame_scans (SysprofDocument *self,
   for (guint i = 0; i < offsets->len; i++)
     {
       guint64 offset = g_array_index (offsets, guint64, i);
+      const SysprofCaptureFrame *frame = (const SysprofCaptureFrame *)(const void *)&self->base[offset];
 
       if (offset < begin)
         {
@@ -1342,7 +1405,7 @@ sysprof_document_create_frame_scans (SysprofDocument *self,
                                          self->needs_swap,
                                          cancellable));
 
-      begin = offset + sizeof (SysprofCaptureFrameIndex);
+      begin = offset + swap_uint16 (self->needs_swap, frame->len);
     }
 
   if (begin < len)
@@ -1384,13 +1447,211 @@ sysprof_document_scan_frames_serial (SysprofDocument *self,
   if (!scan->valid)
     g_warning ("Capture contained an invalid or truncated frame");
 
-  sysprof_document_frames_clear (&self->frames);
-  self->frames = scan->frames;
-  sysprof_document_frames_init (&scan->frames);
+  sysprof_document_frames_set_size (&self->frames, frame_sort_entries_get_size (&scan->entries));
+
+  for (gsize i = 0; i < frame_sort_entries_get_size (&scan->entries); i++)
+    *sysprof_document_frames_index (&self->frames, i) = frame_sort_entries_index (&scan->entries, i)->ptr;
 
   return TRUE;
 }
 
+#define MERGE_MIN_SEGMENT 65536
+
+/* One segment of the output of merging two sorted runs. Segments are
+ * found independently using the merge path so that a single large merge
+ * can still be spread across the thread pool.
+ */
+typedef struct _FrameMerge
+{
+  const FrameSortEntry        *left;
+  const FrameSortEntry        *right;
+  FrameSortEntry              *entries;
+  SysprofDocumentFramePointer *frames;
+  gsize                        n_left;
+  gsize                        n_right;
+  gsize                        begin;
+  gsize                        end;
+} FrameMerge;
+
+/* Number of items from @left within the first @k items of the merge */
+static gsize
+frame_merge_split (const FrameSortEntry *left,
+                   gsize                 n_left,
+                   const FrameSortEntry *right,
+                   gsize                 n_right,
+                   gsize                 k)
+{
+  gsize lo = k > n_right ? k - n_right : 0;
+  gsize hi = MIN (k, n_left);
+
+  while (lo < hi)
+    {
+      gsize i = lo + (hi - lo) / 2;
+
+      /* Ties go to @left to keep the merge stable */
+      if (frame_sort_entry_compare (&left[i], &right[k - i - 1]) <= 0)
+        lo = i + 1;
+      else
+        hi = i;
+    }
+
+  return lo;
+}
+
+static void
+frame_merge_run (FrameMerge *merge)
+{
+  gsize i = frame_merge_split (merge->left, merge->n_left, merge->right, merge->n_right, merge->begin);
+  gsize j = merge->begin - i;
+
+  for (gsize k = merge->begin; k < merge->end; k++)
+    {
+      const FrameSortEntry *entry;
+
+      if (j >= merge->n_right ||
+          (i < merge->n_left && frame_sort_entry_compare (&merge->left[i], &merge->right[j]) <= 0))
+        entry = &merge->left[i++];
+      else
+        entry = &merge->right[j++];
+
+      /* The final round only needs the frame pointers */
+      if (merge->frames != NULL)
+        merge->frames[k] = entry->ptr;
+      else
+        merge->entries[k] = *entry;
+    }
+}
+
+static DexFuture *
+frame_merge_thread (gpointer user_data)
+{
+  frame_merge_run (user_data);
+  return dex_future_new_for_boolean (TRUE);
+}
+
+/*
+ * Each scan has already sorted its own run of frames, so rather than
+ * sorting everything again the runs are merged pairwise until a single
+ * run remains. The last round writes directly into @self's frames.
+ */
+static void
+sysprof_document_merge_frame_scans (SysprofDocument *self,
+                                    DexThreadPool   *pool,
+                                    GPtrArray       *scans)
+{
+  g_autoptr(GArray) bounds = NULL;
+  g_autoptr(GArray) next_bounds = NULL;
+  g_autofree FrameSortEntry *src = NULL;
+  g_autofree FrameSortEntry *dst = NULL;
+  gsize n_frames = 0;
+  gsize segment;
+
+  g_assert (SYSPROF_IS_DOCUMENT (self));
+  g_assert (scans != NULL);
+  g_assert (scans->len > 0);
+
+  bounds = g_array_new (FALSE, FALSE, sizeof (gsize));
+  next_bounds = g_array_new (FALSE, FALSE, sizeof (gsize));
+
+  g_array_append_val (bounds, n_frames);
+
+  for (guint i = 0; i < scans->len; i++)
+    {
+      FrameScan *scan = g_ptr_array_index (scans, i);
+
+      n_frames += frame_sort_entries_get_size (&scan->entries);
+      g_array_append_val (bounds, n_frames);
+    }
+
+  src = g_new (FrameSortEntry, MAX (n_frames, 1));
+  dst = g_new (FrameSortEntry, MAX (n_frames, 1));
+
+  for (guint i = 0; i < scans->len; i++)
+    {
+      FrameScan *scan = g_ptr_array_index (scans, i);
+      gsize n = frame_sort_entries_get_size (&scan->entries);
+
+      if (n > 0)
+        memcpy (&src[g_array_index (bounds, gsize, i)],
+                frame_sort_entries_get_data (&scan->entries),
+                n * sizeof (FrameSortEntry));
+
+      frame_sort_entries_clear (&scan->entries);
+    }
+
+  sysprof_document_frames_set_size (&self->frames, n_frames);
+  segment = MAX (MERGE_MIN_SEGMENT, n_frames / g_get_num_processors ());
+
+  for (;;)
+    {
+      g_autoptr(GPtrArray) futures = g_ptr_array_new_with_free_func (dex_unref);
+      g_autoptr(GPtrArray) merges = g_ptr_array_new_with_free_func (g_free);
+      guint n_runs = bounds->len - 1;
+      gboolean last = n_runs <= 2;
+      FrameSortEntry *tmp;
+
+      g_array_set_size (next_bounds, 0);
+      g_array_append_val (next_bounds, g_array_index (bounds, gsize, 0));
+
+      for (guint r = 0; r < n_runs; r += 2)
+        {
+          gsize left_begin = g_array_index (bounds, gsize, r);
+          gsize right_begin = g_array_index (bounds, gsize, r + 1);
+          gsize right_end = r + 1 < n_runs ? g_array_index (bounds, gsize, r + 2) : right_begin;
+          gsize len = right_end - left_begin;
+
+          for (gsize k = 0; k < len; k += segment)
+            {
+              FrameMerge *merge = g_new0 (FrameMerge, 1);
+
+              merge->left = &src[left_begin];
+              merge->n_left = right_begin - left_begin;
+              merge->right = &src[right_begin];
+              merge->n_right = right_end - right_begin;
+              merge->begin = k;
+              merge->end = MIN (k + segment, len);
+
+              if (last)
+                merge->frames = sysprof_document_frames_index (&self->frames, left_begin);
+              else
+                merge->entries = &dst[left_begin];
+
+              g_ptr_array_add (merges, merge);
+            }
+
+          g_array_append_val (next_bounds, right_end);
+        }
+
+      if (merges->len < 2)
+        {
+          for (guint i = 0; i < merges->len; i++)
+            frame_merge_run (g_ptr_array_index (merges, i));
+        }
+      else
+        {
+          for (guint i = 0; i < merges->len; i++)
+            g_ptr_array_add (futures,
+                             dex_thread_pool_submit (pool,
+                                                     "[sysprof-document-frame-merge]",
+                                                     frame_merge_thread,
+                                                     g_ptr_array_index (merges, i),
+                                                     NULL));
+
+          dex_thread_wait_for (dex_future_allv ((DexFuture **)futures->pdata, futures->len), NULL);
+        }
+
+      if (last)
+        break;
+
+      tmp = src;
+      src = dst;
+      dst = tmp;
+
+      g_array_set_size (bounds, 0);
+      g_array_append_vals (bounds, next_bounds->data, next_bounds->len);
+    }
+}
+
 static gboolean
 sysprof_document_scan_frames (SysprofDocument *self,
                               gsize            len,
@@ -1437,6 +1698,23 @@ sysprof_document_scan_frames (SysprofDocument *self,
                             &local_error))
     valid = FALSE;
 
+  if (local_error == NULL)
+    {
+      for (guint i = 0; i < scans->len; i++)
+        {
+          FrameScan *scan = g_ptr_array_index (scans, i);
+
+          if (!scan->valid)
+            {
+              valid = FALSE;
+              break;
+            }
+        }
+
+      if (valid)
+        sysprof_document_merge_frame_scans (self, pool, scans);
+    }
+
   dex_thread_wait_for (dex_thread_pool_close (pool, DEX_THREAD_POOL_SHUTDOWN_DRAIN), NULL);
 
   if (local_error != NULL)
@@ -1445,17 +1723,6 @@ sysprof_document_scan_frames (SysprofDocument *self,
       return FALSE;
     }
 
-  for (guint i = 0; i < scans->len; i++)
-    {
-      FrameScan *scan = g_ptr_array_index (scans, i);
-
-      if (!scan->valid)
-        {
-          valid = FALSE;
-          break;
-        }
-    }
-
   if (!valid)
     {
       g_clear_pointer (&futures, g_ptr_array_unref);
@@ -1463,360 +1730,799 @@ sysprof_document_scan_frames (SysprofDocument *self,
       return sysprof_document_scan_frames_serial (self, len, cancellable, error);
     }
 
-  sysprof_document_frames_set_size (&self->frames, 0);
+  return TRUE;
+}
 
-  for (guint i = 0; i < scans->len; i++)
-    {
-      FrameScan *scan = g_ptr_array_index (scans, i);
+#define CLASSIFY_MIN_FRAMES 8192
 
-      gsize n_frames = sysprof_document_frames_get_size (&scan->frames);
+typedef struct _FrameClassify
+{
+  SysprofDocument *document;
+  guint            begin;
+  guint            end;
+  gint64           guessed_end_nsec;
+  EggBitset       *allocations;
+  EggBitset       *ctrdefs;
+  EggBitset       *ctrsets;
+  EggBitset       *dbus_messages;
+  EggBitset       *file_chunks;
+  EggBitset       *jitmaps;
+  EggBitset       *logs;
+  EggBitset       *marks;
+  EggBitset       *metadata;
+  EggBitset       *mmaps;
+  EggBitset       *overlays;
+  EggBitset       *pids;
+  EggBitset       *processes;
+  EggBitset       *samples;
+  EggBitset       *samples_with_context_switch;
+  EggBitset       *traceables;
+  /* samples whose addresses live in a shared stack */
+  EggBitset       *stack_samples;
+  /* path -> first position within this chunk */
+  GHashTable      *files_first_position;
+  /* group -> name -> EggBitset */
+  GHashTable      *mark_groups;
+  /* pid -> EggBitset of thread-ids, for processes needing process info */
+  GHashTable      *threads;
+  /* pid -> exit time */
+  GHashTable      *exit_times;
+  /* stack id -> const SysprofCaptureStack * */
+  GHashTable      *stacks;
+} FrameClassify;
+
+static FrameClassify *
+frame_classify_new (SysprofDocument *document,
+                    guint            begin,
+                    guint            end)
+{
+  FrameClassify *classify;
+
+  classify = g_new0 (FrameClassify, 1);
+  classify->document = document;
+  classify->begin = begin;
+  classify->end = end;
+  classify->allocations = egg_bitset_new_empty ();
+  classify->ctrdefs = egg_bitset_new_empty ();
+  classify->ctrsets = egg_bitset_new_empty ();
+  classify->dbus_messages = egg_bitset_new_empty ();
+  classify->file_chunks = egg_bitset_new_empty ();
+  classify->jitmaps = egg_bitset_new_empty ();
+  classify->logs = egg_bitset_new_empty ();
+  classify->marks = egg_bitset_new_empty ();
+  classify->metadata = egg_bitset_new_empty ();
+  classify->mmaps = egg_bitset_new_empty ();
+  classify->overlays = egg_bitset_new_empty ();
+  classify->pids = egg_bitset_new_empty ();
+  classify->processes = egg_bitset_new_empty ();
+  classify->samples = egg_bitset_new_empty ();
+  classify->samples_with_context_switch = egg_bitset_new_empty ();
+  classify->traceables = egg_bitset_new_empty ();
+  classify->stack_samples = egg_bitset_new_empty ();
+  classify->files_first_position = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  classify->mark_groups = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                                 (GDestroyNotify)g_hash_table_unref);
+  classify->threads = g_hash_table_new_full (NULL, NULL, NULL, (GDestroyNotify)egg_bitset_unref);
+  classify->exit_times = g_hash_table_new_full (NULL, NULL, NULL, g_free);
+  classify->stacks = g_hash_table_new (NULL, NULL);
+
+  return classify;
+}
 
-      if (n_frames > 0)
-        sysprof_document_frames_splice (&self->frames,
-                                        sysprof_document_frames_get_size (&self->frames),
-                                        0,
-                                        FALSE,
-                                        sysprof_document_frames_get_data (&scan->frames),
-                                        n_frames);
-      sysprof_document_frames_clear (&scan->frames);
-    }
+static void
+frame_classify_free (FrameClassify *classify)
+{
+  g_clear_pointer (&classify->allocations, egg_bitset_unref);
+  g_clear_pointer (&classify->ctrdefs, egg_bitset_unref);
+  g_clear_pointer (&classify->ctrsets, egg_bitset_unref);
+  g_clear_pointer (&classify->dbus_messages, egg_bitset_unref);
+  g_clear_pointer (&classify->file_chunks, egg_bitset_unref);
+  g_clear_pointer (&classify->jitmaps, egg_bitset_unref);
+  g_clear_pointer (&classify->logs, egg_bitset_unref);
+  g_clear_pointer (&classify->marks, egg_bitset_unref);
+  g_clear_pointer (&classify->metadata, egg_bitset_unref);
+  g_clear_pointer (&classify->mmaps, egg_bitset_unref);
+  g_clear_pointer (&classify->overlays, egg_bitset_unref);
+  g_clear_pointer (&classify->pids, egg_bitset_unref);
+  g_clear_pointer (&classify->processes, egg_bitset_unref);
+  g_clear_pointer (&classify->samples, egg_bitset_unref);
+  g_clear_pointer (&classify->samples_with_context_switch, egg_bitset_unref);
+  g_clear_pointer (&classify->traceables, egg_bitset_unref);
+  g_clear_pointer (&classify->stack_samples, egg_bitset_unref);
+  g_clear_pointer (&classify->files_first_position, g_hash_table_unref);
+  g_clear_pointer (&classify->mark_groups, g_hash_table_unref);
+  g_clear_pointer (&classify->threads, g_hash_table_unref);
+  g_clear_pointer (&classify->exit_times, g_hash_table_unref);
+  g_clear_pointer (&classify->stacks, g_hash_table_unref);
+  g_free (classify);
+}
 
-  if G_UNLIKELY (self->needs_swap)
-    gtk_tim_sort (sysprof_document_frames_get_data (&self->frames),
-                  sysprof_document_frames_get_size (&self->frames),
-                  sizeof (SysprofDocumentFramePointer),
-                  sort_by_time_swapped,
-                  (gpointer)self->base);
-  else
-    gtk_tim_sort (sysprof_document_frames_get_data (&self->frames),
-                  sysprof_document_frames_get_size (&self->frames),
-                  sizeof (SysprofDocumentFramePointer),
-                  sort_by_time,
-                  (gpointer)self->base);
+static void
+frame_classify_seen_thread (FrameClassify *classify,
+                            int            pid,
+                            int            tid)
+{
+  EggBitset *tids;
 
-  return TRUE;
+  if (!(tids = g_hash_table_lookup (classify->threads, GINT_TO_POINTER (pid))))
+    {
+      tids = egg_bitset_new_empty ();
+      g_hash_table_insert (classify->threads, GINT_TO_POINTER (pid), tids);
+    }
+
+  if (tid > 0)
+    egg_bitset_add (tids, tid);
 }
 
-static void
-sysprof_document_update_process_exit_times (SysprofDocument *self)
+static EggBitset *
+frame_classify_lookup_mark (GHashTable *mark_groups,
+                            const char *group,
+                            const char *name)
 {
-  GHashTableIter iter;
-  SysprofProcessInfo *info;
+  GHashTable *names;
+  EggBitset *bitset;
 
-  g_assert (SYSPROF_IS_DOCUMENT (self));
+  if (!(names = g_hash_table_lookup (mark_groups, group)))
+    {
+      names = g_hash_table_new_full (g_str_hash,
+                                     g_str_equal,
+                                     g_free,
+                                     (GDestroyNotify)egg_bitset_unref);
+      g_hash_table_insert (mark_groups, g_strdup (group), names);
+    }
 
-  g_hash_table_iter_init (&iter, self->pid_to_process_info);
-  while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&info))
+  if (!(bitset = g_hash_table_lookup (names, name)))
     {
-      if (info->exit_time == 0)
-        info->exit_time = self->time_span.end_nsec;
+      bitset = egg_bitset_new_empty ();
+      g_hash_table_insert (names, g_strdup (name), bitset);
     }
+
+  return bitset;
 }
 
 static void
-sysprof_document_load_cpu (SysprofDocument *self)
+frame_classify_run (FrameClassify *classify)
 {
-  static const char processor_prefix[] = "processor\t: ";
-  static const char core_id_prefix[] = "core id\t\t: ";
-  static const char model_name_prefix[] = "model name\t: ";
-  static const char model_prefix[] = "Model\t\t: ";
-  const gsize processor_len = sizeof processor_prefix - 1;
-  const gsize core_id_len = sizeof core_id_prefix - 1;
-  const gsize model_name_len = sizeof model_name_prefix - 1;
-  const gsize model_len = sizeof model_prefix - 1;
-  g_autoptr(SysprofDocumentFile) file = NULL;
-  g_autoptr(GBytes) bytes = NULL;
-  g_autoptr(SysprofCpuInfo) cpu_info = NULL;
-  g_autofree char *model = NULL;
-  const char *str;
-  const char *line;
-  LineReader reader;
-  gsize line_len;
-  gsize len;
+  SysprofDocument *self = classify->document;
 
-  g_assert (SYSPROF_IS_DOCUMENT (self));
+  for (guint f = classify->begin; f < classify->end; f++)
+    {
+      SysprofDocumentFramePointer *ptr = sysprof_document_frames_index (&self->frames, f);
+      const SysprofCaptureFrame *tainted = (const SysprofCaptureFrame *)(gpointer)&self->base[ptr->offset];
+      gint64 t = swap_int64 (self->needs_swap, tainted->time);
+      int pid = swap_int32 (self->needs_swap, tainted->pid);
 
-  if (!(file = sysprof_document_lookup_file (self, "/proc/cpuinfo")) ||
-      !(bytes = sysprof_document_file_dup_bytes (file)))
-    return;
+      if (t > classify->guessed_end_nsec && is_data_type (tainted->type))
+        classify->guessed_end_nsec = t;
 
-  str = (const char *)g_bytes_get_data (bytes, &len);
+      egg_bitset_add (classify->pids, pid);
 
-  line_reader_init (&reader, (char *)str, len);
-  while ((line = line_reader_next (&reader, &line_len)))
-    {
-      if (line_len > processor_len &&
-          memcmp (line, processor_prefix, processor_len) == 0)
+      switch ((int)tainted->type)
         {
-          gint64 id = g_ascii_strtoll (line + processor_len, NULL, 10);
+        case SYSPROF_CAPTURE_FRAME_ALLOCATION:
+          egg_bitset_add (classify->allocations, f);
+          egg_bitset_add (classify->traceables, f);
+          break;
 
-          if (cpu_info != NULL)
-            g_list_store_append (self->cpu_info, cpu_info);
+        case SYSPROF_CAPTURE_FRAME_SAMPLE:
+          egg_bitset_add (classify->samples, f);
+          egg_bitset_add (classify->traceables, f);
+          break;
 
-          g_clear_object (&cpu_info);
+        case SYSPROF_CAPTURE_FRAME_PROCESS:
+          egg_bitset_add (classify->processes, f);
+          break;
 
-          cpu_info = g_object_new (SYSPROF_TYPE_CPU_INFO,
-                                   "id", id,
-                                   NULL);
-        }
+        case SYSPROF_CAPTURE_FRAME_FILE_CHUNK:
+          egg_bitset_add (classify->file_chunks, f);
+          break;
 
-      if (line_len > core_id_len &&
-          memcmp (line, core_id_prefix, core_id_len) == 0)
-        {
-          gint64 core_id = g_ascii_strtoll (line + core_id_len, NULL, 10);
+        case SYSPROF_CAPTURE_FRAME_CTRDEF:
+          egg_bitset_add (classify->ctrdefs, f);
+          break;
 
-          if (cpu_info != NULL && core_id > 0)
-            _sysprof_cpu_info_set_core_id (cpu_info, core_id);
-        }
+        case SYSPROF_CAPTURE_FRAME_CTRSET:
+          egg_bitset_add (classify->ctrsets, f);
+          break;
 
-      if (line_len > model_name_len &&
-          memcmp (line, model_name_prefix, model_name_len) == 0)
-        {
-          g_autofree char *model_name = g_strndup (line + model_name_len,
-                                                   line_len - model_name_len);
+        case SYSPROF_CAPTURE_FRAME_DBUS_MESSAGE:
+          egg_bitset_add (classify->dbus_messages, f);
+          break;
 
-          if (cpu_info != NULL)
-            _sysprof_cpu_info_set_model_name (cpu_info, model_name);
+        case SYSPROF_CAPTURE_FRAME_MARK:
+          egg_bitset_add (classify->marks, f);
+          break;
+
+        case SYSPROF_CAPTURE_FRAME_METADATA:
+          egg_bitset_add (classify->metadata, f);
+          break;
+
+        case SYSPROF_CAPTURE_FRAME_JITMAP:
+          egg_bitset_add (classify->jitmaps, f);
+          break;
+
+        case SYSPROF_CAPTURE_FRAME_LOG:
+          egg_bitset_add (classify->logs, f);
+          break;
+
+        case SYSPROF_CAPTURE_FRAME_MAP:
+          egg_bitset_add (classify->mmaps, f);
+          break;
+
+        case SYSPROF_CAPTURE_FRAME_OVERLAY:
+          egg_bitset_add (classify->overlays, f);
+          break;
+
+        default:
+          break;
         }
 
-      if (model == NULL &&
-          line_len > model_len &&
-          memcmp (line, model_prefix, model_len) == 0)
-        model = g_strndup (line + model_len, line_len - model_len);
+      if (tainted->type == SYSPROF_CAPTURE_FRAME_FILE_CHUNK)
+        {
+          const SysprofCaptureFileChunk *file_chunk = (const SysprofCaptureFileChunk *)tainted;
+
+          if (has_null_byte (file_chunk->path, (const char *)file_chunk->data) &&
+              !g_hash_table_contains (classify->files_first_position, file_chunk->path))
+            g_hash_table_insert (classify->files_first_position,
+                                 g_strdup (file_chunk->path),
+                                 GUINT_TO_POINTER (f));
+        }
+      else if (tainted->type == SYSPROF_CAPTURE_FRAME_SAMPLE)
+        {
+          const SysprofCaptureSample *sample = (const SysprofCaptureSample *)tainted;
+          guint n_addrs = swap_uint16 (self->needs_swap, sample->n_addrs);
+          const guint8 *endptr = (const guint8 *)tainted + ptr->length;
+
+          /* If the sample contains a context-switch, record it. Samples
+           * referencing a shared stack are checked once all stacks are
+           * known since the stack may be in an earlier chunk.
+           */
+          if (n_addrs == 0 &&
+              _sysprof_document_frame_flag (self->needs_swap,
+                                            SYSPROF_DOCUMENT_SAMPLE_FLAGS (sample),
+                                            SYSPROF_DOCUMENT_FRAME_STACK_BIT))
+            egg_bitset_add (classify->stack_samples, f);
+          else if ((const guint8 *)sample + (n_addrs * sizeof (SysprofAddress)) <= endptr &&
+                   addresses_have_context_switch (self->needs_swap, sample->addrs, n_addrs))
+            egg_bitset_add (classify->samples_with_context_switch, f);
+
+          if (sample->tid != tainted->pid)
+            frame_classify_seen_thread (classify, pid, swap_int32 (self->needs_swap, sample->tid));
+        }
+      else if (tainted->type == SYSPROF_CAPTURE_FRAME_ALLOCATION)
+        {
+          const SysprofCaptureAllocation *alloc = (const SysprofCaptureAllocation *)tainted;
+
+          frame_classify_seen_thread (classify, pid, swap_int32 (self->needs_swap, alloc->tid));
+        }
+      else if (tainted->type == SYSPROF_CAPTURE_FRAME_STACK)
+        {
+          const SysprofCaptureStack *stack = (const SysprofCaptureStack *)tainted;
+          guint32 stack_id;
+          guint n_addrs;
+
+          if (ptr->length < sizeof *stack)
+            continue;
+
+          stack_id = swap_uint32 (self->needs_swap, stack->id);
+          n_addrs = swap_uint16 (self->needs_swap, stack->n_addrs);
+
+          if (stack_id != 0 &&
+              n_addrs > 0 &&
+              ptr->length >= sizeof *stack + (n_addrs * sizeof (SysprofCaptureAddress)) &&
+              !g_hash_table_contains (classify->stacks, GUINT_TO_POINTER (stack_id)))
+            g_hash_table_insert (classify->stacks, GUINT_TO_POINTER (stack_id), (gpointer)stack);
+        }
+      else if (tainted->type == SYSPROF_CAPTURE_FRAME_EXIT)
+        {
+          g_hash_table_insert (classify->exit_times,
+                               GINT_TO_POINTER (pid),
+                               g_memdup2 (&t, sizeof t));
+        }
+      else if (tainted->type == SYSPROF_CAPTURE_FRAME_MARK)
+        {
+          const SysprofCaptureMark *mark = (const SysprofCaptureMark *)tainted;
+          const char *endptr = (const char *)tainted + ptr->length;
+          gint64 duration = swap_int64 (self->needs_swap, mark->duration);
+
+          if (t + duration > classify->guessed_end_nsec)
+            classify->guessed_end_nsec = t + duration;
+
+          if (has_null_byte (mark->group, endptr) &&
+              has_null_byte (mark->name, endptr))
+            egg_bitset_add (frame_classify_lookup_mark (classify->mark_groups, mark->group, mark->name), f);
+        }
     }
+}
 
-  if (cpu_info != NULL)
-    g_list_store_append (self->cpu_info, cpu_info);
+static DexFuture *
+frame_classify_thread (gpointer user_data)
+{
+  frame_classify_run (user_data);
+  return dex_future_new_for_boolean (TRUE);
+}
 
-  if (model != NULL)
+/* Must be called in order of position so that the first file chunk,
+ * the first definition of a stack, and the last exit for a process win.
+ */
+static void
+frame_classify_merge (FrameClassify   *classify,
+                      SysprofDocument *self)
+{
+  GHashTableIter iter;
+  gpointer key;
+  gpointer value;
+
+  egg_bitset_union (self->allocations, classify->allocations);
+  egg_bitset_union (self->ctrdefs, classify->ctrdefs);
+  egg_bitset_union (self->ctrsets, classify->ctrsets);
+  egg_bitset_union (self->dbus_messages, classify->dbus_messages);
+  egg_bitset_union (self->file_chunks, classify->file_chunks);
+  egg_bitset_union (self->jitmaps, classify->jitmaps);
+  egg_bitset_union (self->logs, classify->logs);
+  egg_bitset_union (self->marks, classify->marks);
+  egg_bitset_union (self->metadata, classify->metadata);
+  egg_bitset_union (self->mmaps, classify->mmaps);
+  egg_bitset_union (self->overlays, classify->overlays);
+  egg_bitset_union (self->pids, classify->pids);
+  egg_bitset_union (self->processes, classify->processes);
+  egg_bitset_union (self->samples, classify->samples);
+  egg_bitset_union (self->samples_with_context_switch, classify->samples_with_context_switch);
+  egg_bitset_union (self->traceables, classify->traceables);
+
+  g_hash_table_iter_init (&iter, classify->files_first_position);
+  while (g_hash_table_iter_next (&iter, &key, &value))
     {
-      guint n_items = g_list_model_get_n_items (G_LIST_MODEL (self->cpu_info));
+      if (!g_hash_table_contains (self->files_first_position, key))
+        {
+          g_hash_table_insert (self->files_first_position, key, value);
+          g_hash_table_iter_steal (&iter);
+        }
+    }
 
-      for (guint i = 0; i < n_items; i++)
+  g_hash_table_iter_init (&iter, classify->stacks);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      if (!g_hash_table_contains (self->stacks, key))
+        g_hash_table_insert (self->stacks, key, value);
+    }
+
+  g_hash_table_iter_init (&iter, classify->mark_groups);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      const char *group = key;
+      GHashTable *names = value;
+      GHashTableIter names_iter;
+      gpointer name;
+      gpointer bitset;
+
+      g_hash_table_iter_init (&names_iter, names);
+      while (g_hash_table_iter_next (&names_iter, &name, &bitset))
+        egg_bitset_union (frame_classify_lookup_mark (self->mark_groups, group, name), bitset);
+    }
+
+  g_hash_table_iter_init (&iter, classify->threads);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      SysprofProcessInfo *info = _sysprof_document_process_info (self, GPOINTER_TO_INT (key), TRUE);
+
+      if (info != NULL)
+        egg_bitset_union (info->thread_ids, value);
+    }
+
+  g_hash_table_iter_init (&iter, classify->exit_times);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      SysprofProcessInfo *info = _sysprof_document_process_info (self, GPOINTER_TO_INT (key), TRUE);
+
+      if (info != NULL)
+        info->exit_time = *(const gint64 *)value;
+    }
+}
+
+/*
+ * Classifies every frame into the per-type bitsets, mark groups, and
+ * process information. Large captures are split into chunks which are
+ * classified in parallel and then merged in order.
+ *
+ * Returns: the guessed end time of the capture
+ */
+static gint64
+sysprof_document_classify_frames (SysprofDocument *self)
+{
+  g_autoptr(DexThreadPool) pool = NULL;
+  g_autoptr(GPtrArray) classifies = NULL;
+  g_autoptr(GPtrArray) futures = NULL;
+  gint64 guessed_end_nsec = 0;
+  guint n_frames;
+  guint n_chunks;
+  guint chunk_size;
+
+  g_assert (SYSPROF_IS_DOCUMENT (self));
+
+  n_frames = sysprof_document_frames_get_size (&self->frames);
+  n_chunks = CLAMP (n_frames / CLASSIFY_MIN_FRAMES, 1, g_get_num_processors ());
+  chunk_size = n_frames / n_chunks + 1;
+
+  classifies = g_ptr_array_new_with_free_func ((GDestroyNotify)frame_classify_free);
+
+  for (guint begin = 0; begin < n_frames; begin += chunk_size)
+    g_ptr_array_add (classifies, frame_classify_new (self, begin, MIN (begin + chunk_size, n_frames)));
+
+  if (classifies->len < 2 || !(pool = dex_thread_pool_new (classifies->len)))
+    {
+      for (guint i = 0; i < classifies->len; i++)
+        frame_classify_run (g_ptr_array_index (classifies, i));
+    }
+  else
+    {
+      futures = g_ptr_array_new_with_free_func (dex_unref);
+
+      for (guint i = 0; i < classifies->len; i++)
+        g_ptr_array_add (futures,
+                         dex_thread_pool_submit (pool,
+                                                 "[sysprof-document-classify]",
+                                                 frame_classify_thread,
+                                                 g_ptr_array_index (classifies, i),
+                                                 NULL));
+
+      dex_thread_wait_for (dex_future_allv ((DexFuture **)futures->pdata, futures->len), NULL);
+      dex_thread_wait_for (dex_thread_pool_close (pool, DEX_THREAD_POOL_SHUTDOWN_DRAIN), NULL);
+    }
+
+  for (guint i = 0; i < classifies->len; i++)
+    {
+      FrameClassify *classify = g_ptr_array_index (classifies, i);
+
+      frame_classify_merge (classify, self);
+      guessed_end_nsec = MAX (guessed_end_nsec, classify->guessed_end_nsec);
+    }
+
+  /* Samples sharing a stack share the answer, so only check each
+   * stack once.
+   */
+  if (g_hash_table_size (self->stacks) > 0)
+    {
+      g_autoptr(GHashTable) context_switches = g_hash_table_new (NULL, NULL);
+
+      for (guint i = 0; i < classifies->len; i++)
         {
-          g_autoptr(SysprofCpuInfo) item = g_list_model_get_item (G_LIST_MODEL (self->cpu_info), i);
+          FrameClassify *classify = g_ptr_array_index (classifies, i);
+          EggBitsetIter iter;
+          guint f;
 
-          _sysprof_cpu_info_set_model_name (item, model);
+          if (!egg_bitset_iter_init_first (&iter, classify->stack_samples, &f))
+            continue;
+
+          do
+            {
+              SysprofDocumentFramePointer *ptr = sysprof_document_frames_index (&self->frames, f);
+              const SysprofCaptureStack *stack;
+              gpointer has_context_switch;
+
+              if (!(stack = sysprof_document_lookup_stack (self, (gconstpointer)&self->base[ptr->offset], ptr->length)))
+                continue;
+
+              if (!g_hash_table_lookup_extended (context_switches, stack, NULL, &has_context_switch))
+                {
+                  has_context_switch = GINT_TO_POINTER (addresses_have_context_switch (self->needs_swap,
+                                                                                      stack->addrs,
+                                                                                      swap_uint16 (self->needs_swap, stack->n_addrs)));
+                  g_hash_table_insert (context_switches, (gpointer)stack, has_context_switch);
+                }
+
+              if (GPOINTER_TO_INT (has_context_switch))
+                egg_bitset_add (self->samples_with_context_switch, f);
+            }
+          while (egg_bitset_iter_next (&iter, &f));
         }
     }
+
+  return guessed_end_nsec;
 }
 
+typedef struct _BlockDecompress
+{
+  const SysprofCaptureBlockInfo *info;
+  const guint8                  *src;
+  guint8                        *dst;
+  gboolean                       failed;
+} BlockDecompress;
+
 static void
-sysprof_document_load_worker (GTask        *task,
-                              gpointer      source_object,
-                              gpointer      task_data,
-                              GCancellable *cancellable)
+block_decompress_run (BlockDecompress *decompress)
 {
-  g_autoptr(SysprofDocument) self = NULL;
-  g_autoptr(GHashTable) files = NULL;
-  g_autoptr(GError) error = NULL;
-  Load *load = task_data;
-  gint64 guessed_end_nsec = 0;
-  gsize len;
+  const SysprofCaptureBlockInfo *info = decompress->info;
 
-  g_assert (source_object == NULL);
-  g_assert (load != NULL);
+  decompress->failed = !_sysprof_capture_decompress (&decompress->dst[info->uncompressed_offset],
+                                                     info->uncompressed_len,
+                                                     &decompress->src[info->offset],
+                                                     info->compressed_len);
+}
 
-  self = g_object_new (SYSPROF_TYPE_DOCUMENT, NULL);
-  self->mapped_file = g_mapped_file_ref (load->mapped_file);
-  self->base = (const guint8 *)g_mapped_file_get_contents (load->mapped_file);
-  len = g_mapped_file_get_length (load->mapped_file);
+static DexFuture *
+block_decompress_thread (gpointer user_data)
+{
+  block_decompress_run (user_data);
+  return dex_future_new_for_boolean (TRUE);
+}
 
-  if (len < sizeof self->header)
+/*
+ * Compressed captures are decompressed into an anonymous file which then
+ * replaces the mapped capture. Blocks are independent so they are
+ * decompressed in parallel directly into their final position.
+ */
+static gboolean
+sysprof_document_decompress (SysprofDocument  *self,
+                             gsize            *len,
+                             GError          **error)
+{
+  g_autoptr(DexThreadPool) pool = NULL;
+  g_autoptr(GMappedFile) mapped_file = NULL;
+  g_autofree SysprofCaptureBlockInfo *blocks = NULL;
+  g_autofree BlockDecompress *decompress = NULL;
+  SysprofCaptureFileHeader header;
+  g_autofd int fd = -1;
+  gsize uncompressed_len;
+  gsize n_blocks;
+  guint8 *dst;
+
+  g_assert (SYSPROF_IS_DOCUMENT (self));
+  g_assert (len != NULL);
+
+  if (!(blocks = _sysprof_capture_list_blocks (self->base, *len, &n_blocks, &uncompressed_len)))
     {
-      g_task_return_new_error (task,
+      int errsv = errno;
+      g_set_error (error,
+                   G_IO_ERROR,
+                   g_io_error_from_errno (errsv),
+                   "Failed to locate compressed blocks: %s",
+                   g_strerror (errsv));
+      return FALSE;
+    }
+
+  if (-1 == (fd = sysprof_memfd_create ("[sysprof-document]")) ||
+      ftruncate (fd, uncompressed_len) != 0 ||
+      MAP_FAILED == (dst = mmap (NULL, uncompressed_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)))
+    {
+      int errsv = errno;
+      g_set_error_literal (error,
+                           G_IO_ERROR,
+                           g_io_error_from_errno (errsv),
+                           g_strerror (errsv));
+      return FALSE;
+    }
+
+  _sysprof_capture_uncompressed_header ((const SysprofCaptureFileHeader *)(gconstpointer)self->base, &header);
+  memcpy (dst, &header, sizeof header);
+
+  decompress = g_new0 (BlockDecompress, n_blocks);
+
+  for (gsize i = 0; i < n_blocks; i++)
+    {
+      decompress[i].info = &blocks[i];
+      decompress[i].src = self->base;
+      decompress[i].dst = dst;
+    }
+
+  if (n_blocks < 2 || !(pool = dex_thread_pool_new (MIN (n_blocks, g_get_num_processors ()))))
+    {
+      for (gsize i = 0; i < n_blocks; i++)
+        block_decompress_run (&decompress[i]);
+    }
+  else
+    {
+      g_autoptr(GPtrArray) futures = g_ptr_array_new_with_free_func (dex_unref);
+
+      for (gsize i = 0; i < n_blocks; i++)
+        g_ptr_array_add (futures,
+                         dex_thread_pool_submit (pool,
+                                                 "[sysprof-document-decompress]",
+                                                 block_decompress_thread,
+                                                 &decompress[i],
+                                                 NULL));
+
+      dex_thread_wait_for (dex_future_allv ((DexFuture **)futures->pdata, futures->len), NULL);
+      dex_thread_wait_for (dex_thread_pool_close (pool, DEX_THREAD_POOL_SHUTDOWN_DRAIN), NULL);
+    }
+
+  munmap (dst, uncompressed_len);
+
+  for (gsize i = 0; i < n_blocks; i++)
+    {
+      if (decompress[i].failed)
+        {
+          g_set_error_literal (error,
                                G_IO_ERROR,
                                G_IO_ERROR_INVALID_DATA,
-                               "File header too short");
-      return;
+                               "Failed to decompress capture");
+          return FALSE;
+        }
     }
 
-  /* Keep a copy of our header */
-  memcpy (&self->header, self->base, sizeof self->header);
-#if G_BYTE_ORDER == G_LITTLE_ENDIAN
-  self->needs_swap = !self->header.little_endian;
-#else
-  self->needs_swap = !!self->header.little_endian;
-#endif
+  if (!(mapped_file = g_mapped_file_new_from_fd (fd, FALSE, error)))
+    return FALSE;
 
-  self->header.time = swap_uint64 (self->needs_swap, self->header.time);
-  self->header.end_time = swap_uint64 (self->needs_swap, self->header.end_time);
-  self->header.capture_time[sizeof self->header.capture_time-1] = 0;
+  g_clear_pointer (&self->mapped_file, g_mapped_file_unref);
+  self->mapped_file = g_steal_pointer (&mapped_file);
+  self->base = (const guint8 *)g_mapped_file_get_contents (self->mapped_file);
+  *len = g_mapped_file_get_length (self->mapped_file);
 
-  self->time_span.begin_nsec = self->header.time;
-  self->time_span.end_nsec = self->header.end_time;
+  return TRUE;
+}
 
-  load_progress (load, .1, _("Indexing capture data frames"));
+static void
+sysprof_document_update_process_exit_times (SysprofDocument *self)
+{
+  GHashTableIter iter;
+  SysprofProcessInfo *info;
 
-  if (!sysprof_document_scan_frames (self, len, cancellable, &error))
+  g_assert (SYSPROF_IS_DOCUMENT (self));
+
+  g_hash_table_iter_init (&iter, self->pid_to_process_info);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&info))
     {
-      g_task_return_error (task, g_steal_pointer (&error));
-      return;
+      if (info->exit_time == 0)
+        info->exit_time = self->time_span.end_nsec;
     }
+}
 
-  load_progress (load, .4, _("Indexing capture data frames"));
+static void
+sysprof_document_load_cpu (SysprofDocument *self)
+{
+  static const char processor_prefix[] = "processor\t: ";
+  static const char core_id_prefix[] = "core id\t\t: ";
+  static const char model_name_prefix[] = "model name\t: ";
+  static const char model_prefix[] = "Model\t\t: ";
+  const gsize processor_len = sizeof processor_prefix - 1;
+  const gsize core_id_len = sizeof core_id_prefix - 1;
+  const gsize model_name_len = sizeof model_name_prefix - 1;
+  const gsize model_len = sizeof model_prefix - 1;
+  g_autoptr(SysprofDocumentFile) file = NULL;
+  g_autoptr(GBytes) bytes = NULL;
+  g_autoptr(SysprofCpuInfo) cpu_info = NULL;
+  g_autofree char *model = NULL;
+  const char *str;
+  const char *line;
+  LineReader reader;
+  gsize line_len;
+  gsize len;
 
-  for (guint f = 0; f < sysprof_document_frames_get_size (&self->frames); f++)
-    {
-      SysprofDocumentFramePointer *ptr = sysprof_document_frames_index (&self->frames, f);
-      const SysprofCaptureFrame *tainted = (const SysprofCaptureFrame *)(gpointer)&self->base[ptr->offset];
-      gint64 t = swap_int64 (self->needs_swap, tainted->time);
-      int pid = swap_int32 (self->needs_swap, tainted->pid);
+  g_assert (SYSPROF_IS_DOCUMENT (self));
 
-      if (t > guessed_end_nsec && is_data_type (tainted->type))
-        guessed_end_nsec = t;
+  if (!(file = sysprof_document_lookup_file (self, "/proc/cpuinfo")) ||
+      !(bytes = sysprof_document_file_dup_bytes (file)))
+    return;
 
-      egg_bitset_add (self->pids, pid);
+  str = (const char *)g_bytes_get_data (bytes, &len);
 
-      switch ((int)tainted->type)
+  line_reader_init (&reader, (char *)str, len);
+  while ((line = line_reader_next (&reader, &line_len)))
+    {
+      if (line_len > processor_len &&
+          memcmp (line, processor_prefix, processor_len) == 0)
         {
-        case SYSPROF_CAPTURE_FRAME_ALLOCATION:
-          egg_bitset_add (self->allocations, f);
-          egg_bitset_add (self->traceables, f);
-          break;
-
-        case SYSPROF_CAPTURE_FRAME_SAMPLE:
-          egg_bitset_add (self->samples, f);
-          egg_bitset_add (self->traceables, f);
-          break;
+          gint64 id = g_ascii_strtoll (line + processor_len, NULL, 10);
 
-        case SYSPROF_CAPTURE_FRAME_PROCESS:
-          egg_bitset_add (self->processes, f);
-          break;
+          if (cpu_info != NULL)
+            g_list_store_append (self->cpu_info, cpu_info);
 
-        case SYSPROF_CAPTURE_FRAME_FILE_CHUNK:
-          egg_bitset_add (self->file_chunks, f);
-          break;
+          g_clear_object (&cpu_info);
 
-        case SYSPROF_CAPTURE_FRAME_CTRDEF:
-          egg_bitset_add (self->ctrdefs, f);
-          break;
+          cpu_info = g_object_new (SYSPROF_TYPE_CPU_INFO,
+                                   "id", id,
+                                   NULL);
+        }
 
-        case SYSPROF_CAPTURE_FRAME_CTRSET:
-          egg_bitset_add (self->ctrsets, f);
-          break;
+      if (line_len > core_id_len &&
+          memcmp (line, core_id_prefix, core_id_len) == 0)
+        {
+          gint64 core_id = g_ascii_strtoll (line + core_id_len, NULL, 10);
 
-        case SYSPROF_CAPTURE_FRAME_DBUS_MESSAGE:
-          egg_bitset_add (self->dbus_messages, f);
-          break;
+          if (cpu_info != NULL && core_id > 0)
+            _sysprof_cpu_info_set_core_id (cpu_info, core_id);
+        }
 
-        case SYSPROF_CAPTURE_FRAME_MARK:
-          egg_bitset_add (self->marks, f);
-          break;
+      if (line_len > model_name_len &&
+          memcmp (line, model_name_prefix, model_name_len) == 0)
+        {
+          g_autofree char *model_name = g_strndup (line + model_name_len,
+                                                   line_len - model_name_len);
 
-        case SYSPROF_CAPTURE_FRAME_METADATA:
-          egg_bitset_add (self->metadata, f);
-          break;
+          if (cpu_info != NULL)
+            _sysprof_cpu_info_set_model_name (cpu_info, model_name);
+        }
 
-        case SYSPROF_CAPTURE_FRAME_JITMAP:
-          egg_bitset_add (self->jitmaps, f);
-          break;
+      if (model == NULL &&
+          line_len > model_len &&
+          memcmp (line, model_prefix, model_len) == 0)
+        model = g_strndup (line + model_len, line_len - model_len);
+    }
 
-        case SYSPROF_CAPTURE_FRAME_LOG:
-          egg_bitset_add (self->logs, f);
-          break;
+  if (cpu_info != NULL)
+    g_list_store_append (self->cpu_info, cpu_info);
 
-        case SYSPROF_CAPTURE_FRAME_MAP:
-          egg_bitset_add (self->mmaps, f);
-          break;
+  if (model != NULL)
+    {
+      guint n_items = g_list_model_get_n_items (G_LIST_MODEL (self->cpu_info));
 
-        case SYSPROF_CAPTURE_FRAME_OVERLAY:
-          egg_bitset_add (self->overlays, f);
-          break;
+      for (guint i = 0; i < n_items; i++)
+        {
+          g_autoptr(SysprofCpuInfo) item = g_list_model_get_item (G_LIST_MODEL (self->cpu_info), i);
 
-        default:
-          break;
+          _sysprof_cpu_info_set_model_name (item, model);
         }
+    }
+}
+
+static void
+sysprof_document_load_worker (GTask        *task,
+                              gpointer      source_object,
+                              gpointer      task_data,
+                              GCancellable *cancellable)
+{
+  g_autoptr(SysprofDocument) self = NULL;
+  g_autoptr(GHashTable) files = NULL;
+  g_autoptr(GError) error = NULL;
+  Load *load = task_data;
+  gint64 guessed_end_nsec = 0;
+  gsize len;
 
-      if (tainted->type == SYSPROF_CAPTURE_FRAME_FILE_CHUNK)
-        {
-          const SysprofCaptureFileChunk *file_chunk = (const SysprofCaptureFileChunk *)tainted;
+  g_assert (source_object == NULL);
+  g_assert (load != NULL);
 
-          if (has_null_byte (file_chunk->path, (const char *)file_chunk->data) &&
-              !g_hash_table_contains (self->files_first_position, file_chunk->path))
-            g_hash_table_insert (self->files_first_position,
-                                 g_strdup (file_chunk->path),
-                                 GUINT_TO_POINTER (f));
-        }
-      else if (tainted->type == SYSPROF_CAPTURE_FRAME_SAMPLE)
-        {
-          const SysprofCaptureSample *sample = (const SysprofCaptureSample *)tainted;
-          guint n_addrs = swap_uint16 (self->needs_swap, sample->n_addrs);
-          const guint8 *endptr = (const guint8 *)tainted + ptr->length;
+  self = g_object_new (SYSPROF_TYPE_DOCUMENT, NULL);
+  self->mapped_file = g_mapped_file_ref (load->mapped_file);
+  self->base = (const guint8 *)g_mapped_file_get_contents (load->mapped_file);
+  len = g_mapped_file_get_length (load->mapped_file);
 
-          /* If the sample contains a context-switch, record it */
-          if ((const guint8 *)sample + (n_addrs * sizeof (SysprofAddress)) <= endptr)
-            {
-              SysprofAddressContext last_context = SYSPROF_ADDRESS_CONTEXT_USER;
+  if (len < sizeof self->header)
+    {
+      g_task_return_new_error (task,
+                               G_IO_ERROR,
+                               G_IO_ERROR_INVALID_DATA,
+                               "File header too short");
+      return;
+    }
 
-              for (guint i = 0; i < n_addrs; i++)
-                {
-                  SysprofAddress addr = swap_uint64 (self->needs_swap, sample->addrs[i]);
-
-                  if (sysprof_address_is_context_switch (addr, &last_context) &&
-                      last_context == SYSPROF_ADDRESS_CONTEXT_KERNEL)
-                    {
-                      egg_bitset_add (self->samples_with_context_switch, f);
-                      break;
-                    }
-                }
-            }
+  if (((const SysprofCaptureFileHeader *)(gconstpointer)self->base)->compressed)
+    {
+      load_progress (load, .05, _("Decompressing capture"));
 
-          if (sample->tid != tainted->pid)
-            {
-              SysprofProcessInfo *info = _sysprof_document_process_info (self, pid, TRUE);
-              sysprof_process_info_seen_thread (info, swap_int32 (self->needs_swap, sample->tid));
-            }
-        }
-      else if (tainted->type == SYSPROF_CAPTURE_FRAME_ALLOCATION)
-        {
-          const SysprofCaptureAllocation *alloc = (const SysprofCaptureAllocation *)tainted;
-          SysprofProcessInfo *info = _sysprof_document_process_info (self, pid, TRUE);
-          sysprof_process_info_seen_thread (info, swap_int32 (self->needs_swap, alloc->tid));
-        }
-      else if (tainted->type == SYSPROF_CAPTURE_FRAME_EXIT)
+      if (!sysprof_document_decompress (self, &len, &error))
         {
-          SysprofProcessInfo *info = _sysprof_document_process_info (self, pid, TRUE);
-
-          info->exit_time = t;
+          g_task_return_error (task, g_steal_pointer (&error));
+          return;
         }
-      else if (tainted->type == SYSPROF_CAPTURE_FRAME_MARK)
-        {
-          const SysprofCaptureMark *mark = (const SysprofCaptureMark *)tainted;
-          const char *endptr = (const char *)tainted + ptr->length;
-          gint64 duration = swap_int64 (self->needs_swap, mark->duration);
+    }
 
-          if (t + duration > guessed_end_nsec)
-            guessed_end_nsec = t + duration;
+  /* Keep a copy of our header */
+  memcpy (&self->header, self->base, sizeof self->header);
+#if G_BYTE_ORDER == G_LITTLE_ENDIAN
+  self->needs_swap = !self->header.little_endian;
+#else
+  self->needs_swap = !!self->header.little_endian;
+#endif
 
-          if (has_null_byte (mark->group, endptr) &&
-              has_null_byte (mark->name, endptr))
-            {
-              const char *group = mark->group;
-              const char *name = mark->name;
-              GHashTable *names;
-              EggBitset *bitset;
+  self->header.time = swap_uint64 (self->needs_swap, self->header.time);
+  self->header.end_time = swap_uint64 (self->needs_swap, self->header.end_time);
+  self->header.capture_time[sizeof self->header.capture_time-1] = 0;
 
-              if (!(names = g_hash_table_lookup (self->mark_groups, group)))
-                {
-                  names = g_hash_table_new_full (g_str_hash,
-                                                 g_str_equal,
-                                                 g_free,
-                                                 (GDestroyNotify)egg_bitset_unref);
-                  g_hash_table_insert (self->mark_groups, g_strdup (group), names);
-                }
+  self->time_span.begin_nsec = self->header.time;
+  self->time_span.end_nsec = self->header.end_time;
 
-              if (!(bitset = g_hash_table_lookup (names, name)))
-                {
-                  bitset = egg_bitset_new_empty ();
-                  g_hash_table_insert (names, g_strdup (name), bitset);
-                }
+  load_progress (load, .1, _("Indexing capture data frames"));
 
-              egg_bitset_add (bitset, f);
-            }
-        }
+  if (!sysprof_document_scan_frames (self, len, cancellable, &error))
+    {
+      g_task_return_error (task, g_steal_pointer (&error));
+      return;
     }
 
+  load_progress (load, .4, _("Indexing capture data frames"));
+
+  guessed_end_nsec = sysprof_document_classify_frames (self);
+
   if (guessed_end_nsec > self->time_span.begin_nsec)
     self->time_span.end_nsec = guessed_end_nsec;
 
@@ -2352,24 +3058,45 @@ sysprof_document_symbolize_traceable (SysprofDocument           *self,
                                       guint                      n_symbols,
                                       SysprofAddressContext     *final_context)
 {
-  SysprofAddressContext last_context = SYSPROF_ADDRESS_CONTEXT_NONE;
-  const SysprofProcessInfo *process_info;
   SysprofAddress *addresses;
   guint n_addresses;
-  guint n_symbolized = 0;
   int pid;
 
   g_return_val_if_fail (SYSPROF_IS_DOCUMENT (self), 0);
   g_return_val_if_fail (SYSPROF_IS_DOCUMENT_TRACEABLE (traceable), 0);
 
   if (n_symbols == 0 || symbols == NULL)
-    goto finish;
+    {
+      if (final_context)
+        *final_context = SYSPROF_ADDRESS_CONTEXT_NONE;
+      return 0;
+    }
 
   pid = sysprof_document_frame_get_pid (SYSPROF_DOCUMENT_FRAME (traceable));
-  process_info = g_hash_table_lookup (self->pid_to_process_info, GINT_TO_POINTER (pid));
   addresses = g_alloca (sizeof (SysprofAddress) * n_symbols);
   n_addresses = sysprof_document_traceable_get_stack_addresses (traceable, addresses, n_symbols);
 
+  return _sysprof_document_symbolize_addresses (self, pid, addresses, n_addresses, symbols, final_context);
+}
+
+guint
+_sysprof_document_symbolize_addresses (SysprofDocument       *self,
+                                       int                    pid,
+                                       const SysprofAddress  *addresses,
+                                       guint                  n_addresses,
+                                       SysprofSymbol        **symbols,
+                                       SysprofAddressContext *final_context)
+{
+  SysprofAddressContext last_context = SYSPROF_ADDRESS_CONTEXT_NONE;
+  const SysprofProcessInfo *process_info;
+  guint n_symbolized = 0;
+
+  g_assert (SYSPROF_IS_DOCUMENT (self));
+  g_assert (addresses != NULL || n_addresses == 0);
+  g_assert (symbols != NULL || n_addresses == 0);
+
+  process_info = g_hash_table_lookup (self->pid_to_process_info, GINT_TO_POINTER (pid));
+
   for (guint i = 0; i < n_addresses; i++)
     {
       SysprofAddressContext context;
@@ -2385,13 +3112,364 @@ sysprof_document_symbolize_traceable (SysprofDocument           *self,
         last_context = context;
     }
 
-finish:
   if (final_context)
     *final_context = last_context;
 
   return n_symbolized;
 }
 
+static void
+sysprof_document_traceable_cursor_resolve (SysprofDocumentTraceableCursor *cursor)
+{
+  GListModel *model = cursor->model;
+
+  /* Walk through any bitset indexes wrapping the document so that we can
+   * translate positions straight into the frames array. If we end up at
+   * something other than our document, we fall back to the model.
+   */
+  while (SYSPROF_IS_DOCUMENT_BITSET_INDEX (model) &&
+         cursor->n_chain < SYSPROF_DOCUMENT_TRACEABLE_CURSOR_MAX_DEPTH)
+    {
+      SysprofDocumentBitsetIndex *index = SYSPROF_DOCUMENT_BITSET_INDEX (model);
+
+      if (_sysprof_document_bitset_index_get_bitset (index) == NULL)
+        break;
+
+      cursor->chain[cursor->n_chain++] = _sysprof_document_bitset_index_get_bitset (index);
+      model = _sysprof_document_bitset_index_get_model (index);
+    }
+
+  cursor->direct = model == G_LIST_MODEL (cursor->document);
+
+  if (!cursor->direct)
+    cursor->n_chain = 0;
+}
+
+/**
+ * _sysprof_document_traceable_cursor_init:
+ * @cursor: a #SysprofDocumentTraceableCursor, typically on the stack
+ * @document: the #SysprofDocument containing the traceables
+ * @model: a #GListModel of #SysprofDocumentTraceable from @document
+ * @selection: (nullable): an optional bitset of positions within @model
+ *
+ * Initializes @cursor to iterate the traceables of @model without
+ * creating a #SysprofDocumentFrame for each item.
+ *
+ * If @selection is set, only those positions within @model are visited.
+ *
+ * When @model is @document, or a bitset index over it, frames are read
+ * directly from the mapped capture. Otherwise the cursor falls back to
+ * g_list_model_get_item().
+ *
+ * Call _sysprof_document_traceable_cursor_clear() when done.
+ */
+void
+_sysprof_document_traceable_cursor_init (SysprofDocumentTraceableCursor *cursor,
+                                         SysprofDocument                *document,
+                                         GListModel                     *model,
+                                         EggBitset                      *selection)
+{
+  g_assert (cursor != NULL);
+  g_assert (SYSPROF_IS_DOCUMENT (document));
+  g_assert (G_IS_LIST_MODEL (model));
+
+  memset (cursor, 0, sizeof *cursor);
+
+  cursor->document = document;
+  cursor->model = model;
+  cursor->selection = selection;
+  cursor->end = g_list_model_get_n_items (model);
+
+  sysprof_document_traceable_cursor_resolve (cursor);
+}
+
+/**
+ * _sysprof_document_traceable_cursor_init_range:
+ * @cursor: a #SysprofDocumentTraceableCursor, typically on the stack
+ * @document: the #SysprofDocument containing the traceables
+ * @model: a #GListModel of #SysprofDocumentTraceable from @document
+ * @begin: the first position within @model
+ * @end: the position within @model to stop at
+ *
+ * Like _sysprof_document_traceable_cursor_init() but only visits the
+ * positions within [@begin, @end) so that @model may be split into
+ * shards and iterated from multiple threads.
+ */
+void
+_sysprof_document_traceable_cursor_init_range (SysprofDocumentTraceableCursor *cursor,
+                                               SysprofDocument                *document,
+                                               GListModel                     *model,
+                                               guint                           begin,
+                                               guint                           end)
+{
+  _sysprof_document_traceable_cursor_init (cursor, document, model, NULL);
+
+  cursor->position = MIN (begin, cursor->end);
+  cursor->end = MIN (end, cursor->end);
+}
+
+static inline guint
+sysprof_document_traceable_cursor_translate (const SysprofDocumentTraceableCursor *cursor,
+                                             guint                                 level,
+                                             guint                                 position)
+{
+  for (guint i = level; i < cursor->n_chain; i++)
+    position = egg_bitset_get_nth (cursor->chain[i], position);
+
+  return position;
+}
+
+static gboolean
+sysprof_document_traceable_cursor_advance (SysprofDocumentTraceableCursor *cursor,
+                                           guint                          *position,
+                                           guint                          *frame_index)
+{
+  gboolean started = cursor->started;
+  guint value;
+
+  cursor->started = TRUE;
+
+  if (cursor->selection != NULL)
+    {
+      if (!(started ?
+            egg_bitset_iter_next (&cursor->iter, &value) :
+            egg_bitset_iter_init_first (&cursor->iter, cursor->selection, &value)))
+        return FALSE;
+
+      if (value >= cursor->end)
+        return FALSE;
+
+      *position = value;
+      *frame_index = sysprof_document_traceable_cursor_translate (cursor, 0, value);
+
+      return TRUE;
+    }
+
+  if (cursor->position >= cursor->end)
+    return FALSE;
+
+  *position = cursor->position++;
+
+  /* The outermost bitset is walked with an iterator rather than asking
+   * for the nth item each time, which would be a search per frame.
+   */
+  if (cursor->n_chain > 0)
+    {
+      if (!(started ?
+            egg_bitset_iter_next (&cursor->iter, &value) :
+            egg_bitset_iter_init_at (&cursor->iter,
+                                     cursor->chain[0],
+                                     egg_bitset_get_nth (cursor->chain[0], *position),
+                                     &value)))
+        return FALSE;
+
+      *frame_index = sysprof_document_traceable_cursor_translate (cursor, 1, value);
+    }
+  else
+    {
+      *frame_index = *position;
+    }
+
+  return TRUE;
+}
+
+static gboolean
+sysprof_document_traceable_cursor_fill (SysprofDocumentTraceableCursor *cursor,
+                                        const SysprofCaptureFrame      *frame,
+                                        guint16                         frame_len,
+                                        gboolean                        needs_swap,
+                                        SysprofDocumentTraceableView   *view)
+{
+  const SysprofCaptureStack *stack;
+  const SysprofCaptureAddress *addrs;
+  guint max_addrs;
+  guint n_addrs;
+
+  if (frame->type == SYSPROF_CAPTURE_FRAME_SAMPLE)
+    {
+      const SysprofCaptureSample *sample = (const SysprofCaptureSample *)frame;
+
+      if (frame_len < sizeof *sample)
+        return FALSE;
+
+      view->tid = swap_int32 (needs_swap, sample->tid);
+      view->address = 0;
+      view->size = 0;
+
+      n_addrs = swap_uint16 (needs_swap, sample->n_addrs);
+      max_addrs = (frame_len - sizeof *sample) / sizeof (SysprofCaptureAddress);
+      addrs = sample->addrs;
+    }
+  else if (frame->type == SYSPROF_CAPTURE_FRAME_ALLOCATION)
+    {
+      const SysprofCaptureAllocation *alloc = (const SysprofCaptureAllocation *)frame;
+
+      if (frame_len < sizeof *alloc)
+        return FALSE;
+
+      view->tid = swap_int32 (needs_swap, alloc->tid);
+      view->address = swap_uint64 (needs_swap, alloc->alloc_addr);
+      view->size = swap_int64 (needs_swap, alloc->alloc_size);
+
+      n_addrs = swap_uint16 (needs_swap, alloc->n_addrs);
+      max_addrs = (frame_len - sizeof *alloc) / sizeof (SysprofCaptureAddress);
+      addrs = alloc->addrs;
+    }
+  else
+    {
+      return FALSE;
+    }
+
+  /* Stacks were validated against their length when indexed */
+  if ((stack = sysprof_document_lookup_stack (cursor->document, frame, frame_len)))
+    {
+      n_addrs = swap_uint16 (needs_swap, stack->n_addrs);
+      max_addrs = n_addrs;
+      addrs = stack->addrs;
+    }
+
+  view->frame = frame;
+  view->frame_len = frame_len;
+  view->type = frame->type;
+  view->cpu = (gint16)swap_uint16 (needs_swap, frame->cpu);
+  view->pid = swap_int32 (needs_swap, frame->pid);
+  view->time = swap_int64 (needs_swap, frame->time);
+  view->n_addresses = MIN (n_addrs, max_addrs);
+
+  if G_LIKELY (!needs_swap)
+    {
+      view->addresses = addrs;
+      return TRUE;
+    }
+
+  /* Foreign byte-order captures are uncommon, so swap into a scratch
+   * buffer which is reused for the lifetime of the cursor.
+   */
+  if (view->n_addresses > cursor->scratch_len)
+    {
+      cursor->scratch_len = MAX (view->n_addresses, 128);
+      cursor->scratch = g_renew (SysprofAddress, cursor->scratch, cursor->scratch_len);
+    }
+
+  for (guint i = 0; i < view->n_addresses; i++)
+    cursor->scratch[i] = swap_uint64 (TRUE, addrs[i]);
+
+  view->addresses = cursor->scratch;
+
+  return TRUE;
+}
+
+/**
+ * _sysprof_document_traceable_cursor_next:
+ * @cursor: a #SysprofDocumentTraceableCursor
+ * @view: (out caller-allocates): location for the next traceable
+ *
+ * Advances @cursor to the next traceable, skipping anything that is not
+ * a sample or an allocation.
+ *
+ * Returns: %TRUE if @view was set; otherwise %FALSE and iteration is done.
+ */
+gboolean
+_sysprof_document_traceable_cursor_next (SysprofDocumentTraceableCursor *cursor,
+                                         SysprofDocumentTraceableView   *view)
+{
+  guint position;
+  guint frame_index;
+
+  g_assert (cursor != NULL);
+  g_assert (view != NULL);
+
+  while (sysprof_document_traceable_cursor_advance (cursor, &position, &frame_index))
+    {
+      SysprofDocument *self = cursor->document;
+
+      view->position = position;
+
+      if G_LIKELY (cursor->direct)
+        {
+          const SysprofDocumentFramePointer *ptr;
+
+          if (frame_index >= sysprof_document_frames_get_size (&self->frames))
+            return FALSE;
+
+          ptr = sysprof_document_frames_index (&self->frames, frame_index);
+
+          if (sysprof_document_traceable_cursor_fill (cursor,
+                                                      (const SysprofCaptureFrame *)&self->base[ptr->offset],
+                                                      ptr->length,
+                                                      self->needs_swap,
+                                                      view))
+            return TRUE;
+        }
+      else
+        {
+          g_clear_object (&cursor->item);
+
+          /* Currently, we might be racing against changes in the model so
+           * just stop if the item went away.
+           */
+          if (!(cursor->item = g_list_model_get_item (cursor->model, position)))
+            return FALSE;
+
+          if (sysprof_document_traceable_cursor_fill (cursor,
+                                                      cursor->item->frame,
+                                                      cursor->item->frame_len,
+                                                      cursor->item->needs_swap,
+                                                      view))
+            return TRUE;
+        }
+    }
+
+  return FALSE;
+}
+
+/**
+ * _sysprof_document_traceable_cursor_dup_frame:
+ * @cursor: a #SysprofDocumentTraceableCursor
+ * @view: the current view from @cursor
+ *
+ * Creates a #SysprofDocumentFrame for @view. This is meant for the few
+ * places, such as callgraph augmentation, which must hand an object to
+ * API consumers.
+ *
+ * Returns: (transfer full): a #SysprofDocumentFrame
+ */
+SysprofDocumentFrame *
+_sysprof_document_traceable_cursor_dup_frame (SysprofDocumentTraceableCursor     *cursor,
+                                              const SysprofDocumentTraceableView *view)
+{
+  SysprofDocumentFrame *ret;
+  SysprofDocument *self;
+
+  g_assert (cursor != NULL);
+  g_assert (view != NULL);
+
+  if (cursor->item != NULL && cursor->item->frame == view->frame)
+    return g_object_ref (cursor->item);
+
+  self = cursor->document;
+
+  ret = _sysprof_document_frame_new (self->mapped_file,
+                                     view->frame,
+                                     view->frame_len,
+                                     self->needs_swap,
+                                     self->header.time,
+                                     self->header.end_time);
+  ret->stack = sysprof_document_lookup_stack (self, view->frame, view->frame_len);
+
+  return ret;
+}
+
+void
+_sysprof_document_traceable_cursor_clear (SysprofDocumentTraceableCursor *cursor)
+{
+  g_assert (cursor != NULL);
+
+  g_clear_object (&cursor->item);
+  g_clear_pointer (&cursor->scratch, g_free);
+  cursor->scratch_len = 0;
+}
+
 /**
  * sysprof_document_list_logs:
  * @self: a #SysprofDocument
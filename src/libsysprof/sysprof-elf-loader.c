@@ -33,6 +33,7 @@
 struct _SysprofElfLoader
 {
   GObject parent_instance;
+  GMutex mutex;
   GHashTable *cache;
   char **debug_dirs;
   char **external_debug_dirs;
@@ -73,6 +74,8 @@ sysprof_elf_loader_finalize (GObject *object)
   g_clear_pointer (&self->external_debug_dirs, g_strfreev);
   g_clear_pointer (&self->cache, g_hash_table_unref);
 
+  g_mutex_clear (&self->mutex);
+
   G_OBJECT_CLASS (sysprof_elf_loader_parent_class)->finalize (object);
 }
 
@@ -150,6 +153,8 @@ sysprof_elf_loader_class_init (SysprofElfLoaderClass *klass)
 static void
 sysprof_elf_loader_init (SysprofElfLoader *self)
 {
+  g_mutex_init (&self->mutex);
+
   self->debug_dirs = g_strdupv ((char **)DEFAULT_DEBUG_DIRS);
   self->cache = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, _g_object_xunref);
 }
@@ -257,6 +262,12 @@ access_path_from_container (const char *path)
   return NULL;
 }
 
+static SysprofElf *sysprof_elf_loader_load_locked (SysprofElfLoader      *self,
+                                                   SysprofMountNamespace *mount_namespace,
+                                                   const char            *file,
+                                                   const char            *build_id,
+                                                   guint64                file_inode);
+
 static SysprofElf *
 get_deepest_debuglink (SysprofElf *elf)
 {
@@ -279,7 +290,7 @@ try_load_build_id (SysprofElfLoader      *self,
     {
       char prefix[3] = {build_id[0], build_id[1], 0};
       g_autofree char *build_id_path = g_build_filename (debug_dir, ".build-id", prefix, build_id, NULL);
-      g_autoptr(SysprofElf) debug_link_elf = sysprof_elf_loader_load (self, mount_namespace, build_id_path, build_id, 0, NULL);
+      g_autoptr(SysprofElf) debug_link_elf = sysprof_elf_loader_load_locked (self, mount_namespace, build_id_path, build_id, 0);
 
       if (debug_link_elf != NULL)
         {
@@ -348,7 +359,7 @@ sysprof_elf_loader_annotate (SysprofElfLoader      *self,
             return;
 
           debug_path = g_build_filename (debug_dir, directory_name, debug_link, NULL);
-          if ((debug_link_elf = sysprof_elf_loader_load (self, mount_namespace, debug_path, build_id, 0, NULL)))
+          if ((debug_link_elf = sysprof_elf_loader_load_locked (self, mount_namespace, debug_path, build_id, 0)))
             {
               sysprof_elf_set_debug_link_elf (elf, get_deepest_debuglink (debug_link_elf));
               return;
@@ -356,13 +367,13 @@ sysprof_elf_loader_annotate (SysprofElfLoader      *self,
 
           short_directory_name = skip_common_prefix (directory_name, debug_dir);
           short_debug_path = g_build_filename (debug_dir, short_directory_name, debug_link, NULL);
-          if ((debug_link_elf = sysprof_elf_loader_load (self, mount_namespace, short_debug_path, build_id, 0, NULL)))
+          if ((debug_link_elf = sysprof_elf_loader_load_locked (self, mount_namespace, short_debug_path, build_id, 0)))
             {
               sysprof_elf_set_debug_link_elf (elf, get_deepest_debuglink (debug_link_elf));
               return;
             }
           shorter_debug_path = g_build_filename (directory_name, ".debug", debug_link, NULL);
-          if ((debug_link_elf = sysprof_elf_loader_load (self, mount_namespace, shorter_debug_path, build_id, 0, NULL)))
+          if ((debug_link_elf = sysprof_elf_loader_load_locked (self, mount_namespace, shorter_debug_path, build_id, 0)))
             {
               sysprof_elf_set_debug_link_elf (elf, get_deepest_debuglink (debug_link_elf));
               return;
@@ -387,7 +398,7 @@ sysprof_elf_loader_annotate (SysprofElfLoader      *self,
           if (try_load_build_id (self, NULL, elf, build_id, debug_dir))
             return;
 
-          if ((debug_link_elf = sysprof_elf_loader_load (self, NULL, debug_path, build_id, 0, NULL)))
+          if ((debug_link_elf = sysprof_elf_loader_load_locked (self, NULL, debug_path, build_id, 0)))
             {
               sysprof_elf_set_debug_link_elf (elf, get_deepest_debuglink (debug_link_elf));
               return;
@@ -423,38 +434,18 @@ get_file_and_inode (const char   *path,
   return *mapped_file != NULL;
 }
 
-/**
- * sysprof_elf_loader_load:
- * @self: a #SysprofElfLoader
- * @mount_namespace: a #SysprofMountNamespace for path resolving
- * @file: the path of the file to load within the mount namespace
- * @build_id: (nullable): an optional build-id that can be used to resolve
- *   the file alternatively to the file path
- * @file_inode: expected inode for @file
- * @error: a location for a #GError, or %NULL
- *
- * Attempts to load a #SysprofElf for @file (or optionally by @build_id).
- *
- * This attempts to follow `.gnu_debuglink` ELF section headers and attach
- * them to the resulting #SysprofElf so that additional symbol information
- * is available.
- *
- * Returns: (transfer full): a #SysprofElf, or %NULL if the file could
- *   not be resolved.
- */
-SysprofElf *
-sysprof_elf_loader_load (SysprofElfLoader       *self,
-                         SysprofMountNamespace  *mount_namespace,
-                         const char             *file,
-                         const char             *build_id,
-                         guint64                 file_inode,
-                         GError                **error)
+static SysprofElf *
+sysprof_elf_loader_load_locked (SysprofElfLoader      *self,
+                                SysprofMountNamespace *mount_namespace,
+                                const char            *file,
+                                const char            *build_id,
+                                guint64                file_inode)
 {
   const char * const fallback_paths[2] = { file, NULL };
   g_auto(GStrv) paths = NULL;
 
-  g_return_val_if_fail (SYSPROF_IS_ELF_LOADER (self), NULL);
-  g_return_val_if_fail (!mount_namespace || SYSPROF_IS_MOUNT_NAMESPACE (mount_namespace), NULL);
+  g_assert (SYSPROF_IS_ELF_LOADER (self));
+  g_assert (!mount_namespace || SYSPROF_IS_MOUNT_NAMESPACE (mount_namespace));
 
   /* We must translate the file into a number of paths that may possibly
    * locate the file in the case that there are overlays in the mount
@@ -470,7 +461,7 @@ sysprof_elf_loader_load (SysprofElfLoader       *self,
     paths = sysprof_mount_namespace_translate (mount_namespace, file);
 
   if (paths == NULL)
-    goto failure;
+    return NULL;
 
   for (guint i = 0; paths[i]; i++)
     {
@@ -537,12 +528,53 @@ sysprof_elf_loader_load (SysprofElfLoader       *self,
         return g_steal_pointer (&elf);
     }
 
-failure:
-  if (error != NULL)
+  return NULL;
+}
+
+/**
+ * sysprof_elf_loader_load:
+ * @self: a #SysprofElfLoader
+ * @mount_namespace: a #SysprofMountNamespace for path resolving
+ * @file: the path of the file to load within the mount namespace
+ * @build_id: (nullable): an optional build-id that can be used to resolve
+ *   the file alternatively to the file path
+ * @file_inode: expected inode for @file
+ * @error: a location for a #GError, or %NULL
+ *
+ * Attempts to load a #SysprofElf for @file (or optionally by @build_id).
+ *
+ * This attempts to follow `.gnu_debuglink` ELF section headers and attach
+ * them to the resulting #SysprofElf so that additional symbol information
+ * is available.
+ *
+ * This function is thread-safe. ELF files are fully resolved, including
+ * their debug links, before they become visible to other threads.
+ *
+ * Returns: (transfer full): a #SysprofElf, or %NULL if the file could
+ *   not be resolved.
+ */
+SysprofElf *
+sysprof_elf_loader_load (SysprofElfLoader       *self,
+                         SysprofMountNamespace  *mount_namespace,
+                         const char             *file,
+                         const char             *build_id,
+                         guint64                 file_inode,
+                         GError                **error)
+{
+  SysprofElf *ret;
+
+  g_return_val_if_fail (SYSPROF_IS_ELF_LOADER (self), NULL);
+  g_return_val_if_fail (!mount_namespace || SYSPROF_IS_MOUNT_NAMESPACE (mount_namespace), NULL);
+
+  g_mutex_lock (&self->mutex);
+  ret = sysprof_elf_loader_load_locked (self, mount_namespace, file, build_id, file_inode);
+  g_mutex_unlock (&self->mutex);
+
+  if (ret == NULL && error != NULL)
     g_set_error_literal (error,
                          G_FILE_ERROR,
                          G_FILE_ERROR_NOENT,
                          "Failed to locate file");
 
-  return NULL;
+  return ret;
 }
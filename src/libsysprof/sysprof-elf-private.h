@@ -39,7 +39,7 @@ const char *sysprof_elf_get_nick              (SysprofElf   *self);
 const char *sysprof_elf_get_file              (SysprofElf   *self);
 const char *sysprof_elf_get_build_id          (SysprofElf   *self);
 const char *sysprof_elf_get_debug_link        (SysprofElf   *self);
-char       *sysprof_elf_get_symbol_at_address (SysprofElf   *self,
+const char *sysprof_elf_get_symbol_at_address (SysprofElf   *self,
                                                guint64       address,
                                                guint64      *begin_address,
                                                guint64      *end_address);
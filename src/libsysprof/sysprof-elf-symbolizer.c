@@ -60,7 +60,7 @@ sysprof_elf_symbolizer_symbolize (SysprofSymbolizer        *symbolizer,
   SysprofElfSymbolizer *self = (SysprofElfSymbolizer *)symbolizer;
   g_autoptr(SysprofElf) elf = NULL;
   SysprofDocumentMmap *map;
-  g_autofree char *name = NULL;
+  const char *name;
   const char *nick = NULL;
   const char *path;
   const char *build_id;
@@ -134,7 +134,7 @@ sysprof_elf_symbolizer_symbolize (SysprofSymbolizer        *symbolizer,
   if (end_address == begin_address)
     end_address++;
 
-  ret = _sysprof_symbol_new (sysprof_strings_get (strings, name),
+  ret = _sysprof_symbol_new (sysprof_strings_get_demangled (strings, name),
                              sysprof_strings_get (strings, path),
                              sysprof_strings_get (strings, nick),
                              map_begin + (begin_address - file_offset),
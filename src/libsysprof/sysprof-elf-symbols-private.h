@@ -0,0 +1,49 @@
+/* sysprof-elf-symbols-private.h
+ *
+ * Copyright 2023 Christian Hergert <chergert@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <glib.h>
+
+#include "elfparser.h"
+
+G_BEGIN_DECLS
+
+typedef struct _SysprofElfSymbols SysprofElfSymbols;
+
+SysprofElfSymbols *sysprof_elf_symbols_new_from_parser (ElfParser          *parser);
+SysprofElfSymbols *sysprof_elf_symbols_load            (const char         *key,
+                                                        GError            **error);
+gboolean           sysprof_elf_symbols_save            (SysprofElfSymbols  *self,
+                                                        const char         *key,
+                                                        GError            **error);
+void               sysprof_elf_symbols_free            (SysprofElfSymbols  *self);
+guint              sysprof_elf_symbols_get_n_symbols   (SysprofElfSymbols  *self);
+const char        *sysprof_elf_symbols_lookup          (SysprofElfSymbols  *self,
+                                                        guint64             address,
+                                                        guint64            *begin_address,
+                                                        guint64            *end_address);
+char              *sysprof_elf_symbols_dup_cache_key   (const char         *filename,
+                                                        const char         *build_id,
+                                                        gsize               file_size);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (SysprofElfSymbols, sysprof_elf_symbols_free)
+
+G_END_DECLS
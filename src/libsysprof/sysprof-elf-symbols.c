@@ -0,0 +1,403 @@
+/* sysprof-elf-symbols.c
+ *
+ * Copyright 2023 Christian Hergert <chergert@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <gio/gio.h>
+
+#include "sysprof-elf-symbols-private.h"
+
+/* SysprofElfSymbols is a pre-sorted symbol table for a single ELF object.
+ * It is stored in $XDG_CACHE_HOME/sysprof/symbols so that opening captures
+ * which reference the same objects can skip reading the ELF symbol tables
+ * entirely. The file is mapped and used in place, so it is only valid on
+ * the host which created it.
+ *
+ * Names are stored as found in the ELF, which may be mangled. Only a small
+ * portion of symbols are ever hit, so demangling is left to
+ * sysprof_strings_get_demangled() when a symbol is actually created.
+ *
+ * The layout is a header, followed by an array of entries sorted by
+ * their begin address, followed by a block of NUL terminated strings.
+ * Addresses are relative to the start of the .text section which is how
+ * elf_parser_lookup_symbol() expects them.
+ */
+
+#define SYMBOLS_MAGIC   "SPSYMTAB"
+#define SYMBOLS_VERSION 2
+
+typedef struct _SymbolsHeader
+{
+  char    magic[8];
+  guint32 version;
+  guint32 n_symbols;
+  guint64 text_size;
+  guint64 strings_len;
+} SymbolsHeader;
+
+typedef struct _SymbolsEntry
+{
+  guint64 begin;
+  guint64 end;
+  guint32 name;
+  guint32 padding;
+} SymbolsEntry;
+
+G_STATIC_ASSERT (sizeof (SymbolsHeader) == 32);
+G_STATIC_ASSERT (sizeof (SymbolsEntry) == 24);
+
+struct _SysprofElfSymbols
+{
+  GBytes             *bytes;
+  const SymbolsEntry *entries;
+  const char         *strings;
+  guint64             text_size;
+  guint               n_symbols;
+};
+
+static SysprofElfSymbols *
+sysprof_elf_symbols_new_for_bytes (GBytes  *bytes,
+                                   GError **error)
+{
+  SysprofElfSymbols *self;
+  const SymbolsHeader *header;
+  const SymbolsEntry *entries;
+  const char *strings;
+  const guint8 *data;
+  gsize len;
+
+  g_assert (bytes != NULL);
+
+  data = g_bytes_get_data (bytes, &len);
+
+  if (len < sizeof *header)
+    goto corrupt;
+
+  header = (const SymbolsHeader *)(gconstpointer)data;
+
+  if (memcmp (header->magic, SYMBOLS_MAGIC, sizeof header->magic) != 0 ||
+      header->version != SYMBOLS_VERSION)
+    goto corrupt;
+
+  if (header->strings_len > len - sizeof *header ||
+      (len - sizeof *header - header->strings_len) / sizeof *entries != header->n_symbols ||
+      (len - sizeof *header - header->strings_len) % sizeof *entries != 0)
+    goto corrupt;
+
+  entries = (const SymbolsEntry *)(gconstpointer)&data[sizeof *header];
+  strings = (const char *)&data[sizeof *header + header->n_symbols * sizeof *entries];
+
+  if (header->n_symbols > 0 &&
+      (header->strings_len == 0 || strings[header->strings_len-1] != 0))
+    goto corrupt;
+
+  for (guint i = 0; i < header->n_symbols; i++)
+    {
+      if (entries[i].name >= header->strings_len ||
+          entries[i].end < entries[i].begin ||
+          (i > 0 && entries[i].begin < entries[i-1].begin))
+        goto corrupt;
+    }
+
+  self = g_new0 (SysprofElfSymbols, 1);
+  self->bytes = g_bytes_ref (bytes);
+  self->entries = entries;
+  self->strings = strings;
+  self->text_size = header->text_size;
+  self->n_symbols = header->n_symbols;
+
+  return self;
+
+corrupt:
+  g_set_error_literal (error,
+                       G_IO_ERROR,
+                       G_IO_ERROR_INVALID_DATA,
+                       "Symbol cache is corrupted");
+
+  return NULL;
+}
+
+/**
+ * sysprof_elf_symbols_new_from_parser:
+ * @parser: an #ElfParser
+ *
+ * Reads every function symbol within @parser.
+ *
+ * Returns: (transfer full): a new #SysprofElfSymbols
+ */
+SysprofElfSymbols *
+sysprof_elf_symbols_new_from_parser (ElfParser *parser)
+{
+  g_autoptr(GByteArray) buffer = NULL;
+  g_autoptr(GByteArray) strings = NULL;
+  g_autoptr(GBytes) bytes = NULL;
+  SymbolsHeader header = {0};
+  guint n_symbols;
+
+  g_return_val_if_fail (parser != NULL, NULL);
+
+  n_symbols = elf_parser_get_n_symbols (parser);
+
+  buffer = g_byte_array_sized_new (sizeof header + (n_symbols * sizeof (SymbolsEntry)));
+  strings = g_byte_array_new ();
+
+  g_byte_array_set_size (buffer, sizeof header);
+
+  for (guint i = 0; i < n_symbols; i++)
+    {
+      const ElfSym *sym = elf_parser_get_nth_symbol (parser, i);
+      const char *name = elf_parser_get_sym_name (parser, sym);
+      SymbolsEntry entry = {0};
+      gulong begin;
+      gulong end;
+
+      elf_parser_get_sym_address_range (parser, sym, &begin, &end);
+
+      if (name == NULL)
+        name = "";
+
+      entry.begin = begin;
+      entry.end = end;
+      entry.name = strings->len;
+
+      g_byte_array_append (buffer, (const guint8 *)&entry, sizeof entry);
+      g_byte_array_append (strings, (const guint8 *)name, strlen (name) + 1);
+    }
+
+  memcpy (header.magic, SYMBOLS_MAGIC, sizeof header.magic);
+  header.version = SYMBOLS_VERSION;
+  header.n_symbols = n_symbols;
+  header.text_size = elf_parser_get_text_size (parser);
+  header.strings_len = strings->len;
+  memcpy (buffer->data, &header, sizeof header);
+
+  g_byte_array_append (buffer, strings->data, strings->len);
+
+  bytes = g_byte_array_free_to_bytes (g_steal_pointer (&buffer));
+
+  return sysprof_elf_symbols_new_for_bytes (bytes, NULL);
+}
+
+static char *
+get_cache_path (const char *key)
+{
+  g_autofree char *name = g_strdup_printf ("%s.symbols", key);
+
+  return g_build_filename (g_get_user_cache_dir (), "sysprof", "symbols", name, NULL);
+}
+
+/**
+ * sysprof_elf_symbols_load:
+ * @key: the cache key from sysprof_elf_symbols_dup_cache_key()
+ * @error: a location for a #GError
+ *
+ * Maps a previously saved symbol table from the cache directory.
+ *
+ * Returns: (transfer full) (nullable): a #SysprofElfSymbols or %NULL
+ */
+SysprofElfSymbols *
+sysprof_elf_symbols_load (const char  *key,
+                          GError     **error)
+{
+  g_autoptr(GMappedFile) mapped_file = NULL;
+  g_autoptr(GBytes) bytes = NULL;
+  g_autofree char *path = NULL;
+
+  g_return_val_if_fail (key != NULL, NULL);
+
+  path = get_cache_path (key);
+
+  if (!(mapped_file = g_mapped_file_new (path, FALSE, error)))
+    return NULL;
+
+  bytes = g_mapped_file_get_bytes (mapped_file);
+
+  return sysprof_elf_symbols_new_for_bytes (bytes, error);
+}
+
+/**
+ * sysprof_elf_symbols_save:
+ * @self: a #SysprofElfSymbols
+ * @key: the cache key from sysprof_elf_symbols_dup_cache_key()
+ * @error: a location for a #GError
+ *
+ * Atomically writes @self to the cache directory so that it may be
+ * loaded with sysprof_elf_symbols_load() later on.
+ *
+ * Returns: %TRUE if successful; otherwise %FALSE and @error is set
+ */
+gboolean
+sysprof_elf_symbols_save (SysprofElfSymbols  *self,
+                          const char         *key,
+                          GError            **error)
+{
+  g_autofree char *path = NULL;
+  g_autofree char *dir = NULL;
+  gconstpointer data;
+  gsize len;
+
+  g_return_val_if_fail (self != NULL, FALSE);
+  g_return_val_if_fail (key != NULL, FALSE);
+
+  path = get_cache_path (key);
+  dir = g_path_get_dirname (path);
+
+  if (g_mkdir_with_parents (dir, 0750) != 0)
+    {
+      int errsv = errno;
+      g_set_error_literal (error,
+                           G_FILE_ERROR,
+                           g_file_error_from_errno (errsv),
+                           g_strerror (errsv));
+      return FALSE;
+    }
+
+  data = g_bytes_get_data (self->bytes, &len);
+
+  return g_file_set_contents_full (path, data, len,
+                                   G_FILE_SET_CONTENTS_CONSISTENT,
+                                   0640,
+                                   error);
+}
+
+void
+sysprof_elf_symbols_free (SysprofElfSymbols *self)
+{
+  if (self == NULL)
+    return;
+
+  g_clear_pointer (&self->bytes, g_bytes_unref);
+  g_free (self);
+}
+
+guint
+sysprof_elf_symbols_get_n_symbols (SysprofElfSymbols *self)
+{
+  g_return_val_if_fail (self != NULL, 0);
+
+  return self->n_symbols;
+}
+
+/**
+ * sysprof_elf_symbols_lookup:
+ * @self: a #SysprofElfSymbols
+ * @address: an address relative to the .text section
+ * @begin_address: (out) (optional): the beginning of the symbol
+ * @end_address: (out) (optional): the end of the symbol
+ *
+ * Locates the symbol containing @address using the same rules as
+ * elf_parser_lookup_symbol().
+ *
+ * Returns: (transfer none) (nullable): the symbol name, which may be
+ *   mangled, or %NULL
+ */
+const char *
+sysprof_elf_symbols_lookup (SysprofElfSymbols *self,
+                            guint64            address,
+                            guint64           *begin_address,
+                            guint64           *end_address)
+{
+  const SymbolsEntry *base;
+  guint len;
+
+  g_return_val_if_fail (self != NULL, NULL);
+
+  if (self->n_symbols == 0 ||
+      address > self->text_size ||
+      address < self->entries[0].begin)
+    return NULL;
+
+  base = self->entries;
+  len = self->n_symbols;
+
+  /* Find the last entry starting at or before @address */
+  while (len > 1)
+    {
+      guint half = len / 2;
+
+      base = (base[half].begin <= address) ? base + half : base;
+      len -= half;
+    }
+
+  /* Symbols without a size extend to the next symbol */
+  if (base->end > base->begin && base->end <= address)
+    return NULL;
+
+  if (begin_address)
+    *begin_address = base->begin;
+
+  if (end_address)
+    *end_address = base->end;
+
+  return &self->strings[base->name];
+}
+
+static gboolean
+is_hex_string (const char *str)
+{
+  for (; *str; str++)
+    {
+      if (!g_ascii_isxdigit (*str))
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+/**
+ * sysprof_elf_symbols_dup_cache_key:
+ * @filename: (nullable): the path to the ELF object
+ * @build_id: (nullable): the build-id of the ELF object
+ * @file_size: the size of the ELF object in bytes
+ *
+ * Creates a key for the symbol cache. The build-id is preferred, but
+ * stripped objects and their debuginfo share a build-id, so the size is
+ * included to tell them apart. Without a build-id, the key is derived
+ * from the path, inode and modification time of @filename.
+ *
+ * Returns: (transfer full) (nullable): a key or %NULL if the object
+ *   cannot be cached
+ */
+char *
+sysprof_elf_symbols_dup_cache_key (const char *filename,
+                                   const char *build_id,
+                                   gsize       file_size)
+{
+  g_autofree char *str = NULL;
+  struct stat stbuf;
+
+  if (build_id != NULL && build_id[0] != 0 && is_hex_string (build_id))
+    return g_strdup_printf ("%s-%"G_GSIZE_MODIFIER"x", build_id, file_size);
+
+  if (filename == NULL || stat (filename, &stbuf) != 0)
+    return NULL;
+
+  str = g_strdup_printf ("%s:%"G_GUINT64_FORMAT":%"G_GINT64_FORMAT":%"G_GINT64_FORMAT,
+                         filename,
+                         (guint64)stbuf.st_ino,
+                         (gint64)stbuf.st_mtime,
+                         (gint64)stbuf.st_size);
+
+  return g_compute_checksum_for_string (G_CHECKSUM_SHA256, str, -1);
+}
@@ -23,6 +23,7 @@
 #include "elfparser.h"
 
 #include "sysprof-elf-private.h"
+#include "sysprof-elf-symbols-private.h"
 
 struct _SysprofElf
 {
@@ -32,8 +33,11 @@ struct _SysprofElf
   char *file;
   SysprofElf *debug_link_elf;
   ElfParser *parser;
+  SysprofElfSymbols *symbols;
   guint64 file_inode;
+  gsize file_size;
   gulong text_offset;
+  gsize symbols_loaded;
 };
 
 enum {
@@ -220,6 +224,7 @@ sysprof_elf_finalize (GObject *object)
 
   g_clear_pointer (&self->file, g_free);
   g_clear_pointer (&self->parser, elf_parser_free);
+  g_clear_pointer (&self->symbols, sysprof_elf_symbols_free);
   g_clear_object (&self->debug_link_elf);
 
   G_OBJECT_CLASS (sysprof_elf_parent_class)->finalize (object);
@@ -348,9 +353,12 @@ sysprof_elf_new (const char   *filename,
 {
   SysprofElf *self;
   ElfParser *parser;
+  gsize file_size;
 
   g_return_val_if_fail (mapped_file != NULL, NULL);
 
+  file_size = g_mapped_file_get_length (mapped_file);
+
   if (!(parser = elf_parser_new_from_mmap (g_steal_pointer (&mapped_file), error)))
     return NULL;
 
@@ -358,8 +366,14 @@ sysprof_elf_new (const char   *filename,
   self->file = g_strdup (filename);
   self->parser = g_steal_pointer (&parser);
   self->file_inode = file_inode;
+  self->file_size = file_size;
   self->text_offset = elf_parser_get_text_offset (self->parser);
 
+  /* The parser lazily caches the build-id, so do that now while we are
+   * the only thread with access to the ELF.
+   */
+  elf_parser_get_build_id (self->parser);
+
   if (filename != NULL)
     {
       const char *base;
@@ -403,7 +417,32 @@ sysprof_elf_get_debug_link (SysprofElf *self)
   return elf_parser_get_debug_link (self->parser, &crc32);
 }
 
-static char *
+static SysprofElfSymbols *
+sysprof_elf_load_symbols (SysprofElf *self)
+{
+  g_autoptr(SysprofElfSymbols) symbols = NULL;
+  g_autoptr(GError) error = NULL;
+  g_autofree char *key = NULL;
+
+  key = sysprof_elf_symbols_dup_cache_key (self->file,
+                                           elf_parser_get_build_id (self->parser),
+                                           self->file_size);
+
+  if (key != NULL && (symbols = sysprof_elf_symbols_load (key, NULL)))
+    return g_steal_pointer (&symbols);
+
+  symbols = sysprof_elf_symbols_new_from_parser (self->parser);
+
+  /* Only bother caching objects which have symbols */
+  if (key != NULL &&
+      sysprof_elf_symbols_get_n_symbols (symbols) > 0 &&
+      !sysprof_elf_symbols_save (symbols, key, &error))
+    g_debug ("Failed to save symbol cache for %s: %s", self->file, error->message);
+
+  return g_steal_pointer (&symbols);
+}
+
+static const char *
 sysprof_elf_get_symbol_at_address_internal (SysprofElf *self,
                                             const char *filename,
                                             guint64     address,
@@ -411,10 +450,9 @@ sysprof_elf_get_symbol_at_address_internal (SysprofElf *self,
                                             guint64    *end_address,
                                             guint64     text_offset)
 {
-  const ElfSym *symbol;
-  char *ret = NULL;
-  gulong begin = 0;
-  gulong end = 0;
+  const char *ret = NULL;
+  guint64 begin = 0;
+  guint64 end = 0;
 
   g_return_val_if_fail (SYSPROF_IS_ELF (self), NULL);
 
@@ -426,28 +464,22 @@ sysprof_elf_get_symbol_at_address_internal (SysprofElf *self,
         return ret;
     }
 
-  if ((symbol = elf_parser_lookup_symbol (self->parser, address - text_offset)))
+  /* Symbols are loaded lazily, either from the on-disk cache or by
+   * reading them from the parser. Do that exactly once so
+   * that lookups may happen from multiple threads afterwards.
+   */
+  if (g_once_init_enter (&self->symbols_loaded))
     {
-      const char *name;
-
-      if (begin_address || end_address)
-        {
-          elf_parser_get_sym_address_range (self->parser, symbol, &begin, &end);
-          begin += text_offset;
-          end += text_offset;
-        }
+      self->symbols = sysprof_elf_load_symbols (self);
+      g_once_init_leave (&self->symbols_loaded, TRUE);
+    }
 
-      name = elf_parser_get_sym_name (self->parser, symbol);
+  if (self->symbols == NULL ||
+      !(ret = sysprof_elf_symbols_lookup (self->symbols, address - text_offset, &begin, &end)))
+    return NULL;
 
-      if (name != NULL && name[0] == '_' && ((name[1] == 'Z') || (name[1] == 'R')))
-        ret = elf_demangle (name);
-      else
-        ret = g_strdup (name);
-    }
-  else
-    {
-      return NULL;
-    }
+  begin += text_offset;
+  end += text_offset;
 
   if (begin_address)
     *begin_address = begin;
@@ -458,7 +490,22 @@ sysprof_elf_get_symbol_at_address_internal (SysprofElf *self,
   return ret;
 }
 
-char *
+/**
+ * sysprof_elf_get_symbol_at_address:
+ * @self: a #SysprofElf
+ * @address: the address within the file
+ * @begin_address: (out) (optional): the beginning of the symbol
+ * @end_address: (out) (optional): the end of the symbol
+ *
+ * Locates the symbol containing @address.
+ *
+ * The name is returned as found in the ELF and may be mangled. Use
+ * sysprof_strings_get_demangled() to get a name suitable for display.
+ *
+ * Returns: (transfer none) (nullable): the name of the symbol, which is
+ *   valid for the lifetime of @self
+ */
+const char *
 sysprof_elf_get_symbol_at_address (SysprofElf *self,
                                    guint64     address,
                                    guint64    *begin_address,
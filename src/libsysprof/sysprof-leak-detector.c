@@ -20,8 +20,6 @@
 
 #include "config.h"
 
-#include "sysprof-document-allocation.h"
-#include "sysprof-document-frame-private.h"
 #include "sysprof-document-private.h"
 #include "sysprof-leak-detector-private.h"
 
@@ -72,51 +70,28 @@ sysprof_leak_detector_detect (SysprofDocument *document,
                               EggBitset       *allocations)
 {
   SysprofAllocs allocs;
-  g_autoptr(SysprofDocumentFrame) frame = NULL;
+  SysprofDocumentTraceableCursor cursor;
+  SysprofDocumentTraceableView alloc;
   g_autoptr(EggBitset) leaks = NULL;
-  const SysprofDocumentFramePointer *frames;
-  guint n_frames;
-  const char *base_addr;
-  EggBitsetIter iter;
   SysprofAllocNode find = {0};
   SysprofAllocNode *res;
-  guint pos;
 
   g_return_val_if_fail (SYSPROF_IS_DOCUMENT (document), NULL);
   g_return_val_if_fail (allocations != NULL, NULL);
 
   leaks = egg_bitset_new_empty ();
 
-  if (!egg_bitset_iter_init_first (&iter, allocations, &pos))
-    return g_steal_pointer (&leaks);
-
-  frames = _sysprof_document_get_frames (document, &n_frames);
-  g_assert (frames != NULL);
+  RB_INIT (&allocs.head);
 
-  /* Load the first allocation to look at. To avoid creating lots
-   * of GObjects, we will update the internal data in the alloc
-   * object to point at each subsequence record. That way it's just
-   * used as a demarshalling container.
+  /* Read allocation records straight from the capture so that we do
+   * not need to create a GObject for each of them.
    */
-  frame = g_list_model_get_item (G_LIST_MODEL (document), pos);
-  frame->time_offset = 0;
+  _sysprof_document_traceable_cursor_init (&cursor, document, G_LIST_MODEL (document), allocations);
 
-  g_assert (frame != NULL);
-  g_assert (SYSPROF_IS_DOCUMENT_ALLOCATION (frame));
-
-  base_addr = g_mapped_file_get_contents (frame->mapped_file);
-
-  RB_INIT (&allocs.head);
-
-  for (;;)
+  while (_sysprof_document_traceable_cursor_next (&cursor, &alloc))
     {
-      SysprofDocumentAllocation *alloc = (SysprofDocumentAllocation *)frame;
-      const SysprofDocumentFramePointer *ptr;
-      guint64 address = sysprof_document_allocation_get_address (alloc);
-      gint64 size = sysprof_document_allocation_get_size (alloc);
-
-      g_assert (pos < n_frames);
-      ptr = &frames[pos];
+      if (alloc.type != SYSPROF_CAPTURE_FRAME_ALLOCATION)
+        continue;
 
       /* Generally we'd want to take into account the PID as well, but
        * since we only support recording from LD_PRELOAD currently, there
@@ -124,31 +99,27 @@ sysprof_leak_detector_detect (SysprofDocument *document,
        * a single capture. Therefore, don't waste the time on it.
        */
 
-      if (size > 0)
+      if (alloc.size > 0)
         {
           SysprofAllocNode *node = g_new0 (SysprofAllocNode, 1);
 
-          node->pos = pos;
-          node->address = address;
-          node->size = size;
+          node->pos = alloc.position;
+          node->address = alloc.address;
+          node->size = alloc.size;
 
           RB_INSERT (sysprof_allocs, &allocs.head, node);
         }
       else
         {
-          find.address = address;
+          find.address = alloc.address;
 
           if ((res = RB_FIND (sysprof_allocs, &allocs.head, &find)))
             RB_REMOVE (sysprof_allocs, &allocs.head, res);
         }
-
-      if (!egg_bitset_iter_next (&iter, &pos))
-        break;
-
-      frame->frame = (SysprofCaptureFrame *)&base_addr[ptr->offset];
-      frame->frame_len = ptr->length;
     }
 
+  _sysprof_document_traceable_cursor_clear (&cursor);
+
   RB_FOREACH (res, sysprof_allocs, &allocs.head) {
     g_assert (res->size > 0);
 
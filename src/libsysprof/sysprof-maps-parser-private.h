@@ -31,14 +31,21 @@ typedef struct _SysprofMapsParser
   LineReader reader;
 } SysprofMapsParser;
 
-void     sysprof_maps_parser_init (SysprofMapsParser *self,
-                                   const char         *str,
-                                   gssize              len);
-gboolean sysprof_maps_parser_next (SysprofMapsParser  *self,
-                                   guint64            *out_begin_addr,
-                                   guint64            *out_end_addr,
-                                   guint64            *out_offset,
-                                   guint64            *out_inode,
-                                   char              **out_filename);
+void     sysprof_maps_parser_init      (SysprofMapsParser  *self,
+                                        const char         *str,
+                                        gssize              len);
+gboolean sysprof_maps_parser_next      (SysprofMapsParser  *self,
+                                        guint64            *out_begin_addr,
+                                        guint64            *out_end_addr,
+                                        guint64            *out_offset,
+                                        guint64            *out_inode,
+                                        char              **out_filename);
+gboolean sysprof_maps_parser_next_full (SysprofMapsParser  *self,
+                                        guint64            *out_begin_addr,
+                                        guint64            *out_end_addr,
+                                        guint64            *out_offset,
+                                        guint64            *out_inode,
+                                        gboolean           *out_executable,
+                                        char              **out_filename);
 
 G_END_DECLS
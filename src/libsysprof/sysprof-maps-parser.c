@@ -32,19 +32,24 @@ sysprof_maps_parser_init (SysprofMapsParser *self,
   line_reader_init (&self->reader, (char *)str, len);
 
   if (address_range_regex == NULL)
-    address_range_regex = g_regex_new ("^([0-9a-f]+)-([0-9a-f]+) [r\\-][w\\-][x\\-][ps\\-] ([0-9a-f]+) [0-9a-f]+:[0-9a-f]+ ([0-9]+) +(.*)$",
+    address_range_regex = g_regex_new ("^([0-9a-f]+)-([0-9a-f]+) [r\\-][w\\-]([x\\-])[ps\\-] ([0-9a-f]+) [0-9a-f]+:[0-9a-f]+ ([0-9]+)(?: +(.*))?$",
                                        G_REGEX_OPTIMIZE,
                                        G_REGEX_MATCH_DEFAULT,
                                        NULL);
 }
 
+/*
+ * Like sysprof_maps_parser_next() but also yields anonymous mappings,
+ * which have an empty filename, and whether the mapping is executable.
+ */
 gboolean
-sysprof_maps_parser_next (SysprofMapsParser  *self,
-                          guint64            *out_begin_addr,
-                          guint64            *out_end_addr,
-                          guint64            *out_offset,
-                          guint64            *out_inode,
-                          char              **out_filename)
+sysprof_maps_parser_next_full (SysprofMapsParser  *self,
+                               guint64            *out_begin_addr,
+                               guint64            *out_end_addr,
+                               guint64            *out_offset,
+                               guint64            *out_inode,
+                               gboolean           *out_executable,
+                               char              **out_filename)
 {
   const char *line;
   gsize len;
@@ -61,10 +66,13 @@ sysprof_maps_parser_next (SysprofMapsParser  *self,
           guint64 inode;
           guint64 offset;
           gboolean is_vdso;
+          gboolean executable;
           int begin_addr_begin;
           int begin_addr_end;
           int end_addr_begin;
           int end_addr_end;
+          int exec_begin;
+          int exec_end;
           int offset_begin;
           int offset_end;
           int inode_begin;
@@ -75,17 +83,24 @@ sysprof_maps_parser_next (SysprofMapsParser  *self,
 
           if (!g_match_info_fetch_pos (match_info, 1, &begin_addr_begin, &begin_addr_end) ||
               !g_match_info_fetch_pos (match_info, 2, &end_addr_begin, &end_addr_end) ||
-              !g_match_info_fetch_pos (match_info, 3, &offset_begin, &offset_end) ||
-              !g_match_info_fetch_pos (match_info, 4, &inode_begin, &inode_end) ||
-              !g_match_info_fetch_pos (match_info, 5, &path_begin, &path_end))
+              !g_match_info_fetch_pos (match_info, 3, &exec_begin, &exec_end) ||
+              !g_match_info_fetch_pos (match_info, 4, &offset_begin, &offset_end) ||
+              !g_match_info_fetch_pos (match_info, 5, &inode_begin, &inode_end))
             continue;
 
+          /* Anonymous mappings have no path at all */
+          if (!g_match_info_fetch_pos (match_info, 6, &path_begin, &path_end) ||
+              path_begin < 0)
+            path_begin = path_end = len;
+
           begin_addr = g_ascii_strtoull (&line[begin_addr_begin], NULL, 16);
           end_addr = g_ascii_strtoull (&line[end_addr_begin], NULL, 16);
           offset = g_ascii_strtoull (&line[offset_begin], NULL, 16);
           inode = g_ascii_strtoull (&line[inode_begin], NULL, 10);
+          executable = line[exec_begin] == 'x';
 
-          if (memcmp (" (deleted",
+          if (path_end - path_begin >= (int)strlen (" (deleted") &&
+              memcmp (" (deleted",
                       &line[path_end] - strlen (" (deleted"),
                       strlen (" (deleted")) == 0)
             path_end -= strlen (" (deleted)");
@@ -104,6 +119,7 @@ sysprof_maps_parser_next (SysprofMapsParser  *self,
           *out_end_addr = end_addr;
           *out_offset = offset;
           *out_inode = inode;
+          *out_executable = executable;
           *out_filename = g_steal_pointer (&file);
 
           return TRUE;
@@ -112,3 +128,34 @@ sysprof_maps_parser_next (SysprofMapsParser  *self,
 
   return FALSE;
 }
+
+gboolean
+sysprof_maps_parser_next (SysprofMapsParser  *self,
+                          guint64            *out_begin_addr,
+                          guint64            *out_end_addr,
+                          guint64            *out_offset,
+                          guint64            *out_inode,
+                          char              **out_filename)
+{
+  gboolean executable;
+  char *filename;
+
+  while (sysprof_maps_parser_next_full (self,
+                                        out_begin_addr,
+                                        out_end_addr,
+                                        out_offset,
+                                        out_inode,
+                                        &executable,
+                                        &filename))
+    {
+      if (filename[0] != 0)
+        {
+          *out_filename = filename;
+          return TRUE;
+        }
+
+      g_free (filename);
+    }
+
+  return FALSE;
+}
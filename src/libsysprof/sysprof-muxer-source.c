@@ -48,12 +48,37 @@ sysprof_muxer_source_size (SysprofMuxerSource *source)
   return source->buffer.end - source->buffer.begin;
 }
 
-static gboolean
-sysprof_muxer_source_dispatch (GSource     *gsource,
-                               GSourceFunc  callback,
-                               gpointer     user_data)
+static void
+sysprof_muxer_source_add_frame (SysprofMuxerSource        *source,
+                                const SysprofCaptureFrame *frame)
+{
+  /* Samples are re-added rather than copied so that the destination
+   * writer gets a chance to deduplicate their stacks.
+   */
+  if (frame->type == SYSPROF_CAPTURE_FRAME_SAMPLE && frame->len >= sizeof (SysprofCaptureSample))
+    {
+      const SysprofCaptureSample *sample = (const SysprofCaptureSample *)frame;
+
+      if (!sample->stack &&
+          frame->len >= sizeof *sample + sample->n_addrs * sizeof (SysprofCaptureAddress))
+        {
+          sysprof_capture_writer_add_sample (source->writer,
+                                             frame->time,
+                                             frame->cpu,
+                                             frame->pid,
+                                             sample->tid,
+                                             sample->addrs,
+                                             sample->n_addrs);
+          return;
+        }
+    }
+
+  _sysprof_capture_writer_add_raw (source->writer, frame);
+}
+
+static gssize
+sysprof_muxer_source_read (SysprofMuxerSource *source)
 {
-  SysprofMuxerSource *source = (SysprofMuxerSource *)gsource;
   gssize n_read;
 
   g_assert (source != NULL);
@@ -79,33 +104,31 @@ sysprof_muxer_source_dispatch (GSource     *gsource,
 
       /* If there is enough to read the frame header, try to read and dispatch
        * it in raw form. We assume we're the same endianness here because this
-       * is coming from the same host (live-unwinder currently).
+       * is coming from the same host (live-unwinder or sampler threads).
        */
       while (sysprof_muxer_source_size (source) >= sizeof *frame)
         {
           frame = (const SysprofCaptureFrame *)source->buffer.begin;
 
-          if (frame->len <= sysprof_muxer_source_size (source))
-            {
-              source->buffer.begin += frame->len;
+          if (frame->len < sizeof *frame ||
+              frame->len > sysprof_muxer_source_size (source))
+            break;
 
-              if (frame->len % sizeof (guint64) != 0)
-                source->buffer.to_skip = sizeof (guint64) - (frame->len % sizeof (guint64));
+          source->buffer.begin += frame->len;
 
-              /* TODO: Technically for counters/JIT map we need to translate them. */
+          if (frame->len % sizeof (guint64) != 0)
+            source->buffer.to_skip = sizeof (guint64) - (frame->len % sizeof (guint64));
 
-              _sysprof_capture_writer_add_raw (source->writer, frame);
-            }
+          /* TODO: Technically for counters/JIT map we need to translate them. */
 
-          if (source->buffer.to_skip > 0 &&
-              source->buffer.to_skip <= sysprof_muxer_source_size (source))
+          sysprof_muxer_source_add_frame (source, frame);
+
+          if (source->buffer.to_skip > 0)
             {
-              source->buffer.begin += source->buffer.to_skip;
-              source->buffer.to_skip = 0;
-              continue;
+              gsize amount = MIN (source->buffer.to_skip, sysprof_muxer_source_size (source));
+              source->buffer.begin += amount;
+              source->buffer.to_skip -= amount;
             }
-
-          break;
         }
 
       /* Move anything left to the head of the buffer so we can
@@ -128,6 +151,15 @@ sysprof_muxer_source_dispatch (GSource     *gsource,
         }
     }
 
+  return n_read;
+}
+
+static gboolean
+sysprof_muxer_source_dispatch (GSource     *gsource,
+                               GSourceFunc  callback,
+                               gpointer     user_data)
+{
+  sysprof_muxer_source_read ((SysprofMuxerSource *)gsource);
 
   return G_SOURCE_CONTINUE;
 }
@@ -171,3 +203,23 @@ sysprof_muxer_source_new (int                   capture_fd,
 
   return (GSource *)source;
 }
+
+/**
+ * sysprof_muxer_source_drain:
+ * @source: a #GSource created with sysprof_muxer_source_new()
+ *
+ * Synchronously reads everything that is currently available from the
+ * capture fd into the writer.
+ *
+ * This is useful once all producers have closed their end of the capture
+ * fd, so that frames still sitting in the pipe are not lost when the
+ * source is destroyed.
+ */
+void
+sysprof_muxer_source_drain (GSource *source)
+{
+  g_return_if_fail (source != NULL);
+
+  while (sysprof_muxer_source_read ((SysprofMuxerSource *)source) > 0)
+    continue;
+}
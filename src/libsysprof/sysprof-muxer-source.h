@@ -27,7 +27,8 @@
 
 G_BEGIN_DECLS
 
-GSource *sysprof_muxer_source_new (int                   capture_fd,
-                                   SysprofCaptureWriter *writer);
+GSource *sysprof_muxer_source_new   (int                   capture_fd,
+                                     SysprofCaptureWriter *writer);
+void     sysprof_muxer_source_drain (GSource              *source);
 
 G_END_DECLS
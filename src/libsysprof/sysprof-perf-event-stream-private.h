@@ -177,6 +177,10 @@ gboolean   sysprof_perf_event_stream_enable    (SysprofPerfEventStream        *s
                                                 GError                       **error);
 gboolean   sysprof_perf_event_stream_disable   (SysprofPerfEventStream        *self,
                                                 GError                       **error);
+int        sysprof_perf_event_stream_get_fd    (SysprofPerfEventStream        *self);
+void       sysprof_perf_event_stream_detach_source
+                                               (SysprofPerfEventStream        *self);
+void       sysprof_perf_event_stream_drain     (SysprofPerfEventStream        *self);
 GVariant  *_sysprof_perf_event_attr_to_variant (const struct perf_event_attr  *attr);
 
 G_END_DECLS
@@ -62,6 +62,9 @@
  */
 #define N_PAGES 32
 
+/* Rough size of a sample record including its callchain */
+#define WATERMARK_RECORD_SIZE 256
+
 struct _SysprofPerfEventStream
 {
   GObject parent_instance;
@@ -122,6 +125,20 @@ _perf_event_open (const struct perf_event_attr *attr,
 GVariant *
 _sysprof_perf_event_attr_to_variant (const struct perf_event_attr *attr)
 {
+  guint32 wakeup_events = attr->wakeup_events;
+  guint32 wakeup_watermark = 0;
+
+  /* sysprofd from before the watermark option ignores both 'watermark'
+   * and 'wakeup_watermark', and reads 'wakeup_events' as a number of
+   * records. Send the watermark converted to records there so that such
+   * a daemon still wakes us up about as often.
+   */
+  if (attr->watermark)
+    {
+      wakeup_watermark = attr->wakeup_watermark;
+      wakeup_events = MAX (1, wakeup_watermark / WATERMARK_RECORD_SIZE);
+    }
+
   return g_variant_take_ref (
     g_variant_new_parsed ("["
                             "{'comm', <%b>},"
@@ -132,10 +149,13 @@ _sysprof_perf_event_attr_to_variant (const struct perf_event_attr *attr)
                             "{'config', <%t>},"
                             "{'disabled', <%b>},"
                             "{'exclude_idle', <%b>},"
+                            "{'freq', <%b>},"
                             "{'mmap', <%b>},"
                             "{'mmap2', <%b>},"
                             "{'build_id', <%b>},"
                             "{'wakeup_events', <%u>},"
+                            "{'watermark', <%b>},"
+                            "{'wakeup_watermark', <%u>},"
                             "{'sample_id_all', <%b>},"
                             "{'sample_period', <%t>},"
                             "{'sample_type', <%t>},"
@@ -152,10 +172,13 @@ _sysprof_perf_event_attr_to_variant (const struct perf_event_attr *attr)
                           (guint64)attr->config,
                           (gboolean)!!attr->disabled,
                           (gboolean)!!attr->exclude_idle,
+                          (gboolean)!!attr->freq,
                           (gboolean)!!attr->mmap,
                           (gboolean)!!attr->mmap2,
                           (gboolean)!!attr->build_id,
-                          (guint32)attr->wakeup_events,
+                          wakeup_events,
+                          (gboolean)!!attr->watermark,
+                          wakeup_watermark,
                           (gboolean)!!attr->sample_id_all,
                           (guint64)attr->sample_period,
                           (guint64)attr->sample_type,
@@ -286,6 +309,10 @@ sysprof_perf_event_stream_flush (SysprofPerfEventStream *self)
 
   self->map->data_tail = tail;
 
+  /* Streams drained from another thread have no source to tune */
+  if (source == NULL)
+    return;
+
   /* If we lost records them we took too long to process events and
    * need to speed up how often we process incoming records. However,
    * if we are the cause of that (due to running to frequently), then
@@ -609,3 +636,48 @@ sysprof_perf_event_stream_disable (SysprofPerfEventStream  *self,
 
   return TRUE;
 }
+
+int
+sysprof_perf_event_stream_get_fd (SysprofPerfEventStream *self)
+{
+  g_return_val_if_fail (SYSPROF_IS_PERF_EVENT_STREAM (self), -1);
+
+  return self->perf_fd;
+}
+
+/**
+ * sysprof_perf_event_stream_detach_source:
+ * @self: a #SysprofPerfEventStream
+ *
+ * Stops draining @self from the main context.
+ *
+ * After calling this, the caller is responsible for calling
+ * sysprof_perf_event_stream_drain() regularly, typically from a thread
+ * which polls sysprof_perf_event_stream_get_fd(). The callback is then
+ * invoked from whichever thread drains the stream, including the final
+ * drain performed by sysprof_perf_event_stream_disable().
+ */
+void
+sysprof_perf_event_stream_detach_source (SysprofPerfEventStream *self)
+{
+  g_return_if_fail (SYSPROF_IS_PERF_EVENT_STREAM (self));
+
+  if (self->source != NULL)
+    {
+      ((SysprofPerfEventSource *)self->source)->stream = NULL;
+      g_source_destroy (self->source);
+      g_clear_pointer (&self->source, g_source_unref);
+    }
+}
+
+void
+sysprof_perf_event_stream_drain (SysprofPerfEventStream *self)
+{
+  g_return_if_fail (SYSPROF_IS_PERF_EVENT_STREAM (self));
+  g_return_if_fail (self->source == NULL);
+
+  if (self->active &&
+      self->map != NULL &&
+      self->tail != self->map->data_head)
+    sysprof_perf_event_stream_flush (self);
+}
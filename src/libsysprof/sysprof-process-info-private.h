@@ -23,6 +23,7 @@
 #include "eggbitset.h"
 
 #include "sysprof-address-layout-private.h"
+#include "sysprof-address-table-private.h"
 #include "sysprof-mount-namespace-private.h"
 #include "sysprof-symbol-cache-private.h"
 
@@ -33,6 +34,7 @@ typedef struct _SysprofProcessInfo
   SysprofAddressLayout  *address_layout;
   SysprofMountNamespace *mount_namespace;
   SysprofSymbolCache    *symbol_cache;
+  SysprofAddressTable   *address_table;
   SysprofSymbol         *fallback_symbol;
   SysprofSymbol         *shared_symbol;
   SysprofSymbol         *symbol;
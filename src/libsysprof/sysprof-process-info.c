@@ -72,6 +72,7 @@ sysprof_process_info_finalize (gpointer data)
   SysprofProcessInfo *self = data;
 
   g_clear_object (&self->address_layout);
+  g_clear_pointer (&self->address_table, sysprof_address_table_free);
   g_clear_object (&self->symbol_cache);
   g_clear_object (&self->mount_namespace);
   g_clear_object (&self->fallback_symbol);
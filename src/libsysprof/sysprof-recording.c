@@ -445,6 +445,9 @@ _sysprof_recording_new (SysprofCaptureWriter  *writer,
   self->writer = sysprof_capture_writer_ref (writer);
   self->use_sysprofd = !!use_sysprofd;
 
+  /* Most samples repeat a handful of stacks, store each of them once */
+  sysprof_capture_writer_set_deduplicate_stacks (self->writer, TRUE);
+
   g_set_object (&self->spawnable, spawnable);
 
   for (guint i = 0; i < n_instruments; i++)
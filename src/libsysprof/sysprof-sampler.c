@@ -20,20 +20,67 @@
 
 #include "config.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <glib/gstdio.h>
+#include <glib-unix.h>
+
+#include "sysprof-enums.h"
 #include "sysprof-instrument-private.h"
+#include "sysprof-muxer-source.h"
 #include "sysprof-perf-event-stream-private.h"
 #include "sysprof-recording-private.h"
 #include "sysprof-sampler.h"
 
 #define N_WAKEUP_EVENTS 149
 
+/* Perf streams are drained on worker threads, each of which services a
+ * group of CPUs. A thread is woken once WAKEUP_WATERMARK bytes are
+ * pending in any of its rings and encodes records into its own capture
+ * writer. That writer is connected to the recording by a pipe, and the
+ * main thread merges each buffer as it arrives.
+ *
+ * A sysprofd which predates watermarks wakes the thread after a similar
+ * number of records instead, see _sysprof_perf_event_attr_to_variant().
+ */
+#define N_CPUS_PER_DRAIN_THREAD 8
+#define WAKEUP_WATERMARK        (32 * 1024)
+#define DRAIN_TIMEOUT_MSEC      250
+#define DRAIN_BUFFER_PAGES      16
+#define DRAIN_PIPE_SIZE         (1024 * 1024)
+
+/* Periods used when neither a frequency nor period is requested */
+static const struct {
+  const char *name;
+  guint32     type;
+  guint64     config;
+  guint64     period;
+} sampler_events[] = {
+  [SYSPROF_SAMPLER_EVENT_CPU_CYCLES]    = { "cpu-cycles",    PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES,    1200000 },
+  [SYSPROF_SAMPLER_EVENT_CPU_CLOCK]     = { "cpu-clock",     PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_CLOCK,     1000000 },
+  [SYSPROF_SAMPLER_EVENT_CACHE_MISSES]  = { "cache-misses",  PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES,  10000 },
+  [SYSPROF_SAMPLER_EVENT_BRANCH_MISSES] = { "branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, 10000 },
+  [SYSPROF_SAMPLER_EVENT_PAGE_FAULTS]   = { "page-faults",   PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS,   100 },
+  [SYSPROF_SAMPLER_EVENT_RAW]           = { "raw",           PERF_TYPE_RAW,      0,                           100000 },
+};
+
 struct _SysprofSampler
 {
   SysprofInstrument  parent_instance;
   GDBusConnection   *connection;
   GPtrArray         *perf_event_streams;
+  GPtrArray         *drainers;
+  DexThreadPool     *drain_pool;
   guint              sample_lost_counter_id;
   gint64             lost_count;
+  SysprofSamplerEvent event;
+  guint64            raw_config;
+  guint64            period;
+  guint              frequency;
 };
 
 struct _SysprofSamplerClass
@@ -46,35 +93,49 @@ typedef struct
   SysprofRecording *recording;
   SysprofCaptureWriter *writer;
   guint lost_counter_id;
-  gint64 lost;
+  /* Shared by every drain thread so the counter is a total */
+  gint64 *lost;
 } StreamData;
 
+typedef struct
+{
+  StreamData *data;
+  GPtrArray *streams;
+  GSource *muxer;
+  DexFuture *future;
+  int wakeup_fd;
+} Drainer;
+
+enum {
+  PROP_0,
+  PROP_EVENT,
+  PROP_FREQUENCY,
+  PROP_PERIOD,
+  PROP_RAW_CONFIG,
+  N_PROPS
+};
+
 G_DEFINE_FINAL_TYPE (SysprofSampler, sysprof_sampler, SYSPROF_TYPE_INSTRUMENT)
 
+static GParamSpec *properties[N_PROPS];
+
 static StreamData *
-stream_data_new (SysprofRecording *recording)
+stream_data_new (SysprofRecording     *recording,
+                 SysprofCaptureWriter *writer,
+                 guint                 lost_counter_id,
+                 gint64               *lost)
 {
-  SysprofCaptureCounter info = {0};
   StreamData *data;
 
   g_assert (SYSPROF_IS_RECORDING (recording));
+  g_assert (writer != NULL);
+  g_assert (lost != NULL);
 
   data = g_atomic_rc_box_new0 (StreamData);
   data->recording = g_object_ref (recording);
-  data->writer = sysprof_capture_writer_ref (_sysprof_recording_writer (recording));
-  data->lost_counter_id = sysprof_capture_writer_request_counter (data->writer, 1);
-  data->lost = 0;
-
-  g_strlcpy (info.category, "Sampler", sizeof info.category);
-  g_strlcpy (info.name, "Lost Samples", sizeof info.name);
-  g_strlcpy (info.description, "Samples dropped due to full ring buffer", sizeof info.description);
-  info.id = data->lost_counter_id;
-  info.type = SYSPROF_CAPTURE_COUNTER_INT64;
-  info.value.v64 = 0;
-
-  sysprof_capture_writer_define_counters (data->writer,
-                                          SYSPROF_CAPTURE_CURRENT_TIME, -1, -1,
-                                          &info, 1);
+  data->writer = sysprof_capture_writer_ref (writer);
+  data->lost_counter_id = lost_counter_id;
+  data->lost = g_atomic_rc_box_acquire (lost);
 
   return data;
 }
@@ -91,6 +152,7 @@ stream_data_finalize (gpointer ptr)
   StreamData *data = ptr;
 
   g_clear_pointer (&data->writer, sysprof_capture_writer_unref);
+  g_clear_pointer (&data->lost, g_atomic_rc_box_release);
   g_clear_object (&data->recording);
 }
 
@@ -102,6 +164,91 @@ stream_data_unref (StreamData *data)
 
 G_DEFINE_AUTOPTR_CLEANUP_FUNC (StreamData, stream_data_unref)
 
+static Drainer *
+drainer_new (SysprofRecording *recording,
+             guint             lost_counter_id,
+             gint64           *lost)
+{
+  SysprofCaptureWriter *writer;
+  g_autofd int read_fd = -1;
+  g_autofd int write_fd = -1;
+  g_autofd int wakeup_fd = -1;
+  Drainer *drainer;
+  int fds[2];
+
+  g_assert (SYSPROF_IS_RECORDING (recording));
+
+  if (pipe2 (fds, O_CLOEXEC) != 0)
+    return NULL;
+
+  read_fd = fds[0];
+  write_fd = fds[1];
+
+#ifdef F_SETPIPE_SZ
+  /* Best effort, a larger pipe lets threads get further ahead of the muxer */
+  (void)fcntl (write_fd, F_SETPIPE_SZ, DRAIN_PIPE_SIZE);
+#endif
+
+  if (-1 == (wakeup_fd = eventfd (0, EFD_CLOEXEC)))
+    return NULL;
+
+  if (!(writer = sysprof_capture_writer_new_from_fd (write_fd, DRAIN_BUFFER_PAGES * sysprof_getpagesize ())))
+    return NULL;
+
+  /* Owned by the writer now */
+  g_steal_fd (&write_fd);
+
+  drainer = g_atomic_rc_box_new0 (Drainer);
+  drainer->data = stream_data_new (recording, writer, lost_counter_id, lost);
+  drainer->streams = g_ptr_array_new_with_free_func (g_object_unref);
+  drainer->muxer = sysprof_muxer_source_new (g_steal_fd (&read_fd), _sysprof_recording_writer (recording));
+  drainer->wakeup_fd = g_steal_fd (&wakeup_fd);
+
+  g_source_set_static_name (drainer->muxer, "[perf-muxer]");
+
+  sysprof_capture_writer_unref (writer);
+
+  return drainer;
+}
+
+static Drainer *
+drainer_ref (Drainer *drainer)
+{
+  return g_atomic_rc_box_acquire (drainer);
+}
+
+static void
+drainer_finalize (gpointer ptr)
+{
+  Drainer *drainer = ptr;
+
+  if (drainer->muxer != NULL)
+    {
+      g_source_destroy (drainer->muxer);
+      g_clear_pointer (&drainer->muxer, g_source_unref);
+    }
+
+  g_clear_pointer (&drainer->streams, g_ptr_array_unref);
+  g_clear_pointer (&drainer->data, stream_data_unref);
+  dex_clear (&drainer->future);
+  g_clear_fd (&drainer->wakeup_fd, NULL);
+}
+
+static void
+drainer_unref (Drainer *drainer)
+{
+  g_atomic_rc_box_release_full (drainer, drainer_finalize);
+}
+
+static void
+drainer_stop (Drainer *drainer)
+{
+  guint64 exiting = 1;
+
+  if (drainer->wakeup_fd != -1)
+    (void)write (drainer->wakeup_fd, &exiting, sizeof exiting);
+}
+
 static char **
 sysprof_sampler_list_required_policy (SysprofInstrument *instrument)
 {
@@ -162,6 +309,43 @@ sysprof_sampler_add_callback (SysprofCaptureWriter            *writer,
                                      n_ips);
 }
 
+typedef struct _FollowProcess
+{
+  SysprofRecording *recording;
+  char *comm;
+  int pid;
+} FollowProcess;
+
+static void
+follow_process_cb (gpointer user_data)
+{
+  FollowProcess *follow = user_data;
+
+  _sysprof_recording_follow_process (follow->recording, follow->pid, follow->comm);
+
+  g_clear_object (&follow->recording);
+  g_free (follow->comm);
+  g_free (follow);
+}
+
+static void
+sysprof_sampler_follow_process (SysprofRecording *recording,
+                                int               pid,
+                                const char       *comm)
+{
+  FollowProcess *follow;
+
+  /* Streams may be drained from a worker thread but instruments
+   * expect to be notified from the main thread.
+   */
+  follow = g_new0 (FollowProcess, 1);
+  follow->recording = g_object_ref (recording);
+  follow->comm = g_strdup (comm);
+  follow->pid = pid;
+
+  dex_scheduler_push (dex_scheduler_get_default (), follow_process_cb, follow);
+}
+
 static void
 sysprof_sampler_perf_event_stream_cb (const SysprofPerfEvent *event,
                                       guint                   cpu,
@@ -176,6 +360,10 @@ sysprof_sampler_perf_event_stream_cb (const SysprofPerfEvent *event,
   g_assert (data != NULL);
   g_assert (event != NULL);
 
+  /* Drain threads release their writer once they have finished */
+  if (writer == NULL)
+    return;
+
   switch (event->header.type)
     {
     case PERF_RECORD_COMM:
@@ -192,9 +380,9 @@ sysprof_sampler_perf_event_stream_cb (const SysprofPerfEvent *event,
                                               event->comm.pid,
                                               event->comm.comm);
 
-          _sysprof_recording_follow_process (recording,
-                                             event->comm.pid,
-                                             event->comm.comm);
+          sysprof_sampler_follow_process (recording,
+                                          event->comm.pid,
+                                          event->comm.comm);
         }
 
       break;
@@ -231,7 +419,7 @@ sysprof_sampler_perf_event_stream_cb (const SysprofPerfEvent *event,
         sysprof_capture_writer_add_log (writer, now, -1, -1, G_LOG_LEVEL_CRITICAL,
                                         "Sampler", message);
 
-        value.v64 = (data->lost += event->lost.lost);
+        value.v64 = __atomic_add_fetch (data->lost, event->lost.lost, __ATOMIC_RELAXED);
         sysprof_capture_writer_set_counters (writer, now, -1, -1,
                                              &data->lost_counter_id, &value, 1);
         break;
@@ -310,13 +498,165 @@ sysprof_sampler_perf_event_stream_cb (const SysprofPerfEvent *event,
     }
 }
 
+static DexFuture *
+sysprof_sampler_drain_thread (gpointer user_data)
+{
+  Drainer *drainer = user_data;
+  g_autofree struct pollfd *pfds = NULL;
+  g_autoptr(GError) error = NULL;
+  guint n_streams;
+
+  g_assert (drainer != NULL);
+  g_assert (drainer->streams != NULL);
+
+  n_streams = drainer->streams->len;
+  pfds = g_new0 (struct pollfd, n_streams + 1);
+
+  for (guint i = 0; i < n_streams; i++)
+    {
+      pfds[i].fd = sysprof_perf_event_stream_get_fd (g_ptr_array_index (drainer->streams, i));
+      pfds[i].events = POLLIN;
+    }
+
+  pfds[n_streams].fd = drainer->wakeup_fd;
+  pfds[n_streams].events = POLLIN;
+
+  /* The watermark may never be reached on mostly idle CPUs, so also
+   * drain periodically to keep process information timely.
+   */
+  for (;;)
+    {
+      if (poll (pfds, n_streams + 1, DRAIN_TIMEOUT_MSEC) < 0 && errno != EINTR)
+        break;
+
+      if (pfds[n_streams].revents != 0)
+        break;
+
+      for (guint i = 0; i < n_streams; i++)
+        sysprof_perf_event_stream_drain (g_ptr_array_index (drainer->streams, i));
+    }
+
+  /* Disabling performs the final drain, so do that from this thread too */
+  for (guint i = 0; i < n_streams; i++)
+    {
+      SysprofPerfEventStream *stream = g_ptr_array_index (drainer->streams, i);
+
+      if (!sysprof_perf_event_stream_disable (stream, &error))
+        g_debug ("%s", error->message);
+
+      g_clear_error (&error);
+    }
+
+  /* Push the last partial buffer to the muxer and close our end of the pipe */
+  sysprof_capture_writer_flush (drainer->data->writer);
+  g_clear_pointer (&drainer->data->writer, sysprof_capture_writer_unref);
+
+  return dex_future_new_for_boolean (TRUE);
+}
+
+static void
+sysprof_sampler_start_drainers (SysprofSampler *self)
+{
+  g_assert (SYSPROF_IS_SAMPLER (self));
+
+  for (guint i = 0; i < self->drainers->len; i++)
+    {
+      Drainer *drainer = g_ptr_array_index (self->drainers, i);
+
+      if (drainer->streams->len == 0)
+        continue;
+
+      g_source_attach (drainer->muxer, NULL);
+
+      drainer->future = dex_thread_pool_submit (self->drain_pool,
+                                                "[sysprof-perf-drain]",
+                                                sysprof_sampler_drain_thread,
+                                                drainer_ref (drainer),
+                                                (GDestroyNotify)drainer_unref);
+    }
+}
+
+static void
+sysprof_sampler_create_drainers (SysprofSampler   *self,
+                                 SysprofRecording *recording,
+                                 guint             n_cpu,
+                                 guint             lost_counter_id,
+                                 gint64           *lost)
+{
+  guint n_drainers;
+
+  g_assert (SYSPROF_IS_SAMPLER (self));
+  g_assert (SYSPROF_IS_RECORDING (recording));
+
+  n_drainers = (n_cpu + N_CPUS_PER_DRAIN_THREAD - 1) / N_CPUS_PER_DRAIN_THREAD;
+
+  if (!(self->drain_pool = dex_thread_pool_new (n_drainers)))
+    return;
+
+  for (guint i = 0; i < n_drainers; i++)
+    {
+      Drainer *drainer;
+
+      if (!(drainer = drainer_new (recording, lost_counter_id, lost)))
+        {
+          g_autoptr(DexThreadPool) pool = g_steal_pointer (&self->drain_pool);
+
+          /* Fall back to draining everything from the main thread */
+          g_ptr_array_remove_range (self->drainers, 0, self->drainers->len);
+          dex_await (dex_thread_pool_close (pool, DEX_THREAD_POOL_SHUTDOWN_DRAIN), NULL);
+          return;
+        }
+
+      g_ptr_array_add (self->drainers, drainer);
+    }
+}
+
 typedef struct _Prepare
 {
-  SysprofRecording *recording;
-  SysprofSampler   *sampler;
-  GDBusConnection  *connection;
+  SysprofRecording    *recording;
+  SysprofSampler      *sampler;
+  GDBusConnection     *connection;
+  SysprofSamplerEvent  event;
+  guint64              raw_config;
+  guint64              period;
+  guint                frequency;
 } Prepare;
 
+static void
+add_sampler_metadata (SysprofCaptureWriter *writer,
+                      SysprofSamplerEvent   event,
+                      guint64               raw_config,
+                      guint                 frequency,
+                      guint64               period)
+{
+  gint64 now = SYSPROF_CAPTURE_CURRENT_TIME;
+  char str[32];
+
+  if (event == SYSPROF_SAMPLER_EVENT_RAW)
+    g_snprintf (str, sizeof str, "raw:0x%"G_GINT64_MODIFIER"x", raw_config);
+  else
+    g_strlcpy (str, sampler_events[event].name, sizeof str);
+
+  sysprof_capture_writer_add_metadata (writer, now, -1, -1,
+                                       "org.gnome.sysprof.sampler.event",
+                                       str, -1);
+
+  if (frequency > 0)
+    {
+      g_snprintf (str, sizeof str, "%u", frequency);
+      sysprof_capture_writer_add_metadata (writer, now, -1, -1,
+                                           "org.gnome.sysprof.sampler.frequency",
+                                           str, -1);
+    }
+  else
+    {
+      g_snprintf (str, sizeof str, "%"G_GUINT64_FORMAT, period);
+      sysprof_capture_writer_add_metadata (writer, now, -1, -1,
+                                           "org.gnome.sysprof.sampler.period",
+                                           str, -1);
+    }
+}
+
 static void
 prepare_free (Prepare *prepare)
 {
@@ -330,19 +670,32 @@ static DexFuture *
 sysprof_sampler_prepare_fiber (gpointer user_data)
 {
   Prepare *prepare = user_data;
+  SysprofSampler *self;
   g_autoptr(StreamData) stream_data = NULL;
   g_autoptr(GPtrArray) futures = NULL;
   g_autoptr(GError) error = NULL;
+  SysprofCaptureCounter info = {0};
+  SysprofCaptureWriter *writer;
   struct perf_event_attr attr = {0};
+  SysprofSamplerEvent event;
+  gint64 *lost;
+  guint lost_counter_id;
   gboolean with_mmap2 = TRUE;
+  guint64 period;
+  guint frequency;
   guint n_cpu;
-  gboolean use_software = FALSE;
 
   g_assert (prepare != NULL);
   g_assert (SYSPROF_IS_RECORDING (prepare->recording));
   g_assert (SYSPROF_IS_SAMPLER (prepare->sampler));
   g_assert (!prepare->connection || G_IS_DBUS_CONNECTION (prepare->connection));
 
+  self = prepare->sampler;
+  writer = _sysprof_recording_writer (prepare->recording);
+  event = prepare->event;
+  period = prepare->period;
+  frequency = prepare->frequency;
+
   /* First thing we need to do is to ensure the consumer has
    * access to kallsyms, which may be from a machine, or boot
    * different than this boot (and therefore symbols exist in
@@ -374,13 +727,37 @@ sysprof_sampler_prepare_fiber (gpointer user_data)
   n_cpu = g_get_num_processors ();
   futures = g_ptr_array_new_with_free_func (dex_unref);
 
+  lost_counter_id = sysprof_capture_writer_request_counter (writer, 1);
+  lost = g_atomic_rc_box_new0 (gint64);
+
+  g_strlcpy (info.category, "Sampler", sizeof info.category);
+  g_strlcpy (info.name, "Lost Samples", sizeof info.name);
+  g_strlcpy (info.description, "Samples dropped due to full ring buffer", sizeof info.description);
+  info.id = lost_counter_id;
+  info.type = SYSPROF_CAPTURE_COUNTER_INT64;
+  info.value.v64 = 0;
+
+  sysprof_capture_writer_define_counters (writer,
+                                          SYSPROF_CAPTURE_CURRENT_TIME, -1, -1,
+                                          &info, 1);
+
+  /* A single thread cannot keep up with draining every CPU on large
+   * machines, so spread the streams across a few drain threads. If
+   * that is not possible, streams are drained from the main context.
+   */
+  sysprof_sampler_create_drainers (self, prepare->recording, n_cpu, lost_counter_id, lost);
+
+  if (self->drainers->len == 0)
+    stream_data = stream_data_new (prepare->recording, writer, lost_counter_id, lost);
+
+  g_atomic_rc_box_release (lost);
+
 try_again:
   attr.sample_type = PERF_SAMPLE_IP
                    | PERF_SAMPLE_TID
                    | PERF_SAMPLE_IDENTIFIER
                    | PERF_SAMPLE_CALLCHAIN
                    | PERF_SAMPLE_TIME;
-  attr.wakeup_events = N_WAKEUP_EVENTS;
   attr.disabled = TRUE;
   attr.mmap = TRUE;
   attr.mmap2 = with_mmap2;
@@ -394,35 +771,60 @@ try_again:
   attr.use_clockid = 1;
 #endif
 
+  if (self->drainers->len > 0)
+    {
+      attr.watermark = 1;
+      attr.wakeup_watermark = WAKEUP_WATERMARK;
+    }
+  else
+    {
+      attr.wakeup_events = N_WAKEUP_EVENTS;
+    }
+
   attr.size = sizeof attr;
 
-  if (use_software)
+  attr.type = sampler_events[event].type;
+
+  if (event == SYSPROF_SAMPLER_EVENT_RAW)
+    attr.config = prepare->raw_config;
+  else
+    attr.config = sampler_events[event].config;
+
+  /* sample_freq shares storage with sample_period */
+  if (frequency > 0)
     {
-      attr.type = PERF_TYPE_SOFTWARE;
-      attr.config = PERF_COUNT_SW_CPU_CLOCK;
-      attr.sample_period = 1000000;
+      attr.freq = 1;
+      attr.sample_freq = frequency;
     }
   else
     {
-      attr.type = PERF_TYPE_HARDWARE;
-      attr.config = PERF_COUNT_HW_CPU_CYCLES;
-      attr.sample_period = 1200000;
+      if (period == 0)
+        period = sampler_events[event].period;
+
+      attr.freq = 0;
+      attr.sample_period = period;
     }
 
   /* Pipeline our request for n_cpu perf_event_open calls and then
    * await them all to complete.
    */
-  stream_data = stream_data_new (prepare->recording);
   for (guint i = 0; i < n_cpu; i++)
-    g_ptr_array_add (futures,
-                     sysprof_perf_event_stream_new (prepare->connection,
-                                                    &attr,
-                                                    i,
-                                                    -1,
-                                                    0,
-                                                    sysprof_sampler_perf_event_stream_cb,
-                                                    stream_data_ref (stream_data),
-                                                    (GDestroyNotify)stream_data_unref));
+    {
+      StreamData *data = stream_data;
+
+      if (self->drainers->len > 0)
+        data = ((Drainer *)g_ptr_array_index (self->drainers, i % self->drainers->len))->data;
+
+      g_ptr_array_add (futures,
+                       sysprof_perf_event_stream_new (prepare->connection,
+                                                      &attr,
+                                                      i,
+                                                      -1,
+                                                      0,
+                                                      sysprof_sampler_perf_event_stream_cb,
+                                                      stream_data_ref (data),
+                                                      (GDestroyNotify)stream_data_unref));
+    }
 
   if (!dex_await (dex_future_allv ((DexFuture **)futures->pdata, futures->len), &error))
     {
@@ -453,14 +855,43 @@ try_again:
             {
               with_mmap2 = FALSE;
               g_ptr_array_remove_range (futures, 0, futures->len);
+              g_clear_error (&error);
               goto try_again;
             }
 
-          if (use_software == FALSE)
+          /* sysprofd before the freq option reads the frequency as a
+           * period, which it rejects as too short, and the kernel rejects
+           * frequencies above perf_event_max_sample_rate. Either way fall
+           * back to sampling by period, which is exact for the CPU clock.
+           */
+          if (frequency > 0)
             {
+              _sysprof_recording_diagnostic (prepare->recording,
+                                             "Sampler",
+                                             "Sampling at %u Hz is not supported, sampling by period instead",
+                                             frequency);
+
+              if (event == SYSPROF_SAMPLER_EVENT_CPU_CLOCK)
+                period = MAX (1, SYSPROF_NSEC_PER_SEC / frequency);
+              else
+                period = 0;
+
+              frequency = 0;
               with_mmap2 = TRUE;
-              use_software = TRUE;
               g_ptr_array_remove_range (futures, 0, futures->len);
+              g_clear_error (&error);
+              goto try_again;
+            }
+
+          /* Not every machine (or VM) exposes a cycle counter */
+          if (event == SYSPROF_SAMPLER_EVENT_CPU_CYCLES)
+            {
+              with_mmap2 = TRUE;
+              event = SYSPROF_SAMPLER_EVENT_CPU_CLOCK;
+              period = 0;
+              frequency = prepare->frequency;
+              g_ptr_array_remove_range (futures, 0, futures->len);
+              g_clear_error (&error);
               goto try_again;
             }
 
@@ -479,8 +910,18 @@ try_again:
       g_autoptr(SysprofPerfEventStream) stream = NULL;
       g_autoptr(GError) stream_error = NULL;
 
-      if ((stream = dex_await_object (dex_ref (future), &stream_error)))
-        g_ptr_array_add (prepare->sampler->perf_event_streams, g_steal_pointer (&stream));
+      if (!(stream = dex_await_object (dex_ref (future), &stream_error)))
+        continue;
+
+      if (self->drainers->len > 0)
+        {
+          Drainer *drainer = g_ptr_array_index (self->drainers, i % self->drainers->len);
+
+          sysprof_perf_event_stream_detach_source (stream);
+          g_ptr_array_add (drainer->streams, g_object_ref (stream));
+        }
+
+      g_ptr_array_add (prepare->sampler->perf_event_streams, g_steal_pointer (&stream));
     }
 
   /* Start all of the samplers immediately as we will drop events that
@@ -499,6 +940,11 @@ try_again:
       g_clear_error (&error);
     }
 
+  if (self->drainers->len > 0)
+    sysprof_sampler_start_drainers (self);
+
+  add_sampler_metadata (writer, event, prepare->raw_config, frequency, period);
+
   return dex_future_new_for_boolean (TRUE);
 }
 
@@ -516,6 +962,10 @@ sysprof_sampler_prepare (SysprofInstrument *instrument,
   g_set_object (&prepare->recording, recording);
   g_set_object (&prepare->sampler, self);
   g_set_object (&prepare->connection, self->connection);
+  prepare->event = self->event;
+  prepare->raw_config = self->raw_config;
+  prepare->period = self->period;
+  prepare->frequency = self->frequency;
 
   return dex_scheduler_spawn (NULL, 0,
                               sysprof_sampler_prepare_fiber,
@@ -539,6 +989,47 @@ record_free (Record *record)
   g_free (record);
 }
 
+static void
+sysprof_sampler_stop_drainers (SysprofSampler *self)
+{
+  g_autoptr(DexThreadPool) pool = NULL;
+  g_autoptr(GPtrArray) futures = NULL;
+
+  g_assert (SYSPROF_IS_SAMPLER (self));
+
+  futures = g_ptr_array_new_with_free_func (dex_unref);
+
+  for (guint i = 0; i < self->drainers->len; i++)
+    {
+      Drainer *drainer = g_ptr_array_index (self->drainers, i);
+
+      if (drainer->future != NULL)
+        {
+          drainer_stop (drainer);
+          g_ptr_array_add (futures, dex_ref (drainer->future));
+        }
+    }
+
+  /* The muxers keep merging on this thread while the drain threads
+   * finish, which matters as they may block writing to a full pipe.
+   */
+  if (futures->len > 0)
+    dex_await (dex_future_allv ((DexFuture **)futures->pdata, futures->len), NULL);
+
+  /* Now that every writer is closed, take whatever is left in the pipes */
+  for (guint i = 0; i < self->drainers->len; i++)
+    {
+      Drainer *drainer = g_ptr_array_index (self->drainers, i);
+
+      sysprof_muxer_source_drain (drainer->muxer);
+    }
+
+  g_ptr_array_remove_range (self->drainers, 0, self->drainers->len);
+
+  if ((pool = g_steal_pointer (&self->drain_pool)))
+    dex_await (dex_thread_pool_close (pool, DEX_THREAD_POOL_SHUTDOWN_DRAIN), NULL);
+}
+
 static DexFuture *
 sysprof_sampler_record_fiber (gpointer user_data)
 {
@@ -553,6 +1044,12 @@ sysprof_sampler_record_fiber (gpointer user_data)
   if (!dex_await (dex_ref (record->cancellable), &error))
     g_debug ("Sampler shutting down for reason: %s", error->message);
 
+  g_clear_error (&error);
+
+  if (record->sampler->drainers->len > 0)
+    sysprof_sampler_stop_drainers (record->sampler);
+
+  /* Streams drained from a thread were already disabled there */
   for (guint i = 0; i < record->sampler->perf_event_streams->len; i++)
     {
       SysprofPerfEventStream *stream = g_ptr_array_index (record->sampler->perf_event_streams, i);
@@ -604,13 +1101,84 @@ static void
 sysprof_sampler_finalize (GObject *object)
 {
   SysprofSampler *self = (SysprofSampler *)object;
+  g_autoptr(DexThreadPool) pool = g_steal_pointer (&self->drain_pool);
+
+  /* Drain threads hold their own reference and exit once woken */
+  if (self->drainers != NULL)
+    {
+      for (guint i = 0; i < self->drainers->len; i++)
+        drainer_stop (g_ptr_array_index (self->drainers, i));
+    }
 
+  g_clear_pointer (&self->drainers, g_ptr_array_unref);
   g_clear_pointer (&self->perf_event_streams, g_ptr_array_unref);
   g_clear_object (&self->connection);
 
   G_OBJECT_CLASS (sysprof_sampler_parent_class)->finalize (object);
 }
 
+static void
+sysprof_sampler_get_property (GObject    *object,
+                              guint       prop_id,
+                              GValue     *value,
+                              GParamSpec *pspec)
+{
+  SysprofSampler *self = SYSPROF_SAMPLER (object);
+
+  switch (prop_id)
+    {
+    case PROP_EVENT:
+      g_value_set_enum (value, sysprof_sampler_get_event (self));
+      break;
+
+    case PROP_FREQUENCY:
+      g_value_set_uint (value, sysprof_sampler_get_frequency (self));
+      break;
+
+    case PROP_PERIOD:
+      g_value_set_uint64 (value, sysprof_sampler_get_period (self));
+      break;
+
+    case PROP_RAW_CONFIG:
+      g_value_set_uint64 (value, sysprof_sampler_get_raw_config (self));
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+    }
+}
+
+static void
+sysprof_sampler_set_property (GObject      *object,
+                              guint         prop_id,
+                              const GValue *value,
+                              GParamSpec   *pspec)
+{
+  SysprofSampler *self = SYSPROF_SAMPLER (object);
+
+  switch (prop_id)
+    {
+    case PROP_EVENT:
+      sysprof_sampler_set_event (self, g_value_get_enum (value));
+      break;
+
+    case PROP_FREQUENCY:
+      sysprof_sampler_set_frequency (self, g_value_get_uint (value));
+      break;
+
+    case PROP_PERIOD:
+      sysprof_sampler_set_period (self, g_value_get_uint64 (value));
+      break;
+
+    case PROP_RAW_CONFIG:
+      sysprof_sampler_set_raw_config (self, g_value_get_uint64 (value));
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+    }
+}
+
 static void
 sysprof_sampler_class_init (SysprofSamplerClass *klass)
 {
@@ -618,17 +1186,51 @@ sysprof_sampler_class_init (SysprofSamplerClass *klass)
   SysprofInstrumentClass *instrument_class = SYSPROF_INSTRUMENT_CLASS (klass);
 
   object_class->finalize = sysprof_sampler_finalize;
+  object_class->get_property = sysprof_sampler_get_property;
+  object_class->set_property = sysprof_sampler_set_property;
 
   instrument_class->list_required_policy = sysprof_sampler_list_required_policy;
   instrument_class->prepare = sysprof_sampler_prepare;
   instrument_class->record = sysprof_sampler_record;
   instrument_class->set_connection = sysprof_sampler_set_connection;
+
+  properties[PROP_EVENT] =
+    g_param_spec_enum ("event", NULL, NULL,
+                       SYSPROF_TYPE_SAMPLER_EVENT,
+                       SYSPROF_SAMPLER_EVENT_CPU_CYCLES,
+                       (G_PARAM_READWRITE |
+                        G_PARAM_EXPLICIT_NOTIFY |
+                        G_PARAM_STATIC_STRINGS));
+
+  properties[PROP_FREQUENCY] =
+    g_param_spec_uint ("frequency", NULL, NULL,
+                       0, G_MAXUINT, 0,
+                       (G_PARAM_READWRITE |
+                        G_PARAM_EXPLICIT_NOTIFY |
+                        G_PARAM_STATIC_STRINGS));
+
+  properties[PROP_PERIOD] =
+    g_param_spec_uint64 ("period", NULL, NULL,
+                         0, G_MAXUINT64, 0,
+                         (G_PARAM_READWRITE |
+                          G_PARAM_EXPLICIT_NOTIFY |
+                          G_PARAM_STATIC_STRINGS));
+
+  properties[PROP_RAW_CONFIG] =
+    g_param_spec_uint64 ("raw-config", NULL, NULL,
+                         0, G_MAXUINT64, 0,
+                         (G_PARAM_READWRITE |
+                          G_PARAM_EXPLICIT_NOTIFY |
+                          G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_properties (object_class, N_PROPS, properties);
 }
 
 static void
 sysprof_sampler_init (SysprofSampler *self)
 {
   self->perf_event_streams = g_ptr_array_new_with_free_func (g_object_unref);
+  self->drainers = g_ptr_array_new_with_free_func ((GDestroyNotify)drainer_unref);
 }
 
 SysprofInstrument *
@@ -636,3 +1238,138 @@ sysprof_sampler_new (void)
 {
   return g_object_new (SYSPROF_TYPE_SAMPLER, NULL);
 }
+
+SysprofSamplerEvent
+sysprof_sampler_get_event (SysprofSampler *self)
+{
+  g_return_val_if_fail (SYSPROF_IS_SAMPLER (self), 0);
+
+  return self->event;
+}
+
+/**
+ * sysprof_sampler_set_event:
+ * @self: a #SysprofSampler
+ * @event: the event which triggers a sample
+ *
+ * Sets the perf event used to take samples. This must be set before
+ * the recording is started.
+ *
+ * The chosen event is recorded in the capture metadata as
+ * "org.gnome.sysprof.sampler.event".
+ *
+ * Since: 51
+ */
+void
+sysprof_sampler_set_event (SysprofSampler      *self,
+                           SysprofSamplerEvent  event)
+{
+  g_return_if_fail (SYSPROF_IS_SAMPLER (self));
+  g_return_if_fail (event < G_N_ELEMENTS (sampler_events));
+
+  if (event != self->event)
+    {
+      self->event = event;
+      g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_EVENT]);
+    }
+}
+
+guint64
+sysprof_sampler_get_raw_config (SysprofSampler *self)
+{
+  g_return_val_if_fail (SYSPROF_IS_SAMPLER (self), 0);
+
+  return self->raw_config;
+}
+
+/**
+ * sysprof_sampler_set_raw_config:
+ * @self: a #SysprofSampler
+ * @raw_config: a PMU specific event code
+ *
+ * Sets the event code to use with %SYSPROF_SAMPLER_EVENT_RAW.
+ *
+ * Since: 51
+ */
+void
+sysprof_sampler_set_raw_config (SysprofSampler *self,
+                                guint64         raw_config)
+{
+  g_return_if_fail (SYSPROF_IS_SAMPLER (self));
+
+  if (raw_config != self->raw_config)
+    {
+      self->raw_config = raw_config;
+      g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_RAW_CONFIG]);
+    }
+}
+
+guint
+sysprof_sampler_get_frequency (SysprofSampler *self)
+{
+  g_return_val_if_fail (SYSPROF_IS_SAMPLER (self), 0);
+
+  return self->frequency;
+}
+
+/**
+ * sysprof_sampler_set_frequency:
+ * @self: a #SysprofSampler
+ * @frequency: samples per second, or 0
+ *
+ * Requests approximately @frequency samples per second on each CPU,
+ * letting the kernel adjust the period as the event rate changes.
+ *
+ * If @frequency is non-zero it takes precedence over
+ * #SysprofSampler:period. The kernel limits the frequency to
+ * `/proc/sys/kernel/perf_event_max_sample_rate`.
+ *
+ * If the frequency cannot be used, such as with an older sysprofd, the
+ * event is sampled by period instead. For the CPU clock that period
+ * matches @frequency, otherwise the default period of the event is used.
+ *
+ * Since: 51
+ */
+void
+sysprof_sampler_set_frequency (SysprofSampler *self,
+                               guint           frequency)
+{
+  g_return_if_fail (SYSPROF_IS_SAMPLER (self));
+
+  if (frequency != self->frequency)
+    {
+      self->frequency = frequency;
+      g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_FREQUENCY]);
+    }
+}
+
+guint64
+sysprof_sampler_get_period (SysprofSampler *self)
+{
+  g_return_val_if_fail (SYSPROF_IS_SAMPLER (self), 0);
+
+  return self->period;
+}
+
+/**
+ * sysprof_sampler_set_period:
+ * @self: a #SysprofSampler
+ * @period: the number of events between samples, or 0
+ *
+ * Sets a fixed number of events between samples. If @period is 0, a
+ * default suitable for #SysprofSampler:event is used.
+ *
+ * Since: 51
+ */
+void
+sysprof_sampler_set_period (SysprofSampler *self,
+                            guint64         period)
+{
+  g_return_if_fail (SYSPROF_IS_SAMPLER (self));
+
+  if (period != self->period)
+    {
+      self->period = period;
+      g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_PERIOD]);
+    }
+}
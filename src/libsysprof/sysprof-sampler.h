@@ -32,10 +32,40 @@ G_BEGIN_DECLS
 typedef struct _SysprofSampler      SysprofSampler;
 typedef struct _SysprofSamplerClass SysprofSamplerClass;
 
+typedef enum _SysprofSamplerEvent
+{
+  SYSPROF_SAMPLER_EVENT_CPU_CYCLES,
+  SYSPROF_SAMPLER_EVENT_CPU_CLOCK,
+  SYSPROF_SAMPLER_EVENT_CACHE_MISSES,
+  SYSPROF_SAMPLER_EVENT_BRANCH_MISSES,
+  SYSPROF_SAMPLER_EVENT_PAGE_FAULTS,
+  SYSPROF_SAMPLER_EVENT_RAW,
+} SysprofSamplerEvent;
+
 SYSPROF_AVAILABLE_IN_ALL
-GType              sysprof_sampler_get_type (void) G_GNUC_CONST;
+GType               sysprof_sampler_get_type       (void) G_GNUC_CONST;
 SYSPROF_AVAILABLE_IN_ALL
-SysprofInstrument *sysprof_sampler_new      (void);
+SysprofInstrument  *sysprof_sampler_new            (void);
+SYSPROF_AVAILABLE_IN_51
+SysprofSamplerEvent sysprof_sampler_get_event      (SysprofSampler      *self);
+SYSPROF_AVAILABLE_IN_51
+void                sysprof_sampler_set_event      (SysprofSampler      *self,
+                                                    SysprofSamplerEvent  event);
+SYSPROF_AVAILABLE_IN_51
+guint64             sysprof_sampler_get_raw_config (SysprofSampler      *self);
+SYSPROF_AVAILABLE_IN_51
+void                sysprof_sampler_set_raw_config (SysprofSampler      *self,
+                                                    guint64              raw_config);
+SYSPROF_AVAILABLE_IN_51
+guint               sysprof_sampler_get_frequency  (SysprofSampler      *self);
+SYSPROF_AVAILABLE_IN_51
+void                sysprof_sampler_set_frequency  (SysprofSampler      *self,
+                                                    guint                frequency);
+SYSPROF_AVAILABLE_IN_51
+guint64             sysprof_sampler_get_period     (SysprofSampler      *self);
+SYSPROF_AVAILABLE_IN_51
+void                sysprof_sampler_set_period     (SysprofSampler      *self,
+                                                    guint64              period);
 
 G_DEFINE_AUTOPTR_CLEANUP_FUNC (SysprofSampler, g_object_unref)
 
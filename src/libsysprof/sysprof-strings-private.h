@@ -26,11 +26,13 @@ G_BEGIN_DECLS
 
 typedef struct _SysprofStrings SysprofStrings;
 
-SysprofStrings *sysprof_strings_new    (void);
-SysprofStrings *sysprof_strings_ref    (SysprofStrings *self);
-void            sysprof_strings_unref  (SysprofStrings *self);
-GRefString     *sysprof_strings_get    (SysprofStrings *self,
-                                        const char     *string);
+SysprofStrings *sysprof_strings_new           (void);
+SysprofStrings *sysprof_strings_ref           (SysprofStrings *self);
+void            sysprof_strings_unref         (SysprofStrings *self);
+GRefString     *sysprof_strings_get           (SysprofStrings *self,
+                                               const char     *string);
+GRefString     *sysprof_strings_get_demangled (SysprofStrings *self,
+                                               const char     *name);
 
 #define SYSPROF_STRV_INIT(...) ((const char * const[]){__VA_ARGS__,NULL})
 
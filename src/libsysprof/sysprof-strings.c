@@ -20,12 +20,16 @@
 
 #include "config.h"
 
+#include "elfparser.h"
+
 #include "sysprof-strings-private.h"
 
 struct _SysprofStrings
 {
   GMutex      mutex;
   GHashTable *hashtable;
+  /* Mangled name -> interned demangled name, borrowed from @hashtable */
+  GHashTable *demangled;
 };
 
 SysprofStrings *
@@ -39,6 +43,7 @@ sysprof_strings_new (void)
                                            g_str_equal,
                                            (GDestroyNotify)g_ref_string_release,
                                            NULL);
+  self->demangled = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
 
   return self;
 }
@@ -55,6 +60,7 @@ sysprof_strings_finalize (gpointer data)
   SysprofStrings *self = data;
 
   g_mutex_clear (&self->mutex);
+  g_clear_pointer (&self->demangled, g_hash_table_unref);
   g_clear_pointer (&self->hashtable, g_hash_table_unref);
 }
 
@@ -64,6 +70,21 @@ sysprof_strings_unref (SysprofStrings *self)
   g_atomic_rc_box_release_full (self, sysprof_strings_finalize);
 }
 
+static GRefString *
+sysprof_strings_get_locked (SysprofStrings *self,
+                            const char     *string)
+{
+  GRefString *ret;
+
+  if (!(ret = g_hash_table_lookup (self->hashtable, string)))
+    {
+      ret = g_ref_string_new (string);
+      g_hash_table_insert (self->hashtable, ret, ret);
+    }
+
+  return ret;
+}
+
 GRefString *
 sysprof_strings_get (SysprofStrings *self,
                      const char     *string)
@@ -74,10 +95,56 @@ sysprof_strings_get (SysprofStrings *self,
     return NULL;
 
   g_mutex_lock (&self->mutex);
-  if (!(ret = g_hash_table_lookup (self->hashtable, string)))
+  ret = g_ref_string_acquire (sysprof_strings_get_locked (self, string));
+  g_mutex_unlock (&self->mutex);
+
+  return ret;
+}
+
+/**
+ * sysprof_strings_get_demangled:
+ * @self: a #SysprofStrings
+ * @name: (nullable): a symbol name which may be mangled
+ *
+ * Like sysprof_strings_get() but demangles C++ and Rust symbol names.
+ *
+ * The same mangled names show up across many processes and objects, so
+ * the result is memoized and each unique name is only demangled once.
+ * Demangling happens without the lock held so that symbolizing threads
+ * do not serialize on it.
+ *
+ * Returns: (transfer full) (nullable): an interned, demangled name
+ */
+GRefString *
+sysprof_strings_get_demangled (SysprofStrings *self,
+                               const char     *name)
+{
+  g_autofree char *demangled = NULL;
+  GRefString *ret;
+
+  if (name == NULL)
+    return NULL;
+
+  if (name[0] != '_' || (name[1] != 'Z' && name[1] != 'R'))
+    return sysprof_strings_get (self, name);
+
+  g_mutex_lock (&self->mutex);
+  ret = g_hash_table_lookup (self->demangled, name);
+  if (ret != NULL)
+    g_ref_string_acquire (ret);
+  g_mutex_unlock (&self->mutex);
+
+  if (ret != NULL)
+    return ret;
+
+  demangled = elf_demangle (name);
+
+  g_mutex_lock (&self->mutex);
+  /* Another thread may have raced us to demangle @name */
+  if (!(ret = g_hash_table_lookup (self->demangled, name)))
     {
-      ret = g_ref_string_new (string);
-      g_hash_table_insert (self->hashtable, ret, ret);
+      ret = sysprof_strings_get_locked (self, demangled);
+      g_hash_table_insert (self->demangled, g_strdup (name), ret);
     }
   g_ref_string_acquire (ret);
   g_mutex_unlock (&self->mutex);
@@ -35,6 +35,7 @@ SysprofSymbol      *sysprof_symbol_cache_lookup          (SysprofSymbolCache *se
                                                           SysprofAddress      address);
 void                sysprof_symbol_cache_take            (SysprofSymbolCache *self,
                                                           SysprofSymbol      *symbol);
+void                sysprof_symbol_cache_freeze          (SysprofSymbolCache *self);
 void                sysprof_symbol_cache_populate_packed (SysprofSymbolCache *self,
                                                           GArray             *array,
                                                           GByteArray         *strings,
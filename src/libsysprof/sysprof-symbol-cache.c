@@ -39,10 +39,28 @@ struct _SysprofSymbolCacheNode
   guint64 max;
 };
 
+typedef struct _SysprofSymbolCacheEntry
+{
+  guint64        high;
+  guint64        max;
+  SysprofSymbol *symbol;
+} SysprofSymbolCacheEntry;
+
 struct _SysprofSymbolCache
 {
   GObject parent_instance;
   RB_HEAD(sysprof_symbol_cache, _SysprofSymbolCacheNode) head;
+
+  /* When frozen, the tree is empty and the symbols are instead stored
+   * in flat arrays sorted by low address. @lows is kept separate from
+   * @entries so the binary search only touches a dense array of keys.
+   * Each entry's max is the highest address covered by that entry or
+   * any entry before it, which lets us handle overlapping symbols.
+   */
+  guint64                 *lows;
+  SysprofSymbolCacheEntry *entries;
+  guint                    n_entries;
+  guint                    frozen : 1;
 };
 
 G_DEFINE_FINAL_TYPE (SysprofSymbolCache, sysprof_symbol_cache, G_TYPE_OBJECT)
@@ -95,6 +113,33 @@ sysprof_symbol_cache_node_free (SysprofSymbolCacheNode *node)
     sysprof_symbol_cache_node_free (right);
 }
 
+static void sysprof_symbol_cache_insert (SysprofSymbolCache *self,
+                                         SysprofSymbol      *symbol);
+
+static void
+sysprof_symbol_cache_clear_frozen (SysprofSymbolCache *self)
+{
+  for (guint i = 0; i < self->n_entries; i++)
+    g_clear_object (&self->entries[i].symbol);
+
+  g_clear_pointer (&self->lows, g_free);
+  g_clear_pointer (&self->entries, g_free);
+  self->n_entries = 0;
+  self->frozen = FALSE;
+}
+
+static void
+sysprof_symbol_cache_thaw (SysprofSymbolCache *self)
+{
+  g_assert (self->frozen);
+  g_assert (RB_EMPTY (&self->head));
+
+  for (guint i = 0; i < self->n_entries; i++)
+    sysprof_symbol_cache_insert (self, g_steal_pointer (&self->entries[i].symbol));
+
+  sysprof_symbol_cache_clear_frozen (self);
+}
+
 static void
 sysprof_symbol_cache_finalize (GObject *object)
 {
@@ -104,6 +149,8 @@ sysprof_symbol_cache_finalize (GObject *object)
   if (node != NULL)
     sysprof_symbol_cache_node_free (node);
 
+  sysprof_symbol_cache_clear_frozen (self);
+
   G_OBJECT_CLASS (sysprof_symbol_cache_parent_class)->finalize (object);
 }
 
@@ -131,14 +178,24 @@ void
 sysprof_symbol_cache_take (SysprofSymbolCache *self,
                            SysprofSymbol      *symbol)
 {
-  SysprofSymbolCacheNode *node;
-  SysprofSymbolCacheNode *parent;
-  SysprofSymbolCacheNode *ret;
-
   g_return_if_fail (SYSPROF_IS_SYMBOL_CACHE (self));
   g_return_if_fail (SYSPROF_IS_SYMBOL (symbol));
   g_return_if_fail (symbol->end_address > symbol->begin_address);
 
+  if (self->frozen)
+    sysprof_symbol_cache_thaw (self);
+
+  sysprof_symbol_cache_insert (self, symbol);
+}
+
+static void
+sysprof_symbol_cache_insert (SysprofSymbolCache *self,
+                             SysprofSymbol      *symbol)
+{
+  SysprofSymbolCacheNode *node;
+  SysprofSymbolCacheNode *parent;
+  SysprofSymbolCacheNode *ret;
+
   /* Some symbols are not suitable for our interval tree */
   if (symbol->begin_address == 0 ||
       symbol->end_address == 0 ||
@@ -174,6 +231,101 @@ sysprof_symbol_cache_take (SysprofSymbolCache *self,
     }
 }
 
+/**
+ * sysprof_symbol_cache_freeze:
+ * @self: a #SysprofSymbolCache
+ *
+ * Compacts the interval tree into flat arrays sorted by address.
+ *
+ * Symbols are inserted during symbolization and then only read, so once
+ * that is complete the cache can be frozen to make lookups cheaper and
+ * drop the per-symbol tree nodes. Taking another symbol will thaw the
+ * cache back into a tree.
+ */
+void
+sysprof_symbol_cache_freeze (SysprofSymbolCache *self)
+{
+  SysprofSymbolCacheNode *node;
+  guint64 max = 0;
+  guint n_entries = 0;
+  guint i = 0;
+
+  g_return_if_fail (SYSPROF_IS_SYMBOL_CACHE (self));
+
+  if (self->frozen)
+    return;
+
+  RB_FOREACH(node, sysprof_symbol_cache, &self->head)
+    n_entries++;
+
+  self->lows = g_new (guint64, n_entries);
+  self->entries = g_new (SysprofSymbolCacheEntry, n_entries);
+  self->n_entries = n_entries;
+  self->frozen = TRUE;
+
+  /* In-order traversal gives us entries sorted by low address */
+  RB_FOREACH(node, sysprof_symbol_cache, &self->head) {
+    max = MAX (max, node->high);
+
+    self->lows[i] = node->low;
+    self->entries[i].high = node->high;
+    self->entries[i].max = max;
+    self->entries[i].symbol = g_steal_pointer (&node->symbol);
+
+    i++;
+  }
+
+  g_assert (i == n_entries);
+
+  if ((node = RB_ROOT(&self->head)))
+    sysprof_symbol_cache_node_free (node);
+
+  RB_INIT (&self->head);
+}
+
+static SysprofSymbol *
+sysprof_symbol_cache_lookup_frozen (SysprofSymbolCache *self,
+                                    SysprofAddress      address)
+{
+  const guint64 *base = self->lows;
+  guint len = self->n_entries;
+  guint pos;
+
+  if (len == 0 || address < base[0])
+    return NULL;
+
+  /* Branchless search for the last entry with low <= address. The
+   * compiler turns the conditional into a cmov so there are no
+   * mispredicted branches and the loop runs a fixed number of times.
+   */
+  while (len > 1)
+    {
+      guint half = len / 2;
+
+      base = (base[half] <= address) ? base + half : base;
+      len -= half;
+    }
+
+  pos = base - self->lows;
+
+  if (address <= self->entries[pos].high)
+    return self->entries[pos].symbol;
+
+  /* Overlapping symbols are rare, but an earlier entry could still
+   * cover @address. The running max lets us stop as soon as nothing
+   * before this position could reach it.
+   */
+  while (pos > 0 && self->entries[pos-1].max >= address)
+    {
+      pos--;
+
+      if (address <= self->entries[pos].high)
+        return self->entries[pos].symbol;
+    }
+
+  return NULL;
+}
+
 SysprofSymbol *
 sysprof_symbol_cache_lookup (SysprofSymbolCache *self,
                              SysprofAddress      address)
@@ -185,6 +337,9 @@ sysprof_symbol_cache_lookup (SysprofSymbolCache *self,
   if (address == 0)
     return NULL;
 
+  if (self->frozen)
+    return sysprof_symbol_cache_lookup_frozen (self, address);
+
   node = RB_ROOT(&self->head);
 
   /* The root node contains our calculated max as augmented in RBTree.
@@ -235,6 +390,27 @@ get_string (GByteArray *strings,
   return pos;
 }
 
+static void
+populate_packed (SysprofSymbol *symbol,
+                 GArray        *array,
+                 GByteArray    *strings,
+                 GHashTable    *strings_offset,
+                 int            pid)
+{
+  SysprofPackedSymbol packed;
+
+  if (symbol->is_fallback)
+    return;
+
+  packed.addr_begin = symbol->begin_address;
+  packed.addr_end = symbol->end_address;
+  packed.pid = pid;
+  packed.offset = get_string (strings, strings_offset, symbol->name);
+  packed.tag_offset = get_string (strings, strings_offset, symbol->binary_nick);
+
+  g_array_append_val (array, packed);
+}
+
 void
 sysprof_symbol_cache_populate_packed (SysprofSymbolCache *self,
                                       GArray             *array,
@@ -248,18 +424,9 @@ sysprof_symbol_cache_populate_packed (SysprofSymbolCache *self,
   g_return_if_fail (array != NULL);
 
   RB_FOREACH(node, sysprof_symbol_cache, &self->head) {
-    SysprofPackedSymbol packed;
-    SysprofSymbol *symbol = node->symbol;
-
-    if (symbol->is_fallback)
-      continue;
-
-    packed.addr_begin = symbol->begin_address;
-    packed.addr_end = symbol->end_address;
-    packed.pid = pid;
-    packed.offset = get_string (strings, strings_offset, symbol->name);
-    packed.tag_offset = get_string (strings, strings_offset, symbol->binary_nick);
-
-    g_array_append_val (array, packed);
+    populate_packed (node->symbol, array, strings, strings_offset, pid);
   }
+
+  for (guint i = 0; i < self->n_entries; i++)
+    populate_packed (self->entries[i].symbol, array, strings, strings_offset, pid);
 }
@@ -38,6 +38,18 @@ struct _SysprofSymbolizer
   GObject parent;
 };
 
+/* Thread-safety contract for symbolizers:
+ *
+ * setup() and prepare_async() are called from the main thread before any
+ * symbolizing occurs and may freely modify the symbolizer.
+ *
+ * Once prepared, symbolize() may be called from multiple threads at the
+ * same time, but never concurrently for the same #SysprofProcessInfo, so
+ * per-process state such as the address layout may be used without
+ * locking. Any state shared across processes must either be immutable
+ * after prepare (kallsyms, jitmap, bundled) or guarded by the symbolizer
+ * itself (ELF loader cache, debuginfod client). @strings is thread-safe.
+ */
 struct _SysprofSymbolizerClass
 {
   GObjectClass parent_class;
@@ -0,0 +1,150 @@
+/* bench-callgraph-wide.c
+ *
+ * Copyright 2023 Christian Hergert <chergert@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "config.h"
+
+#include <glib/gstdio.h>
+
+#include <sysprof.h>
+
+#include "sysprof-callgraph-private.h"
+
+#define CAPTURE_FILE "bench-callgraph-wide.syscap"
+#define PID          1234
+
+static int n_functions = 20000;
+static int n_samples = 500000;
+static int n_iterations = 3;
+static const GOptionEntry entries[] = {
+  { "functions", 'f', 0, G_OPTION_ARG_INT, &n_functions, "Number of unique functions (fan-out)", "N" },
+  { "samples", 's', 0, G_OPTION_ARG_INT, &n_samples, "Number of samples to record", "N" },
+  { "iterations", 'i', 0, G_OPTION_ARG_INT, &n_iterations, "Number of times to build each callgraph", "N" },
+  { 0 }
+};
+
+static void
+write_capture (void)
+{
+  g_autofree SysprofCaptureAddress *functions = g_new (SysprofCaptureAddress, n_functions);
+  SysprofCaptureAddress dispatcher;
+  SysprofCaptureWriter *writer;
+  gint64 t = SYSPROF_CAPTURE_CURRENT_TIME;
+  GRand *rand = g_rand_new_with_seed (0xf00d);
+
+  writer = sysprof_capture_writer_new (CAPTURE_FILE, 0);
+  sysprof_capture_writer_add_process (writer, t, -1, PID, "wide-tree");
+
+  dispatcher = sysprof_capture_writer_add_jitmap (writer, "dispatch");
+
+  for (int i = 0; i < n_functions; i++)
+    {
+      g_autofree char *name = g_strdup_printf ("handler_%d", i);
+      functions[i] = sysprof_capture_writer_add_jitmap (writer, name);
+    }
+
+  /* Half of the samples hang directly off the process and the other half
+   * off of a single dispatcher, so both have @n_functions children.
+   */
+  for (int i = 0; i < n_samples; i++)
+    {
+      SysprofCaptureAddress addrs[2];
+      guint n_addrs = 1;
+
+      addrs[0] = functions[g_rand_int_range (rand, 0, n_functions)];
+
+      if (i & 1)
+        addrs[n_addrs++] = dispatcher;
+
+      sysprof_capture_writer_add_sample (writer, t + i, -1, PID, PID, addrs, n_addrs);
+    }
+
+  sysprof_capture_writer_flush (writer);
+  sysprof_capture_writer_unref (writer);
+  g_rand_free (rand);
+}
+
+static double
+build (SysprofDocument *document,
+       GListModel      *samples,
+       guint            threshold)
+{
+  double best = G_MAXDOUBLE;
+
+  _sysprof_callgraph_set_child_index_threshold (threshold);
+
+  for (int i = 0; i < n_iterations; i++)
+    {
+      g_autoptr(SysprofCallgraph) callgraph = NULL;
+      gint64 begin = g_get_monotonic_time ();
+      double elapsed;
+
+      callgraph = _sysprof_callgraph_new_with_shards (document, 0, samples, 0, NULL, NULL, NULL, 1);
+      elapsed = (g_get_monotonic_time () - begin) / (double)G_USEC_PER_SEC;
+
+      g_assert_cmpint (callgraph->root.count, ==, n_samples);
+
+      best = MIN (best, elapsed);
+    }
+
+  return best;
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  g_autoptr(GOptionContext) context = g_option_context_new ("- benchmark wide callgraph construction");
+  g_autoptr(SysprofDocumentLoader) loader = NULL;
+  g_autoptr(SysprofDocument) document = NULL;
+  g_autoptr(SysprofSymbolizer) symbolizer = NULL;
+  g_autoptr(GListModel) samples = NULL;
+  g_autoptr(GError) error = NULL;
+  double linear;
+  double indexed;
+
+  g_option_context_add_main_entries (context, entries, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    g_error ("%s", error->message);
+
+  if (n_functions < 1 || n_samples < 1 || n_iterations < 1)
+    g_error ("functions, samples, and iterations must be positive");
+
+  write_capture ();
+
+  symbolizer = sysprof_jitmap_symbolizer_new ();
+  loader = sysprof_document_loader_new (CAPTURE_FILE);
+  sysprof_document_loader_set_symbolizer (loader, symbolizer);
+  if (!(document = sysprof_document_loader_load (loader, NULL, &error)))
+    g_error ("Failed to load document: %s", error->message);
+
+  samples = sysprof_document_list_samples (document);
+
+  linear = build (document, samples, G_MAXUINT);
+  indexed = build (document, samples, 32);
+
+  g_print ("Functions: %d, Samples: %d\n", n_functions, n_samples);
+  g_print ("  Linear children: %8.3lf sec\n", linear);
+  g_print ("  Index children:  %8.3lf sec\n", indexed);
+  g_print ("  Speedup:         %8.2lfx\n", linear / indexed);
+
+  g_unlink (CAPTURE_FILE);
+
+  return 0;
+}
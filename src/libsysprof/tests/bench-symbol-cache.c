@@ -0,0 +1,134 @@
+/* bench-symbol-cache.c
+ *
+ * Copyright 2023 Christian Hergert <chergert@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "config.h"
+
+#include <sysprof.h>
+
+#include "sysprof-symbol-private.h"
+#include "sysprof-symbol-cache-private.h"
+
+static int n_symbols = 50000;
+static int n_lookups = 10000000;
+static int n_iterations = 3;
+static const GOptionEntry entries[] = {
+  { "symbols", 's', 0, G_OPTION_ARG_INT, &n_symbols, "Number of symbols in the cache", "N" },
+  { "lookups", 'l', 0, G_OPTION_ARG_INT, &n_lookups, "Number of lookups per iteration", "N" },
+  { "iterations", 'i', 0, G_OPTION_ARG_INT, &n_iterations, "Number of times to run the lookups", "N" },
+  { 0 }
+};
+
+#define BASE_ADDRESS  G_GUINT64_CONSTANT(0x7f0000000000)
+#define SYMBOL_STRIDE 0x40
+
+static double
+run_lookups (SysprofSymbolCache   *cache,
+             const SysprofAddress *addresses,
+             guint                *n_found)
+{
+  double best = G_MAXDOUBLE;
+
+  for (int i = 0; i < n_iterations; i++)
+    {
+      gint64 begin = g_get_monotonic_time ();
+      guint found = 0;
+
+      for (int j = 0; j < n_lookups; j++)
+        found += sysprof_symbol_cache_lookup (cache, addresses[j]) != NULL;
+
+      best = MIN (best, (g_get_monotonic_time () - begin) / (double)G_USEC_PER_SEC);
+      *n_found = found;
+    }
+
+  return best;
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  g_autoptr(GOptionContext) context = g_option_context_new ("- benchmark symbol cache lookups");
+  g_autoptr(SysprofSymbolCache) cache = NULL;
+  g_autofree SysprofAddress *addresses = NULL;
+  g_autoptr(GError) error = NULL;
+  GRand *rand;
+  guint tree_found;
+  guint frozen_found;
+  double tree;
+  double frozen;
+
+  g_option_context_add_main_entries (context, entries, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    g_error ("%s", error->message);
+
+  if (n_symbols < 1 || n_lookups < 1 || n_iterations < 1)
+    g_error ("symbols, lookups, and iterations must be positive");
+
+  rand = g_rand_new_with_seed (0x5ca1ab1e);
+  cache = sysprof_symbol_cache_new ();
+
+  /* Insert in random order so the tree is not built from sorted input,
+   * leaving the occasional gap between symbols to exercise misses.
+   */
+  {
+    g_autofree guint *order = g_new (guint, n_symbols);
+
+    for (int i = 0; i < n_symbols; i++)
+      order[i] = i;
+
+    for (int i = n_symbols - 1; i > 0; i--)
+      {
+        guint j = g_rand_int_range (rand, 0, i + 1);
+        guint tmp = order[i];
+        order[i] = order[j];
+        order[j] = tmp;
+      }
+
+    for (int i = 0; i < n_symbols; i++)
+      {
+        SysprofAddress begin = BASE_ADDRESS + (SysprofAddress)order[i] * SYMBOL_STRIDE;
+        SysprofAddress end = begin + SYMBOL_STRIDE - (order[i] % 8 == 0 ? 0x10 : 0);
+        g_autofree char *name = g_strdup_printf ("symbol_%u", order[i]);
+
+        sysprof_symbol_cache_take (cache,
+                                   _sysprof_symbol_new (g_ref_string_new (name), NULL, NULL,
+                                                        begin, end, SYSPROF_SYMBOL_KIND_USER));
+      }
+  }
+
+  addresses = g_new (SysprofAddress, n_lookups);
+  for (int i = 0; i < n_lookups; i++)
+    addresses[i] = BASE_ADDRESS + g_rand_int_range (rand, 0, n_symbols * SYMBOL_STRIDE);
+
+  tree = run_lookups (cache, addresses, &tree_found);
+  sysprof_symbol_cache_freeze (cache);
+  frozen = run_lookups (cache, addresses, &frozen_found);
+
+  g_assert_cmpint (tree_found, ==, frozen_found);
+
+  g_print ("Symbols: %d, Lookups: %d\n", n_symbols, n_lookups);
+  g_print ("  Interval tree: %8.3lf sec (%6.1lf M/sec)\n", tree, n_lookups / tree / 1000000.);
+  g_print ("  Frozen array:  %8.3lf sec (%6.1lf M/sec)\n", frozen, n_lookups / frozen / 1000000.);
+  g_print ("  Speedup:       %8.2lfx\n", tree / frozen);
+
+  g_rand_free (rand);
+
+  return 0;
+}
@@ -0,0 +1,144 @@
+/* test-address-table.c
+ *
+ * Copyright 2023 Christian Hergert <chergert@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <sysprof.h>
+
+#include "sysprof-address-table-private.h"
+#include "sysprof-symbol-private.h"
+
+static int
+compare_address (gconstpointer a,
+                 gconstpointer b)
+{
+  SysprofAddress addr_a = *(const SysprofAddress *)a;
+  SysprofAddress addr_b = *(const SysprofAddress *)b;
+
+  if (addr_a < addr_b)
+    return -1;
+  else if (addr_a > addr_b)
+    return 1;
+  else
+    return 0;
+}
+
+static void
+test_sort_unique (void)
+{
+  static const guint sizes[] = { 0, 1, 2, 17, 1000, 100000 };
+  GRand *rand = g_rand_new_with_seed (0xadd7);
+
+  for (guint s = 0; s < G_N_ELEMENTS (sizes); s++)
+    {
+      guint n = sizes[s];
+      g_autofree SysprofAddress *addresses = g_new (SysprofAddress, n);
+      g_autofree SysprofAddress *expected = g_new (SysprofAddress, n);
+      guint n_expected = 0;
+      guint len = n;
+
+      /* Mix kernel and user-space style addresses with plenty of
+       * duplicates so that both the skipped and full radix passes run.
+       */
+      for (guint i = 0; i < n; i++)
+        {
+          SysprofAddress base = (i & 1) ? G_GUINT64_CONSTANT (0xffffffff81000000) : 0x7f0000000000;
+
+          addresses[i] = base + g_rand_int_range (rand, 0, MAX (1, n / 4)) * 4;
+        }
+
+      memcpy (expected, addresses, sizeof *addresses * n);
+      qsort (expected, n, sizeof *expected, compare_address);
+
+      for (guint i = 0; i < n; i++)
+        {
+          if (n_expected == 0 || expected[n_expected-1] != expected[i])
+            expected[n_expected++] = expected[i];
+        }
+
+      sysprof_address_sort_unique (addresses, &len);
+
+      g_assert_cmpint (len, ==, n_expected);
+
+      for (guint i = 0; i < len; i++)
+        g_assert_cmpuint (addresses[i], ==, expected[i]);
+    }
+
+  g_rand_free (rand);
+}
+
+static void
+test_lookup (void)
+{
+  static const SysprofAddress addresses[] = { 0x1000, 0x1004, 0x2000, 0x2001, 0xffff0000 };
+  g_autoptr(SysprofAddressTable) table = NULL;
+  g_autoptr(SysprofAddressTable) empty = NULL;
+  SysprofSymbol *symbols[G_N_ELEMENTS (addresses)];
+
+  table = sysprof_address_table_new (addresses, G_N_ELEMENTS (addresses));
+  g_assert_cmpint (sysprof_address_table_get_size (table), ==, G_N_ELEMENTS (addresses));
+
+  for (guint i = 0; i < G_N_ELEMENTS (addresses); i++)
+    {
+      g_autofree char *name = g_strdup_printf ("symbol_%u", i);
+
+      g_assert_cmpuint (sysprof_address_table_get_address (table, i), ==, addresses[i]);
+      g_assert_null (sysprof_address_table_lookup (table, addresses[i]));
+
+      symbols[i] = _sysprof_symbol_new (g_ref_string_new (name), NULL, NULL,
+                                        addresses[i], addresses[i] + 1,
+                                        SYSPROF_SYMBOL_KIND_USER);
+
+      /* Leave one address unresolved */
+      if (i != 2)
+        sysprof_address_table_set (table, i, symbols[i]);
+    }
+
+  for (guint i = 0; i < G_N_ELEMENTS (addresses); i++)
+    {
+      if (i == 2)
+        g_assert_null (sysprof_address_table_lookup (table, addresses[i]));
+      else
+        g_assert_true (sysprof_address_table_lookup (table, addresses[i]) == symbols[i]);
+    }
+
+  /* Only exact matches are found */
+  g_assert_null (sysprof_address_table_lookup (table, 0));
+  g_assert_null (sysprof_address_table_lookup (table, 0x1001));
+  g_assert_null (sysprof_address_table_lookup (table, 0x3000));
+  g_assert_null (sysprof_address_table_lookup (table, G_MAXUINT64));
+
+  empty = sysprof_address_table_new (NULL, 0);
+  g_assert_null (sysprof_address_table_lookup (empty, 0x1000));
+
+  for (guint i = 0; i < G_N_ELEMENTS (symbols); i++)
+    g_object_unref (symbols[i]);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+  g_test_add_func ("/libsysprof/AddressTable/sort_unique", test_sort_unique);
+  g_test_add_func ("/libsysprof/AddressTable/lookup", test_lookup);
+  return g_test_run ();
+}
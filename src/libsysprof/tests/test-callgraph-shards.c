@@ -0,0 +1,272 @@
+/* test-callgraph-shards.c
+ *
+ * Copyright 2023 Christian Hergert <chergert@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "config.h"
+
+#include <glib/gstdio.h>
+
+#include <sysprof.h>
+
+#include "sysprof-callgraph-private.h"
+
+#define CAPTURE_FILE "callgraph-shards.syscap"
+#define N_FUNCTIONS  97
+#define N_SAMPLES    25000
+#define N_PROCESSES  5
+
+typedef struct _Augment
+{
+  guint32 size;
+  guint32 total;
+} Augment;
+
+static void
+augment_cb (SysprofCallgraph     *callgraph,
+            SysprofCallgraphNode *node,
+            SysprofDocumentFrame *frame,
+            gboolean              summarize,
+            gpointer              user_data)
+{
+  Augment *aug;
+
+  g_assert (SYSPROF_IS_CALLGRAPH (callgraph));
+  g_assert (node != NULL);
+  g_assert (SYSPROF_IS_DOCUMENT_SAMPLE (frame));
+
+  aug = sysprof_callgraph_get_augment (callgraph, node);
+  aug->size++;
+
+  if (summarize)
+    {
+      aug = sysprof_callgraph_get_summary_augment (callgraph, node);
+      aug->size++;
+    }
+
+  for (; node; node = sysprof_callgraph_node_parent (node))
+    {
+      aug = sysprof_callgraph_get_augment (callgraph, node);
+      aug->total++;
+    }
+}
+
+static void
+write_capture (void)
+{
+  SysprofCaptureWriter *writer;
+  SysprofCaptureAddress functions[N_FUNCTIONS];
+  gint64 t = SYSPROF_CAPTURE_CURRENT_TIME;
+  GRand *rand = g_rand_new_with_seed (0x5eed);
+
+  writer = sysprof_capture_writer_new (CAPTURE_FILE, 0);
+  g_assert_nonnull (writer);
+
+  for (guint i = 0; i < N_PROCESSES; i++)
+    {
+      g_autofree char *cmdline = g_strdup_printf ("process-%u", i);
+
+      g_assert_true (sysprof_capture_writer_add_process (writer, t, -1, 1000 + i, cmdline));
+    }
+
+  for (guint i = 0; i < N_FUNCTIONS; i++)
+    {
+      g_autofree char *name = g_strdup_printf ("function_%u", i);
+
+      functions[i] = sysprof_capture_writer_add_jitmap (writer, name);
+      g_assert_cmpint (functions[i], !=, 0);
+    }
+
+  for (guint i = 0; i < N_SAMPLES; i++)
+    {
+      SysprofCaptureAddress addrs[16];
+      guint n_addrs = g_rand_int_range (rand, 1, G_N_ELEMENTS (addrs));
+      int pid = 1000 + g_rand_int_range (rand, 0, N_PROCESSES);
+      int tid = pid + g_rand_int_range (rand, 0, 3);
+
+      /* Skew towards a handful of hot functions near the root so that
+       * there is plenty of overlap between shards to merge.
+       */
+      for (guint j = 0; j < n_addrs; j++)
+        {
+          guint max = MIN (N_FUNCTIONS, 4 + (n_addrs - j) * 6);
+          addrs[j] = functions[g_rand_int_range (rand, 0, max)];
+        }
+
+      g_assert_true (sysprof_capture_writer_add_sample (writer, t + i, -1, pid, tid, addrs, n_addrs));
+    }
+
+  g_assert_true (sysprof_capture_writer_flush (writer));
+
+  sysprof_capture_writer_unref (writer);
+  g_rand_free (rand);
+}
+
+static SysprofCallgraphNode *
+find_child (SysprofCallgraphNode *node,
+            SysprofSymbol        *symbol)
+{
+  for (SysprofCallgraphNode *iter = node->children; iter; iter = iter->next)
+    {
+      if (iter->summary->symbol == symbol)
+        return iter;
+    }
+
+  return NULL;
+}
+
+static void
+assert_nodes_equal (SysprofCallgraph     *a,
+                    SysprofCallgraphNode *node_a,
+                    SysprofCallgraph     *b,
+                    SysprofCallgraphNode *node_b)
+{
+  const Augment *aug_a = sysprof_callgraph_get_augment (a, node_a);
+  const Augment *aug_b = sysprof_callgraph_get_augment (b, node_b);
+  guint n_children_a = 0;
+  guint n_children_b = 0;
+
+  g_assert_true (node_a->summary->symbol == node_b->summary->symbol);
+  g_assert_cmpint (node_a->count, ==, node_b->count);
+  g_assert_cmpint (node_a->is_toplevel, ==, node_b->is_toplevel);
+  g_assert_cmpint (node_a->category, ==, node_b->category);
+  g_assert_cmpint (aug_a->size, ==, aug_b->size);
+  g_assert_cmpint (aug_a->total, ==, aug_b->total);
+
+  for (SysprofCallgraphNode *iter = node_b->children; iter; iter = iter->next)
+    n_children_b++;
+
+  /* Sibling order is not stable when two siblings sort equally, so
+   * match children by symbol rather than by position.
+   */
+  for (SysprofCallgraphNode *iter = node_a->children; iter; iter = iter->next)
+    {
+      SysprofCallgraphNode *other = find_child (node_b, iter->summary->symbol);
+
+      g_assert_nonnull (other);
+      assert_nodes_equal (a, iter, b, other);
+
+      n_children_a++;
+    }
+
+  g_assert_cmpint (n_children_a, ==, n_children_b);
+}
+
+static void
+assert_callgraphs_equal (SysprofCallgraph *a,
+                         SysprofCallgraph *b)
+{
+  g_assert_cmpint (a->height, ==, b->height);
+  g_assert_cmpint (a->symbols->len, ==, b->symbols->len);
+  g_assert_cmpint (g_hash_table_size (a->symbol_to_summary), ==,
+                   g_hash_table_size (b->symbol_to_summary));
+
+  for (guint i = 0; i < a->symbols->len; i++)
+    {
+      SysprofSymbol *symbol = g_ptr_array_index (a->symbols, i);
+      const SysprofCallgraphSummary *summary_a;
+      const SysprofCallgraphSummary *summary_b;
+      const Augment *aug_a;
+      const Augment *aug_b;
+
+      g_assert_true (symbol == g_ptr_array_index (b->symbols, i));
+
+      summary_a = g_hash_table_lookup (a->symbol_to_summary, symbol);
+      summary_b = g_hash_table_lookup (b->symbol_to_summary, symbol);
+
+      g_assert_nonnull (summary_a);
+      g_assert_nonnull (summary_b);
+      g_assert_true (summary_a->symbol == summary_b->symbol);
+      g_assert_true (egg_bitset_equals (summary_a->traceables, summary_b->traceables));
+      g_assert_cmpint (summary_a->callers->len, ==, summary_b->callers->len);
+
+      for (guint j = 0; j < summary_a->callers->len; j++)
+        g_assert_true (g_ptr_array_index (summary_a->callers, j) ==
+                       g_ptr_array_index (summary_b->callers, j));
+
+      aug_a = _sysprof_callgraph_get_symbol_augment (a, symbol);
+      aug_b = _sysprof_callgraph_get_symbol_augment (b, symbol);
+
+      g_assert_cmpint (aug_a->size, ==, aug_b->size);
+    }
+
+  assert_nodes_equal (a, &a->root, b, &b->root);
+}
+
+static void
+test_shards_match_serial (void)
+{
+  static const SysprofCallgraphFlags flags[] = {
+    0,
+    SYSPROF_CALLGRAPH_FLAGS_INCLUDE_THREADS | SYSPROF_CALLGRAPH_FLAGS_CATEGORIZE_FRAMES,
+    SYSPROF_CALLGRAPH_FLAGS_BOTTOM_UP | SYSPROF_CALLGRAPH_FLAGS_LEFT_HEAVY,
+    SYSPROF_CALLGRAPH_FLAGS_MERGE_SIMILAR_PROCESSES | SYSPROF_CALLGRAPH_FLAGS_IGNORE_PROCESS_0,
+  };
+  static const guint n_shards[] = { 2, 3, 7, 16 };
+  g_autoptr(SysprofDocumentLoader) loader = NULL;
+  g_autoptr(SysprofDocument) document = NULL;
+  g_autoptr(SysprofSymbolizer) symbolizer = NULL;
+  g_autoptr(GListModel) samples = NULL;
+  g_autoptr(GError) error = NULL;
+
+  write_capture ();
+
+  symbolizer = sysprof_jitmap_symbolizer_new ();
+  loader = sysprof_document_loader_new (CAPTURE_FILE);
+  sysprof_document_loader_set_symbolizer (loader, symbolizer);
+  document = sysprof_document_loader_load (loader, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_nonnull (document);
+
+  samples = sysprof_document_list_samples (document);
+  g_assert_cmpint (g_list_model_get_n_items (samples), ==, N_SAMPLES);
+
+  for (guint f = 0; f < G_N_ELEMENTS (flags); f++)
+    {
+      g_autoptr(SysprofCallgraph) serial = NULL;
+
+      serial = _sysprof_callgraph_new_with_shards (document, flags[f], samples,
+                                                   sizeof (Augment), augment_cb, NULL, NULL,
+                                                   1);
+      g_assert_nonnull (serial);
+      g_assert_cmpint (serial->root.count, >, 0);
+
+      for (guint s = 0; s < G_N_ELEMENTS (n_shards); s++)
+        {
+          g_autoptr(SysprofCallgraph) sharded = NULL;
+
+          sharded = _sysprof_callgraph_new_with_shards (document, flags[f], samples,
+                                                        sizeof (Augment), augment_cb, NULL, NULL,
+                                                        n_shards[s]);
+          g_assert_nonnull (sharded);
+
+          assert_callgraphs_equal (serial, sharded);
+        }
+    }
+
+  g_unlink (CAPTURE_FILE);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+  g_test_add_func ("/libsysprof/Callgraph/shards_match_serial", test_shards_match_serial);
+  return g_test_run ();
+}
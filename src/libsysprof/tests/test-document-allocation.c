@@ -0,0 +1,209 @@
+/* test-document-allocation.c
+ *
+ * Copyright 2023 Christian Hergert <chergert@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "config.h"
+
+#include <glib/gstdio.h>
+
+#include <sysprof.h>
+
+#include "sysprof-callgraph-private.h"
+
+#define CAPTURE_FILE "document-allocation.syscap"
+
+typedef struct _Allocation
+{
+  const char *function;
+  gint64      size;
+  guint32     sample_interval;
+  gint64      estimated_size;
+} Allocation;
+
+/* Estimated sizes are size / (1 - exp (-size / interval)) */
+static const Allocation allocations[] = {
+  { "plain",  1000, 0,       1000 },
+  { "small",  64,   4096,    4128 },
+  { "small",  8192, 4096,    9474 },
+  { "rare",   100,  1000000, 1000050 },
+  { "plain",  1,    0,       1 },
+  { "small",  1,    512,     512 },
+};
+
+typedef struct _Augment
+{
+  gint64 size;
+  gint64 total;
+} Augment;
+
+/* Sums sizes the way the memory callgraph does */
+static void
+augment_cb (SysprofCallgraph     *callgraph,
+            SysprofCallgraphNode *node,
+            SysprofDocumentFrame *frame,
+            gboolean              summarize,
+            gpointer              user_data)
+{
+  Augment *aug;
+  gint64 size;
+
+  g_assert (SYSPROF_IS_CALLGRAPH (callgraph));
+  g_assert (node != NULL);
+  g_assert (SYSPROF_IS_DOCUMENT_ALLOCATION (frame));
+
+  size = sysprof_document_allocation_get_estimated_size (SYSPROF_DOCUMENT_ALLOCATION (frame));
+
+  aug = sysprof_callgraph_get_augment (callgraph, node);
+  aug->size += size;
+
+  if (summarize)
+    {
+      aug = sysprof_callgraph_get_summary_augment (callgraph, node);
+      aug->size += size;
+    }
+
+  for (; node; node = sysprof_callgraph_node_parent (node))
+    {
+      aug = sysprof_callgraph_get_augment (callgraph, node);
+      aug->total += size;
+    }
+}
+
+static void
+write_capture (void)
+{
+  SysprofCaptureWriter *writer;
+  gint64 t = SYSPROF_CAPTURE_CURRENT_TIME;
+
+  writer = sysprof_capture_writer_new (CAPTURE_FILE, 0);
+  g_assert_nonnull (writer);
+
+  g_assert_true (sysprof_capture_writer_add_process (writer, t, -1, 100, "process"));
+
+  for (guint i = 0; i < G_N_ELEMENTS (allocations); i++)
+    {
+      SysprofCaptureAddress addr = sysprof_capture_writer_add_jitmap (writer, allocations[i].function);
+
+      g_assert_true (sysprof_capture_writer_add_allocation_sampled (writer, t + i, -1, 100, 100,
+                                                                    0x1000 * (i + 1),
+                                                                    allocations[i].size,
+                                                                    allocations[i].sample_interval,
+                                                                    &addr, 1));
+    }
+
+  /* Frees of sampled allocations stand for nothing */
+  g_assert_true (sysprof_capture_writer_add_allocation_sampled (writer, t + 100, -1, 100, 100,
+                                                                0x2000, 0, 4096, NULL, 0));
+
+  g_assert_true (sysprof_capture_writer_flush (writer));
+
+  sysprof_capture_writer_unref (writer);
+}
+
+static SysprofSymbol *
+find_symbol (SysprofCallgraph *callgraph,
+             const char       *name)
+{
+  for (guint i = 0; i < callgraph->symbols->len; i++)
+    {
+      SysprofSymbol *symbol = g_ptr_array_index (callgraph->symbols, i);
+
+      if (g_strcmp0 (sysprof_symbol_get_name (symbol), name) == 0)
+        return symbol;
+    }
+
+  return NULL;
+}
+
+static void
+test_estimated_size (void)
+{
+  g_autoptr(SysprofDocumentLoader) loader = NULL;
+  g_autoptr(SysprofDocument) document = NULL;
+  g_autoptr(SysprofSymbolizer) symbolizer = NULL;
+  g_autoptr(SysprofCallgraph) callgraph = NULL;
+  g_autoptr(GListModel) model = NULL;
+  g_autoptr(GError) error = NULL;
+  const Augment *aug;
+  gint64 total = 0;
+  gint64 small = 0;
+
+  write_capture ();
+
+  symbolizer = sysprof_jitmap_symbolizer_new ();
+  loader = sysprof_document_loader_new (CAPTURE_FILE);
+  sysprof_document_loader_set_symbolizer (loader, symbolizer);
+  document = sysprof_document_loader_load (loader, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_nonnull (document);
+
+  model = sysprof_document_list_allocations (document);
+  g_assert_cmpint (g_list_model_get_n_items (model), ==, G_N_ELEMENTS (allocations) + 1);
+
+  for (guint i = 0; i < G_N_ELEMENTS (allocations); i++)
+    {
+      g_autoptr(SysprofDocumentAllocation) allocation = g_list_model_get_item (model, i);
+
+      g_assert_cmpint (sysprof_document_allocation_get_size (allocation), ==, allocations[i].size);
+      g_assert_cmpint (sysprof_document_allocation_get_sample_interval (allocation), ==, allocations[i].sample_interval);
+      g_assert_cmpint (sysprof_document_allocation_get_estimated_size (allocation), ==, allocations[i].estimated_size);
+
+      total += allocations[i].estimated_size;
+
+      if (g_str_equal (allocations[i].function, "small"))
+        small += allocations[i].estimated_size;
+    }
+
+  /* The free keeps its interval but has no size to scale */
+  {
+    g_autoptr(SysprofDocumentAllocation) allocation = g_list_model_get_item (model, G_N_ELEMENTS (allocations));
+
+    g_assert_true (sysprof_document_allocation_is_free (allocation));
+    g_assert_cmpint (sysprof_document_allocation_get_sample_interval (allocation), ==, 4096);
+    g_assert_cmpint (sysprof_document_allocation_get_estimated_size (allocation), ==, 0);
+  }
+
+  callgraph = _sysprof_callgraph_new_with_shards (document, 0, model,
+                                                  sizeof (Augment), augment_cb, NULL, NULL,
+                                                  1);
+  g_assert_nonnull (callgraph);
+
+  aug = sysprof_callgraph_get_augment (callgraph, &callgraph->root);
+  g_assert_cmpint (aug->total, ==, total);
+
+  aug = _sysprof_callgraph_get_symbol_augment (callgraph, find_symbol (callgraph, "small"));
+  g_assert_cmpint (aug->size, ==, small);
+
+  aug = _sysprof_callgraph_get_symbol_augment (callgraph, find_symbol (callgraph, "rare"));
+  g_assert_cmpint (aug->size, ==, 1000050);
+
+  aug = _sysprof_callgraph_get_symbol_augment (callgraph, find_symbol (callgraph, "plain"));
+  g_assert_cmpint (aug->size, ==, 1001);
+
+  g_unlink (CAPTURE_FILE);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+  g_test_add_func ("/libsysprof/DocumentAllocation/estimated-size", test_estimated_size);
+  return g_test_run ();
+}
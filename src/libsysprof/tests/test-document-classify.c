@@ -0,0 +1,153 @@
+/* test-document-classify.c
+ *
+ * Copyright 2023 Christian Hergert <chergert@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "config.h"
+
+#include <glib/gstdio.h>
+
+#include <sysprof.h>
+
+#define CAPTURE_FILE "document-classify.syscap"
+#define N_PIDS       4
+#define N_THREADS    5
+#define N_ROUNDS     20000
+
+/* Enough frames that the classification pass is split into many chunks,
+ * so anything which must remember "first" or "last" crosses chunks.
+ */
+static gint64
+write_capture (void)
+{
+  static const guint8 first[] = "first";
+  static const guint8 second[] = "second";
+  SysprofCaptureWriter *writer;
+  gint64 t;
+
+  writer = sysprof_capture_writer_new (CAPTURE_FILE, 0);
+  g_assert_nonnull (writer);
+
+  t = SYSPROF_CAPTURE_CURRENT_TIME;
+
+  for (guint pid = 0; pid < N_PIDS; pid++)
+    g_assert_true (sysprof_capture_writer_add_process (writer, t, -1, 100 + pid, "process"));
+
+  g_assert_true (sysprof_capture_writer_add_file (writer, t, -1, -1, "/file", TRUE, first, sizeof first));
+
+  for (guint i = 0; i < N_ROUNDS; i++)
+    {
+      SysprofCaptureAddress addrs[2] = { 0x1000, 0x2000 + i };
+      int pid = 100 + (i % N_PIDS);
+      int tid = pid * 10 + (i % N_THREADS);
+
+      g_assert_true (sysprof_capture_writer_add_sample (writer, t + i, -1, pid, tid, addrs, 2));
+
+      if (i % 2 == 0)
+        g_assert_true (sysprof_capture_writer_add_mark (writer, t + i, -1, pid, 10,
+                                                        (i % 4) ? "even" : "quad",
+                                                        "mark", "message"));
+
+      if (i % 5 == 0)
+        g_assert_true (sysprof_capture_writer_add_log (writer, t + i, -1, pid, 0, "test", "message"));
+
+      if (i % 1000 == 999)
+        g_assert_true (sysprof_capture_writer_add_exit (writer, t + i, -1, pid));
+
+      if (i == N_ROUNDS / 2)
+        g_assert_true (sysprof_capture_writer_add_file (writer, t + i, -1, -1, "/file", TRUE, second, sizeof second));
+    }
+
+  g_assert_true (sysprof_capture_writer_flush (writer));
+
+  sysprof_capture_writer_unref (writer);
+
+  return t;
+}
+
+static void
+test_classify (void)
+{
+  g_autoptr(SysprofDocumentLoader) loader = NULL;
+  g_autoptr(SysprofDocument) document = NULL;
+  g_autoptr(SysprofDocumentFile) file = NULL;
+  g_autoptr(GListModel) samples = NULL;
+  g_autoptr(GListModel) logs = NULL;
+  g_autoptr(GListModel) even = NULL;
+  g_autoptr(GListModel) quad = NULL;
+  g_autoptr(GBytes) bytes = NULL;
+  g_autoptr(GError) error = NULL;
+  gint64 t;
+
+  t = write_capture ();
+
+  loader = sysprof_document_loader_new (CAPTURE_FILE);
+  sysprof_document_loader_set_symbolizer (loader, SYSPROF_SYMBOLIZER (sysprof_no_symbolizer_get ()));
+  document = sysprof_document_loader_load (loader, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_nonnull (document);
+
+  samples = sysprof_document_list_samples (document);
+  logs = sysprof_document_list_logs (document);
+  even = sysprof_document_list_marks_by_group (document, "even");
+  quad = sysprof_document_list_marks_by_group (document, "quad");
+
+  g_assert_cmpint (g_list_model_get_n_items (samples), ==, N_ROUNDS);
+  g_assert_cmpint (g_list_model_get_n_items (logs), ==, N_ROUNDS / 5);
+  g_assert_cmpint (g_list_model_get_n_items (even), ==, N_ROUNDS / 4);
+  g_assert_cmpint (g_list_model_get_n_items (quad), ==, N_ROUNDS / 4);
+
+  /* The last mark extends past the last sample */
+  g_assert_cmpint (sysprof_document_get_time_span (document)->end_nsec, ==, t + (N_ROUNDS - 2) + 10);
+
+  /* The first copy of a file wins */
+  file = sysprof_document_lookup_file (document, "/file");
+  g_assert_nonnull (file);
+  bytes = sysprof_document_file_dup_bytes (file);
+  g_assert_cmpmem (g_bytes_get_data (bytes, NULL), g_bytes_get_size (bytes), "first", sizeof "first");
+
+  for (guint i = 0; i < N_PIDS; i++)
+    {
+      g_autoptr(SysprofDocumentProcess) process = sysprof_document_lookup_process (document, 100 + i);
+      g_autoptr(GListModel) threads = NULL;
+
+      g_assert_nonnull (process);
+
+      threads = sysprof_document_process_list_threads (process);
+      g_assert_cmpint (g_list_model_get_n_items (threads), ==, N_THREADS);
+    }
+
+  /* Every exit lands on the last pid and the last one wins */
+  {
+    g_autoptr(SysprofDocumentProcess) process = sysprof_document_lookup_process (document, 100 + N_PIDS - 1);
+
+    g_assert_nonnull (process);
+    g_assert_cmpint (sysprof_document_process_get_exit_time (process), ==, t + N_ROUNDS - 1);
+  }
+
+  g_unlink (CAPTURE_FILE);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+  g_test_add_func ("/libsysprof/Document/classify", test_classify);
+  return g_test_run ();
+}
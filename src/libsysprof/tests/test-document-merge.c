@@ -0,0 +1,162 @@
+/* test-document-merge.c
+ *
+ * Copyright 2023 Christian Hergert <chergert@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "config.h"
+
+#include <glib/gstdio.h>
+
+#include <sysprof.h>
+
+#define CAPTURE_FILE "document-merge.syscap"
+#define N_TIMES      1000
+/* Enough frames for several frame indexes, so the document scans the
+ * capture in separate runs which must then be merged.
+ */
+#define N_ROUNDS     (4 * 64 * 1024 + 1234)
+
+/* Every run covers the whole time range so the merge has to interleave
+ * all of them, and times repeat so the tie-break is exercised too. The
+ * order each frame was written in is kept in the sample thread-id or in
+ * the mark name.
+ */
+static gint64
+write_capture (void)
+{
+  SysprofCaptureWriter *writer;
+  gint64 t;
+
+  writer = sysprof_capture_writer_new (CAPTURE_FILE, 0);
+  g_assert_nonnull (writer);
+
+  t = SYSPROF_CAPTURE_CURRENT_TIME;
+
+  g_assert_true (sysprof_capture_writer_add_process (writer, t, -1, 100, "process"));
+
+  for (guint i = 0; i < N_ROUNDS; i++)
+    {
+      SysprofCaptureAddress addr = 0x1000;
+      gint64 time = t + 1 + ((i * 7919) % N_TIMES);
+
+      if (i % 3 == 0)
+        {
+          char name[16];
+
+          g_snprintf (name, sizeof name, "%u", i);
+          g_assert_true (sysprof_capture_writer_add_mark (writer, time, -1, 100, i % 5, "group", name, "message"));
+        }
+      else
+        {
+          g_assert_true (sysprof_capture_writer_add_sample (writer, time, -1, 100, i, &addr, 1));
+        }
+    }
+
+  g_assert_true (sysprof_capture_writer_flush (writer));
+
+  sysprof_capture_writer_unref (writer);
+
+  return t;
+}
+
+static void
+test_merge (void)
+{
+  g_autoptr(SysprofDocumentLoader) loader = NULL;
+  g_autoptr(SysprofDocument) document = NULL;
+  g_autoptr(GListModel) samples = NULL;
+  g_autoptr(GListModel) marks = NULL;
+  g_autoptr(GError) error = NULL;
+  gint64 last_time = G_MININT64;
+  gint64 last_duration = G_MAXINT64;
+  gint64 last_order = -1;
+  guint n_written = 0;
+  guint n_items;
+
+  write_capture ();
+
+  loader = sysprof_document_loader_new (CAPTURE_FILE);
+  sysprof_document_loader_set_symbolizer (loader, SYSPROF_SYMBOLIZER (sysprof_no_symbolizer_get ()));
+  document = sysprof_document_loader_load (loader, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_nonnull (document);
+
+  samples = sysprof_document_list_samples (document);
+  marks = sysprof_document_list_marks (document);
+
+  g_assert_cmpint (g_list_model_get_n_items (marks), ==, (N_ROUNDS + 2) / 3);
+  g_assert_cmpint (g_list_model_get_n_items (samples), ==, N_ROUNDS - (N_ROUNDS + 2) / 3);
+
+  n_items = g_list_model_get_n_items (G_LIST_MODEL (document));
+
+  for (guint i = 0; i < n_items; i++)
+    {
+      g_autoptr(SysprofDocumentFrame) frame = g_list_model_get_item (G_LIST_MODEL (document), i);
+      gint64 time = sysprof_document_frame_get_time (frame);
+      gint64 duration = 0;
+      gint64 order = -1;
+
+      if (SYSPROF_IS_DOCUMENT_MARK (frame))
+        {
+          duration = sysprof_document_mark_get_duration (SYSPROF_DOCUMENT_MARK (frame));
+          order = g_ascii_strtoll (sysprof_document_mark_get_name (SYSPROF_DOCUMENT_MARK (frame)), NULL, 10);
+        }
+      else if (SYSPROF_IS_DOCUMENT_SAMPLE (frame))
+        {
+          order = sysprof_document_sample_get_tid (SYSPROF_DOCUMENT_SAMPLE (frame));
+        }
+
+      /* Ordered by time, longer marks first */
+      g_assert_cmpint (time, >=, last_time);
+
+      if (time != last_time)
+        {
+          last_duration = G_MAXINT64;
+          last_order = -1;
+        }
+
+      g_assert_cmpint (duration, <=, last_duration);
+
+      if (duration != last_duration)
+        last_order = -1;
+
+      /* Equal keys keep the order they were written in */
+      if (order >= 0)
+        {
+          g_assert_cmpint (order, >, last_order);
+          last_order = order;
+          n_written++;
+        }
+
+      last_time = time;
+      last_duration = duration;
+    }
+
+  g_assert_cmpint (n_written, ==, N_ROUNDS);
+
+  g_unlink (CAPTURE_FILE);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+  g_test_add_func ("/libsysprof/Document/merge", test_merge);
+  return g_test_run ();
+}
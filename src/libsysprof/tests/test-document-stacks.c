@@ -0,0 +1,159 @@
+/* test-document-stacks.c
+ *
+ * Copyright 2023 Christian Hergert <chergert@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "config.h"
+
+#include <glib/gstdio.h>
+
+#include <sysprof.h>
+
+#define CAPTURE_FILE "document-stacks.syscap"
+#define N_ROUNDS     100
+
+static const SysprofCaptureAddress stacks[][4] = {
+  { 0x1000, 0x2000, 0x3000, 0x4000 },
+  { 0x1100, 0x2100, 0x3100, 0x4100 },
+  { 0x1200, 0x2200, 0x3200, 0x4200 },
+};
+
+/* Depth of the stack used by the i'th sample or allocation. A depth of
+ * one is too short to share and stays inline.
+ */
+static guint
+stack_depth (guint i)
+{
+  return (i % 7 == 0) ? 1 : G_N_ELEMENTS (stacks[0]);
+}
+
+static void
+write_capture (void)
+{
+  SysprofCaptureWriter *writer;
+  gint64 t = SYSPROF_CAPTURE_CURRENT_TIME;
+
+  writer = sysprof_capture_writer_new (CAPTURE_FILE, 0);
+  g_assert_nonnull (writer);
+
+  sysprof_capture_writer_set_deduplicate_stacks (writer, TRUE);
+
+  g_assert_true (sysprof_capture_writer_add_process (writer, t, -1, 100, "process"));
+
+  for (guint i = 0; i < N_ROUNDS; i++)
+    {
+      const SysprofCaptureAddress *addrs = stacks[i % G_N_ELEMENTS (stacks)];
+
+      g_assert_true (sysprof_capture_writer_add_sample (writer, t + i, -1, 100, 100,
+                                                        addrs, stack_depth (i)));
+      g_assert_true (sysprof_capture_writer_add_allocation_copy (writer, t + i, -1, 100, 100,
+                                                                 0x10000 + i, 16,
+                                                                 addrs, stack_depth (i)));
+    }
+
+  g_assert_true (sysprof_capture_writer_flush (writer));
+
+  sysprof_capture_writer_unref (writer);
+}
+
+static guint
+count_stack_frames (void)
+{
+  SysprofCaptureReader *reader;
+  SysprofCaptureFrameType type;
+  guint n_stacks = 0;
+
+  reader = sysprof_capture_reader_new (CAPTURE_FILE);
+  g_assert_nonnull (reader);
+
+  while (sysprof_capture_reader_peek_type (reader, &type))
+    {
+      if (type == SYSPROF_CAPTURE_FRAME_STACK)
+        n_stacks++;
+
+      if (!sysprof_capture_reader_skip (reader))
+        break;
+    }
+
+  sysprof_capture_reader_unref (reader);
+
+  return n_stacks;
+}
+
+static void
+assert_traceables (GListModel *model)
+{
+  g_assert_cmpint (g_list_model_get_n_items (model), ==, N_ROUNDS);
+
+  for (guint i = 0; i < N_ROUNDS; i++)
+    {
+      g_autoptr(SysprofDocumentTraceable) traceable = g_list_model_get_item (model, i);
+      const SysprofCaptureAddress *expected = stacks[i % G_N_ELEMENTS (stacks)];
+      guint64 addrs[G_N_ELEMENTS (stacks[0]) + 1];
+      guint n_addrs;
+
+      g_assert_cmpint (sysprof_document_traceable_get_stack_depth (traceable), ==, stack_depth (i));
+
+      n_addrs = sysprof_document_traceable_get_stack_addresses (traceable, addrs, G_N_ELEMENTS (addrs));
+      g_assert_cmpint (n_addrs, ==, stack_depth (i));
+
+      for (guint j = 0; j < n_addrs; j++)
+        {
+          g_assert_cmpint (addrs[j], ==, expected[j]);
+          g_assert_cmpint (sysprof_document_traceable_get_stack_address (traceable, j), ==, expected[j]);
+        }
+    }
+}
+
+static void
+test_expanded (void)
+{
+  g_autoptr(SysprofDocumentLoader) loader = NULL;
+  g_autoptr(SysprofDocument) document = NULL;
+  g_autoptr(GListModel) samples = NULL;
+  g_autoptr(GListModel) allocations = NULL;
+  g_autoptr(GError) error = NULL;
+
+  write_capture ();
+
+  /* Only one frame per distinct stack is written */
+  g_assert_cmpint (count_stack_frames (), ==, G_N_ELEMENTS (stacks));
+
+  loader = sysprof_document_loader_new (CAPTURE_FILE);
+  sysprof_document_loader_set_symbolizer (loader, SYSPROF_SYMBOLIZER (sysprof_no_symbolizer_get ()));
+  document = sysprof_document_loader_load (loader, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_nonnull (document);
+
+  samples = sysprof_document_list_samples (document);
+  allocations = sysprof_document_list_allocations (document);
+
+  assert_traceables (samples);
+  assert_traceables (allocations);
+
+  g_unlink (CAPTURE_FILE);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+  g_test_add_func ("/libsysprof/Document/expanded-stacks", test_expanded);
+  return g_test_run ();
+}
@@ -0,0 +1,179 @@
+/* test-elf-symbols.c
+ *
+ * Copyright 2023 Christian Hergert <chergert@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "config.h"
+
+#include <glib/gstdio.h>
+
+#include <sysprof.h>
+
+#include "elfparser.h"
+
+#include "sysprof-elf-symbols-private.h"
+
+static char *cache_dir;
+
+static void
+assert_matches_parser (ElfParser         *parser,
+                       SysprofElfSymbols *symbols)
+{
+  gulong text_size = elf_parser_get_text_size (parser);
+  guint n_symbols = elf_parser_get_n_symbols (parser);
+  guint n_found = 0;
+
+  g_assert_cmpint (sysprof_elf_symbols_get_n_symbols (symbols), ==, n_symbols);
+
+  /* Walk the whole text section, including a bit past the end */
+  for (gulong address = 0; address < text_size + 64; address += 3)
+    {
+      const ElfSym *sym = elf_parser_lookup_symbol (parser, address);
+      guint64 begin = 0;
+      guint64 end = 0;
+      const char *name = sysprof_elf_symbols_lookup (symbols, address, &begin, &end);
+
+      if (sym == NULL)
+        {
+          g_assert_null (name);
+        }
+      else
+        {
+          const char *expected = elf_parser_get_sym_name (parser, sym);
+          gulong sym_begin;
+          gulong sym_end;
+
+          elf_parser_get_sym_address_range (parser, sym, &sym_begin, &sym_end);
+
+          g_assert_nonnull (name);
+          g_assert_cmpstr (name, ==, expected);
+          g_assert_cmpuint (begin, ==, sym_begin);
+          g_assert_cmpuint (end, ==, sym_end);
+
+          n_found++;
+        }
+    }
+
+  if (n_symbols > 0)
+    g_assert_cmpint (n_found, >, 0);
+}
+
+static void
+test_matches_parser (void)
+{
+  g_autoptr(SysprofElfSymbols) symbols = NULL;
+  g_autoptr(SysprofElfSymbols) loaded = NULL;
+  g_autoptr(GError) error = NULL;
+  g_autofree char *key = NULL;
+  ElfParser *parser;
+
+  /* Our own executable is a convenient ELF with plenty of symbols */
+  parser = elf_parser_new ("/proc/self/exe", &error);
+  g_assert_no_error (error);
+  g_assert_nonnull (parser);
+
+  symbols = sysprof_elf_symbols_new_from_parser (parser);
+  g_assert_nonnull (symbols);
+  assert_matches_parser (parser, symbols);
+
+  key = sysprof_elf_symbols_dup_cache_key ("/proc/self/exe", elf_parser_get_build_id (parser), 1234);
+  g_assert_nonnull (key);
+
+  g_assert_null (sysprof_elf_symbols_load (key, &error));
+  g_assert_error (error, G_FILE_ERROR, G_FILE_ERROR_NOENT);
+  g_clear_error (&error);
+
+  g_assert_true (sysprof_elf_symbols_save (symbols, key, &error));
+  g_assert_no_error (error);
+
+  loaded = sysprof_elf_symbols_load (key, &error);
+  g_assert_no_error (error);
+  g_assert_nonnull (loaded);
+  assert_matches_parser (parser, loaded);
+
+  elf_parser_free (parser);
+}
+
+static void
+test_cache_key (void)
+{
+  g_autofree char *with_build_id = sysprof_elf_symbols_dup_cache_key ("/proc/self/exe", "abcdef0123", 100);
+  g_autofree char *debuginfo = sysprof_elf_symbols_dup_cache_key ("/usr/lib/debug/foo.debug", "abcdef0123", 200);
+  g_autofree char *by_path = sysprof_elf_symbols_dup_cache_key ("/proc/self/exe", NULL, 100);
+  g_autofree char *bad_build_id = sysprof_elf_symbols_dup_cache_key ("/proc/self/exe", "../../etc", 100);
+  g_autofree char *missing = sysprof_elf_symbols_dup_cache_key ("/this/does/not/exist", NULL, 100);
+
+  g_assert_cmpstr (with_build_id, ==, "abcdef0123-64");
+
+  /* Stripped objects and their debuginfo share a build-id */
+  g_assert_cmpstr (debuginfo, !=, with_build_id);
+
+  g_assert_nonnull (by_path);
+  g_assert_null (strchr (by_path, '/'));
+  g_assert_cmpstr (bad_build_id, ==, by_path);
+
+  g_assert_null (missing);
+}
+
+static void
+test_corrupt (void)
+{
+  g_autofree char *path = g_build_filename (cache_dir, "sysprof", "symbols", "corrupt.symbols", NULL);
+  g_autofree char *dir = g_path_get_dirname (path);
+  g_autoptr(GError) error = NULL;
+  static const char *contents[] = {
+    "",
+    "SPSYMTAB",
+    "NOTASYMTABLE_BUT_LONG_ENOUGH_FOR_A_HEADER",
+  };
+
+  g_assert_cmpint (g_mkdir_with_parents (dir, 0750), ==, 0);
+
+  for (guint i = 0; i < G_N_ELEMENTS (contents); i++)
+    {
+      g_assert_true (g_file_set_contents (path, contents[i], -1, NULL));
+      g_assert_null (sysprof_elf_symbols_load ("corrupt", &error));
+      g_assert_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA);
+      g_clear_error (&error);
+    }
+
+  g_unlink (path);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  g_autoptr(GError) error = NULL;
+  int ret;
+
+  /* Keep the symbol cache out of the user's cache directory */
+  cache_dir = g_dir_make_tmp ("test-elf-symbols-XXXXXX", &error);
+  g_assert_no_error (error);
+  g_setenv ("XDG_CACHE_HOME", cache_dir, TRUE);
+
+  g_test_init (&argc, &argv, NULL);
+  g_test_add_func ("/libsysprof/ElfSymbols/matches_parser", test_matches_parser);
+  g_test_add_func ("/libsysprof/ElfSymbols/cache_key", test_cache_key);
+  g_test_add_func ("/libsysprof/ElfSymbols/corrupt", test_corrupt);
+  ret = g_test_run ();
+
+  g_free (cache_dir);
+
+  return ret;
+}
@@ -38,11 +38,42 @@ test_basic (void)
   sysprof_strings_unref (strings);
 }
 
+static void
+test_demangled (void)
+{
+  SysprofStrings *strings = sysprof_strings_new ();
+  GRefString *plain = sysprof_strings_get (strings, "g_main_loop_run");
+  GRefString *a = sysprof_strings_get_demangled (strings, "_ZN3foo3barEv");
+  GRefString *b = sysprof_strings_get_demangled (strings, "_ZN3foo3barEv");
+  GRefString *c = sysprof_strings_get_demangled (strings, "g_main_loop_run");
+  GRefString *d = sysprof_strings_get (strings, a);
+
+  /* Demangled names are memoized and interned with other strings */
+  g_assert_nonnull (a);
+  g_assert_cmpstr (a, !=, "_ZN3foo3barEv");
+  g_assert_true (a == b);
+  g_assert_true (a == d);
+
+  /* Names which are not mangled are interned as-is */
+  g_assert_true (plain == c);
+
+  g_assert_null (sysprof_strings_get_demangled (strings, NULL));
+
+  g_ref_string_release (plain);
+  g_ref_string_release (a);
+  g_ref_string_release (b);
+  g_ref_string_release (c);
+  g_ref_string_release (d);
+
+  sysprof_strings_unref (strings);
+}
+
 int
 main (int argc,
       char *argv[])
 {
   g_test_init (&argc, &argv, NULL);
   g_test_add_func ("/libsysprof/Strings/basic", test_basic);
+  g_test_add_func ("/libsysprof/Strings/demangled", test_demangled);
   return g_test_run ();
 }
@@ -229,6 +229,73 @@ test_collision (void)
    */
 }
 
+static void
+test_frozen (void)
+{
+  SysprofSymbolCache *symbol_cache = sysprof_symbol_cache_new ();
+  g_autoptr(GPtrArray) expected = g_ptr_array_new ();
+  SysprofSymbol *outer;
+  SysprofSymbol *inner;
+  SysprofSymbol *late;
+  GRand *rand = g_rand_new_with_seed (0xf2053);
+
+  /* Mostly adjacent symbols with a few gaps between them */
+  for (guint i = 0; i < 1000; i++)
+    {
+      SysprofAddress begin = 0x400000 + (i * 0x100);
+      SysprofAddress end = begin + g_rand_int_range (rand, 0x80, 0x101);
+      g_autofree char *name = g_strdup_printf ("symbol_%u", i);
+
+      sysprof_symbol_cache_take (symbol_cache, create_symbol (name, begin, end));
+    }
+
+  /* A symbol overlapping a smaller one which starts later */
+  outer = create_symbol ("outer", 0x900000, 0x900100);
+  inner = create_symbol ("inner", 0x900010, 0x900020);
+  sysprof_symbol_cache_take (symbol_cache, g_object_ref (outer));
+  sysprof_symbol_cache_take (symbol_cache, g_object_ref (inner));
+
+  for (SysprofAddress addr = 0x3fff00; addr < 0x900200; addr += 0x7)
+    g_ptr_array_add (expected, sysprof_symbol_cache_lookup (symbol_cache, addr));
+
+  sysprof_symbol_cache_freeze (symbol_cache);
+  sysprof_symbol_cache_freeze (symbol_cache);
+
+  for (SysprofAddress addr = 0x3fff00; addr < 0x900200; addr += 0x7)
+    {
+      SysprofSymbol *lookup = sysprof_symbol_cache_lookup (symbol_cache, addr);
+      guint i = (addr - 0x3fff00) / 0x7;
+
+      /* Overlapping symbols may resolve to either one in the tree, but
+       * the frozen cache prefers the symbol starting closest to @addr.
+       */
+      if (addr >= 0x900010 && addr < 0x900020)
+        g_assert_true (lookup == inner);
+      else if (addr >= 0x900000 && addr < 0x900100)
+        g_assert_true (lookup == outer);
+      else
+        g_assert_true (lookup == g_ptr_array_index (expected, i));
+    }
+
+  g_assert_null (sysprof_symbol_cache_lookup (symbol_cache, 0));
+  g_assert_null (sysprof_symbol_cache_lookup (symbol_cache, 0x3fffff));
+  g_assert_null (sysprof_symbol_cache_lookup (symbol_cache, G_MAXUINT64));
+
+  /* Taking a symbol thaws the cache */
+  late = create_symbol ("late", 0x1000, 0x2000);
+  sysprof_symbol_cache_take (symbol_cache, g_object_ref (late));
+  g_assert_true (sysprof_symbol_cache_lookup (symbol_cache, 0x1800) == late);
+  g_assert_true (sysprof_symbol_cache_lookup (symbol_cache, 0x900050) == outer);
+  g_assert_cmpint (sysprof_symbol_cache_lookup (symbol_cache, 0x400000)->begin_address, ==, 0x400000);
+
+  g_clear_pointer (&expected, g_ptr_array_unref);
+  g_assert_finalize_object (symbol_cache);
+  g_assert_finalize_object (outer);
+  g_assert_finalize_object (inner);
+  g_assert_finalize_object (late);
+  g_rand_free (rand);
+}
+
 int
 main (int argc,
       char *argv[])
@@ -240,5 +307,7 @@ main (int argc,
                    test_jitmap);
   g_test_add_func ("/libsysprof/SysprofSymbolCache/collision",
                    test_collision);
+  g_test_add_func ("/libsysprof/SysprofSymbolCache/frozen",
+                   test_frozen);
   return g_test_run ();
 }
@@ -0,0 +1,296 @@
+/* test-traceable-cursor.c
+ *
+ * Copyright 2023 Christian Hergert <chergert@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "config.h"
+
+#include <glib/gstdio.h>
+
+#include <sysprof.h>
+
+#include "sysprof-document-bitset-index-private.h"
+#include "sysprof-document-private.h"
+
+#define CAPTURE_FILE  "traceable-cursor.syscap"
+#define N_TRACEABLES  5000
+
+static int
+backtrace_cb (SysprofCaptureAddress *addrs,
+              unsigned int           n_addrs,
+              void                  *user_data)
+{
+  guint *depth = user_data;
+  guint n = MIN (*depth, n_addrs);
+
+  for (guint i = 0; i < n; i++)
+    addrs[i] = 0x1000 + (*depth * 0x10) + i;
+
+  return n;
+}
+
+static void
+write_capture (void)
+{
+  SysprofCaptureWriter *writer;
+  gint64 t = SYSPROF_CAPTURE_CURRENT_TIME;
+
+  writer = sysprof_capture_writer_new (CAPTURE_FILE, 0);
+  g_assert_nonnull (writer);
+
+  g_assert_true (sysprof_capture_writer_add_process (writer, t, -1, 100, "process"));
+
+  for (guint i = 0; i < N_TRACEABLES; i++)
+    {
+      guint depth = 1 + (i % 40);
+
+      /* Mix in some non-traceable frames so positions within the
+       * document and within the traceable models diverge.
+       */
+      if (i % 7 == 0)
+        g_assert_true (sysprof_capture_writer_add_log (writer, t + i, -1, 100, 0, "test", "message"));
+
+      if (i % 3 == 0)
+        {
+          g_assert_true (sysprof_capture_writer_add_allocation (writer, t + i, i % 4, 100, 100 + (i % 5),
+                                                                0x8000 + i, (i & 1) ? -1 : (gint64)i,
+                                                                backtrace_cb, &depth));
+        }
+      else
+        {
+          SysprofCaptureAddress addrs[40];
+
+          backtrace_cb (addrs, depth, &depth);
+          g_assert_true (sysprof_capture_writer_add_sample (writer, t + i, i % 4, 100, 100 + (i % 5),
+                                                            addrs, depth));
+        }
+    }
+
+  g_assert_true (sysprof_capture_writer_flush (writer));
+
+  sysprof_capture_writer_unref (writer);
+}
+
+static SysprofDocument *
+load_document (void)
+{
+  g_autoptr(SysprofDocumentLoader) loader = NULL;
+  g_autoptr(GError) error = NULL;
+  SysprofDocument *document;
+
+  write_capture ();
+
+  loader = sysprof_document_loader_new (CAPTURE_FILE);
+  sysprof_document_loader_set_symbolizer (loader, SYSPROF_SYMBOLIZER (sysprof_no_symbolizer_get ()));
+  document = sysprof_document_loader_load (loader, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_nonnull (document);
+
+  return document;
+}
+
+static void
+assert_view_matches (SysprofDocumentTraceableCursor     *cursor,
+                     const SysprofDocumentTraceableView *view,
+                     SysprofDocumentTraceable           *traceable)
+{
+  g_autoptr(SysprofDocumentFrame) frame = NULL;
+  SysprofAddress addresses[64];
+  guint n_addresses;
+
+  g_assert_nonnull (traceable);
+
+  g_assert_cmpint (view->pid, ==, sysprof_document_frame_get_pid (SYSPROF_DOCUMENT_FRAME (traceable)));
+  g_assert_cmpint (view->cpu, ==, sysprof_document_frame_get_cpu (SYSPROF_DOCUMENT_FRAME (traceable)));
+  g_assert_cmpint (view->time, ==, sysprof_document_frame_get_time (SYSPROF_DOCUMENT_FRAME (traceable)));
+  g_assert_cmpint (view->tid, ==, sysprof_document_traceable_get_thread_id (traceable));
+
+  n_addresses = sysprof_document_traceable_get_stack_addresses (traceable, addresses, G_N_ELEMENTS (addresses));
+  g_assert_cmpint (view->n_addresses, ==, n_addresses);
+
+  for (guint i = 0; i < n_addresses; i++)
+    g_assert_cmpuint (view->addresses[i], ==, addresses[i]);
+
+  if (SYSPROF_IS_DOCUMENT_ALLOCATION (traceable))
+    {
+      SysprofDocumentAllocation *alloc = SYSPROF_DOCUMENT_ALLOCATION (traceable);
+
+      g_assert_cmpint (view->type, ==, SYSPROF_CAPTURE_FRAME_ALLOCATION);
+      g_assert_cmpuint (view->address, ==, sysprof_document_allocation_get_address (alloc));
+      g_assert_cmpint (view->size, ==, sysprof_document_allocation_get_size (alloc));
+    }
+  else
+    {
+      g_assert_true (SYSPROF_IS_DOCUMENT_SAMPLE (traceable));
+      g_assert_cmpint (view->type, ==, SYSPROF_CAPTURE_FRAME_SAMPLE);
+    }
+
+  frame = _sysprof_document_traceable_cursor_dup_frame (cursor, view);
+  g_assert_true (G_OBJECT_TYPE (frame) == G_OBJECT_TYPE (traceable));
+  g_assert_true (sysprof_document_frame_equal (frame, SYSPROF_DOCUMENT_FRAME (traceable)));
+}
+
+static void
+assert_cursor_matches (SysprofDocument *document,
+                       GListModel      *model,
+                       EggBitset       *selection,
+                       guint            begin,
+                       guint            end)
+{
+  SysprofDocumentTraceableCursor cursor;
+  SysprofDocumentTraceableView view;
+  EggBitsetIter iter;
+  guint expected;
+  guint count = 0;
+
+  if (selection != NULL)
+    {
+      _sysprof_document_traceable_cursor_init (&cursor, document, model, selection);
+      egg_bitset_iter_init_first (&iter, selection, &expected);
+    }
+  else
+    {
+      _sysprof_document_traceable_cursor_init_range (&cursor, document, model, begin, end);
+      expected = begin;
+    }
+
+  while (_sysprof_document_traceable_cursor_next (&cursor, &view))
+    {
+      g_autoptr(SysprofDocumentTraceable) traceable = NULL;
+
+      /* Non-traceable positions are skipped, so advance to the next
+       * position which has a traceable.
+       */
+      for (;;)
+        {
+          g_autoptr(GObject) item = g_list_model_get_item (model, expected);
+
+          g_assert_nonnull (item);
+
+          if (SYSPROF_IS_DOCUMENT_TRACEABLE (item))
+            {
+              traceable = SYSPROF_DOCUMENT_TRACEABLE (g_steal_pointer (&item));
+              break;
+            }
+
+          if (selection != NULL)
+            g_assert_true (egg_bitset_iter_next (&iter, &expected));
+          else
+            expected++;
+        }
+
+      g_assert_cmpint (view.position, ==, expected);
+      assert_view_matches (&cursor, &view, traceable);
+
+      if (selection != NULL)
+        egg_bitset_iter_next (&iter, &expected);
+      else
+        expected++;
+
+      count++;
+    }
+
+  _sysprof_document_traceable_cursor_clear (&cursor);
+
+  if (selection == NULL)
+    g_assert_cmpint (count, ==, end - begin);
+  else
+    g_assert_cmpint (count, >, 0);
+}
+
+static void
+test_cursor_document (void)
+{
+  g_autoptr(SysprofDocument) document = load_document ();
+  g_autoptr(EggBitset) everything = egg_bitset_new_empty ();
+  EggBitset *traceables = _sysprof_document_traceables (document);
+
+  /* Traceables selected from the document itself */
+  assert_cursor_matches (document, G_LIST_MODEL (document), traceables, 0, 0);
+
+  /* Non-traceable frames within the selection must be skipped */
+  egg_bitset_add_range (everything, 0, g_list_model_get_n_items (G_LIST_MODEL (document)));
+  assert_cursor_matches (document, G_LIST_MODEL (document), everything, 0, 0);
+
+  g_unlink (CAPTURE_FILE);
+}
+
+static void
+test_cursor_bitset_index (void)
+{
+  g_autoptr(SysprofDocument) document = load_document ();
+  g_autoptr(GListModel) samples = sysprof_document_list_samples (document);
+  g_autoptr(GListModel) allocations = sysprof_document_list_allocations (document);
+  g_autoptr(GListModel) nested = NULL;
+  g_autoptr(EggBitset) odd = egg_bitset_new_empty ();
+  guint n_samples = g_list_model_get_n_items (samples);
+  guint n_allocations = g_list_model_get_n_items (allocations);
+
+  g_assert_cmpint (n_samples + n_allocations, ==, N_TRACEABLES);
+
+  assert_cursor_matches (document, samples, NULL, 0, n_samples);
+  assert_cursor_matches (document, allocations, NULL, 0, n_allocations);
+
+  /* Shards in the middle of the model */
+  assert_cursor_matches (document, samples, NULL, 17, 1234);
+  assert_cursor_matches (document, samples, NULL, n_samples - 3, n_samples);
+  assert_cursor_matches (document, samples, NULL, 10, 10);
+
+  /* Index of an index, like callgraph traceables for a symbol */
+  for (guint i = 1; i < n_samples; i += 2)
+    egg_bitset_add (odd, i);
+  nested = _sysprof_document_bitset_index_new (samples, odd);
+
+  assert_cursor_matches (document, nested, NULL, 0, g_list_model_get_n_items (nested));
+  assert_cursor_matches (document, nested, NULL, 5, 50);
+  assert_cursor_matches (document, samples, odd, 0, 0);
+
+  g_unlink (CAPTURE_FILE);
+}
+
+static void
+test_cursor_fallback (void)
+{
+  g_autoptr(SysprofDocument) document = load_document ();
+  g_autoptr(GListModel) samples = sysprof_document_list_samples (document);
+  g_autoptr(GListStore) store = g_list_store_new (SYSPROF_TYPE_DOCUMENT_FRAME);
+  guint n_samples = g_list_model_get_n_items (samples);
+
+  /* Models which are not backed by the document must still work */
+  for (guint i = 0; i < n_samples; i += 11)
+    {
+      g_autoptr(GObject) item = g_list_model_get_item (samples, i);
+      g_list_store_append (store, item);
+    }
+
+  assert_cursor_matches (document, G_LIST_MODEL (store), NULL, 0, g_list_model_get_n_items (G_LIST_MODEL (store)));
+  assert_cursor_matches (document, G_LIST_MODEL (store), NULL, 3, 7);
+
+  g_unlink (CAPTURE_FILE);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+  g_test_add_func ("/libsysprof/TraceableCursor/document", test_cursor_document);
+  g_test_add_func ("/libsysprof/TraceableCursor/bitset_index", test_cursor_bitset_index);
+  g_test_add_func ("/libsysprof/TraceableCursor/fallback", test_cursor_fallback);
+  return g_test_run ();
+}
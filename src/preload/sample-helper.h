@@ -0,0 +1,183 @@
+/* sample-helper.h
+ *
+ * Copyright 2020 Christian Hergert <chergert@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <glib.h>
+#include <math.h>
+#include <sys/mman.h>
+#include <sysprof-capture.h>
+
+/* Addresses of live sampled allocations. Each address may live in one of
+ * two buckets of a cache line each, so looking up an address which was
+ * never sampled, as most frees are, reads at most two cache lines.
+ */
+#define SAMPLED_SET_N_BUCKETS (1 << 16)
+#define SAMPLED_SET_N_SLOTS   8
+
+typedef struct
+{
+  gpointer slots[SAMPLED_SET_N_SLOTS];
+} SampledBucket;
+
+/* Per-thread position within the stream of allocated bytes */
+typedef struct
+{
+  gint64  bytes_left;
+  guint64 rng;
+} SampleState;
+
+static inline SampledBucket *
+sampled_set_new (void)
+{
+  SampledBucket *set;
+
+  set = mmap (NULL,
+              SAMPLED_SET_N_BUCKETS * sizeof (SampledBucket),
+              PROT_READ | PROT_WRITE,
+              MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+              -1, 0);
+
+  return set == MAP_FAILED ? NULL : set;
+}
+
+static inline void
+sampled_set_free (SampledBucket *set)
+{
+  if (set != NULL)
+    munmap (set, SAMPLED_SET_N_BUCKETS * sizeof (SampledBucket));
+}
+
+static inline SampledBucket *
+sampled_set_bucket (SampledBucket *set,
+                    gpointer       ptr,
+                    guint          which)
+{
+  guint64 hash = (GPOINTER_TO_SIZE (ptr) >> 4) * G_GUINT64_CONSTANT (0x9E3779B97F4A7C15);
+
+  if (which == 0)
+    return &set[hash >> 48];
+
+  return &set[(hash >> 16) & (SAMPLED_SET_N_BUCKETS - 1)];
+}
+
+/* Returns FALSE if both buckets for @ptr are full */
+static inline gboolean
+sampled_set_add (SampledBucket *set,
+                 gpointer       ptr)
+{
+  for (guint i = 0; i < 2; i++)
+    {
+      SampledBucket *bucket = sampled_set_bucket (set, ptr, i);
+
+      for (guint j = 0; j < SAMPLED_SET_N_SLOTS; j++)
+        {
+          gpointer expected = NULL;
+
+          if (__atomic_load_n (&bucket->slots[j], __ATOMIC_RELAXED) == NULL &&
+              __atomic_compare_exchange_n (&bucket->slots[j], &expected, ptr,
+                                           FALSE, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            return TRUE;
+        }
+    }
+
+  return FALSE;
+}
+
+static inline gboolean
+sampled_set_remove (SampledBucket *set,
+                    gpointer       ptr)
+{
+  for (guint i = 0; i < 2; i++)
+    {
+      SampledBucket *bucket = sampled_set_bucket (set, ptr, i);
+
+      for (guint j = 0; j < SAMPLED_SET_N_SLOTS; j++)
+        {
+          gpointer expected = ptr;
+
+          if (__atomic_load_n (&bucket->slots[j], __ATOMIC_RELAXED) == ptr &&
+              __atomic_compare_exchange_n (&bucket->slots[j], &expected, NULL,
+                                           FALSE, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            return TRUE;
+        }
+    }
+
+  return FALSE;
+}
+
+/* Number of bytes until the next sample, drawn from an exponential
+ * distribution so that samples form a Poisson process over the bytes
+ * allocated by the thread.
+ */
+static inline gint64
+sample_next_distance (SampleState *state,
+                      guint32      interval)
+{
+  guint64 x;
+  double u;
+
+  if G_UNLIKELY (state->rng == 0)
+    state->rng = (GPOINTER_TO_SIZE (state) ^ SYSPROF_CAPTURE_CURRENT_TIME) | 1;
+
+  /* xorshift64* */
+  x = state->rng;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  state->rng = x;
+
+  /* Uniform within [0,1) */
+  u = ((x * G_GUINT64_CONSTANT (0x2545F4914F6CDD1D)) >> 11) * (1.0 / 9007199254740992.0);
+
+  return 1 + (gint64)(-log1p (-u) * interval);
+}
+
+static gboolean
+sample_slow (SampleState *state,
+             guint32      interval)
+{
+  /* The first allocation on a thread starts from a random point */
+  if G_UNLIKELY (state->rng == 0)
+    {
+      state->bytes_left += sample_next_distance (state, interval);
+
+      if (state->bytes_left > 0)
+        return FALSE;
+    }
+
+  /* However many samples fell within the allocation, it is recorded
+   * once and readers weigh it by the chance it had of being sampled.
+   */
+  state->bytes_left = sample_next_distance (state, interval);
+
+  return TRUE;
+}
+
+static inline gboolean
+sample_allocation (SampleState *state,
+                   guint32      interval,
+                   size_t       size)
+{
+  if G_LIKELY ((state->bytes_left -= (gint64)MIN (size, (size_t)G_MAXINT64)) > 0)
+    return FALSE;
+
+  return sample_slow (state, interval);
+}
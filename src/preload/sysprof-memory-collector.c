@@ -30,6 +30,7 @@
 #include <unistd.h>
 
 #include "backtrace-helper.h"
+#include "sample-helper.h"
 
 #include "gconstructor.h"
 
@@ -64,6 +65,13 @@ static RealAlignedAlloc real_aligned_alloc;
 static RealPosixMemalign real_posix_memalign;
 static RealMemalign real_memalign;
 
+/* Mean number of bytes between sampled allocations from
+ * SYSPROF_MEMPROF_SAMPLE_INTERVAL, or 0 to record every allocation.
+ */
+static guint32 sample_interval;
+static SampledBucket *sampled_set;
+static __thread SampleState sample_state;
+
 #if defined (G_HAS_CONSTRUCTORS)
 # ifdef G_DEFINE_CONSTRUCTOR_NEEDS_PRAGMA
 #  pragma G_DEFINE_CONSTRUCTOR_PRAGMA_ARGS(collector_init_ctor)
@@ -73,11 +81,33 @@ G_DEFINE_CONSTRUCTOR(collector_init_ctor)
 # error Your platform/compiler is missing constructor support
 #endif
 
+static void
+sample_init (void)
+{
+  const char *str;
+  guint64 interval;
+
+  if (!(str = getenv ("SYSPROF_MEMPROF_SAMPLE_INTERVAL")))
+    return;
+
+  interval = strtoull (str, NULL, 10);
+
+  if (interval == 0)
+    return;
+
+  /* Fall back to recording every allocation */
+  if (!(sampled_set = sampled_set_new ()))
+    return;
+
+  sample_interval = MIN (interval, G_MAXUINT32);
+}
+
 static void
 collector_init_ctor (void)
 {
   backtrace_init ();
   sysprof_collector_init ();
+  sample_init ();
   collector_ready = TRUE;
 }
 
@@ -143,21 +173,54 @@ static inline void
 track_malloc (void   *ptr,
               size_t  size)
 {
-  if G_LIKELY (ptr && collector_ready)
-    sysprof_collector_allocate (GPOINTER_TO_SIZE (ptr),
-                                size,
-                                backtrace_func,
-                                NULL);
+  if G_UNLIKELY (!ptr || !collector_ready)
+    return;
+
+  if (sample_interval == 0)
+    {
+      sysprof_collector_allocate (GPOINTER_TO_SIZE (ptr),
+                                  size,
+                                  backtrace_func,
+                                  NULL);
+      return;
+    }
+
+  /* If the set is full the sample is dropped rather than recording an
+   * allocation which would never appear to be freed.
+   */
+  if (sample_allocation (&sample_state, sample_interval, size) &&
+      sampled_set_add (sampled_set, ptr))
+    sysprof_collector_allocate_sampled (GPOINTER_TO_SIZE (ptr),
+                                        size,
+                                        sample_interval,
+                                        backtrace_func,
+                                        NULL);
 }
 
-static inline void
-track_free (void *ptr)
+static void
+emit_free (void *ptr)
 {
-  if G_LIKELY (ptr && collector_ready)
+  if (sample_interval == 0)
     sysprof_collector_allocate (GPOINTER_TO_SIZE (ptr),
                                 0,
                                 NULL,
                                 NULL);
+  else
+    sysprof_collector_allocate_sampled (GPOINTER_TO_SIZE (ptr),
+                                        0,
+                                        sample_interval,
+                                        NULL,
+                                        NULL);
+}
+
+static inline void
+track_free (void *ptr)
+{
+  if G_UNLIKELY (!ptr || !collector_ready)
+    return;
+
+  if (sample_interval == 0 || sampled_set_remove (sampled_set, ptr))
+    emit_free (ptr);
 }
 
 void *
@@ -173,7 +236,7 @@ calloc (size_t nmemb,
         size_t size)
 {
   void *ret = real_calloc (nmemb, size);
-  track_malloc (ret, size);
+  track_malloc (ret, nmemb * size);
   return ret;
 }
 
@@ -181,9 +244,32 @@ void *
 realloc (void   *ptr,
          size_t  size)
 {
-  void *ret = real_realloc (ptr, size);
-  track_free (ptr);
+  gboolean tracked = FALSE;
+  void *ret;
+
+  /* The old address may be handed out again as soon as it is released,
+   * so it must leave the sampled set before then.
+   */
+  if (ptr != NULL && collector_ready)
+    tracked = sample_interval == 0 || sampled_set_remove (sampled_set, ptr);
+
+  ret = real_realloc (ptr, size);
+
+  /* On failure the old block is still live. Should the set have filled
+   * in the meantime, record the free so the block is not leaked.
+   */
+  if G_UNLIKELY (ret == NULL && size > 0)
+    {
+      if (tracked && sample_interval != 0 && !sampled_set_add (sampled_set, ptr))
+        emit_free (ptr);
+      return ret;
+    }
+
+  if (tracked)
+    emit_free (ptr);
+
   track_malloc (ret, size);
+
   return ret;
 }
 
@@ -193,8 +279,9 @@ free (void *ptr)
   if G_LIKELY (ptr < (void *)scratch.buf ||
                ptr >= (void *)&scratch.buf[sizeof scratch.buf])
     {
-      real_free (ptr);
+      /* Before the address may be handed out again */
       track_free (ptr);
+      real_free (ptr);
     }
 }
 
@@ -213,7 +300,8 @@ posix_memalign (void   **memptr,
                 size_t   size)
 {
   int ret = real_posix_memalign (memptr, alignment, size);
-  track_malloc (*memptr, size);
+  if (ret == 0)
+    track_malloc (*memptr, size);
   return ret;
 }
 
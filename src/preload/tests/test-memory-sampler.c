@@ -0,0 +1,147 @@
+/* test-memory-sampler.c
+ *
+ * Copyright 2023 Christian Hergert <chergert@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "config.h"
+
+#include "sample-helper.h"
+
+#define INTERVAL 4096
+
+static void
+test_set_add_remove (void)
+{
+  SampledBucket *set = sampled_set_new ();
+  gpointer a = GSIZE_TO_POINTER (0x10000);
+  gpointer b = GSIZE_TO_POINTER (0x20010);
+
+  g_assert_nonnull (set);
+
+  g_assert_false (sampled_set_remove (set, a));
+
+  g_assert_true (sampled_set_add (set, a));
+  g_assert_true (sampled_set_add (set, b));
+
+  g_assert_true (sampled_set_remove (set, a));
+  g_assert_false (sampled_set_remove (set, a));
+
+  /* Removing one address leaves the others alone */
+  g_assert_true (sampled_set_remove (set, b));
+
+  for (gsize i = 1; i <= 100000; i++)
+    g_assert_true (sampled_set_add (set, GSIZE_TO_POINTER (i * 16)));
+
+  for (gsize i = 1; i <= 100000; i++)
+    g_assert_true (sampled_set_remove (set, GSIZE_TO_POINTER (i * 16)));
+
+  for (guint i = 0; i < SAMPLED_SET_N_BUCKETS; i++)
+    for (guint j = 0; j < SAMPLED_SET_N_SLOTS; j++)
+      g_assert_null (set[i].slots[j]);
+
+  sampled_set_free (set);
+}
+
+static void
+test_set_full (void)
+{
+  SampledBucket *set = sampled_set_new ();
+  gpointer ptr = GSIZE_TO_POINTER (0x7f0000001230);
+  gpointer other = GSIZE_TO_POINTER (0x10);
+  SampledBucket *first;
+  SampledBucket *second;
+
+  g_assert_nonnull (set);
+
+  first = sampled_set_bucket (set, ptr, 0);
+  second = sampled_set_bucket (set, ptr, 1);
+
+  /* Occupy every slot either bucket could offer */
+  for (guint j = 0; j < SAMPLED_SET_N_SLOTS; j++)
+    {
+      first->slots[j] = other;
+      second->slots[j] = other;
+    }
+
+  g_assert_false (sampled_set_add (set, ptr));
+  g_assert_false (sampled_set_remove (set, ptr));
+
+  /* Space in the second bucket is enough */
+  second->slots[3] = NULL;
+  g_assert_true (sampled_set_add (set, ptr));
+  g_assert_true (second->slots[3] == ptr);
+  g_assert_true (sampled_set_remove (set, ptr));
+  g_assert_null (second->slots[3]);
+
+  sampled_set_free (set);
+}
+
+static void
+test_sample_rate (void)
+{
+  SampleState state = { 0 };
+  guint64 total = 0;
+  double estimated = 0;
+  double expected = 0;
+  guint n_samples = 0;
+
+  for (guint i = 0; i < 2000000; i++)
+    {
+      gsize size = (i % 10 == 0) ? g_test_rand_int_range (1, 100000)
+                                 : g_test_rand_int_range (1, 256);
+
+      total += size;
+      expected += -expm1 (-(double)size / INTERVAL);
+
+      if (sample_allocation (&state, INTERVAL, size))
+        {
+          estimated += size / -expm1 (-(double)size / INTERVAL);
+          n_samples++;
+        }
+    }
+
+  /* Each allocation is sampled with the chance that at least one sample
+   * point falls within it, however many it may contain.
+   */
+  g_assert_cmpfloat (fabs (n_samples / expected - 1), <, .02);
+
+  /* Weighing samples by their chance of being sampled recovers the total */
+  g_assert_cmpfloat (fabs (estimated / total - 1), <, .02);
+}
+
+static void
+test_sample_large (void)
+{
+  SampleState state = { 0 };
+
+  /* Allocations far larger than the interval are nearly always sampled */
+  for (guint i = 0; i < 1000; i++)
+    g_assert_true (sample_allocation (&state, INTERVAL, INTERVAL * 100));
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+  g_test_add_func ("/Preload/MemorySampler/set-add-remove", test_set_add_remove);
+  g_test_add_func ("/Preload/MemorySampler/set-full", test_set_full);
+  g_test_add_func ("/Preload/MemorySampler/rate", test_sample_rate);
+  g_test_add_func ("/Preload/MemorySampler/large", test_sample_large);
+  return g_test_run ();
+}
@@ -20,6 +20,7 @@
 
 #include "config.h"
 
+#include <errno.h>
 #include <fcntl.h>
 #include <locale.h>
 #include <signal.h>
@@ -107,6 +108,7 @@ merge_files (int              argc,
              GOptionContext  *context)
 {
   g_autoptr(SysprofCaptureWriter) writer = NULL;
+  g_autoptr(GPtrArray) readers = NULL;
   g_autofree char *contents = NULL;
   g_autofree char *tmpname = NULL;
   gsize len;
@@ -145,10 +147,11 @@ merge_files (int              argc,
     }
 
   writer = sysprof_capture_writer_new_from_fd (fd, 0);
+  readers = g_ptr_array_new_with_free_func ((GDestroyNotify)sysprof_capture_reader_unref);
 
   for (guint i = 1; i < argc; i++)
     {
-      g_autoptr(SysprofCaptureReader) reader = NULL;
+      SysprofCaptureReader *reader;
 
       if (!(reader = sysprof_capture_reader_new (argv[i])))
         {
@@ -158,13 +161,17 @@ merge_files (int              argc,
           return EXIT_FAILURE;
         }
 
-      if (!sysprof_capture_writer_cat (writer, reader))
-        {
-          int errsv = errno;
-          g_printerr ("Failed to join \"%s\": %s\n",
-                      argv[i], g_strerror (errsv));
-          return EXIT_FAILURE;
-        }
+      g_ptr_array_add (readers, reader);
+    }
+
+  /* Interleave the captures by time so the result loads like any other */
+  if (!sysprof_capture_writer_merge (writer,
+                                     (SysprofCaptureReader **)readers->pdata,
+                                     readers->len))
+    {
+      int errsv = errno;
+      g_printerr ("Failed to merge captures: %s\n", g_strerror (errsv));
+      return EXIT_FAILURE;
     }
 
   if (g_file_get_contents (tmpname, &contents, &len, NULL))
@@ -270,6 +277,41 @@ add_trace_fd (SysprofProfiler  *profiler,
   sysprof_profiler_add_instrument (profiler, sysprof_tracefd_consumer_new (g_steal_fd (&trace_fd)));
 }
 
+static gboolean
+apply_sampler_event (SysprofSampler *sampler,
+                     const char     *event)
+{
+  g_autoptr(GEnumClass) enum_class = NULL;
+  const GEnumValue *value;
+
+  if (event == NULL)
+    return TRUE;
+
+  /* Raw PMU events use the same rNNNN syntax as perf */
+  if (event[0] == 'r' && event[1] != 0 && g_ascii_isxdigit (event[1]))
+    {
+      guint64 config;
+
+      if (!g_ascii_string_to_unsigned (event + 1, 16, 0, G_MAXUINT64, &config, NULL))
+        return FALSE;
+
+      sysprof_sampler_set_event (sampler, SYSPROF_SAMPLER_EVENT_RAW);
+      sysprof_sampler_set_raw_config (sampler, config);
+
+      return TRUE;
+    }
+
+  enum_class = g_type_class_ref (SYSPROF_TYPE_SAMPLER_EVENT);
+
+  if (!(value = g_enum_get_value_by_nick (enum_class, event)) ||
+      value->value == SYSPROF_SAMPLER_EVENT_RAW)
+    return FALSE;
+
+  sysprof_sampler_set_event (sampler, value->value);
+
+  return TRUE;
+}
+
 int
 main (int   argc,
       char *argv[])
@@ -281,6 +323,7 @@ main (int   argc,
   g_autoptr(SysprofCaptureWriter) writer = NULL;
   g_autoptr(SysprofProfiler) profiler = NULL;
   g_autofree char *power_profile = NULL;
+  g_autofree char *event = NULL;
   g_auto(GStrv) child_argv = NULL;
   g_auto(GStrv) envs = NULL;
   g_auto(GStrv) monitor_bus = NULL;
@@ -310,7 +353,11 @@ main (int   argc,
   gboolean system_bus = FALSE;
   gboolean session_bus = FALSE;
   gboolean no_sysprofd = FALSE;
+  gboolean compress = FALSE;
   int stack_size = 0;
+  int frequency = 0;
+  gint64 period = 0;
+  gint64 memprof_sample_interval = 0;
   int pid = -1;
   int fd;
   int flags;
@@ -336,6 +383,7 @@ main (int   argc,
     { "gtk", 0, 0, G_OPTION_ARG_NONE, &gtk, N_("Set GTK_TRACE_FD environment to trace a GTK application") },
     { "rapl", 0, 0, G_OPTION_ARG_NONE, &rapl, N_("Include RAPL energy statistics") },
     { "memprof", 0, 0, G_OPTION_ARG_NONE, &memprof, N_("Profile memory allocations and frees") },
+    { "memprof-sample-interval", 0, 0, G_OPTION_ARG_INT64, &memprof_sample_interval, N_("Record one allocation per BYTES allocated on average. Implies --memprof"), N_("BYTES") },
     { "gnome-shell", 0, 0, G_OPTION_ARG_NONE, &gnome_shell, N_("Connect to org.gnome.Shell for profiler statistics") },
     { "speedtrack", 0, 0, G_OPTION_ARG_NONE, &speedtrack, N_("Track performance of the applications main loop") },
     { "power-profile", 0, 0, G_OPTION_ARG_STRING, &power_profile, "Use POWER_PROFILE for duration of recording", "power-saver|balanced|performance" },
@@ -346,6 +394,10 @@ main (int   argc,
     { "stack-size", 0, 0, G_OPTION_ARG_INT, &stack_size, N_("Stack size to copy for unwinding in user-space") },
     { "no-debuginfod", 0, 0, G_OPTION_ARG_NONE, &disable_debuginfod, N_("Do not use debuginfod to resolve symbols") },
     { "no-sysprofd", 0, 0, G_OPTION_ARG_NONE, &no_sysprofd, N_("Do not use Sysprofd to acquire privileges") },
+    { "compress", 0, 0, G_OPTION_ARG_NONE, &compress, N_("Write the capture as compressed blocks") },
+    { "event", 0, 0, G_OPTION_ARG_STRING, &event, N_("The perf event to sample on"), "cpu-cycles|cpu-clock|cache-misses|branch-misses|page-faults|rHEX" },
+    { "frequency", 'F', 0, G_OPTION_ARG_INT, &frequency, N_("Sample approximately HZ times per second on each CPU"), N_("HZ") },
+    { "period", 0, 0, G_OPTION_ARG_INT64, &period, N_("Sample once every PERIOD events"), N_("PERIOD") },
     { NULL }
   };
 
@@ -395,6 +447,9 @@ Examples:\n\
   # Unwind by capturing stack/register contents instead of frame-pointers\n\
   # where the stack-size is a multiple of page-size\n\
   sysprof-cli --stack-size=8192\n\
+\n\
+  # Sample cache misses at roughly 10 kHz on each CPU\n\
+  sysprof-cli --event=cache-misses --frequency=10000\n\
 "));
 
   if (!g_option_context_parse (context, &argc, &argv, &error))
@@ -412,6 +467,15 @@ Examples:\n\
   if (pid != -1)
     g_printerr ("--pid is no longer supported and will be ignored\n");
 
+  if (frequency < 0 || period < 0)
+    {
+      g_printerr ("--frequency and --period must not be negative\n");
+      return EXIT_FAILURE;
+    }
+
+  if (stack_size != 0 && (event != NULL || frequency != 0 || period != 0))
+    g_printerr ("--event, --frequency, and --period are ignored with --stack-size\n");
+
   /* If merge is set, we aren't recording, but instead merging a bunch of
    * files together into a single syscap.
    */
@@ -491,6 +555,12 @@ Examples:\n\
 
   writer = sysprof_capture_writer_new_from_fd (fd, n_buffer_pages * sysprof_getpagesize ());
 
+  if (compress && !sysprof_capture_writer_set_compressed (writer, TRUE))
+    {
+      g_printerr ("Failed to enable compression: %s\n", g_strerror (errno));
+      return EXIT_FAILURE;
+    }
+
   if (command != NULL || child_argv != NULL)
     {
       g_autoptr(SysprofSpawnable) spawnable = sysprof_spawnable_new ();
@@ -540,6 +610,14 @@ Examples:\n\
       if (use_trace_fd)
         add_trace_fd (profiler, spawnable, NULL);
 
+      if (memprof_sample_interval > 0)
+        {
+          g_autofree char *interval = g_strdup_printf ("%"G_GINT64_FORMAT, memprof_sample_interval);
+
+          sysprof_spawnable_setenv (spawnable, "SYSPROF_MEMPROF_SAMPLE_INTERVAL", interval);
+          memprof = TRUE;
+        }
+
       if (memprof)
         sysprof_spawnable_add_ld_preload (spawnable, PACKAGE_LIBDIR"/libsysprof-memory-"API_VERSION_S".so");
 
@@ -552,7 +630,20 @@ Examples:\n\
   if (!no_perf)
     {
       if (stack_size == 0)
-        sysprof_profiler_add_instrument (profiler, sysprof_sampler_new ());
+        {
+          SysprofInstrument *sampler = sysprof_sampler_new ();
+
+          if (!apply_sampler_event (SYSPROF_SAMPLER (sampler), event))
+            {
+              g_printerr ("Unknown perf event “%s”\n", event);
+              g_object_unref (sampler);
+              return EXIT_FAILURE;
+            }
+
+          sysprof_sampler_set_frequency (SYSPROF_SAMPLER (sampler), frequency);
+          sysprof_sampler_set_period (SYSPROF_SAMPLER (sampler), period);
+          sysprof_profiler_add_instrument (profiler, sampler);
+        }
       else
         sysprof_profiler_add_instrument (profiler, sysprof_user_sampler_new (stack_size));
     }
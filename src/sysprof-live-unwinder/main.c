@@ -663,12 +663,14 @@ main (int   argc,
   g_autofd int kallsyms_fd = -1;
   g_autofd int event_fd = -1;
   int stack_size = 0;
+  int unwind_threads = 0;
   const GOptionEntry entries[] = {
     { "perf-fd", 0, 0, G_OPTION_ARG_CALLBACK, perf_fd_callback, "A file-descriptor to the perf event stream", "FD[:CPU]" },
     { "capture-fd", 0, 0, G_OPTION_ARG_INT, &capture_fd, "A file-descriptor to the sysprof capture", "FD" },
     { "event-fd", 0, 0, G_OPTION_ARG_INT, &event_fd, "A file-descriptor to an event-fd used to notify unwinder should exit", "FD" },
     { "kallsyms", 'k', 0, G_OPTION_ARG_INT, &kallsyms_fd, "Bundle kallsyms provided from passed FD", "FD" },
     { "stack-size", 's', 0, G_OPTION_ARG_INT, &stack_size, "Size of stacks being recorded", "STACK_SIZE" },
+    { "unwind-threads", 't', 0, G_OPTION_ARG_INT, &unwind_threads, "Number of threads used to unwind stacks", "N_THREADS" },
     { 0 }
   };
 
@@ -716,6 +718,12 @@ Examples:\n\
       return EXIT_FAILURE;
     }
 
+  if (unwind_threads < 0)
+    {
+      g_printerr ("--unwind-threads must be >= 0\n");
+      return EXIT_FAILURE;
+    }
+
   if (all_perf_fds->len == 0)
     {
       g_printerr ("You must secify at least one --perf-fd\n");
@@ -724,7 +732,7 @@ Examples:\n\
 
   bump_to_max_fd_limit ();
 
-  unwinder = sysprof_live_unwinder_new (writer, g_steal_fd (&kallsyms_fd));
+  unwinder = sysprof_live_unwinder_new (writer, g_steal_fd (&kallsyms_fd), unwind_threads);
 
   for (guint i = 0; i < all_perf_fds->len; i++)
     {
@@ -754,6 +762,10 @@ Examples:\n\
 
   g_main_loop_run (main_loop);
 
+  /* Write out any stacks still being unwound */
+  sysprof_live_unwinder_flush (unwinder);
+  sysprof_capture_writer_flush (writer);
+
   g_clear_pointer (&all_perf_fds, g_array_unref);
 
   return EXIT_SUCCESS;
@@ -50,12 +50,28 @@
 
 #include "sysprof-live-process.h"
 
+/* Frame pointers are trusted for a mapping until walking through it
+ * breaks the chain. Each break costs more than a good frame earns so
+ * that modules built without frame pointers quickly go to DWARF.
+ */
+#define FP_SCORE_MIN     -64
+#define FP_SCORE_MAX      64
+#define FP_SCORE_PENALTY  8
+
+typedef struct _SysprofLiveMap
+{
+  guint64 begin;
+  guint64 end;
+  int     fp_score;
+} SysprofLiveMap;
+
 typedef struct _SysprofLiveProcess
 {
   Dwfl_Callbacks  callbacks;
   Dwfl           *dwfl;
   Elf            *elf;
   char           *root;
+  GArray         *maps;
   GPid            pid;
   int             fd;
 } SysprofLiveProcess;
@@ -78,7 +94,10 @@ typedef struct _SysprofUnwinder
   GPid                tid;
 } SysprofUnwinder;
 
-static SysprofUnwinder *current_unwinder;
+/* Each worker thread unwinds with its own Dwfl, so the unwinder state
+ * consulted by the Dwfl callbacks must be per-thread as well.
+ */
+static __thread SysprofUnwinder *current_unwinder;
 
 #if defined(__x86_64__) || defined(__i386__)
 static inline GPid
@@ -359,6 +378,7 @@ sysprof_live_process_new (GPid pid)
   live_process->pid = pid;
   live_process->fd = _pidfd_open (pid, 0);
   live_process->root = g_strdup_printf ("/proc/%u/root/", pid);
+  live_process->maps = g_array_new (FALSE, FALSE, sizeof (SysprofLiveMap));
   live_process->callbacks.find_elf = sysprof_live_process_find_elf;
   live_process->callbacks.find_debuginfo = sysprof_live_process_find_debuginfo;
   live_process->callbacks.debuginfo_path = g_new0 (char *, 2);
@@ -389,6 +409,7 @@ sysprof_live_process_finalize (gpointer data)
   g_clear_pointer (&live_process->elf, elf_end);
   g_clear_pointer (&live_process->dwfl, dwfl_end);
   g_clear_pointer (&live_process->root, g_free);
+  g_clear_pointer (&live_process->maps, g_array_unref);
   g_clear_pointer (&live_process->callbacks.debuginfo_path, g_free);
 }
 
@@ -445,6 +466,185 @@ sysprof_live_process_get_dwfl (SysprofLiveProcess *self)
 }
 #endif
 
+#if defined(__x86_64__) || defined(__i386__)
+static gboolean
+sysprof_live_process_is_elf_mapping (const char *filename)
+{
+  /* Anonymous memory, including JIT regions, along with [heap], [stack],
+   * [vdso] and friends have no file we could load as a module.
+   */
+  if (filename == NULL || filename[0] != '/')
+    return FALSE;
+
+  if (g_str_has_prefix (filename, "//anon") ||
+      g_str_has_prefix (filename, "/memfd:") ||
+      g_str_has_prefix (filename, "/dev/") ||
+      g_str_has_suffix (filename, " (deleted)"))
+    return FALSE;
+
+  return TRUE;
+}
+
+static SysprofLiveMap *
+sysprof_live_process_find_map (SysprofLiveProcess *self,
+                               guint64             addr)
+{
+  SysprofLiveMap *map;
+  guint lo = 0;
+  guint hi = self->maps->len;
+
+  while (lo < hi)
+    {
+      guint mid = lo + (hi - lo) / 2;
+
+      if (g_array_index (self->maps, SysprofLiveMap, mid).begin <= addr)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  if (lo == 0)
+    return NULL;
+
+  map = &g_array_index (self->maps, SysprofLiveMap, lo - 1);
+
+  return addr < map->end ? map : NULL;
+}
+
+static void
+sysprof_live_process_track_map (SysprofLiveProcess *self,
+                                guint64             begin,
+                                guint64             end)
+{
+  SysprofLiveMap map = { begin, end, 0 };
+  guint lo = 0;
+  guint hi = self->maps->len;
+  guint n_overlap = 0;
+
+  while (lo < hi)
+    {
+      guint mid = lo + (hi - lo) / 2;
+
+      if (g_array_index (self->maps, SysprofLiveMap, mid).begin <= begin)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  if (lo > 0 && g_array_index (self->maps, SysprofLiveMap, lo - 1).end > begin)
+    lo--;
+
+  /* A new mapping replaces anything it overlaps */
+  while (lo + n_overlap < self->maps->len &&
+         g_array_index (self->maps, SysprofLiveMap, lo + n_overlap).begin < end)
+    n_overlap++;
+
+  if (n_overlap > 0)
+    g_array_remove_range (self->maps, lo, n_overlap);
+
+  g_array_insert_val (self->maps, lo, map);
+}
+
+static inline guint64
+read_stack_word (const guint8 *data,
+                 guint64       abi)
+{
+  Dwarf_Word word = 0;
+
+  copy_word (data, &word, abi);
+
+  return word;
+}
+
+/*
+ * Walks the saved frame pointer chain within the copied stack. Every
+ * return address must land in a mapping we know to contain code or the
+ * chain is considered broken and 0 is returned so the caller can fall
+ * back to unwinding with DWARF.
+ */
+static guint
+sysprof_live_process_unwind_frame_pointers (SysprofLiveProcess *self,
+                                            guint64             abi,
+                                            const guint8       *stack,
+                                            gsize               stack_len,
+                                            const guint64      *registers,
+                                            guint               n_registers,
+                                            guint64            *addresses,
+                                            guint               n_addresses)
+{
+  SysprofLiveMap *map;
+  guint64 word_size;
+  guint64 sp;
+  guint64 bp;
+  guint n = 0;
+
+  if (abi == PERF_SAMPLE_REGS_ABI_64 && n_registers == 17)
+    word_size = sizeof (guint64);
+  else if (abi == PERF_SAMPLE_REGS_ABI_32 && n_registers == 9)
+    word_size = sizeof (guint32);
+  else
+    return 0;
+
+  if (stack == NULL || n_addresses == 0)
+    return 0;
+
+  /* perf orders registers as AX, BX, CX, DX, SI, DI, BP, SP, IP */
+  bp = registers[6];
+  sp = registers[7];
+
+  if (!(map = sysprof_live_process_find_map (self, registers[8])) || map->fp_score < 0)
+    return 0;
+
+  addresses[n++] = registers[8];
+
+  while (n < n_addresses)
+    {
+      SysprofLiveMap *next;
+      guint64 saved_bp;
+      guint64 ret;
+
+      if (bp < sp || (bp & (word_size - 1)) != 0)
+        goto broken;
+
+      /* Ran out of copied stack, which DWARF can't improve upon unless
+       * we never got past the first frame.
+       */
+      if (bp - sp > stack_len || stack_len - (bp - sp) < word_size * 2)
+        return n > 1 ? n : 0;
+
+      saved_bp = read_stack_word (&stack[bp - sp], abi);
+      ret = read_stack_word (&stack[bp - sp + word_size], abi);
+
+      /* Outermost frame */
+      if (ret == 0)
+        break;
+
+      if (!(next = sysprof_live_process_find_map (self, ret)))
+        goto broken;
+
+      map->fp_score = MIN (map->fp_score + 1, FP_SCORE_MAX);
+      addresses[n++] = ret;
+      map = next;
+
+      if (saved_bp == 0)
+        break;
+
+      /* Frames must move up the stack */
+      if (saved_bp <= bp)
+        goto broken;
+
+      bp = saved_bp;
+    }
+
+  return n;
+
+broken:
+  map->fp_score = MAX (map->fp_score - FP_SCORE_PENALTY, FP_SCORE_MIN);
+
+  return 0;
+}
+#endif
+
 guint
 sysprof_live_process_unwind (SysprofLiveProcess *self,
                              GPid                tid,
@@ -458,12 +658,27 @@ sysprof_live_process_unwind (SysprofLiveProcess *self,
 {
 #if defined(__x86_64__) || defined(__i386__)
   Dwfl *dwfl;
+  guint n_unwound;
 
   g_assert (self != NULL);
   g_assert (stack != NULL);
   g_assert (registers != NULL);
   g_assert (addresses != NULL);
 
+  /* Most code keeps frame pointers, and walking them needs neither
+   * Dwfl nor the process to still be alive.
+   */
+  n_unwound = sysprof_live_process_unwind_frame_pointers (self,
+                                                          abi,
+                                                          stack,
+                                                          stack_len,
+                                                          registers,
+                                                          n_registers,
+                                                          addresses,
+                                                          n_addresses);
+  if (n_unwound > 0)
+    return n_unwound;
+
   if (!sysprof_live_process_is_active (self))
     return 0;
 
@@ -493,6 +708,9 @@ sysprof_live_process_unwind (SysprofLiveProcess *self,
 #endif
 }
 
+/* Only executable mappings may be added, as every tracked range is
+ * accepted as the target of a return address when walking frames.
+ */
 void
 sysprof_live_process_add_map (SysprofLiveProcess *self,
                               guint64             begin,
@@ -501,9 +719,71 @@ sysprof_live_process_add_map (SysprofLiveProcess *self,
                               guint64             inode,
                               const char         *filename)
 {
+#if defined(__x86_64__) || defined(__i386__)
+  Dwfl_Module *module;
+  const char *name;
+  Dwarf_Addr low;
+  Dwarf_Addr high;
+  guint64 base;
+#endif
+
   g_assert (self != NULL);
 
+#if defined(__x86_64__) || defined(__i386__)
+  if (end <= begin)
+    return;
+
+  /* JIT code may keep frame pointers even without an ELF file backing
+   * it, so it is tracked for the frame pointer walk but not for Dwfl.
+   * Perf names anonymous mappings "//anon" while /proc leaves them empty.
+   */
+  if (sysprof_live_process_is_elf_mapping (filename) ||
+      g_strcmp0 (filename, "//anon") == 0 ||
+      g_strcmp0 (filename, "") == 0 ||
+      g_strcmp0 (filename, "[vdso]") == 0)
+    sysprof_live_process_track_map (self, begin, end);
+
+  /* Every module is reported when Dwfl is first needed */
+  if (self->dwfl == NULL)
+    return;
+
+  /* Perf only tells us about executable mappings, and anything which
+   * is not backed by an ELF file can't be reported to Dwfl anyway.
+   */
+  if (!sysprof_live_process_is_elf_mapping (filename))
+    return;
+
+  /* Modules start where the file is mapped at offset zero, which for
+   * the usual layout is the first PT_LOAD that the bias is based on.
+   */
+  base = offset <= begin ? begin - offset : begin;
+
+  /* Mapping another segment of a module we know about is common, so
+   * avoid reporting it again. If the range now belongs to a different
+   * file, something was unmapped which Dwfl cannot do incrementally.
+   */
+  if ((module = dwfl_addrmodule (self->dwfl, begin)) ||
+      (module = dwfl_addrmodule (self->dwfl, base)) ||
+      (module = dwfl_addrmodule (self->dwfl, end - 1)))
+    {
+      name = dwfl_module_info (module, NULL, &low, &high, NULL, NULL, NULL, NULL);
+
+      if (g_strcmp0 (name, filename) == 0 && low <= begin && end <= high)
+        return;
+
+      goto reset;
+    }
+
+  dwfl_report_begin_add (self->dwfl);
+  module = dwfl_report_module (self->dwfl, filename, base, end);
+  dwfl_report_end (self->dwfl, NULL, NULL);
+
+  if (module != NULL)
+    return;
+
+reset:
   /* We'll reparse VMAs on next use */
   g_clear_pointer (&self->dwfl, dwfl_end);
   g_clear_pointer (&self->elf, elf_end);
+#endif
 }
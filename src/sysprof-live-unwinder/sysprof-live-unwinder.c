@@ -21,22 +21,102 @@
 
 #include "config.h"
 
+#include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
 
 #include <linux/perf_event.h>
+#include <sys/eventfd.h>
 
 #include <glib/gstdio.h>
+#include <glib-unix.h>
 
 #include "sysprof-live-process.h"
 #include "sysprof-live-unwinder.h"
 #include "sysprof-maps-parser-private.h"
 
+/* Unwinding must stay behind the perf ring buffer, so only so many
+ * stack snapshots may be queued before we wait on the workers.
+ */
+#define MAX_UNWOUND      256
+#define MAX_IN_FLIGHT    4096
+#define MAX_WORKERS      8
+
+typedef enum _UnwindJobKind
+{
+  UNWIND_JOB_SAMPLE,
+  UNWIND_JOB_STACK,
+  UNWIND_JOB_MAP,
+  UNWIND_JOB_STOP,
+} UnwindJobKind;
+
+typedef struct _UnwindJob
+{
+  UnwindJobKind                kind;
+  guint                        done : 1;
+
+  guint64                      seq;
+  gint64                       time;
+  int                          cpu;
+  GPid                         pid;
+  GPid                         tid;
+
+  SysprofLiveProcess          *process;
+
+  /* What will be written to the capture. That is either the callchain
+   * from perf or the unwound stack if that turned out to be better.
+   */
+  const SysprofCaptureAddress *addresses;
+  guint                        n_addresses;
+
+  SysprofCaptureAddress       *callchain;
+  guint                        n_callchain;
+  SysprofCaptureAddress       *unwound;
+
+  /* Snapshot of registers and user stack copied out of the ring buffer */
+  guint64                      abi;
+  guint64                     *registers;
+  guint                        n_registers;
+  guint8                      *stack;
+  gsize                        stack_len;
+
+  /* UNWIND_JOB_MAP */
+  guint64                      begin;
+  guint64                      end;
+  guint64                      offset;
+  guint64                      inode;
+  char                        *filename;
+
+  guint64                      data[];
+} UnwindJob;
+
+typedef struct _UnwindWorker
+{
+  GThread     *thread;
+  GAsyncQueue *jobs;
+  GAsyncQueue *results;
+  int          wakeup_fd;
+} UnwindWorker;
+
 struct _SysprofLiveUnwinder
 {
   GObject               parent_instance;
   SysprofCaptureWriter *writer;
   GHashTable           *live_pids_by_pid;
+
+  /* Workers are sharded by pid so that a SysprofLiveProcess, and the
+   * Dwfl within it, is only ever used from a single thread.
+   */
+  UnwindWorker         *workers;
+  guint                 n_workers;
+  GAsyncQueue          *results;
+  int                   wakeup_fd;
+  guint                 results_source;
+  guint                 n_in_flight;
+
+  /* Min-heap of UnwindJob by time which have not yet been written */
+  GPtrArray            *pending;
+  guint64               next_seq;
 };
 
 G_DEFINE_FINAL_TYPE (SysprofLiveUnwinder, sysprof_live_unwinder, G_TYPE_OBJECT)
@@ -48,6 +128,350 @@ enum {
 
 static guint signals[N_SIGNALS];
 
+static UnwindJob *
+unwind_job_new (UnwindJobKind  kind,
+                guint          n_callchain,
+                guint          n_unwound,
+                guint          n_registers,
+                gsize          stack_len)
+{
+  gsize n_words = n_callchain + n_unwound + n_registers + (stack_len + 7) / 8;
+  UnwindJob *job;
+
+  job = g_malloc (sizeof *job + n_words * sizeof (guint64));
+  memset (job, 0, sizeof *job);
+
+  job->kind = kind;
+  job->callchain = (SysprofCaptureAddress *)&job->data[0];
+  job->n_callchain = n_callchain;
+  job->unwound = (SysprofCaptureAddress *)&job->data[n_callchain];
+  job->registers = &job->data[n_callchain + n_unwound];
+  job->n_registers = n_registers;
+  job->stack = (guint8 *)&job->data[n_callchain + n_unwound + n_registers];
+  job->stack_len = stack_len;
+
+  job->addresses = job->callchain;
+  job->n_addresses = n_callchain;
+
+  return job;
+}
+
+static void
+unwind_job_free (UnwindJob *job)
+{
+  g_clear_pointer (&job->process, sysprof_live_process_unref);
+  g_clear_pointer (&job->filename, g_free);
+  g_free (job);
+}
+
+static void
+unwind_job_unwind (UnwindJob *job)
+{
+  gboolean found_user = FALSE;
+  guint pos;
+
+  g_assert (job != NULL);
+  g_assert (job->kind == UNWIND_JOB_STACK);
+  g_assert (job->n_callchain < MAX_UNWOUND);
+
+  /* Copy addresses over (which might be kernel, context-switch, etc until
+   * we get to the PERF_CONTEXT_USER. We'll decode the stack right into the
+   * location after that.
+   */
+  for (pos = 0; pos < job->n_callchain; pos++)
+    {
+      job->unwound[pos] = job->callchain[pos];
+
+      if (job->callchain[pos] == PERF_CONTEXT_USER)
+        {
+          found_user = TRUE;
+          break;
+        }
+    }
+
+  /* If we didn't find a user context (but we have a stack size) synthesize
+   * the PERF_CONTEXT_USER now.
+   */
+  if (!found_user && pos < MAX_UNWOUND)
+    job->unwound[pos++] = PERF_CONTEXT_USER;
+
+  /* Now request the live process unwind the user-space stack */
+  if (pos < MAX_UNWOUND)
+    {
+      guint n_unwound;
+
+      n_unwound = sysprof_live_process_unwind (job->process,
+                                               job->tid,
+                                               job->abi,
+                                               job->stack,
+                                               job->stack_len,
+                                               job->registers,
+                                               job->n_registers,
+                                               &job->unwound[pos],
+                                               MAX_UNWOUND - pos);
+
+      /* Only take DWARF unwind if it was better */
+      if (pos + n_unwound > job->n_callchain)
+        {
+          job->addresses = job->unwound;
+          job->n_addresses = pos + n_unwound;
+        }
+    }
+}
+
+static inline gboolean
+unwind_job_before (const UnwindJob *a,
+                   const UnwindJob *b)
+{
+  return a->time < b->time || (a->time == b->time && a->seq < b->seq);
+}
+
+static void
+pending_push (GPtrArray *heap,
+              UnwindJob *job)
+{
+  guint pos = heap->len;
+
+  g_ptr_array_add (heap, job);
+
+  while (pos > 0)
+    {
+      guint parent = (pos - 1) / 2;
+
+      if (!unwind_job_before (job, heap->pdata[parent]))
+        break;
+
+      heap->pdata[pos] = heap->pdata[parent];
+      pos = parent;
+    }
+
+  heap->pdata[pos] = job;
+}
+
+static UnwindJob *
+pending_pop (GPtrArray *heap)
+{
+  UnwindJob *top;
+  UnwindJob *last;
+  guint pos = 0;
+
+  g_assert (heap->len > 0);
+
+  top = heap->pdata[0];
+  last = g_ptr_array_steal_index_fast (heap, heap->len - 1);
+
+  if (heap->len == 0)
+    return top;
+
+  for (;;)
+    {
+      guint child = pos * 2 + 1;
+
+      if (child >= heap->len)
+        break;
+
+      if (child + 1 < heap->len &&
+          unwind_job_before (heap->pdata[child + 1], heap->pdata[child]))
+        child++;
+
+      if (!unwind_job_before (heap->pdata[child], last))
+        break;
+
+      heap->pdata[pos] = heap->pdata[child];
+      pos = child;
+    }
+
+  heap->pdata[pos] = last;
+
+  return top;
+}
+
+static gpointer
+unwind_worker_thread (gpointer data)
+{
+  UnwindWorker *worker = data;
+
+  for (;;)
+    {
+      UnwindJob *job = g_async_queue_pop (worker->jobs);
+      guint64 one = 1;
+
+      switch (job->kind)
+        {
+        case UNWIND_JOB_STOP:
+          unwind_job_free (job);
+          return NULL;
+
+        case UNWIND_JOB_MAP:
+          sysprof_live_process_add_map (job->process,
+                                        job->begin,
+                                        job->end,
+                                        job->offset,
+                                        job->inode,
+                                        job->filename);
+          unwind_job_free (job);
+          continue;
+
+        case UNWIND_JOB_STACK:
+          unwind_job_unwind (job);
+          break;
+
+        case UNWIND_JOB_SAMPLE:
+        default:
+          g_assert_not_reached ();
+        }
+
+      g_async_queue_push (worker->results, job);
+
+      if (write (worker->wakeup_fd, &one, sizeof one) != sizeof one)
+        {
+          /* Main thread will still find it in the queue */
+        }
+    }
+}
+
+/*
+ * Writes every job at the head of the time-ordered heap which has
+ * completed. A job which is still being unwound holds back everything
+ * after it so that samples are written in time order.
+ */
+static void
+sysprof_live_unwinder_write_pending (SysprofLiveUnwinder *self)
+{
+  g_assert (SYSPROF_IS_LIVE_UNWINDER (self));
+
+  while (self->pending->len > 0)
+    {
+      UnwindJob *job = g_ptr_array_index (self->pending, 0);
+
+      if (!job->done)
+        break;
+
+      job = pending_pop (self->pending);
+
+      sysprof_capture_writer_add_sample (self->writer,
+                                         job->time,
+                                         job->cpu,
+                                         job->pid,
+                                         job->tid,
+                                         job->addresses,
+                                         job->n_addresses);
+
+      unwind_job_free (job);
+    }
+}
+
+static void
+sysprof_live_unwinder_complete (SysprofLiveUnwinder *self,
+                                UnwindJob           *job)
+{
+  g_assert (SYSPROF_IS_LIVE_UNWINDER (self));
+  g_assert (job != NULL);
+  g_assert (self->n_in_flight > 0);
+
+  job->done = TRUE;
+  self->n_in_flight--;
+}
+
+static gboolean
+sysprof_live_unwinder_results_cb (int          fd,
+                                  GIOCondition condition,
+                                  gpointer     user_data)
+{
+  SysprofLiveUnwinder *self = user_data;
+  UnwindJob *job;
+  guint64 count;
+
+  g_assert (SYSPROF_IS_LIVE_UNWINDER (self));
+
+  if (read (fd, &count, sizeof count) != sizeof count)
+    {
+      /* Spurious wakeup or already drained */
+    }
+
+  while ((job = g_async_queue_try_pop (self->results)))
+    sysprof_live_unwinder_complete (self, job);
+
+  sysprof_live_unwinder_write_pending (self);
+
+  return G_SOURCE_CONTINUE;
+}
+
+static void
+sysprof_live_unwinder_start_workers (SysprofLiveUnwinder *self)
+{
+  g_assert (SYSPROF_IS_LIVE_UNWINDER (self));
+  g_assert (self->workers == NULL);
+  g_assert (self->n_workers > 0);
+
+  self->results = g_async_queue_new ();
+  self->wakeup_fd = eventfd (0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+  if (self->wakeup_fd == -1)
+    g_error ("Failed to create eventfd: %s", g_strerror (errno));
+
+  self->results_source = g_unix_fd_add_full (G_PRIORITY_HIGH,
+                                             self->wakeup_fd,
+                                             G_IO_IN,
+                                             sysprof_live_unwinder_results_cb,
+                                             self,
+                                             NULL);
+
+  self->workers = g_new0 (UnwindWorker, self->n_workers);
+
+  for (guint i = 0; i < self->n_workers; i++)
+    {
+      UnwindWorker *worker = &self->workers[i];
+
+      worker->jobs = g_async_queue_new ();
+      worker->results = g_async_queue_ref (self->results);
+      worker->wakeup_fd = self->wakeup_fd;
+      worker->thread = g_thread_new ("[sysprof-unwind]", unwind_worker_thread, worker);
+    }
+}
+
+static void
+sysprof_live_unwinder_stop_workers (SysprofLiveUnwinder *self)
+{
+  g_assert (SYSPROF_IS_LIVE_UNWINDER (self));
+
+  if (self->workers == NULL)
+    return;
+
+  sysprof_live_unwinder_flush (self);
+
+  for (guint i = 0; i < self->n_workers; i++)
+    g_async_queue_push (self->workers[i].jobs, unwind_job_new (UNWIND_JOB_STOP, 0, 0, 0, 0));
+
+  for (guint i = 0; i < self->n_workers; i++)
+    {
+      UnwindWorker *worker = &self->workers[i];
+
+      g_thread_join (worker->thread);
+      g_async_queue_unref (worker->jobs);
+      g_async_queue_unref (worker->results);
+    }
+
+  g_clear_handle_id (&self->results_source, g_source_remove);
+  g_clear_pointer (&self->workers, g_free);
+  g_clear_pointer (&self->results, g_async_queue_unref);
+
+  close (self->wakeup_fd);
+  self->wakeup_fd = -1;
+}
+
+static UnwindWorker *
+sysprof_live_unwinder_get_worker (SysprofLiveUnwinder *self,
+                                  GPid                 pid)
+{
+  g_assert (SYSPROF_IS_LIVE_UNWINDER (self));
+
+  if G_UNLIKELY (self->workers == NULL)
+    sysprof_live_unwinder_start_workers (self);
+
+  return &self->workers[(guint)pid % self->n_workers];
+}
+
 static char *
 sysprof_live_unwinder_read_file (SysprofLiveUnwinder *self,
                                  const char          *path,
@@ -146,16 +570,24 @@ sysprof_live_unwinder_find_pid (SysprofLiveUnwinder *self,
             {
               SysprofMapsParser maps_parser;
               guint64 begin, end, offset, inode;
+              gboolean executable;
               char *filename;
 
               sysprof_maps_parser_init (&maps_parser, maps, -1);
 
-              while (sysprof_maps_parser_next (&maps_parser, &begin, &end, &offset, &inode, &filename))
+              while (sysprof_maps_parser_next_full (&maps_parser, &begin, &end, &offset, &inode, &executable, &filename))
                 {
-                  sysprof_live_process_add_map (live_pid, begin, end, offset, inode, filename);
-                  sysprof_capture_writer_add_map (self->writer, now, -1, pid,
-                                                  begin, end, offset,
-                                                  inode, filename);
+                  /* Only code can be the target of a return address, which
+                   * is all perf will tell us about from here on too.
+                   */
+                  if (executable)
+                    sysprof_live_process_add_map (live_pid, begin, end, offset, inode, filename);
+
+                  if (filename[0] != 0)
+                    sysprof_capture_writer_add_map (self->writer, now, -1, pid,
+                                                    begin, end, offset,
+                                                    inode, filename);
+
                   g_free (filename);
                 }
             }
@@ -196,6 +628,9 @@ sysprof_live_unwinder_finalize (GObject *object)
 {
   SysprofLiveUnwinder *self = (SysprofLiveUnwinder *)object;
 
+  sysprof_live_unwinder_stop_workers (self);
+
+  g_clear_pointer (&self->pending, g_ptr_array_unref);
   g_clear_pointer (&self->writer, sysprof_capture_writer_unref);
   g_clear_pointer (&self->live_pids_by_pid, g_hash_table_unref);
 
@@ -226,11 +661,27 @@ sysprof_live_unwinder_init (SysprofLiveUnwinder *self)
                                                   NULL,
                                                   NULL,
                                                   (GDestroyNotify)sysprof_live_process_unref);
+  self->pending = g_ptr_array_new ();
+  self->wakeup_fd = -1;
 }
 
+/**
+ * sysprof_live_unwinder_new:
+ * @writer: the capture to write to
+ * @kallsyms_fd: a FD for kallsyms to bundle, or -1
+ * @n_workers: the number of threads to unwind stacks on, or 0 for
+ *   a default based on the number of CPUs
+ *
+ * Creates a new #SysprofLiveUnwinder.
+ *
+ * Stacks are unwound on worker threads only once the first sample with
+ * a stack copy arrives, so no threads are created when only callchains
+ * are recorded.
+ */
 SysprofLiveUnwinder *
 sysprof_live_unwinder_new (SysprofCaptureWriter *writer,
-                           int                   kallsyms_fd)
+                           int                   kallsyms_fd,
+                           guint                 n_workers)
 {
   SysprofLiveUnwinder *self;
   g_autofree char *mounts = NULL;
@@ -240,6 +691,10 @@ sysprof_live_unwinder_new (SysprofCaptureWriter *writer,
   self = g_object_new (SYSPROF_TYPE_LIVE_UNWINDER, NULL);
   self->writer = sysprof_capture_writer_ref (writer);
 
+  if (n_workers == 0)
+    n_workers = CLAMP (g_get_num_processors () / 2, 1, MAX_WORKERS);
+  self->n_workers = n_workers;
+
   if (kallsyms_fd != -1)
     {
       sysprof_capture_writer_add_file_fd (writer,
@@ -325,7 +780,30 @@ sysprof_live_unwinder_track_mmap (SysprofLiveUnwinder   *self,
                                     begin, end, offset,
                                     inode, filename);
 
-  sysprof_live_process_add_map (live_pid, begin, end, offset, inode, filename);
+  if (live_pid == NULL)
+    return;
+
+  /* Once workers exist the process may be unwinding on one of them, so
+   * the mapping must be applied in order on that same thread.
+   */
+  if (self->workers != NULL)
+    {
+      UnwindWorker *worker = sysprof_live_unwinder_get_worker (self, pid);
+      UnwindJob *job = unwind_job_new (UNWIND_JOB_MAP, 0, 0, 0, 0);
+
+      job->process = sysprof_live_process_ref (live_pid);
+      job->begin = begin;
+      job->end = end;
+      job->offset = offset;
+      job->inode = inode;
+      job->filename = g_strdup (filename);
+
+      g_async_queue_push (worker->jobs, job);
+    }
+  else
+    {
+      sysprof_live_process_add_map (live_pid, begin, end, offset, inode, filename);
+    }
 }
 
 void
@@ -338,13 +816,34 @@ sysprof_live_unwinder_process_sampled (SysprofLiveUnwinder         *self,
                                        guint                        n_addresses)
 {
   G_GNUC_UNUSED SysprofLiveProcess *live_pid;
+  UnwindJob *job;
 
   g_assert (SYSPROF_IS_LIVE_UNWINDER (self));
 
   live_pid = sysprof_live_unwinder_find_pid (self, pid, TRUE);
 
-  sysprof_capture_writer_add_sample (self->writer, time, cpu, pid, tid,
-                                     addresses, n_addresses);
+  /* Nothing to order against, so avoid the copy */
+  if (self->pending->len == 0)
+    {
+      sysprof_capture_writer_add_sample (self->writer, time, cpu, pid, tid,
+                                         addresses, n_addresses);
+      return;
+    }
+
+  job = unwind_job_new (UNWIND_JOB_SAMPLE, n_addresses, 0, 0, 0);
+  job->done = TRUE;
+  job->seq = self->next_seq++;
+  job->time = time;
+  job->cpu = cpu;
+  job->pid = pid;
+  job->tid = tid;
+
+  if (n_addresses > 0)
+    memcpy (job->callchain, addresses, n_addresses * sizeof *addresses);
+
+  pending_push (self->pending, job);
+
+  sysprof_live_unwinder_write_pending (self);
 }
 
 void
@@ -363,15 +862,14 @@ sysprof_live_unwinder_process_sampled_with_stack (SysprofLiveUnwinder         *s
                                                   guint                        n_registers)
 {
   SysprofLiveProcess *live_pid;
-  SysprofCaptureAddress unwound[256];
-  gboolean found_user = FALSE;
-  guint pos;
+  UnwindWorker *worker;
+  UnwindJob *job;
 
   g_assert (SYSPROF_IS_LIVE_UNWINDER (self));
   g_assert (stack != NULL);
   g_assert (stack_dyn_size <= stack_size);
 
-  if (stack_dyn_size == 0 || n_addresses >= G_N_ELEMENTS (unwound))
+  if (stack_dyn_size == 0 || n_addresses >= MAX_UNWOUND)
     {
       sysprof_live_unwinder_process_sampled (self, time, cpu, pid, tid, addresses, n_addresses);
       return;
@@ -384,49 +882,66 @@ sysprof_live_unwinder_process_sampled_with_stack (SysprofLiveUnwinder         *s
 
   live_pid = sysprof_live_unwinder_find_pid (self, pid, TRUE);
 
-  /* Copy addresses over (which might be kernel, context-switch, etc until
-   * we get to the PERF_CONTEXT_USER. We'll decode the stack right into the
-   * location after that.
+  /* No reason to copy the stack if there is nothing to unwind against */
+  if (live_pid == NULL || !sysprof_live_process_is_active (live_pid))
+    {
+      sysprof_live_unwinder_process_sampled (self, time, cpu, pid, tid, addresses, n_addresses);
+      return;
+    }
+
+  worker = sysprof_live_unwinder_get_worker (self, pid);
+
+  /* Apply back-pressure so that a slow unwind shows up as lost
+   * records from perf rather than unbounded memory use.
    */
-  for (pos = 0; pos < n_addresses; pos++)
+  if (self->n_in_flight >= MAX_IN_FLIGHT)
     {
-      unwound[pos] = addresses[pos];
+      while (self->n_in_flight >= MAX_IN_FLIGHT / 2)
+        sysprof_live_unwinder_complete (self, g_async_queue_pop (self->results));
 
-      if (addresses[pos] == PERF_CONTEXT_USER)
-        {
-          found_user = TRUE;
-          break;
-        }
+      sysprof_live_unwinder_write_pending (self);
     }
 
-  /* If we didn't find a user context (but we have a stack size) synthesize
-   * the PERF_CONTEXT_USER now.
+  /* The ring buffer will be reused as soon as we return, so take a copy
+   * of everything needed to unwind on the worker.
    */
-  if (!found_user && pos < G_N_ELEMENTS (unwound))
-    unwound[pos++] = PERF_CONTEXT_USER;
+  job = unwind_job_new (UNWIND_JOB_STACK, n_addresses, MAX_UNWOUND, n_registers, stack_dyn_size);
+  job->seq = self->next_seq++;
+  job->time = time;
+  job->cpu = cpu;
+  job->pid = pid;
+  job->tid = tid;
+  job->abi = abi;
+  job->process = sysprof_live_process_ref (live_pid);
+
+  if (n_addresses > 0)
+    memcpy (job->callchain, addresses, n_addresses * sizeof *addresses);
+  if (n_registers > 0)
+    memcpy (job->registers, registers, n_registers * sizeof *registers);
+  memcpy (job->stack, stack, stack_dyn_size);
+
+  pending_push (self->pending, job);
+  self->n_in_flight++;
+
+  g_async_queue_push (worker->jobs, job);
+}
 
-  /* Now request the live process unwind the user-space stack */
-  if (pos < G_N_ELEMENTS (unwound))
-    {
-      guint n_unwound;
+/**
+ * sysprof_live_unwinder_flush:
+ * @self: a #SysprofLiveUnwinder
+ *
+ * Waits for every queued stack to be unwound and writes the resulting
+ * samples to the capture.
+ */
+void
+sysprof_live_unwinder_flush (SysprofLiveUnwinder *self)
+{
+  g_return_if_fail (SYSPROF_IS_LIVE_UNWINDER (self));
 
-      n_unwound = sysprof_live_process_unwind (live_pid,
-                                               tid,
-                                               abi,
-                                               stack,
-                                               stack_dyn_size,
-                                               registers,
-                                               n_registers,
-                                               &unwound[pos],
-                                               G_N_ELEMENTS (unwound) - pos);
+  while (self->n_in_flight > 0)
+    sysprof_live_unwinder_complete (self, g_async_queue_pop (self->results));
 
-      /* Only take DWARF unwind if it was better */
-      if (pos + n_unwound > n_addresses)
-        {
-          addresses = unwound;
-          n_addresses = pos + n_unwound;
-        }
-    }
+  sysprof_live_unwinder_write_pending (self);
 
-  sysprof_capture_writer_add_sample (self->writer, time, cpu, pid, tid, addresses, n_addresses);
+  g_assert (self->pending->len == 0);
 }
@@ -30,7 +30,9 @@ G_BEGIN_DECLS
 G_DECLARE_FINAL_TYPE (SysprofLiveUnwinder, sysprof_live_unwinder, SYSPROF, LIVE_UNWINDER, GObject)
 
 SysprofLiveUnwinder *sysprof_live_unwinder_new                        (SysprofCaptureWriter        *writer,
-                                                                       int                          kallsyms_fd);
+                                                                       int                          kallsyms_fd,
+                                                                       guint                        n_workers);
+void                 sysprof_live_unwinder_flush                      (SysprofLiveUnwinder         *self);
 void                 sysprof_live_unwinder_seen_process               (SysprofLiveUnwinder         *self,
                                                                        gint64                       time,
                                                                        int                          cpu,
@@ -24,6 +24,7 @@
 #include <fcntl.h>
 #include <unistd.h>
 
+#include <sys/eventfd.h>
 #include <sys/ioctl.h>
 
 #include <glib/gstdio.h>
@@ -64,6 +65,70 @@
 static gboolean sample_stack;
 static char *kallsyms = NULL;
 static int sample_stack_size = 8192;
+static int unwind_threads = 0;
+static int duration = 0;
+
+/* Reads back the translated capture to see how many samples made it
+ * through the unwinder and how many perf had to drop because we did
+ * not keep up with the ring buffer.
+ */
+static void
+report_throughput (const char *filename,
+                   gint64      elapsed_usec)
+{
+  SysprofCaptureReader *reader;
+  SysprofCaptureFrameType type;
+  gint64 last_time = G_MININT64;
+  guint64 n_samples = 0;
+  guint64 n_lost = 0;
+  guint64 n_out_of_order = 0;
+
+  if (!(reader = sysprof_capture_reader_new (filename)))
+    {
+      g_printerr ("Failed to open %s\n", filename);
+      return;
+    }
+
+  while (sysprof_capture_reader_peek_type (reader, &type))
+    {
+      if (type == SYSPROF_CAPTURE_FRAME_SAMPLE)
+        {
+          const SysprofCaptureSample *sample = sysprof_capture_reader_read_sample (reader);
+
+          if (sample == NULL)
+            break;
+
+          n_samples++;
+
+          if (sample->frame.time < last_time)
+            n_out_of_order++;
+          last_time = sample->frame.time;
+        }
+      else if (type == SYSPROF_CAPTURE_FRAME_LOG)
+        {
+          const SysprofCaptureLog *log = sysprof_capture_reader_read_log (reader);
+
+          if (log == NULL)
+            break;
+
+          if (g_str_has_prefix (log->message, "Lost "))
+            n_lost += g_ascii_strtoull (log->message + strlen ("Lost "), NULL, 10);
+        }
+      else if (!sysprof_capture_reader_skip (reader))
+        {
+          break;
+        }
+    }
+
+  sysprof_capture_reader_unref (reader);
+
+  g_printerr ("%"G_GUINT64_FORMAT" samples in %.2lf seconds, %.1lf samples/sec\n",
+              n_samples,
+              elapsed_usec / (double)G_USEC_PER_SEC,
+              n_samples / MAX (1., elapsed_usec / (double)G_USEC_PER_SEC));
+  g_printerr ("%"G_GUINT64_FORMAT" samples lost, %"G_GUINT64_FORMAT" written out of order\n",
+              n_lost, n_out_of_order);
+}
 
 static void
 open_perf_stream_cb (GObject      *object,
@@ -219,6 +284,8 @@ main_fiber (gpointer user_data)
   g_autoptr(GPtrArray) argv = NULL;
   g_autoptr(GError) error = NULL;
   g_autofd int writer_fd = -1;
+  g_autofd int exit_fd = -1;
+  gint64 begin_time;
   int n_cpu = g_get_num_processors ();
   int next_target_fd = 3;
 
@@ -250,6 +317,19 @@ main_fiber (gpointer user_data)
   if (sample_stack)
     g_ptr_array_add (argv, g_strdup_printf ("--stack-size=%u", sample_stack_size));
 
+  if (unwind_threads > 0)
+    g_ptr_array_add (argv, g_strdup_printf ("--unwind-threads=%d", unwind_threads));
+
+  /* Provide an eventfd so we can stop the unwinder after --duration */
+  if (duration > 0)
+    {
+      if (-1 == (exit_fd = eventfd (0, EFD_CLOEXEC)))
+        return dex_future_new_for_errno (errno);
+
+      g_subprocess_launcher_take_fd (launcher, dup (exit_fd), next_target_fd);
+      g_ptr_array_add (argv, g_strdup_printf ("--event-fd=%d", next_target_fd++));
+    }
+
   g_printerr ("sysprof-live-unwinder at %s\n", (const char *)argv->pdata[0]);
 
   /* First try to open a perf_event stream for as many CPUs as we
@@ -289,16 +369,28 @@ main_fiber (gpointer user_data)
   /* Null-terminate our argv */
   g_ptr_array_add (argv, NULL);
 
+  begin_time = g_get_monotonic_time ();
+
   /* Spawn our worker process with the perf FDs and writer provided */
   if (!(subprocess = g_subprocess_launcher_spawnv (launcher,
                                                    (const char * const *)argv->pdata,
                                                    &error)))
     return dex_future_new_for_error (g_steal_pointer (&error));
 
+  if (duration > 0)
+    {
+      dex_await (dex_timeout_new_seconds (duration), NULL);
+
+      if (eventfd_write (exit_fd, 1) != 0)
+        return dex_future_new_for_errno (errno);
+    }
+
   /* Now wait for the translation process to complete */
   if (!dex_await_boolean (dex_subprocess_wait_check (subprocess), &error))
     return dex_future_new_for_error (g_steal_pointer (&error));
 
+  report_throughput ("translated.syscap", g_get_monotonic_time () - begin_time);
+
   return dex_future_new_true ();
 }
 
@@ -336,6 +428,8 @@ main (int   argc,
     { "sample-stack", 's', 0, G_OPTION_ARG_NONE, &sample_stack, "If the stack should be sampled for user-space unwinding" },
     { "sample-stack-size", 'S', 0, G_OPTION_ARG_INT, &sample_stack_size, "If size of the stack to sample in bytes" },
     { "kallsyms", 'k', 0, G_OPTION_ARG_FILENAME, &kallsyms, "Specify kallsyms for use" },
+    { "unwind-threads", 't', 0, G_OPTION_ARG_INT, &unwind_threads, "Number of threads the unwinder should use" },
+    { "duration", 'd', 0, G_OPTION_ARG_INT, &duration, "Stop recording after this many seconds and report throughput" },
     { NULL }
   };
 
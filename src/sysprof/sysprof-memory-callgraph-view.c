@@ -73,7 +73,8 @@ augment_memory (SysprofCallgraph     *callgraph,
   g_assert (SYSPROF_IS_DOCUMENT_ALLOCATION (frame));
   g_assert (user_data == NULL);
 
-  size = sysprof_document_allocation_get_size (SYSPROF_DOCUMENT_ALLOCATION (frame));
+  /* Sampled allocations are scaled up to the bytes they stand for */
+  size = sysprof_document_allocation_get_estimated_size (SYSPROF_DOCUMENT_ALLOCATION (frame));
 
   if (size < 0)
     size = 0;
@@ -111,6 +111,20 @@ helpers_list_processes (gint32 **processes,
 }
 
 #ifdef __linux__
+/* Events which occur far less often than cycles or clock ticks */
+static gboolean
+is_infrequent_event (const struct perf_event_attr *attr)
+{
+  if (attr->type == PERF_TYPE_HARDWARE)
+    return attr->config == PERF_COUNT_HW_CACHE_MISSES ||
+           attr->config == PERF_COUNT_HW_BRANCH_MISSES;
+
+  if (attr->type == PERF_TYPE_SOFTWARE)
+    return attr->config == PERF_COUNT_SW_PAGE_FAULTS;
+
+  return attr->type == PERF_TYPE_TRACEPOINT;
+}
+
 static int
 _perf_event_open (struct perf_event_attr *attr,
                   pid_t                   pid,
@@ -120,8 +134,10 @@ _perf_event_open (struct perf_event_attr *attr,
 {
   g_assert (attr != NULL);
 
-  /* Quick sanity check */
-  if (attr->sample_period < 100000 && attr->type != PERF_TYPE_TRACEPOINT)
+  /* Quick sanity check. The kernel limits sampling frequencies itself
+   * and infrequent events may be sampled with a shorter period.
+   */
+  if (!attr->freq && attr->sample_period < 100000 && !is_infrequent_event (attr))
     return -EINVAL;
 
   return syscall (__NR_perf_event_open, attr, pid, cpu, group_fd, flags);
@@ -146,6 +162,7 @@ helpers_perf_event_open (GVariant *options,
   char *key;
   gint32 disabled = 0;
   gint32 wakeup_events = 149;
+  guint32 wakeup_watermark = 0;
   gint32 type = 0;
   guint64 sample_period = 0;
   guint64 sample_type = 0;
@@ -161,6 +178,8 @@ helpers_perf_event_open (GVariant *options,
   int exclude_idle = 0;
   int use_clockid = 0;
   int sample_id_all = 0;
+  int watermark = 0;
+  int freq = 0;
 
   g_assert (out_fd != NULL);
 
@@ -183,6 +202,24 @@ helpers_perf_event_open (GVariant *options,
             goto bad_arg;
           wakeup_events = g_variant_get_uint32 (value);
         }
+      else if (strcmp (key, "freq") == 0)
+        {
+          if (!g_variant_is_of_type (value, G_VARIANT_TYPE_BOOLEAN))
+            goto bad_arg;
+          freq = g_variant_get_boolean (value);
+        }
+      else if (strcmp (key, "watermark") == 0)
+        {
+          if (!g_variant_is_of_type (value, G_VARIANT_TYPE_BOOLEAN))
+            goto bad_arg;
+          watermark = g_variant_get_boolean (value);
+        }
+      else if (strcmp (key, "wakeup_watermark") == 0)
+        {
+          if (!g_variant_is_of_type (value, G_VARIANT_TYPE_UINT32))
+            goto bad_arg;
+          wakeup_watermark = g_variant_get_uint32 (value);
+        }
       else if (strcmp (key, "sample_id_all") == 0)
         {
           if (!g_variant_is_of_type (value, G_VARIANT_TYPE_BOOLEAN))
@@ -289,11 +326,20 @@ helpers_perf_event_open (GVariant *options,
   attr.mmap2 = !!mmap2;
   attr.build_id = !!build_id;
   attr.sample_id_all = sample_id_all;
+  /* sample_freq shares storage with sample_period */
+  attr.freq = !!freq;
   attr.sample_period = sample_period;
   attr.sample_type = sample_type;
   attr.task = !!task;
   attr.type = type;
-  attr.wakeup_events = wakeup_events;
+  /* wakeup_watermark shares storage with wakeup_events. Clients send
+   * both so that daemons without watermarks wake them up too.
+   */
+  attr.watermark = !!watermark;
+  if (watermark)
+    attr.wakeup_watermark = wakeup_watermark;
+  else
+    attr.wakeup_events = wakeup_events;
   attr.sample_regs_user = sample_regs_user;
   attr.sample_stack_user = sample_stack_user;
 